@@ -38,7 +38,19 @@ static char const *gpl = "\
 #include <signal.h>
 #include <termios.h>
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
 static int cmd_backup (int argc, char **argv);
+static int cmd_codecbench (int argc, char **argv);
+static uint64_T benchtime ();
 static int cmd_diff (int argc, char **argv);
 static bool diff_file (char const *path1, char const *path2);
 static char *formatime (char *buff, time_t time);
@@ -66,6 +78,7 @@ static int cmd_xorvfy (int argc, char **argv);
 
 static CryptoPP::BlockCipher *getciphercontext (char const *name, bool enc);
 static CryptoPP::HashTransformation *gethashercontext (char const *name);
+static bool decodecompress (char const *arg, int *codec_r, int *level_r);
 static void usagecipherargs (char const *decenc);
 static bool readpasswd (char const *prompt, char *pwbuff, size_t pwsize);
 
@@ -455,6 +468,7 @@ int main (int argc, char **argv)
 
     if (argc >= 2) {
         if (strcasecmp (argv[1], "backup")     == 0) return cmd_backup     (argc - 1, argv + 1);
+        if (strcasecmp (argv[1], "codecbench") == 0) return cmd_codecbench (argc - 1, argv + 1);
         if (strcasecmp (argv[1], "compare")    == 0) return cmd_restore    (argc - 1, argv + 1, &compFSAccess);
         if (strcasecmp (argv[1], "diff")       == 0) return cmd_diff       (argc - 1, argv + 1);
         if (strcasecmp (argv[1], "dumprecord") == 0) return cmd_dumprecord (argc - 1, argv + 1);
@@ -468,6 +482,7 @@ int main (int argc, char **argv)
         fprintf (stderr, "ftbackup: unknown command %s\n", argv[1]);
     }
     fprintf (stderr, "usage: ftbackup backup ...\n");
+    fprintf (stderr, "       ftbackup codecbench ...\n");
     fprintf (stderr, "       ftbackup compare ...\n");
     fprintf (stderr, "       ftbackup diff ...\n");
     fprintf (stderr, "       ftbackup dumprecord ...\n");
@@ -497,6 +512,10 @@ static int cmd_backup (int argc, char **argv)
 
     for (i = 0; ++ i < argc;) {
         if ((argv[i][0] == '-') && (argv[i][1] != 0)) {
+            if (strcasecmp (argv[i], "-adaptive") == 0) {
+                ftbwriter.opt_adaptive = true;
+                continue;
+            }
             if (strcasecmp (argv[i], "-blocksize") == 0) {
                 if (++ i >= argc) goto usage;
                 blocksize = strtoul (argv[i], &p, 0);
@@ -508,6 +527,29 @@ static int cmd_backup (int argc, char **argv)
                 ftbwriter.l2bs = __builtin_ctz (blocksize);
                 continue;
             }
+            if (strcasecmp (argv[i], "-catalog") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbwriter.opt_catalog = argv[i];
+                continue;
+            }
+            if (strcasecmp (argv[i], "-chaindict") == 0) {
+                ftbwriter.opt_chaindict = true;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-compress") == 0) {
+                if (++ i >= argc) goto usage;
+                if (!decodecompress (argv[i], &ftbwriter.opt_codec, &ftbwriter.opt_codeclevel)) goto usage;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-cthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbwriter.opt_cthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftbwriter.opt_cthreads < 0) || (ftbwriter.opt_cthreads > 255)) {
+                    fprintf (stderr, "ftbackup: cthreads %s must be integer in range 0..255\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
             if (strcasecmp (argv[i], "-encrypt") == 0) {
                 i = ftbwriter.decodecipherargs (argc, argv, i, true);
                 if (i < 0) goto usage;
@@ -523,10 +565,42 @@ static int cmd_backup (int argc, char **argv)
                 ftbwriter.histdbname = argv[i];
                 continue;
             }
+            if (strcasecmp (argv[i], "-hthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbwriter.opt_hthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftbwriter.opt_hthreads < 0) || (ftbwriter.opt_hthreads > 255)) {
+                    fprintf (stderr, "ftbackup: hthreads %s must be integer in range 0..255\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
             if (strcasecmp (argv[i], "-idirect") == 0) {
                 ftbwriter.ioptions |= O_DIRECT;
                 continue;
             }
+            if (strcasecmp (argv[i], "-iouring") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbwriter.opt_iouring = strtoul (argv[i], &p, 0);
+                if ((*p != 0) || (ftbwriter.opt_iouring > 256)) {
+                    fprintf (stderr, "ftbackup: iouring %s must be integer in range 0..256\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
+            if (strcasecmp (argv[i], "-lthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbwriter.opt_lthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftbwriter.opt_lthreads < 0) || (ftbwriter.opt_lthreads > 255)) {
+                    fprintf (stderr, "ftbackup: lthreads %s must be integer in range 0..255\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
+            if (strcasecmp (argv[i], "-manifest") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbwriter.opt_manifest = argv[i];
+                continue;
+            }
             if (strcasecmp (argv[i], "-noxor") == 0) {
                 ftbwriter.xorgc = ftbwriter.xorsc = 0;
                 continue;
@@ -539,6 +613,35 @@ static int cmd_backup (int argc, char **argv)
                 ftbwriter.ooptions |= O_SYNC;
                 continue;
             }
+            if (strcasecmp (argv[i], "-owrites") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbwriter.opt_owrites = strtoul (argv[i], &p, 0);
+                if ((*p != 0) || (ftbwriter.opt_owrites > 256)) {
+                    fprintf (stderr, "ftbackup: owrites %s must be integer in range 0..256\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
+            if (strcasecmp (argv[i], "-qdepth") == 0) {
+                if (++ i >= argc) goto usage;
+                p = strchr (argv[i], '=');
+                if (p != NULL) {
+                    uint32_T *qdepth = NULL;
+                    *p = 0;
+                    if (strcasecmp (argv[i], "compr") == 0) qdepth = &ftbwriter.opt_comprdepth;
+                    if (strcasecmp (argv[i], "frblk") == 0) qdepth = &ftbwriter.opt_frblkdepth;
+                    if (strcasecmp (argv[i], "frbuf") == 0) qdepth = &ftbwriter.opt_frbufdepth;
+                    if (strcasecmp (argv[i], "hist")  == 0) qdepth = &ftbwriter.opt_histdepth;
+                    if (strcasecmp (argv[i], "write") == 0) qdepth = &ftbwriter.opt_writedepth;
+                    *(p ++) = '=';
+                    if (qdepth != NULL) {
+                        *qdepth = strtoul (p, &p, 0);
+                        if ((*p == 0) && (*qdepth >= RQ_MINDEPTH) && (*qdepth <= RQ_MAXDEPTH)) continue;
+                    }
+                }
+                fprintf (stderr, "ftbackup: invalid qdepth %s\n", argv[i]);
+                goto usage;
+            }
             if (strcasecmp (argv[i], "-record") == 0) {
                 if (++ i >= argc) goto usage;
                 ftbwriter.opt_record = argv[i];
@@ -608,6 +711,18 @@ static int cmd_backup (int argc, char **argv)
         goto usage;
     }
 
+    // each compressed run is primed by the one before it so they must be compressed in order
+    if (ftbwriter.opt_chaindict && ((ftbwriter.opt_cthreads > 0) || (ftbwriter.opt_codec != CODEC_ZLIB))) {
+        fprintf (stderr, "ftbackup: -chaindict only works with zlib compression and no -cthreads\n");
+        goto usage;
+    }
+
+    // the manifest lists the segment files
+    if ((ftbwriter.opt_manifest != NULL) && (ftbwriter.opt_segsize == 0)) {
+        fprintf (stderr, "ftbackup: -manifest only works with -segsize\n");
+        goto usage;
+    }
+
     // how many bytes needed for one span of data blocks plus their corresponding XOR blocks
     spansize = 1 << ftbwriter.l2bs;
     if (ftbwriter.xorgc != 0) spansize *= ftbwriter.xorgc * (ftbwriter.xorsc + 1);
@@ -627,17 +742,48 @@ static int cmd_backup (int argc, char **argv)
 
 usage:
     fprintf (stderr, "usage: ftbackup backup [<options>...] <saveset> <rootpath>\n");
+    fprintf (stderr, "    -adaptive             store files that look already compressed without compressing them\n");
+    fprintf (stderr, "                            default is to compress all files\n");
     fprintf (stderr, "    -blocksize <bs>       write <bs> bytes at a time\n");
     fprintf (stderr, "                            powers-of-two, range %u..%u\n", MINBLOCKSIZE, MAXBLOCKSIZE);
     fprintf (stderr, "                            default is %u\n", DEFBLOCKSIZE);
+    fprintf (stderr, "    -catalog <file>       write where each file is in the saveset to given file\n");
+    fprintf (stderr, "                            so restore and compare -catalog can skip to the files selected\n");
+    fprintf (stderr, "    -chaindict            prime each file's compression with the end of the previous files\n");
+    fprintf (stderr, "                            default is to compress each file by itself\n");
+    fprintf (stderr, "    -compress <codec>[:<level>]\n");
+    fprintf (stderr, "                          compress file data with the given codec\n");
+    fprintf (stderr, "                            zlib = levels 0..9 (default)\n");
+    fprintf (stderr, "                            zstd = levels 1..22, if built in\n");
+    fprintf (stderr, "                             lz4 = levels 0..12, if built in\n");
+    fprintf (stderr, "                            none = don't compress\n");
+    fprintf (stderr, "    -cthreads <n>         compress with <n> worker threads\n");
+    fprintf (stderr, "                            default is to compress in a single thread\n");
     usagecipherargs ("encrypt");
     fprintf (stderr, "    -history [::<histss>] <histdb>\n");
     fprintf (stderr, "                          add filenames saved to database\n");
+    fprintf (stderr, "    -hthreads <n>         hash and encrypt blocks with <n> worker threads\n");
+    fprintf (stderr, "                            default is to hash and encrypt in the writing thread\n");
     fprintf (stderr, "    -idirect              use O_DIRECT when reading files\n");
+    fprintf (stderr, "    -iouring <n>          read files with io_uring keeping <n> reads in flight\n");
+    fprintf (stderr, "                            default is to read files with pread one at a time\n");
+    fprintf (stderr, "    -lthreads <n>         look up and open files ahead of writing them with <n> worker threads\n");
+    fprintf (stderr, "                            default is to look up each file as it is written\n");
+    fprintf (stderr, "    -manifest <file>      write name, size, blocks and checksum of each -segsize segment file\n");
+    fprintf (stderr, "                            to given file so readers can find and check them up front\n");
     fprintf (stderr, "    -noxor                don't write any recovery blocks\n");
     fprintf (stderr, "                            default is to write recovery blocks\n");
     fprintf (stderr, "    -odirect              use O_DIRECT when writing saveset\n");
     fprintf (stderr, "    -osync                use O_SYNC when writing saveset\n");
+    fprintf (stderr, "    -owrites <n>          write saveset with io_uring keeping <n> writes in flight\n");
+    fprintf (stderr, "                            default is to write one block at a time\n");
+    fprintf (stderr, "    -qdepth <queue>=<n>   set number of slots in an inter-thread queue\n");
+    fprintf (stderr, "                            frbuf = file read buffers\n");
+    fprintf (stderr, "                            compr = data waiting to be compressed\n");
+    fprintf (stderr, "                            frblk = saveset blocks\n");
+    fprintf (stderr, "                            write = blocks waiting to be written\n");
+    fprintf (stderr, "                             hist = filenames waiting for history database\n");
+    fprintf (stderr, "                            range %u..%u, default is %u\n", RQ_MINDEPTH, RQ_MAXDEPTH, RQ_DEFDEPTH);
     fprintf (stderr, "    -record <file>        record backup date/time to given file\n");
     fprintf (stderr, "    -segsize <segsz>      write saveset to multiple files, each of maximum size <segsz>\n");
     fprintf (stderr, "                            default is to write saveset to one file no matter how big\n");
@@ -656,6 +802,180 @@ usage:
     return EX_CMD;
 }
 
+/**
+ * @brief Time compressing and decompressing files the way backup and restore do,
+ *        first with just the stream calls (eg, plain zlib), then also with the
+ *        whole run calls (eg, libdeflate for files up to FILEIOSIZE).
+ */
+static int cmd_codecbench (int argc, char **argv)
+{
+    char *p;
+    Codec *codec;
+    int codectype, fd, i, level, nfiles, pass, rc, run, runs;
+    struct stat statbuf;
+    uint32_T inlen, len, outlen, *sizes, *zsizes;
+    uint64_T best[2], decns, encns, totalin, totalout;
+    uint8_T const *in;
+    uint8_T **datas, *out, *outbuf, **zdatas;
+
+    codectype = CODEC_ZLIB;
+    level     = CODEC_DEFLEVEL;
+    runs      = 3;
+    nfiles    = 0;
+    datas     = (uint8_T **) malloc (argc * sizeof *datas);
+    zdatas    = (uint8_T **) malloc (argc * sizeof *zdatas);
+    sizes     = (uint32_T *) malloc (argc * sizeof *sizes);
+    zsizes    = (uint32_T *) malloc (argc * sizeof *zsizes);
+    if ((datas == NULL) || (zdatas == NULL) || (sizes == NULL) || (zsizes == NULL)) NOMEM ();
+
+    for (i = 0; ++ i < argc;) {
+        if (argv[i][0] == '-') {
+            if (strcasecmp (argv[i], "-compress") == 0) {
+                if (++ i >= argc) goto usage;
+                if (!decodecompress (argv[i], &codectype, &level)) goto usage;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-runs") == 0) {
+                if (++ i >= argc) goto usage;
+                runs = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (runs < 1) || (runs > 100)) {
+                    fprintf (stderr, "ftbackup: runs %s must be integer in range 1..100\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
+            fprintf (stderr, "ftbackup: unknown option %s\n", argv[i]);
+            goto usage;
+        }
+
+        // read whole file into memory
+        fd = open (argv[i], O_RDONLY);
+        if ((fd < 0) || (fstat (fd, &statbuf) < 0)) {
+            fprintf (stderr, "ftbackup: open(%s) error: %s\n", argv[i], mystrerr (errno));
+            if (fd >= 0) close (fd);
+            continue;
+        }
+        if (!S_ISREG (statbuf.st_mode) || (statbuf.st_size == 0) || (statbuf.st_size > 0x40000000)) {
+            close (fd);
+            continue;
+        }
+        sizes[nfiles] = statbuf.st_size;
+        datas[nfiles] = (uint8_T *) malloc (sizes[nfiles]);
+        if (datas[nfiles] == NULL) NOMEM ();
+        for (len = 0; len < sizes[nfiles]; len += rc) {
+            rc = read (fd, datas[nfiles] + len, sizes[nfiles] - len);
+            if (rc <= 0) break;
+        }
+        close (fd);
+        if (len < sizes[nfiles]) {
+            fprintf (stderr, "ftbackup: read(%s) error: %s\n", argv[i], ((rc == 0) ? "end of file" : mystrerr (errno)));
+            free (datas[nfiles]);
+            continue;
+        }
+        nfiles ++;
+    }
+    if (nfiles == 0) goto usage;
+
+    outbuf = (uint8_T *) malloc (FILEIOSIZE);
+    if (outbuf == NULL) NOMEM ();
+
+    for (pass = 0; pass < 2; pass ++) {
+        Codec::wholeruns = (pass > 0);
+        codec = Codec::create (codectype, level);
+        best[0] = best[1] = 0;
+        totalin = totalout = 0;
+
+        for (run = 0; run < runs; run ++) {
+
+            /*
+             * Compress each file as a run, in FILEIOSIZE pieces like backup reads them.
+             */
+            encns = benchtime ();
+            for (i = 0; i < nfiles; i ++) {
+                zdatas[i] = (uint8_T *) malloc (codec->encbound (sizes[i]) + 16);
+                if (zdatas[i] == NULL) NOMEM ();
+                outlen = codec->encbound (sizes[i]) + 16;
+                if ((sizes[i] > FILEIOSIZE) || !codec->encwhole (datas[i], sizes[i], zdatas[i], &outlen)) {
+                    in  = datas[i];
+                    out = zdatas[i];
+                    codec->encbegin ();
+                    for (inlen = 0; inlen < sizes[i];) {
+                        len = sizes[i] - inlen;
+                        if (len > FILEIOSIZE) len = FILEIOSIZE;
+                        inlen += len;
+                        while (len > 0) codec->encode (&in, &len, &out, &outlen, false);
+                    }
+                    len = 0;
+                    while (!codec->encode (&in, &len, &out, &outlen, true)) { }
+                    outlen = out - zdatas[i];
+                }
+                zsizes[i] = outlen;
+            }
+            encns = benchtime () - encns;
+
+            /*
+             * Decompress each run to a FILEIOSIZE buffer like restore does.
+             */
+            decns = benchtime ();
+            for (i = 0; i < nfiles; i ++) {
+                if ((sizes[i] <= FILEIOSIZE) && codec->decwhole (zdatas[i], zsizes[i], &len, outbuf, sizes[i])) {
+                    rc = (memcmp (outbuf, datas[i], sizes[i]) == 0) ? 1 : -1;
+                } else {
+                    in    = zdatas[i];
+                    inlen = zsizes[i];
+                    len   = 0;
+                    codec->decbegin ();
+                    do {
+                        out    = outbuf;
+                        outlen = FILEIOSIZE;
+                        rc = codec->decode (&in, &inlen, &out, &outlen);
+                        if ((len + out - outbuf > sizes[i]) || (memcmp (outbuf, datas[i] + len, out - outbuf) != 0)) rc = -1;
+                        len += out - outbuf;
+                    } while (rc == 0);
+                    if (len != sizes[i]) rc = -1;
+                }
+                if (rc != 1) {
+                    fprintf (stderr, "ftbackup: codecbench %s decompress mismatch\n", Codec::name (codectype));
+                    return EX_SSIO;
+                }
+            }
+            decns = benchtime () - decns;
+
+            if ((run == 0) || (encns < best[0])) best[0] = encns;
+            if ((run == 0) || (decns < best[1])) best[1] = decns;
+            totalin = totalout = 0;
+            for (i = 0; i < nfiles; i ++) {
+                totalin  += sizes[i];
+                totalout += zsizes[i];
+                free (zdatas[i]);
+            }
+        }
+
+        printf ("%-14s %12llu -> %12llu bytes (%5.1f%%)  compress %8.1f MB/s  decompress %8.1f MB/s\n",
+                (pass == 0) ? "stream calls" : "whole runs", totalin, totalout, totalout * 100.0 / totalin,
+                totalin * 1000.0 / best[0], totalin * 1000.0 / best[1]);
+        delete codec;
+    }
+    Codec::wholeruns = true;
+    return EX_OK;
+
+usage:
+    fprintf (stderr, "usage: ftbackup codecbench [<options>...] <file>...\n");
+    fprintf (stderr, "    -compress <codec>[:<level>]\n");
+    fprintf (stderr, "                          codec to time, as given to backup\n");
+    fprintf (stderr, "    -runs <n>             time each <n> times, keeping the fastest\n");
+    fprintf (stderr, "                            default is 3\n");
+    return EX_CMD;
+}
+
+static uint64_T benchtime ()
+{
+    struct timespec tp;
+
+    if (clock_gettime (CLOCK_MONOTONIC, &tp) < 0) SYSERRNO (clock_gettime);
+    return ((uint64_T) tp.tv_sec * 1000000000ULL) + tp.tv_nsec;
+}
+
 /**
  * @brief Compare two directory trees.
  */
@@ -1548,6 +1868,8 @@ static int cmd_history_delss (char const *sssince, char const *ssbefore, char co
          */
         wildcard = wildcards[i];
         wildcardlen = wildcardlength (wildcard);
+        WildMatcher wildmatch;
+        wildmatch.add (wildcard);
 
         /*
          * Find first possible match for the wildcard.
@@ -1582,7 +1904,7 @@ static int cmd_history_delss (char const *sssince, char const *ssbefore, char co
              */
             name = savebuf.path;
             wildcard = wildcards[i];
-            if (wildcardmatch (wildcards[i], name) && (strcmp (timestr, sssince) >= 0) && (strcmp (timestr, ssbefore) < 0)) {
+            if ((wildmatch.match (name) >= 0) && (strcmp (timestr, sssince) >= 0) && (strcmp (timestr, ssbefore) < 0)) {
 
                 /*
                  * If so, print.
@@ -1718,13 +2040,15 @@ static int cmd_history_list (char const *sssince, char const *ssbefore, char con
     for (i = 0; i < nwildcards; i ++) {
         wildcard = wildcards[i];
         wildcardlen = wildcardlength (wildcard);
+        WildMatcher wildmatch;
+        wildmatch.add (wildcard);
 
         sts = ix_search_key (rabfiles, IX_SEARCH_GEF, 0, wildcardlen, (IX_Rbf const *) wildcard, sizeof filebuf, (IX_Rbf *) &filebuf, &filelen);
 
         while (sts == IX_SUCCESS) {
             name = filebuf.path;
             if ((wildcardlen > 0) && (memcmp (name, wildcard, wildcardlen) > 0)) break;
-            if (wildcardmatch (wildcard, name)) {
+            if (wildmatch.match (name) >= 0) {
                 first = true;
 
                 /*
@@ -1782,13 +2106,15 @@ struct FTBLister : FTBReader {
     bool opt_ctime;
 
     virtual char const *select_file (Header const *hdr);
+    virtual bool skips_data (Header const *hdr) { return true; }
 };
 
 static int cmd_list (int argc, char **argv)
 {
-    char *ssname;
+    char *p, *ssname;
     FTBLister ftblister = FTBLister ();
     int i;
+    unsigned long readahead;
 
     ftblister.opt_atime = false;
     ftblister.opt_ctime = false;
@@ -1810,6 +2136,47 @@ static int cmd_list (int argc, char **argv)
                 if (i < 0) goto usage;
                 continue;
             }
+            if (strcasecmp (argv[i], "-dthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftblister.opt_dthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftblister.opt_dthreads < 0) || (ftblister.opt_dthreads > PD_MAXTHREADS)) {
+                    fprintf (stderr, "ftbackup: dthreads %s must be integer in range 0..%d\n", argv[i], PD_MAXTHREADS);
+                    goto usage;
+                }
+                continue;
+            }
+            if (strcasecmp (argv[i], "-idirect") == 0) {
+                ftblister.opt_idirect = true;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-manifest") == 0) {
+                if (++ i >= argc) goto usage;
+                ftblister.opt_manifest = argv[i];
+                continue;
+            }
+            if (strcasecmp (argv[i], "-mmap") == 0) {
+                ftblister.opt_mmap = true;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-readahead") == 0) {
+                if (++ i >= argc) goto usage;
+                readahead = strtoul (argv[i], &p, 0);
+                if ((*p != 0) || (readahead > RX_MAXSIZE) || (readahead % PAGESIZE != 0)) {
+                    fprintf (stderr, "ftbackup: readahead %s must be multiple of %u up to %u\n", argv[i], PAGESIZE, RX_MAXSIZE);
+                    goto usage;
+                }
+                ftblister.opt_readahead = readahead;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-rthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftblister.opt_rthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftblister.opt_rthreads < 0) || (ftblister.opt_rthreads > 255)) {
+                    fprintf (stderr, "ftbackup: rthreads %s must be integer in range 0..255\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
             if (strcasecmp (argv[i], "-simrderrs") == 0) {
                 if (++ i >= argc) goto usage;
                 ftblister.opt_simrderrs = atoi (argv[i]);
@@ -1828,12 +2195,26 @@ static int cmd_list (int argc, char **argv)
         fprintf (stderr, "ftbackup: missing <saveset>\n");
         goto usage;
     }
+    if (ftblister.opt_mmap && (ftblister.opt_idirect || (ftblister.opt_rthreads > 0))) {
+        fprintf (stderr, "ftbackup: -mmap cannot be used with -idirect or -rthreads\n");
+        goto usage;
+    }
+    if ((ftblister.opt_dthreads > 0) && ((ftblister.opt_rthreads > 0) || (ftblister.opt_simrderrs != 0))) {
+        fprintf (stderr, "ftbackup: -dthreads cannot be used with -rthreads or -simrderrs\n");
+        goto usage;
+    }
     ftblister.tfs = &nullFSAccess;
     return ftblister.read_saveset (ssname);
 
 usage:
-    fprintf (stderr, "usage: ftbackup list [-atime|-ctime] [-decrypt ... ] [-simrderrs <mod>] <saveset>\n");
+    fprintf (stderr, "usage: ftbackup list [-atime|-ctime] [-decrypt ... ] [-dthreads <n>] [-idirect] [-manifest <file>] [-mmap] [-readahead <bytes>] [-rthreads <n>] [-simrderrs <mod>] <saveset>\n");
     usagecipherargs ("decrypt");
+    fprintf (stderr, "        -dthreads <n> = decode chunks of the saveset with <n> threads\n");
+    fprintf (stderr, "        -idirect = read saveset with O_DIRECT\n");
+    fprintf (stderr, "        -manifest <file> = find and check segment files using manifest written by backup -manifest\n");
+    fprintf (stderr, "        -mmap = map saveset into memory rather than reading it\n");
+    fprintf (stderr, "        -readahead <bytes> = read saveset <bytes> at a time, 0 for one block at a time\n");
+    fprintf (stderr, "        -rthreads <n> = decrypt and check blocks with <n> threads while reading ahead\n");
     return EX_CMD;
 }
 
@@ -1858,16 +2239,31 @@ static int cmd_restore (int argc, char **argv, IFSAccess *tfs)
     char const *savewildcard;
     FTBReadMapper ftbreadmapper = FTBReadMapper ();
     int i;
+    unsigned long readahead;
 
     savewildcard = NULL;
     ssname = NULL;
     for (i = 0; ++ i < argc;) {
         if ((argv[i][0] == '-') && (argv[i][1] != 0)) {
+            if (strcasecmp (argv[i], "-catalog") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbreadmapper.opt_catalog = argv[i];
+                continue;
+            }
             if (strcasecmp (argv[i], "-decrypt") == 0) {
                 i = ftbreadmapper.decodecipherargs (argc, argv, i, false);
                 if (i < 0) goto usage;
                 continue;
             }
+            if (strcasecmp (argv[i], "-dthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbreadmapper.opt_dthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftbreadmapper.opt_dthreads < 0) || (ftbreadmapper.opt_dthreads > PD_MAXTHREADS)) {
+                    fprintf (stderr, "ftbackup: dthreads %s must be integer in range 0..%d\n", argv[i], PD_MAXTHREADS);
+                    goto usage;
+                }
+                continue;
+            }
             if (strcasecmp (argv[i], "-incremental") == 0) {
                 ftbreadmapper.opt_incrmntl  = true;
                 ftbreadmapper.opt_overwrite = true;
@@ -1877,10 +2273,42 @@ static int cmd_restore (int argc, char **argv, IFSAccess *tfs)
                 ftbreadmapper.opt_mkdirs = true;
                 continue;
             }
+            if (strcasecmp (argv[i], "-mmap") == 0) {
+                ftbreadmapper.opt_mmap = true;
+                continue;
+            }
             if (strcasecmp (argv[i], "-overwrite") == 0) {
                 ftbreadmapper.opt_overwrite = true;
                 continue;
             }
+            if (strcasecmp (argv[i], "-idirect") == 0) {
+                ftbreadmapper.opt_idirect = true;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-manifest") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbreadmapper.opt_manifest = argv[i];
+                continue;
+            }
+            if (strcasecmp (argv[i], "-readahead") == 0) {
+                if (++ i >= argc) goto usage;
+                readahead = strtoul (argv[i], &p, 0);
+                if ((*p != 0) || (readahead > RX_MAXSIZE) || (readahead % PAGESIZE != 0)) {
+                    fprintf (stderr, "ftbackup: readahead %s must be multiple of %u up to %u\n", argv[i], PAGESIZE, RX_MAXSIZE);
+                    goto usage;
+                }
+                ftbreadmapper.opt_readahead = readahead;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-rthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbreadmapper.opt_rthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftbreadmapper.opt_rthreads < 0) || (ftbreadmapper.opt_rthreads > 255)) {
+                    fprintf (stderr, "ftbackup: rthreads %s must be integer in range 0..255\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
             if (strcasecmp (argv[i], "-simrderrs") == 0) {
                 if (++ i >= argc) goto usage;
                 ftbreadmapper.opt_simrderrs = atoi (argv[i]);
@@ -1899,6 +2327,15 @@ static int cmd_restore (int argc, char **argv, IFSAccess *tfs)
                 }
                 continue;
             }
+            if (strcasecmp (argv[i], "-wthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbreadmapper.opt_wthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftbreadmapper.opt_wthreads < 0) || (ftbreadmapper.opt_wthreads > 255)) {
+                    fprintf (stderr, "ftbackup: wthreads %s must be integer in range 0..255\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
             if (strcasecmp (argv[i], "-xverbose") == 0) {
                 ftbreadmapper.opt_xverbose = true;
                 continue;
@@ -1934,12 +2371,29 @@ static int cmd_restore (int argc, char **argv, IFSAccess *tfs)
         fprintf (stderr, "ftbackup: missing required arguments\n");
         goto usage;
     }
+    if (ftbreadmapper.opt_mmap && (ftbreadmapper.opt_idirect || (ftbreadmapper.opt_rthreads > 0))) {
+        fprintf (stderr, "ftbackup: -mmap cannot be used with -idirect or -rthreads\n");
+        goto usage;
+    }
+    if ((ftbreadmapper.opt_dthreads > 0) && ((ftbreadmapper.opt_catalog != NULL) ||
+            (ftbreadmapper.opt_rthreads > 0) || (ftbreadmapper.opt_simrderrs != 0))) {
+        fprintf (stderr, "ftbackup: -dthreads cannot be used with -catalog, -rthreads or -simrderrs\n");
+        goto usage;
+    }
     ftbreadmapper.tfs = tfs;
     return ftbreadmapper.read_saveset (ssname);
 
 usage:
-    fprintf (stderr, "usage: ftbackup %s [-decrypt ...] [-incremental] [-mkdirs] [-overwrite] [-simrderrs <mod>] [-verbose] [-verbsec <seconds>] [-xverbose] [-xverbsec <seconds>] <saveset> {<savewildcard> -to <outputmapping>} ...\n", argv[0]);
+    fprintf (stderr, "usage: ftbackup %s [-catalog <file>] [-decrypt ...] [-dthreads <n>] [-idirect] [-incremental] [-manifest <file>] [-mkdirs] [-mmap] [-overwrite] [-readahead <bytes>] [-rthreads <n>] [-simrderrs <mod>] [-verbose] [-verbsec <seconds>] [-wthreads <n>] [-xverbose] [-xverbsec <seconds>] <saveset> {<savewildcard> -to <outputmapping>} ...\n", argv[0]);
     usagecipherargs ("decrypt");
+    fprintf (stderr, "        -catalog <file> = skip to the files selected using catalog written by backup -catalog\n");
+    fprintf (stderr, "        -dthreads <n> = decode chunks of the saveset with <n> threads\n");
+    fprintf (stderr, "        -idirect = read saveset with O_DIRECT\n");
+    fprintf (stderr, "        -manifest <file> = find and check segment files using manifest written by backup -manifest\n");
+    fprintf (stderr, "        -mmap = map saveset into memory rather than reading it\n");
+    fprintf (stderr, "        -readahead <bytes> = read saveset <bytes> at a time, 0 for one block at a time\n");
+    fprintf (stderr, "        -rthreads <n> = decrypt and check blocks with <n> threads while reading ahead\n");
+    fprintf (stderr, "        -wthreads <n> = create and write files with <n> threads\n");
     fprintf (stderr, "        <savewildcard> = select files from saveset that match this wildcard\n");
     fprintf (stderr, "        <outputmapping> = map the matching filenames to this string\n");
     fprintf (stderr, "        use '**' -to '' to %s all files to same name on disk\n", argv[0]);
@@ -1956,25 +2410,104 @@ static int cmd_version (int argc, char **argv)
 }
 
 /**
- * @brief Verify the XOR blocks of a saveset.
+ * @brief Verify the sequence numbers, hashes and XOR blocks of a saveset.
+ *        Segment files always start a new XOR span and spans don't depend on
+ *        each other, so the spans are verified by a pool of -rthreads threads,
+ *        each reading its span -readahead bytes at a time.  Spans are reported
+ *        on in saveset order as they finish, then each segment as its last
+ *        span is reported on.
  */
 struct FTBXorVfy : FTBReader {
+    FTBXorVfy ();
+    ~FTBXorVfy ();
     char const *select_file (Header const *hdr) { return FTBREADER_SELECT_SKIP; }
+    int xorvfy (char const *name);
+
+private:
+    // segment file being verified, or the whole saveset if not segmented
+    struct XVSeg {
+        char *name;
+        int fd;
+        uint32_T segno;             // 0 if saveset not segmented
+        uint32_T prevsegno;         // segment opened before this one, 0 if none
+        uint32_T expseqno;          // seqno it should start with, 0 if not known
+        uint32_T firstseqno;        // seqno of its first data block
+        uint32_T nspans;            // spans in segment
+        uint32_T ndone;             // spans reported on so far
+        uint32_T nbad;              // spans found bad so far
+        uint32_T crc;               // crc32 of spans reported on so far
+        bool crcok;                 // crc covers everything reported on so far
+        uint64_T size;
+        ManifestSeg *manseg;        // -manifest entry, NULL if none
+    };
+
+    // XOR span being verified
+    struct XVSpan {
+        XVSeg *seg;
+        uint64_T pos;               // where span starts in segment file
+        uint64_T len;               // bytes of span in segment file
+        uint32_T firstseqno;        // seqno of its first data block
+        uint32_T firstxorno;        // xorno of its first XOR block
+        uint32_T crc;               // crc32 of its bytes
+        bool crcok;                 // all its bytes were read
+        bool done;                  // verified, ready to be reported on
+        char err[128];              // what is wrong with it, empty string if nothing
+    };
+
+    // what a thread verifies spans with
+    struct XVCtx {
+        CryptoPP::HashTransformation *blkhasher;
+        CryptoPP::BlockCipher *blkdecipher;
+        CryptoPP::BlockCipher *blkencipher;
+        Block **xorblocks;          // XOR of each group's blocks so far
+        uint8_T *xorcounts;         // number of blocks in each group's XOR so far
+        uint8_T *rdbuf;             // span read into here rdsize bytes at a time
+    };
+
+    Block baseblock;            // first block of saveset, gives block size and XOR counts
+    pthread_cond_t xvcond;
+    pthread_mutex_t xvmutex;
+    pthread_t *xvhandls;
+    RingQueue<XVSpan *> xvworkqueue;
+    uint32_T blksperspan;       // data and XOR blocks in a full span
+    uint32_T bs;                // block size, 0 until first segment opened
+    uint32_T bsnh;              // block size not including hash
+    uint32_T dataperspan;       // data blocks in a full span
+    uint32_T nbad;              // spans found bad
+    uint32_T nerrs;             // other things found wrong
+    uint32_T nsegs;             // segments verified
+    uint32_T nspans;            // spans verified
+    uint32_T rdsize;            // bytes of span read at once
+    uint32_T xvnjobs;           // number of spans in xvjobs
+    uint32_T xvoldest;          // oldest span in xvjobs not yet reported on
+    uint32_T xvused;            // number of spans in xvjobs being verified or waiting to be reported on
+    uint64_T nbytes;            // bytes of spans verified
+    XVCtx xvctx;                // verifies spans when no -rthreads
+    XVSpan *xvjobs;
+
+    XVSeg *open_segment (char const *name, uint32_T segno, uint32_T prevsegno, uint32_T expseqno);
+    void queue_spans (XVSeg *seg);
+    void retire_span ();
+    void finish_segment (XVSeg *seg);
+    void verify_span (XVSpan *span, XVCtx *ctx);
+    void verify_block (XVSpan *span, XVCtx *ctx, Block *block, uint64_T pos, uint32_T *lastseqno, uint32_T *lastxorno);
+    void ctx_init (XVCtx *ctx);
+    void ctx_free (XVCtx *ctx);
+    void xvpool_start ();
+    void xvpool_stop ();
+
+    static void *xvwork_thread_wrapper (void *ftbx);
+    void *xvwork_thread ();
 };
 
 static int cmd_xorvfy (int argc, char **argv)
 {
-    char const *name;
-    Block baseblock, *block, *xorblk, **xorblocks;
-    bool ok;
+    char *p, *ssname;
     FTBXorVfy ftbxorvfy;
-    int fd, i, rc;
-    uint32_T bs, bsnh, lastseqno, lastxorno, xorgn;
-    uint64_T rdpos;
-    uint8_T *xorcounts;
+    int i;
+    unsigned long readahead;
 
-    name      = NULL;
-    ftbxorvfy = FTBXorVfy ();
+    ssname = NULL;
     for (i = 0; ++ i < argc;) {
         if ((argv[i][0] == '-') && (argv[i][1] != 0)) {
             if (strcasecmp (argv[i], "-decrypt") == 0) {
@@ -1982,132 +2515,622 @@ static int cmd_xorvfy (int argc, char **argv)
                 if (i < 0) goto usage;
                 continue;
             }
+            if (strcasecmp (argv[i], "-manifest") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbxorvfy.opt_manifest = argv[i];
+                continue;
+            }
+            if (strcasecmp (argv[i], "-readahead") == 0) {
+                if (++ i >= argc) goto usage;
+                readahead = strtoul (argv[i], &p, 0);
+                if ((*p != 0) || (readahead > RX_MAXSIZE) || (readahead % PAGESIZE != 0)) {
+                    fprintf (stderr, "ftbackup: readahead %s must be multiple of %u up to %u\n", argv[i], PAGESIZE, RX_MAXSIZE);
+                    goto usage;
+                }
+                ftbxorvfy.opt_readahead = readahead;
+                continue;
+            }
+            if (strcasecmp (argv[i], "-rthreads") == 0) {
+                if (++ i >= argc) goto usage;
+                ftbxorvfy.opt_rthreads = strtol (argv[i], &p, 0);
+                if ((*p != 0) || (ftbxorvfy.opt_rthreads < 0) || (ftbxorvfy.opt_rthreads > 255)) {
+                    fprintf (stderr, "ftbackup: rthreads %s must be integer in range 0..255\n", argv[i]);
+                    goto usage;
+                }
+                continue;
+            }
+            if (strcasecmp (argv[i], "-verbose") == 0) {
+                ftbxorvfy.opt_verbose = true;
+                continue;
+            }
+            fprintf (stderr, "ftbackup: unknown option %s\n", argv[i]);
+            goto usage;
+        }
+        if (ssname != NULL) {
+            fprintf (stderr, "ftbackup: unknown argument %s\n", argv[i]);
             goto usage;
         }
-        if (name != NULL) goto usage;
-        name = argv[i];
+        ssname = argv[i];
     }
-    if (name == NULL) goto usage;
-
-    fd = open (name, O_RDONLY);
-    if (fd < 0) {
-        fprintf (stderr, "open(%s) error: %s\n", name, mystrerr (errno));
-        return EX_SSIO;
+    if (ssname == NULL) {
+        fprintf (stderr, "ftbackup: missing <saveset>\n");
+        goto usage;
     }
+    return ftbxorvfy.xorvfy (ssname);
 
-    ftbxorvfy.maybesetdefaulthasher ();
+usage:
+    fprintf (stderr, "usage: ftbackup xorvfy [-decrypt ...] [-manifest <file>] [-readahead <bytes>] [-rthreads <n>] [-verbose] <saveset>\n");
+    usagecipherargs ("decrypt");
+    fprintf (stderr, "        -manifest <file> = find and check segment files using manifest written by backup -manifest\n");
+    fprintf (stderr, "        -readahead <bytes> = read saveset <bytes> at a time, 0 for one block at a time\n");
+    fprintf (stderr, "        -rthreads <n> = verify XOR spans with <n> threads\n");
+    fprintf (stderr, "        -verbose = report on every XOR span, not just bad ones\n");
+    return EX_CMD;
+}
 
-    block = (Block *) alloca (MINBLOCKSIZE);
-    rc = read (fd, block, MINBLOCKSIZE);
-    if (rc != MINBLOCKSIZE) {
-        if (rc < 0) {
-            fprintf (stderr, "read(%s) error: %s\n", name, mystrerr (errno));
-        } else {
-            fprintf (stderr, "read(%s) file too short\n", name);
-        }
-        close (fd);
-        return EX_SSIO;
-    }
+FTBXorVfy::FTBXorVfy ()
+{
+    memset (&baseblock, 0, sizeof baseblock);
+    memset (&xvctx, 0, sizeof xvctx);
+    blksperspan = 0;
+    bs          = 0;
+    bsnh        = 0;
+    dataperspan = 0;
+    nbad        = 0;
+    nerrs       = 0;
+    nsegs       = 0;
+    nspans      = 0;
+    nbytes      = 0;
+    rdsize      = 0;
+    xvhandls    = NULL;
+    xvjobs      = NULL;
+    xvnjobs     = 0;
+    xvoldest    = 0;
+    xvused      = 0;
+    pthread_cond_init  (&xvcond,  NULL);
+    pthread_mutex_init (&xvmutex, NULL);
+}
 
-    ftbxorvfy.decrypt_block (block, MINBLOCKSIZE);
+FTBXorVfy::~FTBXorVfy ()
+{
+    pthread_cond_destroy  (&xvcond);
+    pthread_mutex_destroy (&xvmutex);
+}
 
-    baseblock = *block;
+/**
+ * @brief Verify the whole saveset, all its segments if segmented.
+ * @param name = saveset file name, or base name of segment files
+ */
+int FTBXorVfy::xorvfy (char const *name)
+{
+    bool segmented;
+    char *segname;
+    double secs;
+    struct stat statbuf;
+    uint32_T i, nextseqno, prevsegno, segno;
+    uint64_T started;
+    XVSeg *seg;
 
-    bs   = 1 << baseblock.l2bs;
-    bsnh = bs - ftbxorvfy.hashsize ();
+    started = benchtime ();
 
-    block = (Block *) malloc (bs);
-    xorblocks = (Block **) malloc (baseblock.xorgc * sizeof *xorblocks);
-    for (xorgn = 0; xorgn < baseblock.xorgc; xorgn ++) xorblocks[xorgn] = (Block *) calloc (1, bsnh);
-    xorcounts = (uint8_T *) calloc (baseblock.xorgc, sizeof *xorcounts);
+    maybesetdefaulthasher ();
 
-    lastseqno = 0;
-    lastxorno = 0;
-    ok = false;
-    rdpos = 0;
+    if ((opt_manifest != NULL) && !manifest_load ()) return EX_SSIO;
 
-    while (((rc = pread (fd, block, bs, rdpos)) >= 0) && ((uint32_T) rc == bs)) {
-        if (!ftbxorvfy.decrypt_block (block, bs)) {
-            fprintf (stderr, "%llu: block digest not valid\n", rdpos);
-            goto done;
+    /*
+     * If the name isn't a file, it is the base name of segment files.
+     */
+    segmented = false;
+    segname   = NULL;
+    segno     = 0;
+    if (stat (name, &statbuf) < 0) {
+        if (errno != ENOENT) {
+            fprintf (stderr, "ftbackup: stat(%s) error: %s\n", name, mystrerr (errno));
+            return EX_SSIO;
         }
-        if (memcmp (block->magic, BLOCK_MAGIC, 8) != 0) {
-            fprintf (stderr, "%llu: bad block magic\n", rdpos);
-            goto done;
+        segno = next_segno (name, 0);
+        if (segno == 0) {
+            fprintf (stderr, "ftbackup: open(%s) error: %s\n", name, mystrerr (ENOENT));
+            return EX_SSIO;
         }
-        if (block->xorno == 0) {
-            if ((block->l2bs != baseblock.l2bs) || (block->xorgc != baseblock.xorgc) || (block->xorsc != baseblock.xorsc)) {
-                fprintf (stderr, "%llu: bad numbers %u,%u,%u, expect %u,%u,%u in seqno %u\n",
-                        rdpos, block->l2bs, block->xorgc, block->xorsc,
-                        baseblock.l2bs, baseblock.xorgc, baseblock.xorsc, block->seqno);
-                goto done;
-            }
-            if (++ lastseqno != block->seqno) {
-                fprintf (stderr, "%llu: bad seqno %u\n", rdpos, block->seqno);
-                goto done;
-            }
-            xorgn  = (block->seqno - 1) % baseblock.xorgc;
-            xorblk = xorblocks[xorgn];
-            FTBackup::xorblockdata (xorblk, block, bsnh);
-            xorcounts[xorgn] ++;
-        } else {
-            if (++ lastxorno != block->xorno) {
-                fprintf (stderr, "%llu: bad xorno %u\n", rdpos, block->xorno);
-                goto done;
-            }
-            xorgn  = (block->xorno - 1) % baseblock.xorgc;
-            xorblk = xorblocks[xorgn];
-            if (xorcounts[xorgn] != block->xorbc) {
-                fprintf (stderr, "%llu: bad xorbc %u\n", rdpos, block->xorbc);
-                goto done;
-            }
-            FTBackup::xorblockdata (xorblk, block, bsnh);
-            for (rc = 0; rc < (uint8_T *)block + bsnh - block->data; rc ++) {
-                if (xorblk->data[rc] != 0) {
-                    fprintf (stderr, "%llu: bad xor data at xorno %u[%d]\n", rdpos, block->xorno, rc);
-                    goto done;
-                }
-            }
+        segmented = true;
+        segname   = (char *) alloca (strlen (name) + SEGNODECDIGS + 4);
+    }
 
-            memset (xorblk, 0, bsnh);
-            xorcounts[xorgn] = 0;
+    /*
+     * Queue the spans of each segment to be verified, reporting on them as they finish.
+     * A segment should start with the seqno following on from the segment before it.
+     */
+    nextseqno = 1;
+    prevsegno = 0;
+    do {
+        if (segmented) sprintf (segname, "%s%.*u", name, SEGNODECDIGS, segno);
+        seg = open_segment (segmented ? segname : name, segno, prevsegno,
+                (segmented && (segno == prevsegno + 1)) ? nextseqno : 0);
+        if (seg == NULL) {
+            if (bs == 0) return EX_SSIO;
+            nerrs ++;
+        } else {
+            if (xvjobs == NULL) xvpool_start ();
+            nextseqno = seg->firstseqno + seg->nspans * dataperspan;
+            if (baseblock.xorgc == 0) nextseqno = seg->firstseqno + seg->size / bs;
+            prevsegno = segno;
+            queue_spans (seg);
         }
+    } while (segmented && ((segno = next_segno (name, segno)) != 0));
 
-        rdpos += bs;
-    }
+    while (xvused > 0) retire_span ();
+    xvpool_stop ();
 
-    if (rc < 0) {
-        fprintf (stderr, "%llu: pread() error: %s\n", rdpos, mystrerr (errno));
-        goto done;
-    }
-    if (rc != 0) {
-        fprintf (stderr, "%llu: pread() only %d bytes of %u\n", rdpos, rc, bs);
-        goto done;
+    /*
+     * Segments in the manifest that are missing were reported by manifest_check().
+     */
+    if (segmented) {
+        for (i = 0; i < mannsegs; i ++) {
+            if (!mansegs[i].present) nerrs ++;
+        }
     }
 
-    for (xorgn = 0; xorgn < baseblock.xorgc; xorgn ++) {
-        if (xorcounts[xorgn] != 0) {
-            fprintf (stderr, "%llu: missing end xor block group %u\n", rdpos, xorgn);
-            goto done;
+    secs = (benchtime () - started) / 1000000000.0;
+    fprintf (stderr, "%u segment%s, %u span%s, %u bad, %llu bytes in %.1f sec, %.1f MB/s\n",
+            nsegs, ((nsegs == 1) ? "" : "s"), nspans, ((nspans == 1) ? "" : "s"), nbad,
+            nbytes, secs, ((secs > 0) ? nbytes / secs / 1000000.0 : 0.0));
+    if ((nbad != 0) || (nerrs != 0)) return EX_SSIO;
+    fprintf (stderr, "success!\n");
+    return EX_OK;
+}
+
+/**
+ * @brief Open a segment file and figure out what spans are in it.
+ *        The very first one opened gives the block size and XOR counts.
+ * @param segno = segment number, 0 if saveset not segmented
+ * @param prevsegno = segment number opened before this one, 0 if none
+ * @param expseqno = seqno the segment should start with, 0 if not known
+ * @returns NULL: can't be opened (message printed)
+ *          else: segment, its spans not yet queued
+ */
+FTBXorVfy::XVSeg *FTBXorVfy::open_segment (char const *name, uint32_T segno, uint32_T prevsegno, uint32_T expseqno)
+{
+    Block *block;
+    int fd;
+    long rc;
+    struct stat statbuf;
+    uint32_T firstseqno;
+    XVSeg *seg;
+
+    fd = open (name, O_RDONLY);
+    if (fd < 0) {
+        fprintf (stderr, "ftbackup: open(%s) error: %s\n", name, mystrerr (errno));
+        return NULL;
+    }
+    if (fstat (fd, &statbuf) < 0) SYSERRNO (fstat);
+
+    if (bs == 0) {
+        block = (Block *) alloca (MINBLOCKSIZE);
+        rc = pread (fd, block, MINBLOCKSIZE, 0);
+        if (rc != MINBLOCKSIZE) {
+            if (rc < 0) {
+                fprintf (stderr, "ftbackup: read(%s) error: %s\n", name, mystrerr (errno));
+            } else {
+                fprintf (stderr, "ftbackup: read(%s) file too short\n", name);
+            }
+            close (fd);
+            return NULL;
+        }
+        decrypt_block (block, MINBLOCKSIZE);
+        if ((memcmp (block->magic, BLOCK_MAGIC, 8) != 0) || (block->l2bs > 31) ||
+                (1U << block->l2bs < MINBLOCKSIZE) || (1U << block->l2bs > MAXBLOCKSIZE)) {
+            fprintf (stderr, "ftbackup: %s: bad first block\n", name);
+            close (fd);
+            return NULL;
+        }
+        baseblock = *block;
+
+        bs   = 1 << baseblock.l2bs;
+        bsnh = bs - hashsize ();
+
+        /*
+         * Read whole spans at once if -readahead is big enough.
+         * Without XOR blocks, a span is just what is read at once.
+         */
+        rdsize = opt_readahead / bs * bs;
+        if (rdsize == 0) rdsize = bs;
+        if (baseblock.xorgc > 0) {
+            dataperspan = baseblock.xorgc * baseblock.xorsc;
+            blksperspan = dataperspan + baseblock.xorgc;
+            if (rdsize / bs > blksperspan) rdsize = blksperspan * bs;
+        } else {
+            dataperspan = rdsize / bs;
+            blksperspan = dataperspan;
         }
     }
 
-    fprintf (stderr, "success!\n");
-    ok = true;
+    seg = (XVSeg *) calloc (1, sizeof *seg);
+    if (seg == NULL) NOMEM ();
+    seg->name = strdup (name);
+    if (seg->name == NULL) NOMEM ();
+    seg->fd        = fd;
+    seg->segno     = segno;
+    seg->prevsegno = prevsegno;
+    seg->expseqno  = expseqno;
+    seg->crc       = crc32 (0L, Z_NULL, 0);
+    seg->crcok     = (statbuf.st_size % bs == 0);
+    seg->size      = statbuf.st_size;
+    seg->manseg    = (segno == 0) ? NULL : manifest_seg (segno);
 
-done:
-    close (fd);
-    for (xorgn = 0; xorgn < baseblock.xorgc; xorgn ++) free (xorblocks[xorgn]);
-    free (block);
-    free (xorblocks);
-    free (xorcounts);
+    /*
+     * Get the seqno it starts with from its first block, else assume it is what it should be.
+     * The manifest says what it should be even if segments before it are missing.
+     */
+    if ((seg->manseg != NULL) && (seg->manseg->firstseqno != 0)) {
+        expseqno = seg->expseqno = seg->manseg->firstseqno;
+    }
+    firstseqno = 0;
+    if (seg->size >= bs) {
+        block = (Block *) malloc (bs);
+        if (block == NULL) NOMEM ();
+        if ((pread (fd, block, bs, 0) == (long) bs) && decrypt_block (block, bs) &&
+                (memcmp (block->magic, BLOCK_MAGIC, 8) == 0) && (block->xorno == 0)) {
+            firstseqno = block->seqno;
+        }
+        free (block);
+    }
+    if (firstseqno == 0) firstseqno = (expseqno != 0) ? expseqno : 1;
+    if (baseblock.xorgc > 0) firstseqno -= (firstseqno - 1) % dataperspan;
 
-    return ok ? EX_OK : EX_SSIO;
+    seg->firstseqno = firstseqno;
+    seg->nspans     = (seg->size / bs + blksperspan - 1) / blksperspan;
+    return seg;
+}
 
-usage:
-    fprintf (stderr, "usage: ftbackup xorvfy [-decrypt ...] <saveset>\n");
-    usagecipherargs ("decrypt");
-    return EX_CMD;
+/**
+ * @brief Queue all the spans of a segment to be verified,
+ *        reporting on the oldest ones as needed to make room.
+ */
+void FTBXorVfy::queue_spans (XVSeg *seg)
+{
+    uint32_T i;
+    uint64_T nblocks;
+    XVSpan *span;
+
+    nsegs ++;
+
+    /*
+     * Nothing to wait for, report on it once everything before it has been.
+     */
+    if (seg->nspans == 0) {
+        while (xvused > 0) retire_span ();
+        finish_segment (seg);
+        return;
+    }
+
+    nblocks = seg->size / bs;
+    for (i = 0; i < seg->nspans; i ++) {
+        if (xvused == xvnjobs) retire_span ();
+        span = &xvjobs[(xvoldest+xvused)%xvnjobs];
+        xvused ++;
+
+        span->seg        = seg;
+        span->pos        = (uint64_T) i * blksperspan * bs;
+        span->len        = (nblocks - (uint64_T) i * blksperspan) * bs;
+        if (span->len > (uint64_T) blksperspan * bs) span->len = (uint64_T) blksperspan * bs;
+        span->firstseqno = seg->firstseqno + i * dataperspan;
+        span->firstxorno = (baseblock.xorgc > 0) ? (span->firstseqno - 1) / dataperspan * baseblock.xorgc + 1 : 0;
+        span->done       = false;
+
+        if (xvhandls == NULL) {
+            verify_span (span, &xvctx);
+            span->done = true;
+        } else {
+            xvworkqueue.enqueue (span);
+        }
+    }
+}
+
+/**
+ * @brief Wait for the oldest span being verified to finish and report on it,
+ *        then on its segment if it was the segment's last span.
+ */
+void FTBXorVfy::retire_span ()
+{
+    XVSeg *seg;
+    XVSpan *span;
+
+    span = &xvjobs[xvoldest];
+    pthread_mutex_lock (&xvmutex);
+    while (!span->done) pthread_cond_wait (&xvcond, &xvmutex);
+    pthread_mutex_unlock (&xvmutex);
+
+    seg = span->seg;
+    if (span->err[0] != 0) {
+        fprintf (stderr, "%s: span %u: %s\n", seg->name, (span->firstseqno - 1) / dataperspan, span->err);
+        seg->nbad ++;
+        nbad ++;
+    } else if (opt_verbose) {
+        fprintf (stderr, "%s: span %u: seqno %u ok\n", seg->name, (span->firstseqno - 1) / dataperspan, span->firstseqno);
+    }
+    seg->crc = crc32_combine (seg->crc, span->crc, span->len);
+    if (!span->crcok) seg->crcok = false;
+    nspans ++;
+    nbytes += span->len;
+
+    xvoldest = (xvoldest + 1) % xvnjobs;
+    xvused --;
+
+    if (++ seg->ndone == seg->nspans) finish_segment (seg);
+}
+
+/**
+ * @brief All of segment's spans have been reported on, report on the segment as a whole then close it.
+ */
+void FTBXorVfy::finish_segment (XVSeg *seg)
+{
+    bool ok;
+    uint32_T segno;
+
+    ok = (seg->nbad == 0);
+
+    if (mansegs == NULL) {
+        for (segno = seg->prevsegno; ++ segno < seg->segno;) {
+            fprintf (stderr, "ftbackup: segment %.*s%.*u missing\n", (int) strlen (seg->name) - SEGNODECDIGS, seg->name, SEGNODECDIGS, segno);
+            ok = false;
+        }
+    }
+    if ((seg->expseqno != 0) && (seg->firstseqno != seg->expseqno)) {
+        fprintf (stderr, "%s: starts with seqno %u, expected %u\n", seg->name, seg->firstseqno, seg->expseqno);
+        ok = false;
+    }
+    if (seg->nspans == 0) {
+        fprintf (stderr, "%s: no blocks\n", seg->name);
+        ok = false;
+    }
+    if (seg->size % bs != 0) {
+        fprintf (stderr, "%s: ends with partial block of %llu bytes\n", seg->name, seg->size % bs);
+        ok = false;
+    }
+
+    fprintf (stderr, "%s: %u span%s, %u bad, %llu bytes", seg->name, seg->nspans, ((seg->nspans == 1) ? "" : "s"), seg->nbad, seg->size);
+    if (seg->manseg != NULL) {
+        if (!seg->crcok) {
+            fprintf (stderr, ", crc not checked");
+        } else if (seg->crc == seg->manseg->crc) {
+            fprintf (stderr, ", crc ok");
+        } else {
+            fprintf (stderr, ", crc %08X, manifest says %08X", seg->crc, seg->manseg->crc);
+            ok = false;
+        }
+    }
+    fprintf (stderr, "\n");
+    if (!ok && (seg->nbad == 0)) nerrs ++;
+
+    close (seg->fd);
+    free (seg->name);
+    free (seg);
+}
+
+/**
+ * @brief Read and verify a span, leaving what is wrong with it in span->err.
+ *        Reads the whole span even if something is wrong so the crc covers it.
+ */
+void FTBXorVfy::verify_span (XVSpan *span, XVCtx *ctx)
+{
+    long rc;
+    uint32_T i, lastseqno, lastxorno, len, xorgn;
+    uint64_T ofs;
+
+    span->err[0] = 0;
+    span->crc    = crc32 (0L, Z_NULL, 0);
+    span->crcok  = true;
+
+    for (xorgn = 0; xorgn < baseblock.xorgc; xorgn ++) memset (ctx->xorblocks[xorgn], 0, bsnh);
+    memset (ctx->xorcounts, 0, baseblock.xorgc);
+    lastseqno = span->firstseqno - 1;
+    lastxorno = span->firstxorno - 1;
+
+    for (ofs = 0; ofs < span->len; ofs += len) {
+        len = rdsize;
+        if (len > span->len - ofs) len = span->len - ofs;
+        rc = pread (span->seg->fd, ctx->rdbuf, len, span->pos + ofs);
+        if ((rc < 0) || ((uint32_T) rc != len)) {
+            if (rc < 0) {
+                snprintf (span->err, sizeof span->err, "%llu: pread() error: %s", span->pos + ofs, mystrerr (errno));
+            } else {
+                snprintf (span->err, sizeof span->err, "%llu: pread() only %ld bytes of %u", span->pos + ofs, rc, len);
+            }
+            span->crcok = false;
+            return;
+        }
+        span->crc = crc32 (span->crc, ctx->rdbuf, len);
+        for (i = 0; (i < len) && (span->err[0] == 0); i += bs) {
+            verify_block (span, ctx, (Block *) (ctx->rdbuf + i), span->pos + ofs + i, &lastseqno, &lastxorno);
+        }
+    }
+
+    if (span->err[0] == 0) {
+        for (xorgn = 0; xorgn < baseblock.xorgc; xorgn ++) {
+            if (ctx->xorcounts[xorgn] != 0) {
+                snprintf (span->err, sizeof span->err, "%llu: missing end xor block group %u", span->pos + span->len, xorgn);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Verify a block of a span, XORing it into its group's XOR so far.
+ * @param pos = where block is in segment file
+ * @param lastseqno,lastxorno = last seqno and xorno verified in the span
+ */
+void FTBXorVfy::verify_block (XVSpan *span, XVCtx *ctx, Block *block, uint64_T pos, uint32_T *lastseqno, uint32_T *lastxorno)
+{
+    Block *xorblk;
+    int i;
+    uint32_T xorgn;
+
+    if (!decrypt_block (block, bs, ctx->blkhasher, ctx->blkdecipher, ctx->blkencipher)) {
+        snprintf (span->err, sizeof span->err, "%llu: block digest not valid", pos);
+        return;
+    }
+    if (memcmp (block->magic, BLOCK_MAGIC, 8) != 0) {
+        snprintf (span->err, sizeof span->err, "%llu: bad block magic", pos);
+        return;
+    }
+    if (block->xorno == 0) {
+        if ((block->l2bs != baseblock.l2bs) || (block->xorgc != baseblock.xorgc) || (block->xorsc != baseblock.xorsc)) {
+            snprintf (span->err, sizeof span->err, "%llu: bad numbers %u,%u,%u, expect %u,%u,%u in seqno %u",
+                    pos, block->l2bs, block->xorgc, block->xorsc,
+                    baseblock.l2bs, baseblock.xorgc, baseblock.xorsc, block->seqno);
+            return;
+        }
+        if ((++ *lastseqno != block->seqno) || (block->seqno - span->firstseqno >= dataperspan)) {
+            snprintf (span->err, sizeof span->err, "%llu: bad seqno %u", pos, block->seqno);
+            return;
+        }
+        if (baseblock.xorgc > 0) {
+            xorgn  = (block->seqno - 1) % baseblock.xorgc;
+            xorblk = ctx->xorblocks[xorgn];
+            FTBackup::xorblockdata (xorblk, block, bsnh);
+            ctx->xorcounts[xorgn] ++;
+        }
+    } else {
+        if ((baseblock.xorgc == 0) || (++ *lastxorno != block->xorno)) {
+            snprintf (span->err, sizeof span->err, "%llu: bad xorno %u", pos, block->xorno);
+            return;
+        }
+        xorgn  = (block->xorno - 1) % baseblock.xorgc;
+        xorblk = ctx->xorblocks[xorgn];
+        if (ctx->xorcounts[xorgn] != block->xorbc) {
+            snprintf (span->err, sizeof span->err, "%llu: bad xorbc %u", pos, block->xorbc);
+            return;
+        }
+        FTBackup::xorblockdata (xorblk, block, bsnh);
+        for (i = 0; i < (uint8_T *)block + bsnh - block->data; i ++) {
+            if (xorblk->data[i] != 0) {
+                snprintf (span->err, sizeof span->err, "%llu: bad xor data at xorno %u[%d]", pos, block->xorno, i);
+                return;
+            }
+        }
+
+        memset (xorblk, 0, bsnh);
+        ctx->xorcounts[xorgn] = 0;
+    }
+}
+
+/**
+ * @brief Set up what a thread needs to verify spans with.
+ */
+void FTBXorVfy::ctx_init (XVCtx *ctx)
+{
+    uint32_T xorgn;
+
+    ctx->blkhasher   = newhasher ();
+    ctx->blkdecipher = newcipher (false);
+    ctx->blkencipher = newcipher (true);
+    ctx->xorblocks   = (Block **) malloc ((baseblock.xorgc + 1) * sizeof *ctx->xorblocks);
+    ctx->xorcounts   = (uint8_T *) calloc (baseblock.xorgc + 1, sizeof *ctx->xorcounts);
+    ctx->rdbuf       = (uint8_T *) malloc (rdsize);
+    if ((ctx->xorblocks == NULL) || (ctx->xorcounts == NULL) || (ctx->rdbuf == NULL)) NOMEM ();
+    for (xorgn = 0; xorgn < baseblock.xorgc; xorgn ++) {
+        ctx->xorblocks[xorgn] = (Block *) calloc (1, bsnh);
+        if (ctx->xorblocks[xorgn] == NULL) NOMEM ();
+    }
+}
+
+void FTBXorVfy::ctx_free (XVCtx *ctx)
+{
+    uint32_T xorgn;
+
+    for (xorgn = 0; xorgn < baseblock.xorgc; xorgn ++) free (ctx->xorblocks[xorgn]);
+    free (ctx->xorblocks);
+    free (ctx->xorcounts);
+    free (ctx->rdbuf);
+    delete ctx->blkhasher;
+    if (ctx->blkdecipher != NULL) delete ctx->blkdecipher;
+    if (ctx->blkencipher != NULL) delete ctx->blkencipher;
+    memset (ctx, 0, sizeof *ctx);
+}
+
+/**
+ * @brief Start the -rthreads threads, if any, once the block size and XOR counts are known.
+ *        Without threads, spans are verified as they are queued.
+ */
+void FTBXorVfy::xvpool_start ()
+{
+    int i, rc;
+
+    xvnjobs = (opt_rthreads > 0) ? opt_rthreads * RD_PERTHREAD : 1;
+    xvjobs  = (XVSpan *) calloc (xvnjobs, sizeof *xvjobs);
+    if (xvjobs == NULL) NOMEM ();
+    xvoldest = 0;
+    xvused   = 0;
+
+    if (opt_rthreads == 0) {
+        ctx_init (&xvctx);
+        return;
+    }
+
+    xvworkqueue.setdepth (xvnjobs);
+    xvhandls = (pthread_t *) malloc (opt_rthreads * sizeof *xvhandls);
+    if (xvhandls == NULL) NOMEM ();
+    for (i = 0; i < opt_rthreads; i ++) {
+        rc = pthread_create (&xvhandls[i], NULL, xvwork_thread_wrapper, this);
+        if (rc != 0) SYSERR (pthread_create, rc);
+    }
+}
+
+/**
+ * @brief Stop the -rthreads threads, if running, once everything queued has been reported on.
+ */
+void FTBXorVfy::xvpool_stop ()
+{
+    int i, rc;
+
+    if (xvjobs == NULL) return;
+
+    if (xvhandls == NULL) {
+        ctx_free (&xvctx);
+    } else {
+        for (i = 0; i < opt_rthreads; i ++) {
+            xvworkqueue.enqueue (NULL);
+        }
+        for (i = 0; i < opt_rthreads; i ++) {
+            rc = pthread_join (xvhandls[i], NULL);
+            if (rc != 0) SYSERR (pthread_join, rc);
+        }
+        free (xvhandls);
+        xvhandls = NULL;
+    }
+
+    free (xvjobs);
+    xvjobs = NULL;
+}
+
+/**
+ * @brief Verify spans queued by queue_spans().
+ */
+void *FTBXorVfy::xvwork_thread_wrapper (void *ftbx)
+{
+    return ((FTBXorVfy *) ftbx)->xvwork_thread ();
+}
+void *FTBXorVfy::xvwork_thread ()
+{
+    XVCtx ctx;
+    XVSpan *span;
+
+    ctx_init (&ctx);
+
+    while ((span = xvworkqueue.dequeue ()) != NULL) {
+        verify_span (span, &ctx);
+
+        pthread_mutex_lock (&xvmutex);
+        span->done = true;
+        pthread_cond_broadcast (&xvcond);
+        pthread_mutex_unlock (&xvmutex);
+    }
+
+    ctx_free (&ctx);
+
+    return NULL;
 }
 
 FTBackup::FTBackup ()
@@ -2118,6 +3141,8 @@ FTBackup::FTBackup ()
     decipher   = NULL;
     encipher   = NULL;
     hasher     = NULL;
+    ciphername = NULL;
+    hashername = NULL;
     hashinibuf = NULL;
     hashinilen = 0;
 }
@@ -2287,7 +3312,6 @@ void FTBackup::xorblockdata (void *dst, void const *src, uint32_T nby)
  */
 int FTBackup::decodecipherargs (int argc, char **argv, int i, bool enc)
 {
-    char const *ciphername, *hashername;
     char keybuff[4096], keybufr[4096], *keyline, *p;
     CryptoPP::BlockCipher *newcipher;
     CryptoPP::HashTransformation *newhasher;
@@ -2526,97 +3550,900 @@ void FTBackup::maybesetdefaulthasher ()
         hasher = new CryptoPP::Weak::MD5 ();
     }
 }
-
-static void usagecipherargs (char const *decenc)
-{
-    fprintf (stderr, "    -%s [:<cipher>] [:<hasher>] <keyspec>\n", decenc);
-    fprintf (stderr, "                            cipher = block cipher algorithm (default %s)\n", DEF_CIPHERNAME);
-    fprintf (stderr, "                            hasher = key hasher algorithm (default %s)\n", DEF_HASHERNAME);
-    fprintf (stderr, "                           keyspec = - : prompt at stdin\n");
-    fprintf (stderr, "                             @filename : read from first line of file\n");
-    fprintf (stderr, "                                  else : literal string\n");
 
-    fprintf (stderr, "              cipher algorithms:"
-#define _CIPHOP(Name) " " #Name
-    CIPHLIST
-#undef _CIPHOP
-    "\n");
+/**
+ * @brief Create another cipher context the same as decipher/encipher, for use by another thread.
+ * @param enc = false: decryption; true: encryption
+ * @returns NULL if not encrypting, else new keyed cipher context
+ */
+CryptoPP::BlockCipher *FTBackup::newcipher (bool enc)
+{
+    CryptoPP::BlockCipher *cipher;
 
-    fprintf (stderr, "              hasher algorithms:"
-#define _HASHOP(Name) " " #Name
-    HASHLIST
-#undef _HASHOP
-    "\n");
+    if ((enc ? encipher : decipher) == NULL) return NULL;
+    cipher = getciphercontext (ciphername, enc);
+    cipher->SetKey (hashinibuf, cipher->DefaultKeyLength (), CryptoPP::g_nullNameValuePairs);
+    return cipher;
 }
 
-static bool readpasswd (char const *prompt, char *pwbuff, size_t pwsize)
+/**
+ * @brief Create another hasher context the same as hasher, for use by another thread.
+ */
+CryptoPP::HashTransformation *FTBackup::newhasher ()
 {
-    int promptlen, rc, ttyfd;
-    struct termios nflags, oflags;
+    if (hashername == NULL) return new CryptoPP::Weak::MD5 ();
+    return gethashercontext (hashername);
+}
+
+IoRing::IoRing ()
+{
+    ringfd     = -1;
+    sqentries  = 0;
+    sqpending  = 0;
+    sqhead     = sqtail = sqmask = sqarray = NULL;
+    cqhead     = cqtail = cqmask = NULL;
+    sqes       = cqes = NULL;
+    sqring     = cqring = NULL;
+    sqringsize = cqringsize = sqessize = 0;
+}
 
-    ttyfd = open ("/dev/tty", O_RDWR | O_NOCTTY);
-    if (ttyfd < 0) {
-        fprintf (stderr, "open(/dev/tty) error: %s\n", mystrerr (errno));
-        return false;
-    }
+IoRing::~IoRing ()
+{
+    if (sqes   != NULL) munmap (sqes,   sqessize);
+    if (cqring != NULL) munmap (cqring, cqringsize);
+    if (sqring != NULL) munmap (sqring, sqringsize);
+    if (ringfd >= 0) close (ringfd);
+}
 
-    if (tcgetattr (ttyfd, &oflags) < 0) {
-        fprintf (stderr, "tcgetattr(/dev/tty) error: %s\n", mystrerr (errno));
-        goto err2;
-    }
+/**
+ * @brief Create the rings.
+ * @param entries = max number of requests in flight
+ * @returns 0: success
+ *       else: -errno
+ */
+int IoRing::setup (uint32_T entries)
+{
+#if defined (IORING_OFF_SQ_RING) && defined (__NR_io_uring_setup)
+    int fd;
+    struct io_uring_params params;
 
-    nflags = oflags;
-    nflags.c_lflag &= ~ECHO;
-    nflags.c_lflag |= ECHONL;
+    memset (&params, 0, sizeof params);
+    fd = syscall (__NR_io_uring_setup, entries, &params);
+    if (fd < 0) return - errno;
 
-    if (tcsetattr (ttyfd, TCSANOW, &nflags) < 0) {
-        fprintf (stderr, "tcsetattr(/dev/tty) error: %s\n", mystrerr (errno));
-        goto err2;
+    // IORING_OP_READ and _WRITE came along with this one
+    if (! (params.features & IORING_FEAT_FAST_POLL)) {
+        close (fd);
+        return - ENOSYS;
     }
 
-    promptlen = strlen (prompt);
-    do {
-        rc = write (ttyfd, prompt, promptlen);
-        if (rc < promptlen) {
-            if (rc >= 0) errno = MYENDOFILE;
-            fprintf (stderr, "write(/dev/tty) error: %s\n", mystrerr (errno));
-            goto err1;
-        }
-        rc = read (ttyfd, pwbuff, pwsize);
-        if (rc <= 0) {
-            if (rc == 0) errno = MYENDOFILE;
-            fprintf (stderr, "read(/dev/tty) error: %s\n", mystrerr (errno));
-            goto err1;
-        }
-    } while ((rc == 1) || (pwbuff[rc-1] != '\n'));
-
-    pwbuff[--rc] = 0;
-
-    if (tcsetattr (ttyfd, TCSANOW, &oflags) < 0) {
-        fprintf (stderr, "tcsetattr(/dev/tty) error: %s\n", mystrerr (errno));
-        goto err2;
-    }
+    ringfd     = fd;
+    sqentries  = params.sq_entries;
+    sqringsize = params.sq_off.array + params.sq_entries * sizeof (uint32_T);
+    cqringsize = params.cq_off.cqes  + params.cq_entries * sizeof (struct io_uring_cqe);
+    sqessize   = params.sq_entries * sizeof (struct io_uring_sqe);
+
+    sqring = mmap (NULL, sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqring == MAP_FAILED) goto mmaperr;
+    cqring = mmap (NULL, cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cqring == MAP_FAILED) goto mmaperr;
+    sqes   = mmap (NULL, sqessize,   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes   == MAP_FAILED) goto mmaperr;
+
+    sqhead  = (uint32_T *) ((uint8_T *) sqring + params.sq_off.head);
+    sqtail  = (uint32_T *) ((uint8_T *) sqring + params.sq_off.tail);
+    sqmask  = (uint32_T *) ((uint8_T *) sqring + params.sq_off.ring_mask);
+    sqarray = (uint32_T *) ((uint8_T *) sqring + params.sq_off.array);
+    cqhead  = (uint32_T *) ((uint8_T *) cqring + params.cq_off.head);
+    cqtail  = (uint32_T *) ((uint8_T *) cqring + params.cq_off.tail);
+    cqmask  = (uint32_T *) ((uint8_T *) cqring + params.cq_off.ring_mask);
+    cqes    = (uint8_T *) cqring + params.cq_off.cqes;
+    return 0;
 
-    close (ttyfd);
-    return true;
+mmaperr:
+    fd = - errno;
+    if ((sqes   != NULL) && (sqes   != MAP_FAILED)) munmap (sqes,   sqessize);
+    if ((cqring != NULL) && (cqring != MAP_FAILED)) munmap (cqring, cqringsize);
+    if ((sqring != NULL) && (sqring != MAP_FAILED)) munmap (sqring, sqringsize);
+    sqes   = NULL;
+    cqring = NULL;
+    sqring = NULL;
+    close (ringfd);
+    ringfd = -1;
+    return fd;
+#else
+    return - ENOSYS;
+#endif
+}
 
-err1:
-    tcsetattr (ttyfd, TCSANOW, &oflags);
-err2:
-    close (ttyfd);
+/**
+ * @brief Queue a read or write request, submitted by the next submit() call.
+ * @param data = passed back by getcqe() when the request completes
+ * @returns true: request queued
+ *         false: submission ring is full
+ */
+bool IoRing::prepread (int fd, void *buf, uint32_T len, uint64_T pos, uint64_T data)
+{
+#ifdef IORING_OFF_SQ_RING
+    return prep (IORING_OP_READ, fd, buf, len, pos, data);
+#else
     return false;
+#endif
 }
-
-char const *mystrerr (int err)
+
+bool IoRing::prepwrite (int fd, void const *buf, uint32_T len, uint64_T pos, uint64_T data)
 {
-    if (err == MYEDATACMP) return "data compare mismatch";
-    if (err == MYESIMRDER) return "simulated read error";
-    if (err == MYENDOFILE) return "end of file";
-    return strerror (err);
+#ifdef IORING_OFF_SQ_RING
+    return prep (IORING_OP_WRITE, fd, buf, len, pos, data);
+#else
+    return false;
+#endif
 }
 
-/**
- * @brief Find out how many chars at beginning of string are not wildcard.
+bool IoRing::prepwritev (int fd, struct iovec const *iov, uint32_T niov, uint64_T pos, uint64_T data)
+{
+#ifdef IORING_OFF_SQ_RING
+    return prep (IORING_OP_WRITEV, fd, iov, niov, pos, data);
+#else
+    return false;
+#endif
+}
+
+bool IoRing::prep (int opcode, int fd, void const *buf, uint32_T len, uint64_T pos, uint64_T data)
+{
+#ifdef IORING_OFF_SQ_RING
+    struct io_uring_sqe *sqe;
+    uint32_T idx, tail;
+
+    tail = *sqtail;
+    if (tail - __atomic_load_n (sqhead, __ATOMIC_ACQUIRE) >= sqentries) return false;
+
+    idx = tail & *sqmask;
+    sqe = (struct io_uring_sqe *) sqes + idx;
+    memset (sqe, 0, sizeof *sqe);
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->addr      = (ulong_T) buf;
+    sqe->len       = len;
+    sqe->off       = pos;
+    sqe->user_data = data;
+    sqarray[idx]   = idx;
+
+    __atomic_store_n (sqtail, tail + 1, __ATOMIC_RELEASE);
+    sqpending ++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Submit queued requests to the kernel.
+ * @param waitfor = wait for at least this many completions to be available
+ * @returns >= 0: number of requests submitted
+ *          else: -errno
+ */
+int IoRing::submit (uint32_T waitfor)
+{
+#if defined (IORING_OFF_SQ_RING) && defined (__NR_io_uring_enter)
+    int rc;
+
+    do rc = syscall (__NR_io_uring_enter, ringfd, sqpending, waitfor, (waitfor > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while ((rc < 0) && (errno == EINTR));
+    if (rc < 0) return - errno;
+    sqpending -= rc;
+    return rc;
+#else
+    return - ENOSYS;
+#endif
+}
+
+/**
+ * @brief Get a completed request, if any.
+ * @param data = as passed to prepread() or prepwrite()
+ * @param res = number of bytes transferred, else -errno
+ * @returns true: request completed
+ *         false: no completions available
+ */
+bool IoRing::getcqe (uint64_T *data, int *res)
+{
+#ifdef IORING_OFF_SQ_RING
+    struct io_uring_cqe *cqe;
+    uint32_T head;
+
+    head = *cqhead;
+    if (head == __atomic_load_n (cqtail, __ATOMIC_ACQUIRE)) return false;
+
+    cqe   = (struct io_uring_cqe *) cqes + (head & *cqmask);
+    *data = cqe->user_data;
+    *res  = cqe->res;
+
+    __atomic_store_n (cqhead, head + 1, __ATOMIC_RELEASE);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief zlib deflate codec.
+ */
+struct ZlibCodec : Codec {
+    ZlibCodec (int level);
+    ~ZlibCodec ();
+
+    virtual void encbegin ();
+    virtual bool encode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen, bool end);
+    virtual uint32_T encbound (uint32_T inlen);
+    virtual void encdict (uint8_T const *dict, uint32_T len);
+    virtual void decbegin ();
+    virtual int decode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen);
+    virtual bool decdict (uint8_T const *dict, uint32_T len);
+    virtual bool encwhole (uint8_T const *in, uint32_T inlen, uint8_T *out, uint32_T *outlen);
+    virtual bool decwhole (uint8_T const *in, uint32_T inlen, uint32_T *inused, uint8_T *out, uint32_T outlen);
+
+private:
+    bool dopen;
+    bool eopen;
+    int level;
+    z_stream dstrm;
+    z_stream estrm;
+#ifdef HAVE_LIBDEFLATE
+    struct libdeflate_compressor *lcomp;
+    struct libdeflate_decompressor *ldecomp;
+#endif
+};
+
+bool Codec::wholeruns = true;
+
+ZlibCodec::ZlibCodec (int level)
+{
+    this->level = level;
+    dopen = false;
+    eopen = false;
+    memset (&dstrm, 0, sizeof dstrm);
+    memset (&estrm, 0, sizeof estrm);
+#ifdef HAVE_LIBDEFLATE
+    lcomp   = NULL;
+    ldecomp = NULL;
+#endif
+}
+
+ZlibCodec::~ZlibCodec ()
+{
+    if (dopen) inflateEnd (&dstrm);
+    if (eopen) deflateEnd (&estrm);
+#ifdef HAVE_LIBDEFLATE
+    if (lcomp   != NULL) libdeflate_free_compressor (lcomp);
+    if (ldecomp != NULL) libdeflate_free_decompressor (ldecomp);
+#endif
+}
+
+void ZlibCodec::encbegin ()
+{
+    int rc;
+
+    if (eopen) rc = deflateReset (&estrm);
+    else {
+        rc = deflateInit (&estrm, level);
+        eopen = true;
+    }
+    if (rc != Z_OK) INTERR (deflateInit, rc);
+}
+
+bool ZlibCodec::encode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen, bool end)
+{
+    int rc;
+
+    if (!end && (*inlen == 0)) return false;
+
+    estrm.next_in   = (Bytef *) *in;
+    estrm.avail_in  = *inlen;
+    estrm.next_out  = *out;
+    estrm.avail_out = *outlen;
+    rc = deflate (&estrm, end ? Z_FINISH : Z_NO_FLUSH);
+    if ((rc != Z_OK) && (rc != Z_STREAM_END)) INTERR (deflate, rc);
+    *in     = estrm.next_in;
+    *inlen  = estrm.avail_in;
+    *out    = estrm.next_out;
+    *outlen = estrm.avail_out;
+    return rc == Z_STREAM_END;
+}
+
+uint32_T ZlibCodec::encbound (uint32_T inlen)
+{
+    return compressBound (inlen);
+}
+
+void ZlibCodec::encdict (uint8_T const *dict, uint32_T len)
+{
+    int rc;
+
+    rc = deflateSetDictionary (&estrm, dict, len);
+    if (rc != Z_OK) INTERR (deflateSetDictionary, rc);
+}
+
+void ZlibCodec::decbegin ()
+{
+    int rc;
+
+    if (dopen) rc = inflateReset (&dstrm);
+    else {
+        rc = inflateInit (&dstrm);
+        dopen = true;
+    }
+    if (rc != Z_OK) INTERR (inflateInit, rc);
+}
+
+int ZlibCodec::decode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen)
+{
+    int rc;
+
+    dstrm.next_in   = (Bytef *) *in;
+    dstrm.avail_in  = *inlen;
+    dstrm.next_out  = *out;
+    dstrm.avail_out = *outlen;
+    rc = inflate (&dstrm, Z_SYNC_FLUSH);
+    *in     = dstrm.next_in;
+    *inlen  = dstrm.avail_in;
+    *out    = dstrm.next_out;
+    *outlen = dstrm.avail_out;
+    if (rc == Z_STREAM_END) return 1;
+    if (rc == Z_NEED_DICT) return 2;
+    if ((rc == Z_OK) || (rc == Z_BUF_ERROR)) return 0;  // Z_BUF_ERROR: no progress, needs more input or output space
+    fprintf (stderr, "ftbackup: inflate() error %d\n", rc);
+    return -1;
+}
+
+bool ZlibCodec::decdict (uint8_T const *dict, uint32_T len)
+{
+    int rc;
+
+    rc = inflateSetDictionary (&dstrm, dict, len);
+    if (rc == Z_OK) return true;
+    fprintf (stderr, "ftbackup: inflateSetDictionary() error %d\n", rc);
+    return false;
+}
+
+/**
+ * @brief With libdeflate, whole runs are done by it instead of zlib.  It makes plain
+ *        zlib format streams just like zlib does, only faster.  Level 0 (stored) and
+ *        runs primed with a dictionary still go through zlib.
+ */
+bool ZlibCodec::encwhole (uint8_T const *in, uint32_T inlen, uint8_T *out, uint32_T *outlen)
+{
+#ifdef HAVE_LIBDEFLATE
+    size_t rc;
+
+    if (!wholeruns || (level == 0)) return false;
+    if (lcomp == NULL) {
+        lcomp = libdeflate_alloc_compressor ((level < 0) ? 6 : level);
+        if (lcomp == NULL) NOMEM ();
+    }
+    rc = libdeflate_zlib_compress (lcomp, in, inlen, out, *outlen);
+    if (rc == 0) return false;
+    *outlen = rc;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ZlibCodec::decwhole (uint8_T const *in, uint32_T inlen, uint32_T *inused, uint8_T *out, uint32_T outlen)
+{
+#ifdef HAVE_LIBDEFLATE
+    size_t used;
+
+    if (!wholeruns) return false;
+    if (ldecomp == NULL) {
+        ldecomp = libdeflate_alloc_decompressor ();
+        if (ldecomp == NULL) NOMEM ();
+    }
+    if (libdeflate_zlib_decompress_ex (ldecomp, in, inlen, out, outlen, &used, NULL) != LIBDEFLATE_SUCCESS) return false;
+    *inused = used;
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * @brief zstd codec, each run is one zstd frame.
+ */
+struct ZstdCodec : Codec {
+    ZstdCodec (int level);
+    ~ZstdCodec ();
+
+    virtual void encbegin ();
+    virtual bool encode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen, bool end);
+    virtual uint32_T encbound (uint32_T inlen);
+    virtual void decbegin ();
+    virtual int decode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen);
+
+private:
+    int level;
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+};
+
+ZstdCodec::ZstdCodec (int level)
+{
+    this->level = level;
+    cctx = NULL;
+    dctx = NULL;
+}
+
+ZstdCodec::~ZstdCodec ()
+{
+    if (cctx != NULL) ZSTD_freeCCtx (cctx);
+    if (dctx != NULL) ZSTD_freeDCtx (dctx);
+}
+
+void ZstdCodec::encbegin ()
+{
+    size_t rc;
+
+    if (cctx == NULL) {
+        cctx = ZSTD_createCCtx ();
+        if (cctx == NULL) NOMEM ();
+        rc = ZSTD_CCtx_setParameter (cctx, ZSTD_c_compressionLevel, level);
+        if (ZSTD_isError (rc)) {
+            fprintf (stderr, "ftbackup: ZSTD_CCtx_setParameter() error: %s\n", ZSTD_getErrorName (rc));
+            abort ();
+        }
+    }
+    ZSTD_CCtx_reset (cctx, ZSTD_reset_session_only);
+}
+
+bool ZstdCodec::encode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen, bool end)
+{
+    size_t rc;
+    ZSTD_inBuffer ib;
+    ZSTD_outBuffer ob;
+
+    if (!end && (*inlen == 0)) return false;
+
+    ib.src  = *in;
+    ib.size = *inlen;
+    ib.pos  = 0;
+    ob.dst  = *out;
+    ob.size = *outlen;
+    ob.pos  = 0;
+    rc = ZSTD_compressStream2 (cctx, &ob, &ib, end ? ZSTD_e_end : ZSTD_e_continue);
+    if (ZSTD_isError (rc)) {
+        fprintf (stderr, "ftbackup: ZSTD_compressStream2() error: %s\n", ZSTD_getErrorName (rc));
+        abort ();
+    }
+    *in     += ib.pos;
+    *inlen  -= ib.pos;
+    *out    += ob.pos;
+    *outlen -= ob.pos;
+    return end && (rc == 0);
+}
+
+uint32_T ZstdCodec::encbound (uint32_T inlen)
+{
+    return ZSTD_compressBound (inlen);
+}
+
+void ZstdCodec::decbegin ()
+{
+    if (dctx == NULL) {
+        dctx = ZSTD_createDCtx ();
+        if (dctx == NULL) NOMEM ();
+    }
+    ZSTD_DCtx_reset (dctx, ZSTD_reset_session_only);
+}
+
+int ZstdCodec::decode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen)
+{
+    size_t rc;
+    ZSTD_inBuffer ib;
+    ZSTD_outBuffer ob;
+
+    ib.src  = *in;
+    ib.size = *inlen;
+    ib.pos  = 0;
+    ob.dst  = *out;
+    ob.size = *outlen;
+    ob.pos  = 0;
+    rc = ZSTD_decompressStream (dctx, &ob, &ib);
+    *in     += ib.pos;
+    *inlen  -= ib.pos;
+    *out    += ob.pos;
+    *outlen -= ob.pos;
+    if (ZSTD_isError (rc)) {
+        fprintf (stderr, "ftbackup: ZSTD_decompressStream() error: %s\n", ZSTD_getErrorName (rc));
+        return -1;
+    }
+    return rc == 0;
+}
+#endif
+
+#ifdef HAVE_LZ4
+/**
+ * @brief lz4 codec, each run is one lz4 frame.
+ *        The lz4 frame functions want room for a whole compressed block,
+ *        so compress to a staging buffer and copy out from there.
+ */
+#define LZ4_INCHUNK 65536   // most bytes given to LZ4F_compressUpdate() at once
+
+struct Lz4Codec : Codec {
+    Lz4Codec (int level);
+    ~Lz4Codec ();
+
+    virtual void encbegin ();
+    virtual bool encode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen, bool end);
+    virtual uint32_T encbound (uint32_T inlen);
+    virtual void decbegin ();
+    virtual int decode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen);
+
+private:
+    bool begun;             // frame header has been staged
+    bool ended;             // frame end mark has been staged
+    LZ4F_cctx *cctx;
+    LZ4F_dctx *dctx;
+    LZ4F_preferences_t prefs;
+    uint8_T *stage;         // compressed data waiting to be copied out
+    uint32_T stagelen;      // number of bytes in stage
+    uint32_T stagepos;      // number of those bytes already copied out
+    uint32_T stagesize;     // number of bytes malloc()d for stage
+};
+
+Lz4Codec::Lz4Codec (int level)
+{
+    memset (&prefs, 0, sizeof prefs);
+    prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs.compressionLevel = level;
+    prefs.autoFlush = 1;
+    begun     = false;
+    ended     = false;
+    cctx      = NULL;
+    dctx      = NULL;
+    stage     = NULL;
+    stagelen  = 0;
+    stagepos  = 0;
+    stagesize = 0;
+}
+
+Lz4Codec::~Lz4Codec ()
+{
+    if (cctx != NULL) LZ4F_freeCompressionContext (cctx);
+    if (dctx != NULL) LZ4F_freeDecompressionContext (dctx);
+    free (stage);
+}
+
+void Lz4Codec::encbegin ()
+{
+    size_t rc;
+
+    if (cctx == NULL) {
+        rc = LZ4F_createCompressionContext (&cctx, LZ4F_VERSION);
+        if (LZ4F_isError (rc)) {
+            fprintf (stderr, "ftbackup: LZ4F_createCompressionContext() error: %s\n", LZ4F_getErrorName (rc));
+            abort ();
+        }
+        stagesize = LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound (LZ4_INCHUNK, &prefs);
+        stage = (uint8_T *) malloc (stagesize);
+        if (stage == NULL) NOMEM ();
+    }
+    begun    = false;
+    ended    = false;
+    stagelen = 0;
+    stagepos = 0;
+}
+
+bool Lz4Codec::encode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen, bool end)
+{
+    size_t rc;
+    uint32_T len;
+
+    while (true) {
+
+        // copy out whatever is staged
+        if (stagepos < stagelen) {
+            len = stagelen - stagepos;
+            if (len > *outlen) len = *outlen;
+            memcpy (*out, stage + stagepos, len);
+            *out     += len;
+            *outlen  -= len;
+            stagepos += len;
+            if (stagepos < stagelen) return false;
+        }
+        stagelen = stagepos = 0;
+
+        // stage more, header first, then data, then end mark
+        if (!begun) {
+            rc = LZ4F_compressBegin (cctx, stage, stagesize, &prefs);
+            begun = true;
+        } else if (*inlen > 0) {
+            len = *inlen;
+            if (len > LZ4_INCHUNK) len = LZ4_INCHUNK;
+            rc = LZ4F_compressUpdate (cctx, stage, stagesize, *in, len, NULL);
+            *in    += len;
+            *inlen -= len;
+        } else if (end && !ended) {
+            rc = LZ4F_compressEnd (cctx, stage, stagesize, NULL);
+            ended = true;
+        } else {
+            return ended;
+        }
+        if (LZ4F_isError (rc)) {
+            fprintf (stderr, "ftbackup: LZ4F_compress() error: %s\n", LZ4F_getErrorName (rc));
+            abort ();
+        }
+        stagelen = rc;
+        if (*outlen == 0) return false;
+    }
+}
+
+uint32_T Lz4Codec::encbound (uint32_T inlen)
+{
+    return LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound (inlen, &prefs);
+}
+
+void Lz4Codec::decbegin ()
+{
+    size_t rc;
+
+    if (dctx == NULL) {
+        rc = LZ4F_createDecompressionContext (&dctx, LZ4F_VERSION);
+        if (LZ4F_isError (rc)) {
+            fprintf (stderr, "ftbackup: LZ4F_createDecompressionContext() error: %s\n", LZ4F_getErrorName (rc));
+            abort ();
+        }
+    }
+    LZ4F_resetDecompressionContext (dctx);
+}
+
+int Lz4Codec::decode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen)
+{
+    size_t dstlen, rc, srclen;
+
+    dstlen = *outlen;
+    srclen = *inlen;
+    rc = LZ4F_decompress (dctx, *out, &dstlen, *in, &srclen, NULL);
+    *in     += srclen;
+    *inlen  -= srclen;
+    *out    += dstlen;
+    *outlen -= dstlen;
+    if (LZ4F_isError (rc)) {
+        fprintf (stderr, "ftbackup: LZ4F_decompress() error: %s\n", LZ4F_getErrorName (rc));
+        return -1;
+    }
+    return rc == 0;
+}
+#endif
+
+/**
+ * @brief Create a codec.
+ * @param type = CODEC_ZLIB, CODEC_ZSTD or CODEC_LZ4
+ * @param level = compression level, CODEC_DEFLEVEL for codec's default
+ * @returns NULL: codec not built in
+ *          else: codec
+ */
+Codec *Codec::create (int type, int level)
+{
+    switch (type) {
+        case CODEC_ZLIB: {
+            return new ZlibCodec ((level == CODEC_DEFLEVEL) ? Z_DEFAULT_COMPRESSION : level);
+        }
+#ifdef HAVE_ZSTD
+        case CODEC_ZSTD: {
+            return new ZstdCodec ((level == CODEC_DEFLEVEL) ? ZSTD_CLEVEL_DEFAULT : level);
+        }
+#endif
+#ifdef HAVE_LZ4
+        case CODEC_LZ4: {
+            return new Lz4Codec ((level == CODEC_DEFLEVEL) ? 0 : level);
+        }
+#endif
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get which codec a compressed run was written with.
+ * @param firstbyte = first byte of the run
+ * @returns -1: not a known codec
+ *        else: CODEC_ZLIB, CODEC_ZSTD or CODEC_LZ4
+ */
+int Codec::sniff (uint8_T firstbyte)
+{
+    switch (firstbyte) {
+        case 0x78: return CODEC_ZLIB;
+        case 0x28: return CODEC_ZSTD;
+        case 0x04: return CODEC_LZ4;
+    }
+    return -1;
+}
+
+char const *Codec::name (int type)
+{
+    switch (type) {
+        case CODEC_ZLIB: return "zlib";
+        case CODEC_ZSTD: return "zstd";
+        case CODEC_LZ4:  return "lz4";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Append data to the end of the dictionary, keeping just the last CODEC_DICTSIZE bytes.
+ */
+void CodecDict::append (void const *data, uint32_T n)
+{
+    uint32_T keep;
+
+    if (n >= CODEC_DICTSIZE) {
+        memcpy (buf, (uint8_T const *) data + n - CODEC_DICTSIZE, CODEC_DICTSIZE);
+        len = end = CODEC_DICTSIZE;
+        return;
+    }
+
+    // if no room after what we have, shift what is still needed down to the beginning
+    if (end + n > sizeof buf) {
+        keep = CODEC_DICTSIZE - n;
+        if (keep > len) keep = len;
+        memmove (buf, buf + end - keep, keep);
+        len = end = keep;
+    }
+
+    memcpy (buf + end, data, n);
+    end += n;
+    len += n;
+    if (len > CODEC_DICTSIZE) len = CODEC_DICTSIZE;
+}
+
+/**
+ * @brief Decode -compress <codec>[:<level>] argument.
+ * @returns true: *codec_r,*level_r filled in
+ *         false: error message printed
+ */
+static bool decodecompress (char const *arg, int *codec_r, int *level_r)
+{
+    char const *lvl;
+    char *p;
+    Codec *codec;
+    int codectype, i, level, namelen;
+
+    static struct {
+        char const *name;
+        int codec;
+        int minlevel;
+        int maxlevel;
+    } const codecnames[] = {
+        { "zlib", CODEC_ZLIB, 0,  9 },
+        { "zstd", CODEC_ZSTD, 1, 22 },
+        { "lz4",  CODEC_LZ4,  0, 12 },
+        { "none", CODEC_ZLIB, 0,  0 }
+    };
+
+    lvl = strchr (arg, ':');
+    namelen = (lvl == NULL) ? strlen (arg) : lvl - arg;
+    for (i = 0; i < (int) (sizeof codecnames / sizeof codecnames[0]); i ++) {
+        if ((strlen (codecnames[i].name) == (size_t) namelen) && (strncasecmp (codecnames[i].name, arg, namelen) == 0)) break;
+    }
+    if (i >= (int) (sizeof codecnames / sizeof codecnames[0])) {
+        fprintf (stderr, "ftbackup: unknown compression codec %s\n", arg);
+        return false;
+    }
+    codectype = codecnames[i].codec;
+
+    // none is zlib level 0, ie, stored deflate blocks, so old restores can still read it
+    level = (codecnames[i].maxlevel == 0) ? 0 : CODEC_DEFLEVEL;
+    if (lvl != NULL) {
+        level = strtol (++ lvl, &p, 0);
+        if ((*lvl == 0) || (*p != 0) || (level < codecnames[i].minlevel) || (level > codecnames[i].maxlevel)) {
+            fprintf (stderr, "ftbackup: %s level %s must be integer in range %d..%d\n",
+                    codecnames[i].name, lvl, codecnames[i].minlevel, codecnames[i].maxlevel);
+            return false;
+        }
+    }
+
+    codec = Codec::create (codectype, level);
+    if (codec == NULL) {
+        fprintf (stderr, "ftbackup: %s compression not built in\n", codecnames[i].name);
+        return false;
+    }
+    delete codec;
+
+    *codec_r = codectype;
+    *level_r = level;
+    return true;
+}
+
+static void usagecipherargs (char const *decenc)
+{
+    fprintf (stderr, "    -%s [:<cipher>] [:<hasher>] <keyspec>\n", decenc);
+    fprintf (stderr, "                            cipher = block cipher algorithm (default %s)\n", DEF_CIPHERNAME);
+    fprintf (stderr, "                            hasher = key hasher algorithm (default %s)\n", DEF_HASHERNAME);
+    fprintf (stderr, "                           keyspec = - : prompt at stdin\n");
+    fprintf (stderr, "                             @filename : read from first line of file\n");
+    fprintf (stderr, "                                  else : literal string\n");
+
+    fprintf (stderr, "              cipher algorithms:"
+#define _CIPHOP(Name) " " #Name
+    CIPHLIST
+#undef _CIPHOP
+    "\n");
+
+    fprintf (stderr, "              hasher algorithms:"
+#define _HASHOP(Name) " " #Name
+    HASHLIST
+#undef _HASHOP
+    "\n");
+}
+
+static bool readpasswd (char const *prompt, char *pwbuff, size_t pwsize)
+{
+    int promptlen, rc, ttyfd;
+    struct termios nflags, oflags;
+
+    ttyfd = open ("/dev/tty", O_RDWR | O_NOCTTY);
+    if (ttyfd < 0) {
+        fprintf (stderr, "open(/dev/tty) error: %s\n", mystrerr (errno));
+        return false;
+    }
+
+    if (tcgetattr (ttyfd, &oflags) < 0) {
+        fprintf (stderr, "tcgetattr(/dev/tty) error: %s\n", mystrerr (errno));
+        goto err2;
+    }
+
+    nflags = oflags;
+    nflags.c_lflag &= ~ECHO;
+    nflags.c_lflag |= ECHONL;
+
+    if (tcsetattr (ttyfd, TCSANOW, &nflags) < 0) {
+        fprintf (stderr, "tcsetattr(/dev/tty) error: %s\n", mystrerr (errno));
+        goto err2;
+    }
+
+    promptlen = strlen (prompt);
+    do {
+        rc = write (ttyfd, prompt, promptlen);
+        if (rc < promptlen) {
+            if (rc >= 0) errno = MYENDOFILE;
+            fprintf (stderr, "write(/dev/tty) error: %s\n", mystrerr (errno));
+            goto err1;
+        }
+        rc = read (ttyfd, pwbuff, pwsize);
+        if (rc <= 0) {
+            if (rc == 0) errno = MYENDOFILE;
+            fprintf (stderr, "read(/dev/tty) error: %s\n", mystrerr (errno));
+            goto err1;
+        }
+    } while ((rc == 1) || (pwbuff[rc-1] != '\n'));
+
+    pwbuff[--rc] = 0;
+
+    if (tcsetattr (ttyfd, TCSANOW, &oflags) < 0) {
+        fprintf (stderr, "tcsetattr(/dev/tty) error: %s\n", mystrerr (errno));
+        goto err2;
+    }
+
+    close (ttyfd);
+    return true;
+
+err1:
+    tcsetattr (ttyfd, TCSANOW, &oflags);
+err2:
+    close (ttyfd);
+    return false;
+}
+
+char const *mystrerr (int err)
+{
+    if (err == MYEDATACMP) return "data compare mismatch";
+    if (err == MYESIMRDER) return "simulated read error";
+    if (err == MYENDOFILE) return "end of file";
+    return strerror (err);
+}
+
+/**
+ * @brief Find out how many chars at beginning of string are not wildcard.
  * @param wild = wildcard
  * @returns number of chars at beginning of wildcard
  */
@@ -2635,73 +4462,101 @@ bool wildcardchar (char c)
     return (c == '*') || (c == '?') || (c == '[');
 }
 
+WildMatcher::WildMatcher ()
+{
+    elems     = NULL;
+    dfaaccept = NULL;
+    dfatrans  = NULL;
+    dfahash   = NULL;
+    dfasets   = NULL;
+    tmpset    = NULL;
+    nelems    = 0;
+    elemsize  = 0;
+    nwilds    = 0;
+    nclasses  = 0;
+    nsets     = 0;
+    ndfa      = 0;
+    maxstates = 0;
+    hashmask  = 0;
+}
+
+WildMatcher::~WildMatcher ()
+{
+    free (elems);
+    free (dfaaccept);
+    free (dfatrans);
+    free (dfahash);
+    free (dfasets);
+    free (tmpset);
+}
+
 /**
- * @brief Match a filename against a wildcard.
- * @param wild = wildcard to match
- * @param name = filename to match
- * @returns true: filename is matched by wildcard
- *         false: does not match
+ * @brief Add a wildcard to the set.
+ * @param wild = wildcard to add
+ * @returns index of the wildcard, as returned by match()
  */
-bool wildcardmatch (char const *wild, char const *name)
+int WildMatcher::add (char const *wild)
 {
-    bool match, notflag, supa;
-    char nc, wc, wc2;
-    int i, j, k, nmend, wcend;
+    bool notflag, supa;
+    char wc, wc2;
+    int b, i, wcend;
+    WildElem *elem;
+
+    /*
+     * Any DFA states built so far don't know about this wildcard.
+     */
+    maxstates = 0;
+    ndfa = 0;
 
     i = 0;
-    j = 0;
     wcend = strlen (wild);
-    nmend = strlen (name);
+    do {
+        if (nelems >= elemsize) {
+            elemsize += elemsize / 2 + 16;
+            elems = (WildElem *) realloc (elems, elemsize * sizeof *elems);
+            if (elems == NULL) NOMEM ();
+        }
+        elem = &elems[nelems++];
+        memset (elem, 0, sizeof *elem);
 
-    // keep going as long as there are wildcard chars to match
-    while (i < wcend) {
+        // end of wildcard, name must end here too
+        if (i >= wcend) {
+            elem->kind    = WE_FINAL;
+            elem->wildidx = nwilds;
+            break;
+        }
+
+        elem->kind = WE_CHAR;
         wc = wild[i];
 
-        // '*' matches any number of (including zero) chars from name
+        // '*' matches any number of chars excluding '/', '**' including '/'
         if (wc == '*') {
-
-            // skip over all the '*'s in a row in wildcard
-            // '**' matches chars including '/' from name (supa = true)
-            // '*' matches chars excluding '/' from name (supa = false)
             supa = false;
             while ((++ i < wcend) && (wild[i] == '*')) {
                 supa = true;
             }
-
-            // optimization: if no more '*'s or '['s in wildcard, then match the end of both strings.
-            if ((strchr (wild + i, '*') == NULL) &&
-                (strchr (wild + i, '[') == NULL) &&
-                (strchr (wild + i, '\\') == NULL)) {
-                k = nmend - (wcend - i);
-                if (j > k) return false;
-                if (!supa && (memchr (name + j, '/', k - j) != NULL)) return false;
-                return wildcardmatch (wild + i, name + k);
-            }
-
-            // try matching what's left of name with what's left in wildcard.
-            // take one char at a time from name and try to match.
-            // take '/' from name iff supa mode.
-            while (!wildcardmatch (wild + i, name + j)) {
-                if (++ j >= nmend) return false;
-                if (!supa && (name[j-1] == '/')) return false;
-            }
-            return true;
+            elem->kind = WE_STAR;
+            memset (elem->bits, 0xFF, sizeof elem->bits);
+            if (!supa) elem->bits['/'/64] &= ~ (1ULL << ('/' % 64));
+            continue;
         }
 
-        // there's a wildcard char other than '*' to match
-        // if nothing left in name, it's no match
-        if (j >= nmend) return false;
-        nc = name[j];
+        // '?' matches any one char
+        if (wc == '?') {
+            memset (elem->bits, 0xFF, sizeof elem->bits);
+            i ++;
+            continue;
+        }
 
         // for [...], name char must match one of the ... chars
+        // a '[' or '[!' at end of wildcard leaves an empty set so nothing matches
         if (wc == '[') {
-            match = false;
             notflag = false;
-            if (++ i >= wcend) break;
+            if (++ i >= wcend) continue;
             wc = wild[i];
             if ((wc == '!') || (wc == '^')) {
                 notflag = true;
-                if (++ i >= wcend) break;
+                if (++ i >= wcend) continue;
                 wc = wild[i];
             }
             do {
@@ -2716,32 +4571,248 @@ bool wildcardmatch (char const *wild, char const *name)
                         if (++ i >= wcend) break;
                         wc2 = wild[i];
                     }
-                    match |= (nc >= wc) && (nc <= wc2);
+                    for (b = 0; b < 256; b ++) {
+                        if (((char) b >= wc) && ((char) b <= wc2)) elem->bits[b/64] |= 1ULL << (b % 64);
+                    }
                 } else {
-                    match |= (nc == wc);
+                    b = (uint8_T) wc;
+                    elem->bits[b/64] |= 1ULL << (b % 64);
                 }
                 if (++ i >= wcend) break;
                 wc = wild[i];
             } while (wc != ']');
-            if (!match ^ notflag) return false;
+            if (notflag) {
+                for (b = 0; b < 4; b ++) elem->bits[b] = ~ elem->bits[b];
+            }
+            i ++;
+            continue;
         }
 
-        // fail match if chars don't match
-        else if (wc != '?') {
-            if (wc == '\\') {
-                if (++ i >= wcend) break;
-                wc = wild[i];
-            }
+        // '\' takes next char literally, at end of wildcard leaves an empty set
+        if (wc == '\\') {
+            if (++ i >= wcend) continue;
+            wc = wild[i];
+        }
+        b = (uint8_T) wc;
+        elem->bits[b/64] |= 1ULL << (b % 64);
+        i ++;
+    } while (true);
+
+    return nwilds ++;
+}
+
+/**
+ * @brief Match a name against the wildcards.
+ * @param name = name to match
+ * @returns -1: no wildcard matches
+ *        else: index of lowest numbered wildcard that matches
+ */
+int WildMatcher::match (char const *name)
+{
+    int state;
+
+    state = run (name);
+    return ((state < 0) || (dfaaccept[state] < 0)) ? -1 : dfaaccept[state];
+}
 
-            if (nc != wc) return false;
+/**
+ * @brief See if any of the wildcards might match a name beginning with the given string.
+ * @param prefix = beginning of name
+ * @returns true: some name beginning with prefix might be matched
+ *         false: no name beginning with prefix can be matched
+ */
+bool WildMatcher::canmatch (char const *prefix)
+{
+    return run (prefix) >= 0;
+}
+
+/**
+ * @brief Run the DFA over a string.
+ * @param str = string to run over
+ * @returns -1: no wildcard can match the string or anything beginning with it
+ *        else: DFA state at end of string
+ */
+int WildMatcher::run (char const *str)
+{
+    int next, state;
+    uint8_T c;
+
+    if (nwilds == 0) return -1;
+    if (maxstates == 0) compile ();
+
+    state = 0;
+    while ((c = *(str ++)) != 0) {
+        next = dfatrans[state*nclasses+classes[c]];
+        if (next < 0) next = step (state, c);
+        if (dfaaccept[next] < -1) return -1;
+        state = next;
+    }
+    return state;
+}
+
+/**
+ * @brief Set up tables for building DFA states from the wildcards' elements.
+ */
+void WildMatcher::compile ()
+{
+    int b, e, i, key, newclasses[512], statesize;
+    uint8_T inset;
+
+    /*
+     * Split the chars into classes that every element treats the same
+     * so the transition tables only need one entry per class.
+     */
+    memset (classes, 0, sizeof classes);
+    nclasses = 1;
+    for (e = 0; e < nelems; e ++) {
+        if (elems[e].kind == WE_FINAL) continue;
+        memset (newclasses, -1, nclasses * 2 * sizeof *newclasses);
+        i = 0;
+        for (b = 0; b < 256; b ++) {
+            inset = (elems[e].bits[b/64] >> (b % 64)) & 1;
+            key   = classes[b] * 2 + inset;
+            if (newclasses[key] < 0) newclasses[key] = i ++;
+            classes[b] = newclasses[key];
         }
+        nclasses = i;
+    }
 
-        // those chars match, on to next chars
-        i ++;
-        j ++;
+    /*
+     * Allocate room for as many DFA states as fit in the cache.
+     */
+    nsets     = (nelems + 63) / 64;
+    statesize = nsets * sizeof *dfasets + nclasses * sizeof *dfatrans + sizeof *dfaaccept;
+    maxstates = WM_MAXCACHE / statesize;
+    if (maxstates > WM_MAXSTATES) maxstates = WM_MAXSTATES;
+    if (maxstates < 16) maxstates = 16;
+    for (hashmask = 1; hashmask < maxstates * 2;) hashmask *= 2;
+    hashmask --;
+
+    dfaaccept = (int *) realloc (dfaaccept, maxstates * sizeof *dfaaccept);
+    dfatrans  = (int *) realloc (dfatrans, maxstates * nclasses * sizeof *dfatrans);
+    dfahash   = (int *) realloc (dfahash, (hashmask + 1) * sizeof *dfahash);
+    dfasets   = (uint64_T *) realloc (dfasets, maxstates * nsets * sizeof *dfasets);
+    tmpset    = (uint64_T *) realloc (tmpset, nsets * 2 * sizeof *tmpset);
+    if ((dfaaccept == NULL) || (dfatrans == NULL) || (dfahash == NULL) || (dfasets == NULL) || (tmpset == NULL)) NOMEM ();
+
+    flush ();
+}
+
+/**
+ * @brief Throw away all DFA states and make a new start state 0.
+ */
+void WildMatcher::flush ()
+{
+    int e;
+
+    ndfa = 0;
+    memset (dfahash, -1, (hashmask + 1) * sizeof *dfahash);
+
+    /*
+     * Start state is the first element of each wildcard.
+     * Build it in the second half of tmpset so step() can flush
+     * while holding on to the state it is trying to add.
+     */
+    memset (tmpset + nsets, 0, nsets * sizeof *tmpset);
+    for (e = 0; e < nelems; e ++) {
+        if ((e == 0) || (elems[e-1].kind == WE_FINAL)) closure (tmpset + nsets, e);
+    }
+    findstate (tmpset + nsets);
+}
+
+/**
+ * @brief Add an element to an NFA set, along with the elements after it that
+ *        can be reached without matching a char, ie, skipping over '*'s.
+ */
+void WildMatcher::closure (uint64_T *set, int e)
+{
+    do set[e/64] |= 1ULL << (e % 64);
+    while (elems[e++].kind == WE_STAR);
+}
+
+/**
+ * @brief Find the DFA state for an NFA set, creating it if not there.
+ * @returns index of DFA state, else -1 if no room to create it
+ */
+int WildMatcher::findstate (uint64_T const *set)
+{
+    int accept, e, i, state;
+    uint32_T h;
+    uint64_T hash, w;
+
+    hash = 0;
+    for (i = 0; i < nsets; i ++) {
+        hash = (hash ^ set[i]) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+
+    for (h = hash;; h ++) {
+        state = dfahash[h&hashmask];
+        if (state < 0) break;
+        if (memcmp (&dfasets[state*nsets], set, nsets * sizeof *set) == 0) return state;
+    }
+    if (ndfa >= maxstates) return -1;
+
+    /*
+     * Lowest numbered wildcard whose WE_FINAL is in the set is the match.
+     * An empty set means nothing can ever match from here on.
+     */
+    accept = -2;
+    for (i = 0; i < nsets; i ++) {
+        if (set[i] != 0) {
+            accept = -1;
+            for (w = set[i]; w != 0; w &= w - 1) {
+                e = i * 64 + __builtin_ctzll (w);
+                if (elems[e].kind == WE_FINAL) {
+                    accept = elems[e].wildidx;
+                    goto gotaccept;
+                }
+            }
+        }
     }
+gotaccept:
+
+    state = ndfa ++;
+    dfahash[h&hashmask] = state;
+    dfaaccept[state] = accept;
+    memset (&dfatrans[state*nclasses], -1, nclasses * sizeof *dfatrans);
+    memcpy (&dfasets[state*nsets], set, nsets * sizeof *set);
+    return state;
+}
 
-    return j >= nmend;
+/**
+ * @brief Build the DFA state reached from a state by matching a char.
+ * @param state = state being matched from
+ * @param c = next char of name
+ * @returns next state (state may have been flushed to make room)
+ */
+int WildMatcher::step (int state, uint8_T c)
+{
+    int e, i, kind, next;
+    uint64_T cbit, w;
+
+    cbit = 1ULL << (c % 64);
+    memset (tmpset, 0, nsets * sizeof *tmpset);
+    for (i = 0; i < nsets; i ++) {
+        for (w = dfasets[state*nsets+i]; w != 0; w &= w - 1) {
+            e = i * 64 + __builtin_ctzll (w);
+            kind = elems[e].kind;
+            if ((kind != WE_FINAL) && (elems[e].bits[c/64] & cbit)) {
+                closure (tmpset, (kind == WE_STAR) ? e : e + 1);
+            }
+        }
+    }
+
+    next = findstate (tmpset);
+    if (next >= 0) {
+        dfatrans[state*nclasses+classes[c]] = next;
+    } else {
+
+        // cache full, start over with just the start state and this one
+        flush ();
+        next = findstate (tmpset);
+    }
+    return next;
 }
 
 /**
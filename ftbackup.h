@@ -22,18 +22,32 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/xattr.h>
 #include <time.h>
 #include <unistd.h>
 #include <zlib.h>
 
+#if defined (__has_include)
+#if __has_include (<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
 #include "cryptopp/cryptlib.h"
 
 extern "C" {
@@ -61,6 +75,10 @@ extern "C" {
 
 #define BLOCK_MAGIC  "ftbackup"
 #define HEADER_MAGIC "ftbheder"
+#define CATALOG_MAGIC "ftbcatlg"
+#define MANIFEST_MAGIC "ftbmanifest"
+
+#define CFL_CHAINDICT 0x01  // saveset written with -chaindict, runs can't be decoded by themselves
 
 #define HFL_HDLINK 0x01  // regular file is an hardlink
 #define HFL_XATTRS 0x02  // xattrs follow name
@@ -109,6 +127,30 @@ struct Header {
     char        name[0];    // file name (incl null) and xattrs
 };
 
+struct CatalogHdr {
+    char        magic[8];   // magic number CATALOG_MAGIC
+    uint32_T    flags;      // flag bits
+};
+
+struct CatalogRec {
+    uint32_T    seqno;      // data block the file header starts in
+    uint32_T    hdroffs;    // offset of file header within that block
+    Header      hdr;        // file header, nameln is just the name (incl null), no xattrs
+};
+
+// one line of a -manifest file, in this order
+struct ManifestSeg {
+    uint32_T    segno;      // segment number on end of segment file name
+    uint64_T    size;       // bytes in segment file
+    uint32_T    firstseqno; // data blocks in segment file, 0,0 if none
+    uint32_T    lastseqno;
+    uint32_T    firstxorno; // XOR blocks in segment file, 0,0 if none
+    uint32_T    lastxorno;
+    uint32_T    crc;        // zlib crc32() of whole segment file
+    char       *name;       // segment file name without directory
+    bool        present;    // reader: segment file is there and the right size
+};
+
 struct HistFileRec {
     char path[DB_FILE_PATH_MAX];        // pathname of saved file
     uint64_T saves[DB_FILE_SAVE_MAX];   // timens_BE of savesets
@@ -127,6 +169,8 @@ struct FTBackup {
     CryptoPP::BlockCipher *decipher;
     CryptoPP::BlockCipher *encipher;
     CryptoPP::HashTransformation *hasher;
+    char const *ciphername;
+    char const *hashername;
     uint8_T *hashinibuf;
     uint32_T hashinilen;
 
@@ -138,6 +182,8 @@ struct FTBackup {
     bool blockbaseisvalid (Block *block);
     int decodecipherargs (int argc, char **argv, int i, bool enc);
     void maybesetdefaulthasher ();
+    CryptoPP::BlockCipher *newcipher (bool enc);
+    CryptoPP::HashTransformation *newhasher ();
     uint32_T hashsize ();
     static void xorblockdata (void *dst, void const *src, uint32_T nby);
 };
@@ -177,13 +223,394 @@ struct IFSAccess {
     virtual int fslsetxattr (char const *path, char const *name, void const *value, int size, int flags) =0;
 };
 
+/**
+ * @brief Minimal io_uring submission and completion rings using the raw system calls.
+ *        setup() fails with -ENOSYS if the kernel or the headers we were compiled
+ *        with don't support it, so the caller can fall back to plain system calls.
+ */
+struct IoRing {
+    IoRing ();
+    ~IoRing ();
+
+    int setup (uint32_T entries);
+    bool isopen () { return ringfd >= 0; }
+    bool prepread (int fd, void *buf, uint32_T len, uint64_T pos, uint64_T data);
+    bool prepwrite (int fd, void const *buf, uint32_T len, uint64_T pos, uint64_T data);
+    bool prepwritev (int fd, struct iovec const *iov, uint32_T niov, uint64_T pos, uint64_T data);
+    int submit (uint32_T waitfor);
+    bool getcqe (uint64_T *data, int *res);
+
+private:
+    int ringfd;
+    uint32_T sqentries;
+    uint32_T sqpending;     // entries prepared but not yet submitted
+    uint32_T *sqhead, *sqtail, *sqmask, *sqarray;
+    uint32_T *cqhead, *cqtail, *cqmask;
+    void *sqes, *cqes;
+    void *sqring, *cqring;
+    size_t sqringsize, cqringsize, sqessize;
+
+    IoRing (IoRing const &);
+    IoRing &operator= (IoRing const &);
+
+    bool prep (int opcode, int fd, void const *buf, uint32_T len, uint64_T pos, uint64_T data);
+};
+
+#define RQ_DEFDEPTH 4                   // default number of slots in a RingQueue
+#define RQ_MINDEPTH 2                   // minimum number of slots in a RingQueue
+#define RQ_MAXDEPTH 65536               // maximum number of slots in a RingQueue
+#define RQ_SPINS 256                    // times to retry before parking in enqueue() or dequeue()
+
+/**
+ * @brief Bounded lock-free queue.  Any number of threads may enqueue and dequeue.
+ *        Threads that find the queue full (or empty) spin a little then park
+ *        until a dequeue (or enqueue) wakes them.
+ */
+template <class T>
+struct RingQueue {
+    RingQueue ();
+    ~RingQueue ();
+    void setdepth (uint32_T n);
+    uint32_T getdepth () { return depth; }
+    void enqueue (T slot);
+    bool trydequeue (T *slot);
+    T dequeue ();
+
+private:
+    struct Cell {
+        uint64_T seq;   // == pos: cell empty, can be enqueued at position pos
+                        // == pos + 1: cell full, can be dequeued at position pos
+        T slot;
+    };
+
+    Cell *cells;
+    uint32_T depth;
+    uint32_T nparked;   // number of threads parked in enqueue() or dequeue()
+    pthread_cond_t  cond;
+    pthread_mutex_t mutex;
+
+    // producer and consumer positions in separate cache lines
+    uint8_T  pad0[64];
+    uint64_T enqpos;    // next position to enqueue to
+    uint8_T  pad1[64];
+    uint64_T deqpos;    // next position to dequeue from
+    uint8_T  pad2[64];
+
+    RingQueue (RingQueue const &);
+    RingQueue &operator= (RingQueue const &);
+
+    bool tryput (T slot);
+    bool tryget (T *slot);
+    void wakeparked ();
+};
+
+/**
+ * @brief Ring queue implementation.
+ *
+ *        Each cell's seq says which position may next use the cell.  It starts
+ *        out as the cell's index, is set to pos + 1 when the slot is filled at
+ *        position pos, then to pos + depth when the slot is emptied, ready for
+ *        the next time around.  Threads claim positions by incrementing enqpos
+ *        or deqpos with compare-and-swap.  There must be at least two slots so
+ *        a full cell's pos + 1 can't be mistaken for an empty cell's pos + depth.
+ */
+
+template <class T>
+RingQueue<T>::RingQueue ()
+{
+    cells   = NULL;
+    depth   = 0;
+    nparked = 0;
+    enqpos  = 0;
+    deqpos  = 0;
+    pthread_cond_init  (&cond,  NULL);
+    pthread_mutex_init (&mutex, NULL);
+    setdepth (RQ_DEFDEPTH);
+}
+
+template <class T>
+RingQueue<T>::~RingQueue ()
+{
+    free (cells);
+    pthread_cond_destroy  (&cond);
+    pthread_mutex_destroy (&mutex);
+}
+
+/**
+ * @brief Set number of slots in the queue, must be called while queue is empty
+ *        and no other thread is accessing it.
+ */
+template <class T>
+void RingQueue<T>::setdepth (uint32_T n)
+{
+    uint32_T i;
+
+    if ((enqpos != deqpos) || (n < RQ_MINDEPTH) || (n > RQ_MAXDEPTH)) abort ();
+    cells = (Cell *) realloc (cells, n * sizeof *cells);
+    if (cells == NULL) NOMEM ();
+    memset (cells, 0, n * sizeof *cells);
+    for (i = 0; i < n; i ++) {
+        cells[i].seq = i;
+    }
+    depth  = n;
+    enqpos = 0;
+    deqpos = 0;
+}
+
+template <class T>
+void RingQueue<T>::enqueue (T slot)
+{
+    bool ok;
+    uint32_T spins;
+
+    for (spins = 0; !tryput (slot); spins ++) {
+        if (spins < RQ_SPINS) {
+#ifdef __amd64__
+            asm volatile ("pause");
+#endif
+            continue;
+        }
+        pthread_mutex_lock (&mutex);
+        __atomic_add_fetch (&nparked, 1, __ATOMIC_SEQ_CST);
+        ok = tryput (slot);
+        if (!ok) pthread_cond_wait (&cond, &mutex);
+        __atomic_sub_fetch (&nparked, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock (&mutex);
+        if (ok) break;
+    }
+    wakeparked ();
+}
+
+template <class T>
+bool RingQueue<T>::trydequeue (T *slot)
+{
+    if (!tryget (slot)) return false;
+    wakeparked ();
+    return true;
+}
+
+template <class T>
+T RingQueue<T>::dequeue ()
+{
+    bool ok;
+    T slot;
+    uint32_T spins;
+
+    for (spins = 0; !tryget (&slot); spins ++) {
+        if (spins < RQ_SPINS) {
+#ifdef __amd64__
+            asm volatile ("pause");
+#endif
+            continue;
+        }
+        pthread_mutex_lock (&mutex);
+        __atomic_add_fetch (&nparked, 1, __ATOMIC_SEQ_CST);
+        ok = tryget (&slot);
+        if (!ok) pthread_cond_wait (&cond, &mutex);
+        __atomic_sub_fetch (&nparked, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock (&mutex);
+        if (ok) break;
+    }
+    wakeparked ();
+    return slot;
+}
+
+/**
+ * @brief Try to put slot in queue without waiting.
+ * @returns true: slot enqueued; false: queue full
+ */
+template <class T>
+bool RingQueue<T>::tryput (T slot)
+{
+    Cell *cell;
+    int64_t dif;
+    uint64_T pos, seq;
+
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    pos = __atomic_load_n (&enqpos, __ATOMIC_RELAXED);
+    while (true) {
+        cell = &cells[pos%depth];
+        seq  = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+        dif  = (int64_t) (seq - pos);
+        if (dif < 0) return false;
+        if (dif > 0) pos = __atomic_load_n (&enqpos, __ATOMIC_RELAXED);
+        else if (__atomic_compare_exchange_n (&enqpos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    }
+    cell->slot = slot;
+    __atomic_store_n (&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Try to get slot from queue without waiting.
+ * @returns true: slot dequeued; false: queue empty
+ */
+template <class T>
+bool RingQueue<T>::tryget (T *slot)
+{
+    Cell *cell;
+    int64_t dif;
+    uint64_T pos, seq;
+
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    pos = __atomic_load_n (&deqpos, __ATOMIC_RELAXED);
+    while (true) {
+        cell = &cells[pos%depth];
+        seq  = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+        dif  = (int64_t) (seq - (pos + 1));
+        if (dif < 0) return false;
+        if (dif > 0) pos = __atomic_load_n (&deqpos, __ATOMIC_RELAXED);
+        else if (__atomic_compare_exchange_n (&deqpos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    }
+    *slot = cell->slot;
+    __atomic_store_n (&cell->seq, pos + depth, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief An enqueue or dequeue was done, wake any threads parked waiting for one.
+ *        A thread parking increments nparked before its final try so either it
+ *        sees what we did or we see it parking.
+ */
+template <class T>
+void RingQueue<T>::wakeparked ()
+{
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&nparked, __ATOMIC_RELAXED) != 0) {
+        pthread_mutex_lock (&mutex);
+        pthread_cond_broadcast (&cond);
+        pthread_mutex_unlock (&mutex);
+    }
+}
+
+#define CODEC_ZLIB 0        // deflate with zlib header and trailer, run begins with 0x78
+#define CODEC_ZSTD 1        // zstd frame, run begins with 0x28
+#define CODEC_LZ4  2        // lz4 frame, run begins with 0x04
+#define CODEC_NUM  3
+#define CODEC_DEFLEVEL -1   // use codec's default compression level
+#define CODEC_DICTSIZE 32768 // most bytes of preceding data a run can be primed with
+
+/**
+ * @brief Compressor and decompressor for runs of compressed data in a saveset.
+ *        Each run is a complete stream that ends by itself and whose first byte
+ *        says which codec made it, so a saveset can mix codecs and old savesets
+ *        (all zlib) still read.
+ */
+struct Codec {
+    static Codec *create (int type, int level);
+    static int sniff (uint8_T firstbyte);
+    static char const *name (int type);
+
+    virtual ~Codec () { }
+
+    // start compressing a new run
+    // then compress as much as possible, returning when input is used up or output is full
+    // end = input is used up, finish the run; returns true when the run is complete
+    virtual void encbegin () =0;
+    virtual bool encode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen, bool end) =0;
+    virtual uint32_T encbound (uint32_T inlen) =0;
+
+    // prime the run just begun with data that preceded it (codecs that can't just ignore it)
+    virtual void encdict (uint8_T const *dict, uint32_T len) { }
+
+    // start decompressing a new run
+    // then decompress as much as possible
+    // returns 0: need more input or output space; 1: end of run; 2: call decdict(); -1: corrupt data (message printed)
+    virtual void decbegin () =0;
+    virtual int decode (uint8_T const **in, uint32_T *inlen, uint8_T **out, uint32_T *outlen) =0;
+
+    // give the run the same data it was primed with by encdict()
+    // returns false if it isn't the same (message printed)
+    virtual bool decdict (uint8_T const *dict, uint32_T len) { return false; }
+
+    // compress or decompress a run that is all in memory in one call, for codecs that can do it faster that way
+    // encwhole: *outlen = room at out on entry, compressed length on return
+    // decwhole: run must decompress to exactly outlen bytes, *inused = its compressed length
+    // both return false if the codec can't, nothing done, so use the calls above instead
+    virtual bool encwhole (uint8_T const *in, uint32_T inlen, uint8_T *out, uint32_T *outlen) { return false; }
+    virtual bool decwhole (uint8_T const *in, uint32_T inlen, uint32_T *inused, uint8_T *out, uint32_T outlen) { return false; }
+
+    static bool wholeruns;              // false: encwhole(), decwhole() always return false
+};
+
+/**
+ * @brief Last CODEC_DICTSIZE bytes of the data going through the codecs,
+ *        ie, what the next run gets primed with.
+ */
+struct CodecDict {
+    CodecDict () { reset (); }
+    void reset () { len = end = 0; }
+    void append (void const *data, uint32_T n);
+    uint8_T const *data () const { return buf + end - len; }
+
+    uint32_T len;                       // number of bytes, ending just before buf[end]
+    uint32_T end;
+    uint8_T buf[CODEC_DICTSIZE*2];      // slack so most appends don't have to shift
+};
+
+#define WE_CHAR  0          // WildMatcher element matching one char from its set
+#define WE_STAR  1          // WildMatcher element matching any number of chars from its set
+#define WE_FINAL 2          // WildMatcher element marking end of a wildcard
+#define WM_MAXSTATES 1024   // most WildMatcher DFA states cached before starting over
+#define WM_MAXCACHE (4*1024*1024)  // most bytes of WildMatcher DFA states cached
+
+/**
+ * @brief Set of wildcards compiled to match a name against all of them in one pass.
+ *        '*' matches any chars but '/', '**' matches any chars, '?' matches any char,
+ *        [...] and [!...] match a char from a set, '\' takes the next char literally.
+ *        The wildcards are compiled to an NFA whose DFA states are built as names are
+ *        matched and cached, so each name costs one table lookup per char.
+ *        Not thread safe as match() updates the cache.
+ */
+struct WildMatcher {
+    WildMatcher ();
+    ~WildMatcher ();
+
+    int add (char const *wild);
+    int match (char const *name);
+    bool canmatch (char const *prefix);
+    int count () { return nwilds; }
+
+private:
+    struct WildElem {
+        uint64_T bits[4];   // set of chars matched by this element
+        int      kind;      // WE_CHAR, WE_STAR or WE_FINAL
+        int      wildidx;   // WE_FINAL: index of wildcard matched
+    };
+
+    WildElem *elems;        // elements of all wildcards, each followed by a WE_FINAL
+    int *dfaaccept;         // per DFA state, lowest wildcard index matched, else -1
+    int *dfatrans;          // per DFA state and char class, next state, else -1 not computed yet
+    int *dfahash;           // hash table of DFA state indices, -1 for empty
+    uint64_T *dfasets;      // per DFA state, set of NFA elements it represents
+    uint64_T *tmpset;       // scratch set being built by step()
+    int nelems;
+    int elemsize;
+    int nwilds;
+    int nclasses;
+    int nsets;              // words per set in dfasets
+    int ndfa;               // number of DFA states built
+    int maxstates;          // number of DFA states there is room for
+    int hashmask;           // number of entries in dfahash minus one
+    uint8_T classes[256];   // char class each char belongs to
+
+    WildMatcher (WildMatcher const &);
+    WildMatcher &operator= (WildMatcher const &);
+
+    void compile ();
+    void flush ();
+    void closure (uint64_T *set, int e);
+    int findstate (uint64_T const *set);
+    int run (char const *str);
+    int step (int state, uint8_T c);
+};
+
 #define MYEDATACMP 632396223
 #define MYESIMRDER 632396224
 #define MYENDOFILE 632396225
 char const *mystrerr (int err);
 int wildcardlength (char const *wild);
 bool wildcardchar (char c);
-bool wildcardmatch (char const *wild, char const *name);
 int myalphasort (const struct dirent **a, const struct dirent **b);
 
 static inline uint64_T quadswab (uint64_T q)
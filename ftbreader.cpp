@@ -36,6 +36,19 @@ struct LostSSBlock {
     LostSSBlock (uint32_T sn) { seqno = sn; }
 };
 
+/**
+ * @brief Reader a -dthreads thread decodes its chunks of the saveset with.
+ *        It reads blocks just as the main reader would, only with its own file descriptor.
+ */
+struct FTBReader::PartReader : FTBReader {
+    virtual char const *select_file (Header const *hdr) { return FTBREADER_SELECT_SKIP; }
+};
+
+static __thread sigjmp_buf sigbusjmp;
+static __thread volatile sig_atomic_t sigbusarmed;
+
+static void sigbushand (int signum);
+static bool copy_mapped (uint8_T *dst, uint8_T const *src, uint32_T len);
 static uint32_T extpackeduint32 (char const **ptr);
 static uint32_T findnextsegno (char const *basename, uint32_T lastsegno);
 static void updatetimes (IFSAccess *ifsa, char const *name, uint64_T atimns, uint64_T mtimns);
@@ -43,10 +56,18 @@ static bool rmdirentry  (IFSAccess *ifsa, char const *dirname, char const *entna
 
 FTBReader::FTBReader ()
 {
+    opt_idirect   = false;
     opt_incrmntl  = false;
     opt_mkdirs    = false;
+    opt_mmap      = false;
     opt_overwrite = false;
+    opt_catalog   = NULL;
+    opt_manifest  = NULL;
+    opt_dthreads  = 0;
+    opt_rthreads  = 0;
+    opt_readahead = RX_DEFSIZE;
     opt_simrderrs = 0;
+    opt_wthreads  = 0;
 
     opt_verbose   = false;
     opt_verbsec   = 0;
@@ -56,18 +77,34 @@ FTBReader::FTBReader ()
     lastverbsec   = 0;
     lastxverbsec  = 0;
 
+    blkpool       = NULL;
+    blkwindow     = NULL;
+    curRBlock     = NULL;
     xorblocks     = NULL;
+    catrec        = NULL;
+    mansegs       = NULL;
+    blkseekable   = false;
+    manchecked    = false;
+    pdstop        = false;
     skipall       = false;
     wprwrite      = false;
     zisopen       = false;
     inodesname    = NULL;
     ssbasename    = NULL;
+    pdsegname     = NULL;
     sssegname     = NULL;
+    catfile       = NULL;
     wprfile       = NULL;
+    pdmain        = NULL;
+    pdhdr         = NULL;
     ssfd          = -1;
-    linkedBlocks  = NULL;
-    linkedRBlock  = NULL;
     memset (&ssstat, 0, sizeof ssstat);
+    blkpoolsize   = 0;
+    blkpoolused   = 0;
+    blkwinsize    = 0;
+    blkwinused    = 0;
+    catrecall     = 0;
+    mannsegs      = 0;
     inodessize    = 0;
     inodesused    = 0;
     lastfileno    = 0;
@@ -77,7 +114,58 @@ FTBReader::FTBReader ()
     pipepos       = 0;
     readoffset    = 0;
     gotxors       = NULL;
+    mapbase       = NULL;
+    mapsize       = 0;
+    rxbuf         = NULL;
+    rxalloc       = 0;
+    rxlen         = 0;
+    rxbadend      = 0;
+    rxpos         = 0;
     memset (&zstrm,  0, sizeof zstrm);
+    memset (decoders, 0, sizeof decoders);
+    deccodec      = NULL;
+    runfresh      = false;
+    segskipped    = false;
+    rdprompt      = false;
+    rdstop        = false;
+    rwfailed      = false;
+    rdprrc        = 0;
+    rdprerr       = 0;
+    rdprlen       = 0;
+    rdhandls      = NULL;
+    rdjobs        = NULL;
+    rdnjobs       = 0;
+    rdoldest      = 0;
+    rdprpos       = 0;
+    rdreadoffs    = 0;
+    rdprbuf       = NULL;
+    wjok          = true;
+    wjhandls      = NULL;
+    wjobs         = NULL;
+    wjnbufs       = 0;
+    wjnjobs       = 0;
+    pdjob         = NULL;
+    pdfilling     = false;
+    pdjobs        = NULL;
+    pdhandls      = NULL;
+    memset (&pdpiece, 0, sizeof pdpiece);
+    memset (&pdblock, 0, sizeof pdblock);
+    pdchunkblks   = 0;
+    pdhdrall      = 0;
+    pdhead        = 0;
+    pdlast        = 0;
+    pdnext        = 0;
+    pdnjobs       = 0;
+    pdpieceofs    = 0;
+    pdsegno       = 0;
+    pdmsgseqno    = 0;
+    pdmsgofs      = 0;
+    pthread_cond_init  (&pdcond,  NULL);
+    pthread_cond_init  (&rdcond,  NULL);
+    pthread_cond_init  (&wjcond,  NULL);
+    pthread_mutex_init (&pdmutex, NULL);
+    pthread_mutex_init (&rdmutex, NULL);
+    pthread_mutex_init (&wjmutex, NULL);
 }
 
 /**
@@ -85,9 +173,18 @@ FTBReader::FTBReader ()
  */
 FTBReader::~FTBReader ()
 {
-    LinkedBlock *linkedBlock;
     uint32_T i;
 
+    pdpool_stop ();
+    rdpipe_stop ();
+    wpool_stop ();
+    pthread_cond_destroy  (&pdcond);
+    pthread_cond_destroy  (&rdcond);
+    pthread_cond_destroy  (&wjcond);
+    pthread_mutex_destroy (&pdmutex);
+    pthread_mutex_destroy (&rdmutex);
+    pthread_mutex_destroy (&wjmutex);
+
     if (xorblocks != NULL) {
         for (i = 0; i < xorgc; i ++) {
             free (xorblocks[i]);
@@ -103,26 +200,62 @@ FTBReader::~FTBReader ()
     if (wprfile != NULL) {
         fclose (wprfile);
     }
+    if (catfile != NULL) {
+        fclose (catfile);
+    }
+    if (catrec != NULL) {
+        free (catrec);
+    }
+    if (pdhdr != NULL) {
+        free (pdhdr);
+    }
+    if (mansegs != NULL) {
+        for (i = 0; i < mannsegs; i ++) {
+            free (mansegs[i].name);
+        }
+        free (mansegs);
+    }
     if (ssfd >= 0) {
         close (ssfd);
     }
-    while ((linkedBlock = linkedBlocks) != NULL) {
-        linkedBlocks = linkedBlock->next;
-        free (linkedBlock);
+    if (blkwindow != NULL) {
+        for (i = 0; i < blkwinsize; i ++) {
+            if (!ismapped (blkwindow[i])) free (blkwindow[i]);
+        }
+        free (blkwindow);
+    }
+    if ((curRBlock != NULL) && !ismapped (curRBlock)) {
+        free (curRBlock);
+    }
+    if (mapbase != NULL) {
+        munmap (mapbase, mapsize);
     }
-    if (linkedRBlock != NULL) {
-        free (linkedRBlock);
+    if (blkpool != NULL) {
+        for (i = 0; i < blkpoolused; i ++) {
+            free (blkpool[i]);
+        }
+        free (blkpool);
     }
     if (gotxors != NULL) {
         free (gotxors);
     }
-    if (zisopen) {
-        zstrm.avail_out = 0;
-        zstrm.next_out  = NULL;
-        inflateEnd (&zstrm);
+    if (rxbuf != NULL) {
+        free (rxbuf);
+    }
+    for (i = 0; i < CODEC_NUM; i ++) {
+        delete decoders[i];
     }
 }
 
+/**
+ * @brief Say whether select_file() will skip the data of a regular file.
+ *        -dthreads threads call it so they can skip the data the way skip_data() does.
+ */
+bool FTBReader::skips_data (Header const *hdr)
+{
+    return false;
+}
+
 /**
  * @brief Read through saveset, listing and/or restoring all files therein.
  * @returns exit code
@@ -130,17 +263,18 @@ FTBReader::~FTBReader ()
 int FTBReader::read_saveset (char const *ssname)
 {
     Block *rblock;
-    bool fileopen, needhdr, ok, printnextgoodfile, setimes, thisok;
-    char const *dstname, *xattrsnameend, *xattrsnameptr, *xattrsvaluptr;
+    bool catsel, fileopen, needhdr, ok, printnextgoodfile, queued, setimes, thisok;
+    char const *dstname;
     char *lastfilenamefinished, *p;
     DirTime *dirTime, *dirTimes;
     Header *hdr;
     int cmp, ssnamelen;
-    uint32_T hassegno, hdrall, lastfilenofinished;
-    uint32_T skipped, xattrslistlen, xattrsvalulen;
+    uint32_T hassegno, hdrall, lastfilenofinished, skipped;
 
     maybesetdefaulthasher ();
 
+    if ((opt_manifest != NULL) && !manifest_load ()) return EX_SSIO;
+
     hdr    = (Header *) malloc (sizeof *hdr);
     hdrall = sizeof *hdr;
     if (hdr == NULL) NOMEM ();
@@ -176,7 +310,7 @@ int FTBReader::read_saveset (char const *ssname)
             ssbasename = p;
 
             // we must be able to open that specific file as given by the user
-            ssfd = open (ssname, O_RDONLY);
+            ssfd = open_saveset (ssname);
             if (ssfd < 0) {
                 fprintf (stderr, "ftbackup: open(%s) error: %s\n", ssname, mystrerr (errno));
                 return EX_SSIO;
@@ -185,7 +319,7 @@ int FTBReader::read_saveset (char const *ssname)
 
             // if no <digits>, the user could be saying to open that exact file
             // or for us to find the first segment file starting with that name
-            ssfd = open (ssname, O_RDONLY);
+            ssfd = open_saveset (ssname);
             if (ssfd >= 0) {
                 if (fstat (ssfd, &ssstat) < 0) SYSERRNO (fstat);
                 if (S_ISDIR (ssstat.st_mode)) {
@@ -208,7 +342,7 @@ int FTBReader::read_saveset (char const *ssname)
                 }
 
                 // the given name is not found, try opening <givenname><lowest-segno>
-                thissegno  = findnextsegno (ssname, 0);
+                thissegno  = next_segno (ssname, 0);
                 if (thissegno == 0) {
                     fprintf (stderr, "ftbackup: open(%s) error: %s\n", ssname, mystrerr (ENOENT));
                     return EX_SSIO;
@@ -216,7 +350,7 @@ int FTBReader::read_saveset (char const *ssname)
                 ssbasename = ssname;
                 sssegname  = (char *) alloca (ssnamelen + SEGNODECDIGS + 4);
                 sprintf (sssegname, "%s%.*u", ssname, SEGNODECDIGS, thissegno);
-                ssfd = open (sssegname, O_RDONLY);
+                ssfd = open_saveset (sssegname);
                 if (ssfd < 0) {
                     fprintf (stderr, "ftbackup: open(%s) error: %s\n", sssegname, mystrerr (errno));
                     return EX_SSIO;
@@ -227,6 +361,9 @@ int FTBReader::read_saveset (char const *ssname)
 
     if (fstat (ssfd, &ssstat) < 0) SYSERRNO (fstat);
 
+    if ((mansegs != NULL) && (thissegno != 0) && !manchecked) manifest_check (ssbasename);
+    if ((opt_catalog != NULL) && !catalog_open ()) return EX_SSIO;
+
     try {
         dirTimes = NULL;
         lastfilenamefinished = strdup ("");
@@ -234,6 +371,8 @@ int FTBReader::read_saveset (char const *ssname)
         needhdr = true;
         ok = true;
         printnextgoodfile = false;
+        if (opt_dthreads > 0) pdpool_start ();
+        if (opt_wthreads > 0) wpool_start ();
 
         while (true) {
             try {
@@ -243,7 +382,18 @@ int FTBReader::read_saveset (char const *ssname)
                  * It should have correct magic number and be next file in sequence.
                  */
                 fileopen = false;
+                catsel = false;
                 if (needhdr) {
+
+                    /*
+                     * With a catalog, find the next file selected without reading
+                     * the ones in between, and skip the saveset to its header.
+                     */
+                    if (catfile != NULL) {
+                        dstname = catalog_next ();
+                        if (dstname == FTBREADER_SELECT_DONE) break;
+                        catsel = (dstname != NULL);
+                    }
                     read_raw (hdr, (ulong_T)hdr->name - (ulong_T)hdr, false);
                     if (memcmp (hdr->magic, HEADER_MAGIC, 8) != 0) {
                         fprintf (stderr, "ftbackup: bad header magic number\n");
@@ -274,17 +424,26 @@ int FTBReader::read_saveset (char const *ssname)
 
                 /*
                  * See if file is selected and maybe output listing line.
+                 * If selected from the catalog, make sure it is the same file.
                  */
-                dstname = select_file (hdr);
-                if (dstname == FTBREADER_SELECT_DONE) break;
+                if (catsel) {
+                    if ((hdr->fileno != catrec->hdr.fileno) || (strcmp (hdr->name, catrec->hdr.name) != 0)) {
+                        fprintf (stderr, "ftbackup: catalog %s does not match saveset at file %u\n", opt_catalog, catrec->hdr.fileno);
+                        exit (EX_SSIO);
+                    }
+                } else {
+                    dstname = select_file (hdr);
+                    if (dstname == FTBREADER_SELECT_DONE) break;
+                }
 
                 /*
                  * If we won't be restoring anything more to a previous directory,
-                 * set its times.
+                 * set its times, once -wthreads threads are done with files in it.
                  */
                 while ((dstname != FTBREADER_SELECT_SKIP) && ((dirTime = dirTimes) != NULL) &&
                         (memcmp (dstname, dirTime->name, dirTime->nameln) > 0)) {
                     dirTimes = dirTime->next;
+                    wpool_wait (dirTime->name, dirTime->nameln);
                     updatetimes (tfs, dirTime->name, dirTime->atimns, dirTime->mtimns);
                     free (dirTime);
                 }
@@ -293,8 +452,9 @@ int FTBReader::read_saveset (char const *ssname)
                  * Call the processing function, skipping the data if not enabled.
                  */
                 fileopen = true;
+                queued = false;
                 setimes = false;
-                     if (S_ISREG (hdr->stmode)) thisok = read_regular   (hdr, dstname);
+                     if (S_ISREG (hdr->stmode)) thisok = read_regular   (hdr, dstname, &queued);
                 else if (S_ISDIR (hdr->stmode)) thisok = read_directory (hdr, dstname, &setimes);
                 else if (S_ISLNK (hdr->stmode)) thisok = read_symlink   (hdr, dstname);
                                            else thisok = read_special   (hdr, dstname);
@@ -310,13 +470,11 @@ int FTBReader::read_saveset (char const *ssname)
 
                 /*
                  * If restored successfully, try to set ownership, protection and times.
+                 * A -wthreads thread does that for a regular file once it has written it.
                  */
-                if (thisok && (dstname != FTBREADER_SELECT_SKIP)) {
-                    tfs->fslchown (dstname, hdr->ownuid, hdr->owngid);
-                    if (!S_ISLNK (hdr->stmode)) tfs->fschmod (dstname, hdr->stmode);
-                    if (!S_ISDIR (hdr->stmode)) {
-                        updatetimes (tfs, dstname, hdr->atimns, hdr->mtimns);
-                    } else if (setimes) {
+                if (thisok && !queued && (dstname != FTBREADER_SELECT_SKIP)) {
+                    ok &= restore_attrs (hdr, dstname);
+                    if (S_ISDIR (hdr->stmode) && setimes) {
                         cmp = strlen (dstname);
                         dirTime = (DirTime *) malloc (cmp + sizeof *dirTime);
                         if (dirTime == NULL) NOMEM ();
@@ -327,21 +485,6 @@ int FTBReader::read_saveset (char const *ssname)
                         strcpy (dirTime->name, dstname);
                         dirTimes = dirTime;
                     }
-                    if (hdr->flags & HFL_XATTRS) {
-                        xattrsnameptr = hdr->name + strlen (hdr->name) + 1;
-                        xattrslistlen = extpackeduint32 (&xattrsnameptr);
-                        xattrsvaluptr = xattrsnameend = xattrsnameptr + xattrslistlen;
-                        while (xattrsnameptr < xattrsnameend) {
-                            xattrsvalulen = extpackeduint32 (&xattrsvaluptr);
-                            if (tfs->fslsetxattr (dstname, xattrsnameptr, xattrsvaluptr, xattrsvalulen, 0) < 0) {
-                                fprintf (stderr, "ftbackup: lsetxattr(%s,%s) error: %s\n",
-                                        dstname, xattrsnameptr, strerror (errno));
-                                ok = false;
-                            }
-                            xattrsnameptr += strlen (xattrsnameptr) + 1;
-                            xattrsvaluptr += xattrsvalulen;
-                        }
-                    }
                 }
             } catch (LostSSBlock *lssb) {
                 delete lssb;
@@ -375,8 +518,13 @@ int FTBReader::read_saveset (char const *ssname)
         }
 
         /*
-         * Reached normal end of saveset, flush all pending directory time updates.
+         * Reached normal end of saveset, stop the -dthreads threads,
+         * wait for -wthreads threads to finish, then flush all pending
+         * directory time updates.
          */
+        pdpool_stop ();
+        wpool_stop ();
+        ok &= wjok;
         while ((dirTime = dirTimes) != NULL) {
             dirTimes = dirTime->next;
             updatetimes (tfs, dirTime->name, dirTime->atimns, dirTime->mtimns);
@@ -386,6 +534,7 @@ int FTBReader::read_saveset (char const *ssname)
         /*
          * All done.
          */
+        rdpipe_stop ();
         if (hdr != NULL) free (hdr);
         free (lastfilenamefinished);
         if (ssfd != STDIN_FILENO) {
@@ -399,6 +548,9 @@ int FTBReader::read_saveset (char const *ssname)
 
     } catch (EndOfSSFile *eossf) {
         delete eossf;
+        pdpool_stop ();
+        rdpipe_stop ();
+        wpool_stop ();
 
         /*
          * Got to end of saveset without seeing end mark.
@@ -421,30 +573,73 @@ static uint32_T extpackeduint32 (char const **ptr)
     return val;
 }
 
+/**
+ * @brief Set a restored file's ownership, protection, times and extended attributes.
+ * @param hdr = backup header
+ * @param dstname = where the file was restored to
+ * @returns true: success
+ *         false: error setting extended attributes
+ */
+bool FTBReader::restore_attrs (Header const *hdr, char const *dstname)
+{
+    bool ok;
+    char const *xattrsnameend, *xattrsnameptr, *xattrsvaluptr;
+    uint32_T xattrslistlen, xattrsvalulen;
+
+    ok = true;
+    tfs->fslchown (dstname, hdr->ownuid, hdr->owngid);
+    if (!S_ISLNK (hdr->stmode)) tfs->fschmod (dstname, hdr->stmode);
+    if (!S_ISDIR (hdr->stmode)) updatetimes (tfs, dstname, hdr->atimns, hdr->mtimns);
+    if (hdr->flags & HFL_XATTRS) {
+        xattrsnameptr = hdr->name + strlen (hdr->name) + 1;
+        xattrslistlen = extpackeduint32 (&xattrsnameptr);
+        xattrsvaluptr = xattrsnameend = xattrsnameptr + xattrslistlen;
+        while (xattrsnameptr < xattrsnameend) {
+            xattrsvalulen = extpackeduint32 (&xattrsvaluptr);
+            if (tfs->fslsetxattr (dstname, xattrsnameptr, xattrsvaluptr, xattrsvalulen, 0) < 0) {
+                fprintf (stderr, "ftbackup: lsetxattr(%s,%s) error: %s\n",
+                        dstname, xattrsnameptr, strerror (errno));
+                ok = false;
+            }
+            xattrsnameptr += strlen (xattrsnameptr) + 1;
+            xattrsvaluptr += xattrsvalulen;
+        }
+    }
+    return ok;
+}
+
 /**
  * @brief Restore a regular file's contents from the saveset.
+ *        With -wthreads, the file is handed to a thread that creates it,
+ *        writes the data as it is read here, then sets its attributes.
  * @param hdr = backup header
  * @param dstname = where to restore the regular file to
  *                  FTBREADER_SELECT_SKIP to skip file
- * @returns true: success
+ * @returns true: success (or queued to a -wthreads thread)
  *         false: error writing file
+ *         *queued = true: a -wthreads thread will set the attributes
  */
-bool FTBReader::read_regular (Header *hdr, char const *dstname)
+bool FTBReader::read_regular (Header *hdr, char const *dstname, bool *queued)
 {
     char *tmpname = NULL;
+    FileWrite fw;
     int fd, rc;
-    struct stat statbuf;
     time_t now;
-    uint32_T oldfileno, wofs;
+    uint32_T oldfileno;
     uint64_T len, rofs;
-    uint8_T buf[FILEIOSIZE];
+    uint8_T *buf, stkbuf[FILEIOSIZE];
+    WriteJob *job;
 
     /*
      * See if it's an hardlink to an earlier file in the saveset.
+     * A -wthreads thread might still be restoring that file.
      */
     if (hdr->flags & HFL_HDLINK) {
         read_raw (&oldfileno, sizeof oldfileno, false);
         if (dstname != FTBREADER_SELECT_SKIP) {
+            if ((oldfileno < inodesused) && (inodesname[oldfileno] != NULL)) {
+                wpool_wait (inodesname[oldfileno], strlen (inodesname[oldfileno]) + 1);
+            }
             if ((oldfileno >= inodesused) || (inodesname[oldfileno] == NULL)) {
                 fprintf (stderr, "ftbackup: hardlink %s missing old file %u\n", hdr->name, oldfileno);
                 return false;
@@ -462,24 +657,18 @@ bool FTBReader::read_regular (Header *hdr, char const *dstname)
     /*
      * Not an hardlink, create a temp file and put in list of hardlinkable files.
      */
-    if (dstname == FTBREADER_SELECT_SKIP) {
-        fd = -1;
-    } else {
-        tmpname = (char *) alloca (strlen (dstname) + 15);
-        sprintf (tmpname, "%s.$$ftbackup$$", dstname);
-        do_mkdirs (dstname);
-        fd = tfs->fscreat (dstname, tmpname, opt_overwrite, hdr->stmode);
-        if (fd < 0) {
-            fprintf (stderr, "ftbackup: creat(%s) error: %s\n", dstname, mystrerr (errno));
-        } else if (tfs->fsftruncate (fd, hdr->size) < 0) {
-            fprintf (stderr, "ftbackup: ftruncate(%s, %llu) error: %s\n", dstname, hdr->size, mystrerr (errno));
-            tfs->fsclose (fd);
-            fd = -1;
-        } else if (tfs->fsfstat (fd, &statbuf) < 0) {
-            fprintf (stderr, "ftbackup: fstat(%s) error: %s\n", dstname, mystrerr (errno));
-            tfs->fsclose (fd);
-            fd = -1;
+    fd  = -1;
+    job = NULL;
+    if (dstname != FTBREADER_SELECT_SKIP) {
+        if (wjobs != NULL) {
+            job = wpool_newjob (hdr, dstname);
+            *queued = true;
         } else {
+            tmpname = (char *) alloca (strlen (dstname) + 15);
+            sprintf (tmpname, "%s.$$ftbackup$$", dstname);
+            fd = creat_regular (hdr, dstname, tmpname);
+        }
+        if ((job != NULL) || (fd >= 0)) {
 
             /*
              * Enter in list of restored regular files in case there is
@@ -501,7 +690,11 @@ bool FTBReader::read_regular (Header *hdr, char const *dstname)
 
     /*
      * Read data from saveset and write to file.
+     * With -wthreads, the file's thread does the writing,
+     * else with -rthreads, the file writing thread does it.
      */
+    buf = stkbuf;
+    memset (&fw, 0, sizeof fw);
     try {
         for (rofs = 0; rofs < hdr->size; rofs += len) {
             now = time (NULL);
@@ -519,27 +712,70 @@ bool FTBReader::read_regular (Header *hdr, char const *dstname)
                     print_header (stderr, hdr, dstname, rofs);
                 }
             }
+            if ((dstname == FTBREADER_SELECT_SKIP) && skip_data ()) break;
             len = hdr->size - rofs;
-            if (len > sizeof buf) len = sizeof buf;
-            read_raw (buf, len, true);
-            if (fd >= 0) {
-                for (wofs = 0; wofs < len; wofs += rc) {
-                    rc = tfs->fswrite (fd, buf + wofs, len - wofs);
-                    if (rc <= 0) {
-                        fprintf (stderr, "ftbackup: write(%s) error: %s\n", dstname, ((rc == 0) ? "end of file" : mystrerr (errno)));
-                        tfs->fsclose (fd);
-                        fd = -1;
-                        break;
-                    }
+            if (len > sizeof stkbuf) len = sizeof stkbuf;
+            if (job != NULL) buf = wjbufqueue.dequeue ();
+            else if (rdjobs != NULL) buf = rwbufqueue.dequeue ();
+            if ((rofs > 0) || (len < hdr->size) || !read_whole (buf, len)) {
+                read_raw (buf, len, true);
+            }
+            if (job != NULL) {
+                fw.buf = buf;
+                fw.len = len;
+                job->dataqueue.enqueue (fw);
+                buf = stkbuf;
+            } else if (buf != stkbuf) {
+                if ((fd >= 0) && !__atomic_load_n (&rwfailed, __ATOMIC_ACQUIRE)) {
+                    fw.buf  = buf;
+                    fw.len  = len;
+                    fw.fd   = fd;
+                    fw.name = dstname;
+                    rwritequeue.enqueue (fw);
+                } else {
+                    rwbufqueue.enqueue (buf);
                 }
+                buf = stkbuf;
+            } else if (fd >= 0) {
+                fd = write_regular (fd, buf, len, dstname);
             }
         }
 
+        /*
+         * Tell the file's thread it has all the data.
+         */
+        if (job != NULL) {
+            fw.buf = NULL;
+            fw.len = 0;
+            job->dataqueue.enqueue (fw);
+            return true;
+        }
+
+        /*
+         * Wait for file writing thread to finish with it.
+         */
+        if (!rwrite_drain () && (fd >= 0)) {
+            tfs->fsclose (fd);
+            fd = -1;
+        }
+
     } catch (...) {
 
         /*
          * Warn that file is corrupted cuz of unrecoverable media error exception.
+         * If a -wthreads thread has the file, it does the warning, so wait for it
+         * to keep the messages in order.
          */
+        if (job != NULL) {
+            if (buf != stkbuf) wjbufqueue.enqueue (buf);
+            fw.buf = NULL;
+            fw.len = 1;
+            job->dataqueue.enqueue (fw);
+            wpool_wait (dstname, strlen (dstname) + 1);
+            throw;
+        }
+        if (buf != stkbuf) rwbufqueue.enqueue (buf);
+        rwrite_drain ();
         if (fd >= 0) {
             fprintf (stderr, "ftbackup: file %s corrupt due to unrecoverable saveset media errors\n", dstname);
             tfs->fsclose (fd);
@@ -559,6 +795,55 @@ bool FTBReader::read_regular (Header *hdr, char const *dstname)
     return (dstname == FTBREADER_SELECT_SKIP) || (fd >= 0);
 }
 
+/**
+ * @brief Create temp file to restore a regular file's contents to.
+ * @param hdr = backup header
+ * @param dstname = where the regular file is being restored to
+ * @param tmpname = temp name it is written as until closed
+ * @returns file descriptor or -1 if error (message printed)
+ */
+int FTBReader::creat_regular (Header const *hdr, char const *dstname, char const *tmpname)
+{
+    int fd;
+    struct stat statbuf;
+
+    do_mkdirs (dstname);
+    fd = tfs->fscreat (dstname, tmpname, opt_overwrite, hdr->stmode);
+    if (fd < 0) {
+        fprintf (stderr, "ftbackup: creat(%s) error: %s\n", dstname, mystrerr (errno));
+    } else if (tfs->fsftruncate (fd, hdr->size) < 0) {
+        fprintf (stderr, "ftbackup: ftruncate(%s, %llu) error: %s\n", dstname, hdr->size, mystrerr (errno));
+        tfs->fsclose (fd);
+        fd = -1;
+    } else if (tfs->fsfstat (fd, &statbuf) < 0) {
+        fprintf (stderr, "ftbackup: fstat(%s) error: %s\n", dstname, mystrerr (errno));
+        tfs->fsclose (fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Write data to regular file being restored.
+ * @returns fd: success
+ *          -1: write error (message printed and file closed)
+ */
+int FTBReader::write_regular (int fd, uint8_T const *buf, uint32_T len, char const *dstname)
+{
+    int rc;
+    uint32_T wofs;
+
+    for (wofs = 0; wofs < len; wofs += rc) {
+        rc = tfs->fswrite (fd, buf + wofs, len - wofs);
+        if (rc <= 0) {
+            fprintf (stderr, "ftbackup: write(%s) error: %s\n", dstname, ((rc == 0) ? "end of file" : mystrerr (errno)));
+            tfs->fsclose (fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
 /**
  * @brief Restore a directory's contents from the saveset.
  * @param hdr = backup header
@@ -823,6 +1108,7 @@ void FTBReader::do_mkdirs (char const *dstname)
 
 /**
  * @brief Read raw data from saveset block, unzipping it if necessary.
+ *        With -dthreads, it has already been decoded by the threads.
  * @param buf = where to return the data
  * @param len = number of bytes to return
  * @param zip = true: data in saveset is compressed, unzip it
@@ -832,6 +1118,11 @@ void FTBReader::read_raw (void *buf, uint32_T len, bool zip)
 {
     int rc;
 
+    if (pdjobs != NULL) {
+        pd_read (buf, len);
+        return;
+    }
+
     zstrm.next_out  = (Bytef *) buf;
     zstrm.avail_out = len;
     while (zstrm.avail_out > 0) {
@@ -849,36 +1140,37 @@ void FTBReader::read_raw (void *buf, uint32_T len, bool zip)
         if (zip) {
 
             /*
-             * It is zipped, make sure our unzipper is open.
+             * It is zipped, make sure we have a decoder open for the codec the run was written with.
              */
             if (!zisopen) {
-                uint32_T ai = zstrm.avail_in;
-                uint32_T ao = zstrm.avail_out;
-                Bytef   *ni = zstrm.next_in;
-                Bytef   *no = zstrm.next_out;
-                memset (&zstrm, 0, sizeof zstrm);
-                rc = inflateInit (&zstrm);
-                if (rc != Z_OK) INTERR (inflateInit, rc);
-                zstrm.avail_in  = ai;
-                zstrm.avail_out = ao;
-                zstrm.next_in   = ni;
-                zstrm.next_out  = no;
-                zisopen = true;
+                deccodec = read_codec ();
+                deccodec->decbegin ();
+                runfresh = true;
+                zisopen  = true;
             }
 
             /*
              * Unzip some stuff.
              */
-            rc = inflate (&zstrm, Z_SYNC_FLUSH);
-            if (rc == Z_STREAM_END) {
-                rc = inflateEnd (&zstrm);
-                if (rc != Z_OK) INTERR (inflateEnd, rc);
+            rc = read_decode (zstrm.next_out, zstrm.avail_out);
+            if (rc == 2) {
+
+                /*
+                 * Run was primed with the end of the previous runs (backup -chaindict).
+                 */
+                if (!deccodec->decdict (rundict.data (), rundict.len)) {
+                    zisopen = false;
+                    zstrm.avail_in = 0;
+                    throw new LostSSBlock (0);
+                }
+                runfresh = false;
+                continue;
+            }
+            if (rc > 0) {
                 zisopen = false;
                 continue;
             }
-            if ((rc != Z_OK) && (rc != Z_NEED_DICT)) {
-                fprintf (stderr, "ftbackup: inflate() error %d\n", rc);
-                inflateEnd (&zstrm);
+            if (rc < 0) {
                 zisopen = false;
                 zstrm.avail_in = 0;
                 throw new LostSSBlock (0);
@@ -890,34 +1182,19 @@ void FTBReader::read_raw (void *buf, uint32_T len, bool zip)
              */
             if (zisopen) {
                 uint8_T junk[64];
-                uint32_T ao = zstrm.avail_out;
-                Bytef   *no = zstrm.next_out;
 
                 /*
                  * There might be some junk bytes on the end,
                  * so make sure we consume them all up before
                  * marking the unzipper closed.
                  */
-                zstrm.avail_out = sizeof junk;
-                zstrm.next_out  = junk;
-                rc = inflate (&zstrm, Z_FINISH);
-                if ((rc != Z_OK) && (rc != Z_NEED_DICT)) {
-
-                    /*
-                     * Free off all unzipper context.
-                     */
-                    zstrm.avail_out = sizeof junk;
-                    zstrm.next_out  = junk;
-                    rc = inflateEnd (&zstrm);
-                    if (rc != Z_OK) INTERR (inflateEnd, rc);
+                if (read_decode (junk, sizeof junk) != 0) {
                     zisopen = false;
                 }
 
                 /*
                  * Loop back to make sure we have some input data to process.
                  */
-                zstrm.avail_out = ao;
-                zstrm.next_out  = no;
                 continue;
             }
 
@@ -926,7 +1203,11 @@ void FTBReader::read_raw (void *buf, uint32_T len, bool zip)
              */
             len = zstrm.avail_in;
             if (len > zstrm.avail_out) len = zstrm.avail_out;
-            memcpy (zstrm.next_out, zstrm.next_in, len);
+            if (!ismapped (curRBlock)) {
+                memcpy (zstrm.next_out, zstrm.next_in, len);
+            } else if (!copy_mapped (zstrm.next_out, zstrm.next_in, len)) {
+                mapped_fault ();
+            }
             zstrm.avail_in  -= len;
             zstrm.avail_out -= len;
             zstrm.next_in   += len;
@@ -936,477 +1217,2578 @@ void FTBReader::read_raw (void *buf, uint32_T len, bool zip)
 }
 
 /**
- * @brief Read next data block from saveset, performing recovery if needed.
- * @param skipfh = true: read whole block lastseqno+1
- *                false: repeat until block with file header found
- * @returns pointer to block just read
- *          lastseqno incremented
- *          lastxorno possibly incremented
- *          l2bs,xorgc,xorsc filled in if first call
- *          zstrm.avail_in = number of bytes available
- *          zstrm.next_in  = pointer to bytes within block
+ * @brief Read a whole compressed run in one call if it is all in the current block
+ *        and the codec can do that, as it is much faster for small files.
+ * @param buf = where to return the data
+ * @param len = exact number of bytes the run decompresses to
+ * @returns true: data returned, run consumed
+ *         false: nothing done, use read_raw() instead
  */
-Block *FTBReader::read_block (bool skipfh)
+bool FTBReader::read_whole (void *buf, uint32_T len)
 {
-    Block *rblock;
-    uint32_T offs;
+    bool ok;
+    Codec *codec;
+    uint32_T used;
 
-    /*
-     * Discard block from last call.
-     */
-    if (linkedRBlock != NULL) {
-        free (linkedRBlock);
-        linkedRBlock = NULL;
+    if (zisopen || !Codec::wholeruns || (pdjobs != NULL)) return false;
+    if (zstrm.avail_in == 0) {
+        read_block (false);
     }
-
-    /*
-     * If first call, we need some craziness to get block size and XOR parameters.
-     */
-    if (readoffset == 0) {
-        read_first_block ();
+    codec = read_codec ();
+    if (ismapped (curRBlock)) {
+        if (sigsetjmp (sigbusjmp, 0) != 0) {
+            sigbusarmed = 0;
+            mapped_fault ();
+        }
+        sigbusarmed = 1;
     }
+    ok = codec->decwhole (zstrm.next_in, zstrm.avail_in, &used, (uint8_T *) buf, len);
+    sigbusarmed = 0;
+    if (!ok) return false;
+    zstrm.next_in  += used;
+    zstrm.avail_in -= used;
+
+    // a run done in one call was not primed so it starts the chain over
+    rundict.reset ();
+    rundict.append (buf, len);
+    return true;
+}
 
-    /*
-     * Either read it or recover it.
-     */
-nextblock:
-    lastseqno ++;
-    zstrm.avail_in = 0;
-    zstrm.next_in  = NULL;
-    linkedRBlock   = read_or_recover_block ();
+/**
+ * @brief Skip over the rest of a deselected regular file's data without decoding it.
+ *        The next file's header follows right after the data, so if no header starts
+ *        in the current block past where we are, the next header is the first one in
+ *        a later block, which that block's hdroffs points to.
+ * @returns true: zstrm positioned at the next file's header
+ *         false: the next header might be in the current block after the data,
+ *                so the data has to be decoded to find where it ends
+ */
+bool FTBReader::skip_data ()
+{
+    uint32_T offs;
 
-    /*
-     * Point to block and get offset to start of data in block.
-     */
-    rblock = &linkedRBlock->block;
-    offs   = (ulong_T)rblock->data - (ulong_T)rblock;
+    if (pdjobs != NULL) return pd_skipped ();
 
-    /*
-     * If skipping to next file header, get another block
-     * if this block doesn't have a file header.
-     */
-    if (skipfh) {
-        offs = rblock->hdroffs;
-        if (offs == 0) goto nextblock;
+    if (zstrm.avail_in > 0) {
+        offs = (ulong_T)zstrm.next_in - (ulong_T)curRBlock;
+        if (curRBlock->hdroffs > offs) {
+            zstrm.avail_in -= curRBlock->hdroffs - offs;
+            zstrm.next_in  += curRBlock->hdroffs - offs;
+            zisopen = false;
+            return true;
+        }
+        if (curRBlock->hdroffs != 0) return false;
     }
 
     /*
-     * Set up the data descriptor.
+     * Data goes on past the current block, so read blocks till one with a header.
      */
-    zstrm.avail_in = (1 << l2bs) - offs - hashsize ();
-    zstrm.next_in  = (uint8_T *)rblock + offs;
-    return rblock;
+    read_block (true);
+    return true;
 }
 
 /**
- * @brief Scan the saveset for a valid header and get the blocksize and XOR parameters.
- * @returns with first readable block pushed on linkedBlocks list
- *          and l2bs, xorgc, xorsc, xorblocks, gotxors initialized
- *          and readoffset updated just past whatever was read
+ * @brief Get decoder for the compressed run starting at zstrm.next_in.
  */
-void FTBReader::read_first_block ()
+Codec *FTBReader::read_codec ()
+{
+    int type;
+
+    type = Codec::sniff (*zstrm.next_in);
+    if (type < 0) {
+        fprintf (stderr, "ftbackup: unknown compression type 0x%02X\n", *zstrm.next_in);
+        zstrm.avail_in = 0;
+        throw new LostSSBlock (0);
+    }
+    if (decoders[type] == NULL) {
+        decoders[type] = Codec::create (type, CODEC_DEFLEVEL);
+        if (decoders[type] == NULL) {
+            fprintf (stderr, "ftbackup: saveset uses %s compression which is not built in\n", Codec::name (type));
+            exit (EX_SSIO);
+        }
+    }
+    return decoders[type];
+}
+
+/**
+ * @brief Pass saveset block data through the open decoder.
+ * @param out = where to put decoded data
+ * @param outlen = room at out
+ * @returns 0: more to come; 1: end of run; -1: corrupt (message printed)
+ *          zstrm.next_in,avail_in advanced over the bytes decoded
+ *          zstrm.next_out,avail_out advanced if out is zstrm.next_out
+ */
+int FTBReader::read_decode (Bytef *out, uint32_T outlen)
 {
-    Block *miniBlock, *miniEncrp, *tblock;
+    bool curs;
     int rc;
-    LinkedBlock *bigBlock;
-    uint32_T bs, bytesCopied, i;
-    uint64_T miniOffset;
+    uint8_T const *ni;
+    uint8_T *no;
+    uint32_T ai, ao;
+
+    curs = (out == zstrm.next_out);
+    ni   = zstrm.next_in;
+    ai   = zstrm.avail_in;
+    no   = out;
+    ao   = outlen;
 
     /*
-     * Step through file by minimum block size until we find a valid block header.
+     * A block being used in place in the -mmap mapping is decoded with SIGBUS caught.
      */
-    bigBlock    = NULL;
-    bs          = 0;
-    bytesCopied = 0;
-    miniBlock   = (Block *) alloca (MINBLOCKSIZE);
-    miniEncrp   = (Block *) alloca (MINBLOCKSIZE);
-    while (true) {
-
-        /*
-         * Keep reading until we get something of MINBLOCKSIZE.
-         * Any error means get rid of bigBlock that we are trying to build.
-         */
-        while (true) {
-            miniOffset = readoffset;
-            rc = wrapped_pread (miniBlock, MINBLOCKSIZE, readoffset);
-            readoffset += MINBLOCKSIZE;
-            if (rc == MINBLOCKSIZE) break;
-            fprintf (stderr, "ftbackup: pread(%llu) saveset error: %s\n", miniOffset,
-                    ((rc > 0) ? "partial read" : (rc == 0) ? "end of file" : mystrerr (errno)));
-            if (rc == 0) {
-                fprintf (stderr, "ftbackup: unable to locate a block header\n");
-                throw new EndOfSSFile ();
-            }
-            if (bigBlock != NULL) {
-                free (bigBlock);
-                bigBlock = NULL;
-            }
+    if (ismapped (curRBlock)) {
+        if (sigsetjmp (sigbusjmp, 0) != 0) {
+            sigbusarmed = 0;
+            mapped_fault ();
         }
+        sigbusarmed = 1;
+    }
+    rc = deccodec->decode (&ni, &ai, &no, &ao);
+    sigbusarmed = 0;
+    zstrm.next_in  = (Bytef *) ni;
+    zstrm.avail_in = ai;
+    if (curs) {
 
         /*
-         * Found something readable, see if it has correct magic number and a valid block size field.
-         * If so, it is the beginning of a bigBlock.
+         * Keep the end of the decoded data in case the next run was primed with it.
+         * A run that wasn't primed means the writer started the chain over.
          */
-        memcpy (miniEncrp, miniBlock, MINBLOCKSIZE);
-        if (bigBlock == NULL) {
-            decrypt_block (miniBlock, MINBLOCKSIZE);
-            if (memcmp (miniBlock->magic, BLOCK_MAGIC, 8) != 0) continue;
-            if (miniBlock->xorbc != 0) continue;
-            l2bs = miniBlock->l2bs;
-            if (l2bs > 31) continue;
-            bs   = 1 << l2bs;
-            if ((bs < MINBLOCKSIZE) || (bs > MAXBLOCKSIZE)) continue;
-            bigBlock      = (LinkedBlock *) malloc (bs + sizeof *bigBlock);
-            if (bigBlock == NULL) NOMEM ();
-            bytesCopied   = 0;
+        if (no > zstrm.next_out) {
+            if (runfresh) {
+                rundict.reset ();
+                runfresh = false;
+            }
+            rundict.append (zstrm.next_out, no - zstrm.next_out);
         }
+        zstrm.next_out  = no;
+        zstrm.avail_out = ao;
+    }
+    return rc;
+}
 
-        /*
-         * Copy the (possibly encrypted) mini block data to the bigBlock.
-         */
-        memcpy ((uint8_T *)&bigBlock->block + bytesCopied, miniEncrp, MINBLOCKSIZE);
-        bytesCopied += MINBLOCKSIZE;
+/**
+ * @brief Open the -catalog file written by backup -catalog.
+ * @returns false: can't be opened (message printed)
+ */
+bool FTBReader::catalog_open ()
+{
+    CatalogHdr cathdr;
 
-        /*
-         * Done if the whole big block is valid.
-         */
-        if (bytesCopied < bs) continue;
-        tblock = &bigBlock->block;
-        if (decrypt_block (tblock, bs)) {
-            xorgc = tblock->xorgc;
-            xorsc = tblock->xorsc;
-            if (blockisvalid (tblock)) break;
-        }
-        free (bigBlock);
-        bigBlock = NULL;
+    catfile = fopen (opt_catalog, "r");
+    if (catfile == NULL) {
+        fprintf (stderr, "ftbackup: fopen(%s) error: %s\n", opt_catalog, mystrerr (errno));
+        return false;
+    }
+    if ((fread (&cathdr, sizeof cathdr, 1, catfile) != 1) || (memcmp (cathdr.magic, CATALOG_MAGIC, 8) != 0)) {
+        fprintf (stderr, "ftbackup: %s is not a catalog\n", opt_catalog);
+        return false;
     }
 
     /*
-     * Push this block as the one-and-only valid block so far.
-     */
-    bigBlock->next = NULL;
-    linkedBlocks = bigBlock;
-
-    /*
-     * Calloc XOR blocks and fill in this block as initial XOR.
+     * Runs primed with the end of the previous runs can't be decoded by themselves,
+     * so the whole saveset has to be read.
      */
-    if (xorgc > 0) {
-        xorblocks = (Block **) malloc (xorgc * sizeof *xorblocks);
-        if (xorblocks == NULL) NOMEM ();
-        for (i = 0; i < xorgc; i ++) {
-            xorblocks[i] = (Block *) calloc (1, bs - hashsize ());
-            if (xorblocks[i] == NULL) NOMEM ();
-        }
-        i = (tblock->seqno - 1) % xorgc;
-        memcpy (xorblocks[i], tblock, bs - hashsize ());
-
-        gotxors = (uint8_T *) calloc (xorgc, sizeof *gotxors);
-        if (gotxors == NULL) NOMEM ();
-        gotxors[i] = 1;
+    if (cathdr.flags & CFL_CHAINDICT) {
+        fprintf (stderr, "ftbackup: saveset written with -chaindict, reading whole saveset\n");
+        fclose (catfile);
+        catfile = NULL;
+        return true;
     }
+
+    catrecall = sizeof *catrec + 256;
+    catrec = (CatalogRec *) malloc (catrecall);
+    if (catrec == NULL) NOMEM ();
+    return true;
 }
 
 /**
- * @brief Scan forward trying to read or recover block lastseqno.
- * @returns pointer to malloc()d block
- *          also, readoffset incremented past what was last read
- *                xorblocks, gotxors updated
- *                possibly intermediate blocks stacked on linkedBlocks
+ * @brief Read next record from the -catalog file into catrec.
+ * @returns true: record read
+ *         false: end of catalog, file closed (message printed)
  */
-FTBReader::LinkedBlock *FTBReader::read_or_recover_block ()
+bool FTBReader::catalog_read ()
 {
-    int rc;
-    LinkedBlock *linkedBlock, **lLinkedBlock;
-    uint32_T bs, bsnh, i, xorno;
-    uint64_T lastreadoffs;
+    uint32_T fixed;
+
+    fixed = (ulong_T)catrec->hdr.name - (ulong_T)catrec;
+    if ((fread (catrec, fixed, 1, catfile) == 1) && (memcmp (catrec->hdr.magic, HEADER_MAGIC, 8) == 0) &&
+            (catrec->hdr.nameln <= CAT_MAXNAME)) {
+        if (catrecall < fixed + catrec->hdr.nameln) {
+            catrecall = fixed + catrec->hdr.nameln;
+            catrec = (CatalogRec *) realloc (catrec, catrecall);
+            if (catrec == NULL) NOMEM ();
+        }
+        if (catrec->hdr.nameln == 0) return true;
+        if ((fread (catrec->hdr.name, catrec->hdr.nameln, 1, catfile) == 1) &&
+                (catrec->hdr.name[catrec->hdr.nameln-1] == 0)) return true;
+    }
+
+    /*
+     * Catalog ends before the end-of-saveset header, read the rest of saveset as is.
+     */
+    if (ferror (catfile)) {
+        fprintf (stderr, "ftbackup: fread(%s) error: %s\n", opt_catalog, mystrerr (errno));
+    } else {
+        fprintf (stderr, "ftbackup: catalog %s truncated or corrupt\n", opt_catalog);
+    }
+    fclose (catfile);
+    catfile = NULL;
+    return false;
+}
+
+/**
+ * @brief Step through the catalog to the next file selected, without reading
+ *        the saveset, then skip the saveset to that file's header.
+ * @returns NULL: read next header from saveset and select it as usual
+ *          FTBREADER_SELECT_DONE: no more files wanted
+ *          else: file selected, this is where to restore it to
+ */
+char const *FTBReader::catalog_next ()
+{
+    char const *dstname;
+
+    while (catalog_read ()) {
+
+        // saveset may be past it after skipping a bad block
+        if (catrec->hdr.fileno <= lastfileno) continue;
+
+        // skip to end-of-saveset header so we know the whole saveset was written
+        if (catrec->hdr.nameln == 0) {
+            catalog_seek ();
+            return NULL;
+        }
+
+        dstname = select_file (&catrec->hdr);
+        if (dstname == FTBREADER_SELECT_SKIP) continue;
+        if (dstname != FTBREADER_SELECT_DONE) catalog_seek ();
+        return dstname;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Position saveset at the header of the file in catrec.
+ *        Blocks up to it are read but not decoded, except whole XOR spans before
+ *        the one it is in aren't read at all if the saveset can be seeked.
+ *        The rest of its span is read so a bad block can still be recovered.
+ */
+void FTBReader::catalog_seek ()
+{
+    uint32_T bs, offs, seqno, start;
+
+    /*
+     * If it is the very next file, saveset is already there.
+     */
+    if (catrec->hdr.fileno == lastfileno + 1) return;
+    lastfileno = catrec->hdr.fileno - 1;
+
+    /*
+     * Make sure we have block size and XOR parameters.
+     */
+    if (blkpool == NULL) read_block (false);
+    bs    = 1 << l2bs;
+    seqno = catrec->seqno;
+    offs  = catrec->hdroffs;
+    if ((seqno < lastseqno) || (offs < sizeof (Block)) || (offs >= bs - hashsize ())) {
+        fprintf (stderr, "ftbackup: catalog %s does not match saveset at file %u\n", opt_catalog, catrec->hdr.fileno);
+        exit (EX_SSIO);
+    }
+
+    /*
+     * Header is in a later block, maybe skip to start of its XOR span then read up to it.
+     * Blocks in between that can't be read don't matter, but the header's block does.
+     */
+    if (seqno > lastseqno) {
+        start = seqno;
+        if (xorgc > 0) start -= (seqno - 1) % (xorgc * xorsc);
+        if (blkseekable && (start > lastseqno + 1)) seek_saveset (start);
+        while (lastseqno < seqno) {
+            try {
+                read_block (false);
+            } catch (LostSSBlock *lssb) {
+                if (lastseqno == seqno) throw lssb;
+                delete lssb;
+            }
+        }
+    }
+    if (curRBlock == NULL) throw new LostSSBlock (lastseqno);
+
+    /*
+     * Point at the header.  Each file's data is its own run so decoding starts over.
+     */
+    zstrm.next_in  = (uint8_T *)curRBlock + offs;
+    zstrm.avail_in = bs - offs - hashsize ();
+    zisopen = false;
+}
+
+/**
+ * @brief Skip saveset to the given data block, discarding all blocks read ahead.
+ *        It is the first block of an XOR span (unless -noxor), so XOR groups start over.
+ */
+void FTBReader::seek_saveset (uint32_T seqno)
+{
+    uint32_T bs, i, nextsegno, segno;
+    uint64_T gappos, pos, segpos, segsize, size;
+
+    bs = 1 << l2bs;
+    if (curRBlock != NULL) {
+        free_block (curRBlock);
+        curRBlock = NULL;
+    }
+    for (i = 0; i < blkwinsize; i ++) {
+        if (blkwindow[i] != NULL) {
+            free_block (blkwindow[i]);
+            blkwindow[i] = NULL;
+        }
+    }
+    blkwinused = 0;
+    if (xorgc > 0) {
+        lastxorno = (seqno - 1) / xorsc / xorgc * xorgc;
+        memset (gotxors, 0, xorgc * sizeof *gotxors);
+        for (i = 0; i < xorgc; i ++) memset (xorblocks[i], 0, bs - hashsize ());
+    }
+    lastseqno = seqno - 1;
+    zstrm.avail_in = 0;
+    zstrm.next_in  = NULL;
+    zisopen = false;
+
+    /*
+     * Skip over whole segment files before the block, then open the one it is in.
+     * Start with the first one if the block is before this one, or if wrapped_pread()
+     * went on past a missing one, as positions in this one are off by its size then.
+     * Missing segment files are as big as the manifest says, else as the one before.
+     * If the block is in one, start at the one after that like wrapped_pread() does
+     * and let read_or_recover_block() sort out the seqnos.
+     */
+    pos     = block_offset (seqno);
+    segno   = thissegno;
+    segpos  = pipepos;
+    segsize = (ssstat.st_size + bs - 1) / bs * bs;
+    if ((thissegno != 0) && S_ISREG (ssstat.st_mode)) {
+        if (segskipped || (pos < segpos)) {
+            segno   = next_segno (ssbasename, 0);
+            segpos  = 0;
+            segsize = (segment_size (segno) + bs - 1) / bs * bs;
+            segskipped = false;
+        }
+        while (pos - segpos >= segsize) {
+            nextsegno = next_segno (ssbasename, segno);
+            if (nextsegno == 0) {
+                pos = segpos + segsize;
+                break;
+            }
+            gappos = segpos + segsize;
+            for (i = segno + 1; i < nextsegno; i ++) {
+                size    = segment_size (i);
+                gappos += (size > 0) ? (size + bs - 1) / bs * bs : segsize;
+            }
+            if (pos < gappos) {
+                pos = segpos + segsize;
+                break;
+            }
+            segno   = nextsegno;
+            segpos  = gappos;
+            segsize = (segment_size (segno) + bs - 1) / bs * bs;
+        }
+    }
+    if (segno != thissegno) {
+        close (ssfd);
+        thissegno = segno;
+        sprintf (sssegname, "%s%.*u", ssbasename, SEGNODECDIGS, thissegno);
+        ssfd = open_saveset (sssegname);
+        if (ssfd < 0) {
+            fprintf (stderr, "ftbackup: open(%s) error: %s\n", sssegname, mystrerr (errno));
+            exit (EX_SSIO);
+        }
+        if (fstat (ssfd, &ssstat) < 0) SYSERRNO (fstat);
+    }
+    pipepos    = segpos;
+    readoffset = pos;
+}
+
+/**
+ * @brief Read the -manifest file written by backup -manifest.
+ * @returns false: can't be read (message printed)
+ */
+bool FTBReader::manifest_load ()
+{
+    char line[MAN_MAXLINE], *p;
+    FILE *manfile;
+    int n;
+    ManifestSeg *seg;
+    uint32_T manalloc;
+
+    manfile = fopen (opt_manifest, "r");
+    if (manfile == NULL) {
+        fprintf (stderr, "ftbackup: fopen(%s) error: %s\n", opt_manifest, mystrerr (errno));
+        return false;
+    }
+    if ((fgets (line, sizeof line, manfile) == NULL) || (strcmp (line, MANIFEST_MAGIC "\n") != 0)) goto bad;
+
+    manalloc = 0;
+    while (fgets (line, sizeof line, manfile) != NULL) {
+        p = strchr (line, '\n');
+        if (p == NULL) goto bad;
+        *p = 0;
+        if (mannsegs == manalloc) {
+            manalloc += manalloc / 2 + 16;
+            mansegs = (ManifestSeg *) realloc (mansegs, manalloc * sizeof *mansegs);
+            if (mansegs == NULL) NOMEM ();
+        }
+        seg = &mansegs[mannsegs];
+        memset (seg, 0, sizeof *seg);
+        n = 0;
+        if ((sscanf (line, "%u %llu %u %u %u %u %X %n", &seg->segno, &seg->size, &seg->firstseqno, &seg->lastseqno,
+                &seg->firstxorno, &seg->lastxorno, &seg->crc, &n) != 7) || (n == 0) || (line[n] == 0)) goto bad;
+        if ((mannsegs > 0) && (seg->segno <= mansegs[mannsegs-1].segno)) goto bad;
+        seg->name = strdup (line + n);
+        if (seg->name == NULL) NOMEM ();
+        mannsegs ++;
+    }
+    if (ferror (manfile) || (mannsegs == 0)) goto bad;
+    fclose (manfile);
+    return true;
+
+bad:
+    fprintf (stderr, "ftbackup: %s is not a manifest\n", opt_manifest);
+    fclose (manfile);
+    return false;
+}
+
+/**
+ * @brief Check up front that all the segment files in the manifest are there and the right size,
+ *        rather than finding out when getting to them.  next_segno() skips the missing ones.
+ * @param basename = segment file names without the segment number
+ */
+void FTBReader::manifest_check (char const *basename)
+{
+    char *name;
+    ManifestSeg *seg;
+    struct stat statbuf;
+    uint32_T i;
+
+    manchecked = true;
+    name = (char *) alloca (strlen (basename) + SEGNODECDIGS + 4);
+    for (i = 0; i < mannsegs; i ++) {
+        seg = &mansegs[i];
+        sprintf (name, "%s%.*u", basename, SEGNODECDIGS, seg->segno);
+        if (stat (name, &statbuf) < 0) {
+            fprintf (stderr, "ftbackup: segment %s missing: %s\n", name, mystrerr (errno));
+            continue;
+        }
+        seg->present = true;
+        if ((uint64_T) statbuf.st_size != seg->size) {
+            fprintf (stderr, "ftbackup: segment %s is %llu bytes, manifest says %llu\n", name, (uint64_T) statbuf.st_size, seg->size);
+            seg->size = statbuf.st_size;  // segment_size() gives where it really ends
+        }
+    }
+}
+
+/**
+ * @brief Find a segment file in the manifest.
+ * @returns NULL if not listed
+ */
+ManifestSeg *FTBReader::manifest_seg (uint32_T segno)
+{
+    uint32_T hi, lo, mid;
+
+    lo = 0;
+    hi = mannsegs;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (mansegs[mid].segno < segno) lo = mid + 1;
+        else hi = mid;
+    }
+    return ((lo < mannsegs) && (mansegs[lo].segno == segno)) ? &mansegs[lo] : NULL;
+}
+
+/**
+ * @brief Find next segment file after the given one, from the manifest if there is one,
+ *        else by scanning the directory.
+ * @returns 0: no next file found
+ *       else: next greater segment number
+ */
+uint32_T FTBReader::next_segno (char const *basename, uint32_T lastsegno)
+{
+    ManifestSeg *seg;
+
+    if (mansegs == NULL) return findnextsegno (basename, lastsegno);
+    if (!manchecked) manifest_check (basename);
+
+    seg = manifest_seg (lastsegno);
+    seg = (seg == NULL) ? mansegs : seg + 1;
+    for (; seg < mansegs + mannsegs; seg ++) {
+        if (seg->present && (seg->segno > lastsegno)) return seg->segno;
+    }
+    return 0;
+}
+
+/**
+ * @brief Get size of a segment file, from the manifest if there is one.
+ */
+uint64_T FTBReader::segment_size (uint32_T segno)
+{
+    char *name;
+    ManifestSeg *seg;
+    struct stat statbuf;
+
+    seg = manifest_seg (segno);
+    if (seg != NULL) return seg->size;
+
+    name = (char *) alloca (strlen (ssbasename) + SEGNODECDIGS + 4);
+    sprintf (name, "%s%.*u", ssbasename, SEGNODECDIGS, segno);
+    if (stat (name, &statbuf) < 0) return 0;
+    return statbuf.st_size;
+}
+
+/**
+ * @brief Get where the writer put the given data block in the saveset,
+ *        ie, after all data blocks before it and the XOR blocks of the spans before it.
+ */
+uint64_T FTBReader::block_offset (uint32_T seqno)
+{
+    uint64_T index;
+
+    index = seqno - 1;
+    if (xorgc > 0) index += index / xorsc / xorgc * xorgc;
+    return index << l2bs;
+}
+
+/**
+ * @brief Read next data block from saveset, performing recovery if needed.
+ * @param skipfh = true: read whole block lastseqno+1
+ *                false: repeat until block with file header found
+ * @returns pointer to block just read
+ *          lastseqno incremented
+ *          lastxorno possibly incremented
+ *          l2bs,xorgc,xorsc filled in if first call
+ *          zstrm.avail_in = number of bytes available
+ *          zstrm.next_in  = pointer to bytes within block
+ */
+Block *FTBReader::read_block (bool skipfh)
+{
+    Block *rblock;
+    uint32_T offs;
+
+    /*
+     * With -dthreads, the threads have done the reading, just skip to where they resynced.
+     */
+    if (pdjobs != NULL) {
+        if (!skipfh) abort ();
+        return pd_resynced ();
+    }
+
+    /*
+     * Discard block from last call.
+     */
+    if (curRBlock != NULL) {
+        free_block (curRBlock);
+        curRBlock = NULL;
+    }
+
+    /*
+     * If first call, we need some craziness to get block size and XOR parameters.
+     */
+    if (blkpool == NULL) {
+        read_first_block ();
+        if (opt_rthreads > 0) rdpipe_start ();
+    }
+
+    /*
+     * Either read it or recover it.
+     */
+nextblock:
+    lastseqno ++;
+    zstrm.avail_in = 0;
+    zstrm.next_in  = NULL;
+    rblock = curRBlock = read_or_recover_block ();
+
+    /*
+     * Get offset to start of data in block.
+     */
+    offs = (ulong_T)rblock->data - (ulong_T)rblock;
+
+    /*
+     * If skipping to next file header, get another block
+     * if this block doesn't have a file header.
+     */
+    if (skipfh) {
+        offs = rblock->hdroffs;
+        if (offs == 0) {
+            free_block (rblock);
+            curRBlock = NULL;
+            goto nextblock;
+        }
+        zisopen = false;
+    }
+
+    /*
+     * Set up the data descriptor.
+     */
+    zstrm.avail_in = (1 << l2bs) - offs - hashsize ();
+    zstrm.next_in  = (uint8_T *)rblock + offs;
+    return rblock;
+}
+
+/**
+ * @brief Scan the saveset for a valid header and get the blocksize and XOR parameters.
+ * @returns with first readable block stacked in blkwindow
+ *          and l2bs, xorgc, xorsc, xorblocks, gotxors, block pool initialized
+ *          and readoffset updated just past whatever was read
+ */
+void FTBReader::read_first_block ()
+{
+    Block *bigBlock, *miniBlock, *miniEncrp;
+    int rc;
+    uint32_T bs, bytesCopied, i;
+    uint64_T miniOffset;
+
+    /*
+     * Step through file by minimum block size until we find a valid block header.
+     */
+    bigBlock    = NULL;
+    bs          = 0;
+    bytesCopied = 0;
+    miniBlock   = (Block *) alloca (MINBLOCKSIZE);
+    miniEncrp   = (Block *) alloca (MINBLOCKSIZE);
+    while (true) {
+
+        /*
+         * Keep reading until we get something of MINBLOCKSIZE.
+         * Any error means get rid of bigBlock that we are trying to build.
+         */
+        while (true) {
+            miniOffset = readoffset;
+            rc = wrapped_pread (miniBlock, MINBLOCKSIZE, readoffset);
+            readoffset += MINBLOCKSIZE;
+            if (rc == MINBLOCKSIZE) break;
+            fprintf (stderr, "ftbackup: pread(%llu) saveset error: %s\n", miniOffset,
+                    ((rc > 0) ? "partial read" : (rc == 0) ? "end of file" : mystrerr (errno)));
+            if (rc == 0) {
+                fprintf (stderr, "ftbackup: unable to locate a block header\n");
+                throw new EndOfSSFile ();
+            }
+            if (bigBlock != NULL) {
+                free (bigBlock);
+                bigBlock = NULL;
+            }
+        }
+
+        /*
+         * Found something readable, see if it has correct magic number and a valid block size field.
+         * If so, it is the beginning of a bigBlock.
+         */
+        memcpy (miniEncrp, miniBlock, MINBLOCKSIZE);
+        if (bigBlock == NULL) {
+            decrypt_block (miniBlock, MINBLOCKSIZE);
+            if (memcmp (miniBlock->magic, BLOCK_MAGIC, 8) != 0) continue;
+            if (miniBlock->xorbc != 0) continue;
+            l2bs = miniBlock->l2bs;
+            if (l2bs > 31) continue;
+            bs   = 1 << l2bs;
+            if ((bs < MINBLOCKSIZE) || (bs > MAXBLOCKSIZE)) continue;
+            bigBlock      = malloc_block ();
+            bytesCopied   = 0;
+        }
+
+        /*
+         * Copy the (possibly encrypted) mini block data to the bigBlock.
+         */
+        memcpy ((uint8_T *)bigBlock + bytesCopied, miniEncrp, MINBLOCKSIZE);
+        bytesCopied += MINBLOCKSIZE;
+
+        /*
+         * Done if the whole big block is valid.
+         */
+        if (bytesCopied < bs) continue;
+        if (decrypt_block (bigBlock, bs)) {
+            xorgc = bigBlock->xorgc;
+            xorsc = bigBlock->xorsc;
+            if (blockisvalid (bigBlock)) break;
+        }
+        free (bigBlock);
+        bigBlock = NULL;
+    }
+
+    /*
+     * Calloc XOR blocks and fill in this block as initial XOR.
+     */
+    if (xorgc > 0) {
+        xorblocks = (Block **) malloc (xorgc * sizeof *xorblocks);
+        if (xorblocks == NULL) NOMEM ();
+        for (i = 0; i < xorgc; i ++) {
+            xorblocks[i] = (Block *) calloc (1, bs - hashsize ());
+            if (xorblocks[i] == NULL) NOMEM ();
+        }
+        i = (bigBlock->seqno - 1) % xorgc;
+        memcpy (xorblocks[i], bigBlock, bs - hashsize ());
+
+        gotxors = (uint8_T *) calloc (xorgc, sizeof *gotxors);
+        if (gotxors == NULL) NOMEM ();
+        gotxors[i] = 1;
+    }
+
+    /*
+     * A -catalog or -dthreads can skip ahead if blocks are where the writer put them.
+     */
+    blkseekable = (opt_rthreads == 0) && (opt_simrderrs == 0) &&
+            (S_ISREG (ssstat.st_mode) || S_ISBLK (ssstat.st_mode)) &&
+            (readoffset - bs == block_offset (bigBlock->seqno));
+
+    /*
+     * Now that we know how many blocks can be read ahead during recovery,
+     * set up the buffers and stack this block as the one-and-only valid block so far.
+     */
+    blkpool_init ();
+    stack_block (bigBlock);
+}
+
+/**
+ * @brief Set up the block buffer pool and the window of blocks read ahead.
+ *
+ *        Blocks are read ahead of lastseqno only while recovering the rest of its
+ *        XOR span, plus the first one of the next span that stops the search, so
+ *        they are all within a span of lastseqno and can be found by seqno modulo
+ *        the span size.  With -noxor, only one block is ever read ahead.
+ *
+ *        Buffers needed are the window plus the one read_block() returned last
+ *        time plus one being read into.
+ */
+void FTBReader::blkpool_init ()
+{
+    blkwinsize = (xorgc > 0) ? xorgc * xorsc + 1 : 2;
+    blkwinused = 0;
+    blkwindow  = (Block **) calloc (blkwinsize, sizeof *blkwindow);
+    if (blkwindow == NULL) NOMEM ();
+
+    blkpoolsize = blkwinsize + 2;
+    blkpoolused = 0;
+    blkpool     = (Block **) malloc (blkpoolsize * sizeof *blkpool);
+    if (blkpool == NULL) NOMEM ();
+
+    // the first block is already allocated
+    while (blkpoolused < blkpoolsize - 1) {
+        blkpool[blkpoolused++] = malloc_block ();
+    }
+}
+
+/**
+ * @brief Malloc a block.  They are page aligned so O_DIRECT will work.
+ */
+Block *FTBReader::malloc_block ()
+{
+    Block *block;
+    int rc;
+
+    rc = posix_memalign ((void **)&block, PAGESIZE, 1 << l2bs);
+    if (rc != 0) NOMEM ();
+    return block;
+}
+
+/**
+ * @brief Get a block buffer from the pool.
+ */
+Block *FTBReader::get_block ()
+{
+    if (blkpoolused == 0) abort ();
+    return blkpool[--blkpoolused];
+}
+
+/**
+ * @brief Put a block buffer back in the pool.
+ *        Blocks in the -mmap mapping are not from the pool so are just unlocked.
+ */
+void FTBReader::free_block (Block *block)
+{
+    if (ismapped (block)) {
+        munlock (block, 1 << l2bs);
+        return;
+    }
+    if (blkpoolused >= blkpoolsize) abort ();
+    blkpool[blkpoolused++] = block;
+}
+
+/**
+ * @brief Save a block read ahead of lastseqno until read_or_recover_block() wants it.
+ *        If its window slot holds a block we still want, keep the lower numbered of
+ *        the two, as the other is so far ahead something big is missing in between.
+ */
+void FTBReader::stack_block (Block *block)
+{
+    Block **slot, *old;
+
+    slot = &blkwindow[block->seqno%blkwinsize];
+    old  = *slot;
+    if (old == NULL) {
+        blkwinused ++;
+    } else if ((old->seqno > lastseqno) && (old->seqno < block->seqno)) {
+        free_block (block);
+        return;
+    } else {
+        free_block (old);
+    }
+    *slot = block;
+}
+
+/**
+ * @brief Take block out of the read-ahead window.
+ * @returns NULL: it isn't there
+ *          else: the block
+ */
+Block *FTBReader::unstack_block (uint32_T seqno)
+{
+    Block **slot, *block;
+
+    slot  = &blkwindow[seqno%blkwinsize];
+    block = *slot;
+    if ((block == NULL) || (block->seqno != seqno)) return NULL;
+    *slot = NULL;
+    blkwinused --;
+    return block;
+}
+
+/**
+ * @brief Get block from the -mmap mapping of the current segment file.
+ *        An unencrypted data block is used right where it is in the mapping.  Its digest
+ *        is checked with SIGBUS caught, then its pages are locked in memory till it is
+ *        freed so they can't be dropped and fault when it is decompressed.  Encrypted
+ *        and XOR blocks get modified so they are copied to the given block buffer, also
+ *        with SIGBUS caught.  A media error (SIGBUS) leaves wrapped_pread() to read the
+ *        block again and get the error the usual way.
+ * @param block = buffer from get_block() to copy into
+ *                returns pointer to the block, maybe in the mapping
+ * @param hashok = returns whether the digest is valid
+ * @returns false: read the block with wrapped_pread()
+ *           true: block gotten
+ */
+bool FTBReader::mapped_read (Block **block, uint64_T pos, uint32_T bs, bool *hashok)
+{
+    Block *b;
+    int rc;
+    uint64_T segpos;
+
+    if ((opt_simrderrs != 0) || (pos < pipepos)) return false;
+    if (!S_ISREG (ssstat.st_mode) && !S_ISBLK (ssstat.st_mode)) return false;
+    if (mapbase == NULL) {
+        map_saveset ();
+        if (mapbase == NULL) return false;
+    }
+    segpos = pos - pipepos;
+    if (segpos + bs > mapsize) return false;
+    b = (Block *) (mapbase + segpos);
+
+    if (decipher == NULL) {
+        rc = verify_mapped (b, bs);
+        if (rc < 0) return false;
+        *hashok = (rc > 0);
+        if (rc == 1) {
+            free_block (*block);
+            *block = b;
+        } else if ((rc == 2) && !copy_mapped ((uint8_T *) *block, (uint8_T const *) b, bs)) {
+            return false;
+        }
+        return true;
+    }
+
+    if (!copy_mapped ((uint8_T *) *block, (uint8_T const *) b, bs)) return false;
+    *hashok = decrypt_block (*block, bs);
+    return true;
+}
+
+/**
+ * @brief Check the digest of an unencrypted block in the -mmap mapping with SIGBUS caught
+ *        and lock its pages in memory if it can be used in place.
+ * @returns -1: got SIGBUS, ie, media error
+ *           0: digest not valid
+ *           1: valid and locked in memory
+ *           2: valid but has to be copied (XOR block or can't be locked)
+ */
+int FTBReader::verify_mapped (Block *block, uint32_T bs)
+{
+    int rc;
+
+    if (sigsetjmp (sigbusjmp, 0) != 0) {
+        sigbusarmed = 0;
+        return -1;
+    }
+    sigbusarmed = 1;
+    rc = 0;
+    if (decrypt_block (block, bs)) {
+        rc = ((block->xorbc == 0) && (mlock (block, bs) == 0)) ? 1 : 2;
+    }
+    sigbusarmed = 0;
+    return rc;
+}
+
+/**
+ * @brief See if block is in the -mmap mapping rather than a block buffer.
+ */
+bool FTBReader::ismapped (Block const *block)
+{
+    return (mapbase != NULL) && ((uint8_T const *) block >= mapbase) && ((uint8_T const *) block < mapbase + mapsize);
+}
+
+/**
+ * @brief If block is in the -mmap mapping, copy it to a block buffer so it can be kept after unmapping.
+ */
+Block *FTBReader::keep_mapped (Block *block)
+{
+    Block *copy;
+
+    if (!ismapped (block)) return block;
+    copy = get_block ();
+    memcpy (copy, block, 1 << l2bs);
+    munlock (block, 1 << l2bs);
+    return copy;
+}
+
+/**
+ * @brief Map the whole current segment file for -mmap.
+ *        If it can't be mapped, say so and read the usual way.
+ */
+void FTBReader::map_saveset ()
+{
+    struct sigaction sa;
+    uint64_T size;
+    void *base;
+
+    size = ssstat.st_size;
+    if (S_ISBLK (ssstat.st_mode) && (ioctl (ssfd, BLKGETSIZE64, &size) < 0)) SYSERRNO (ioctl);
+    if (size == 0) return;
+
+    base = mmap (NULL, size, PROT_READ, MAP_SHARED, ssfd, 0);
+    if (base == MAP_FAILED) {
+        read_error ("ftbackup: mmap(%s) error: %s, reading normally\n", sssegname, mystrerr (errno));
+        opt_mmap = false;
+        return;
+    }
+    if (opt_readahead > 0) madvise (base, size, MADV_SEQUENTIAL);
+
+    // SA_NODEFER so the guards can use sigsetjmp() without saving the signal mask
+    memset (&sa, 0, sizeof sa);
+    sa.sa_handler = sigbushand;
+    sa.sa_flags   = SA_NODEFER;
+    if (sigaction (SIGBUS, &sa, NULL) < 0) SYSERRNO (sigaction);
+
+    mapbase = (uint8_T *) base;
+    mapsize = size;
+}
+
+/**
+ * @brief Unmap the -mmap mapping before the segment file is closed,
+ *        first copying blocks still being held from it to block buffers.
+ */
+void FTBReader::unmap_saveset ()
+{
+    Block *copy;
+    uint32_T i;
+
+    if (mapbase == NULL) return;
+
+    if (ismapped (curRBlock)) {
+        copy = keep_mapped (curRBlock);
+        if (zstrm.next_in != NULL) zstrm.next_in = (uint8_T *) copy + (zstrm.next_in - (uint8_T *) curRBlock);
+        curRBlock = copy;
+    }
+    for (i = 0; i < blkwinsize; i ++) {
+        if (blkwindow[i] != NULL) blkwindow[i] = keep_mapped (blkwindow[i]);
+    }
+
+    munmap (mapbase, mapsize);
+    mapbase = NULL;
+    mapsize = 0;
+}
+
+/**
+ * @brief Got SIGBUS using a block in place in the -mmap mapping after its digest was checked.
+ *        Treat it like corrupt data so the caller skips on to the next file header.
+ */
+void FTBReader::mapped_fault ()
+{
+    block_error (lastseqno, "ftbackup: saveset media error (SIGBUS) in block %u\n", lastseqno);
+    zisopen = false;
+    zstrm.avail_in = 0;
+    throw new LostSSBlock (lastseqno);
+}
+
+/**
+ * @brief Copy from the -mmap mapping with SIGBUS caught.
+ *        The jump buffer is per thread so a fault only ever returns to the thread that took it.
+ * @returns true: all copied
+ *         false: got SIGBUS, ie, media error
+ */
+static bool copy_mapped (uint8_T *dst, uint8_T const *src, uint32_T len)
+{
+    if (sigsetjmp (sigbusjmp, 0) != 0) {
+        sigbusarmed = 0;
+        return false;
+    }
+    sigbusarmed = 1;
+    memcpy (dst, src, len);
+    sigbusarmed = 0;
+    return true;
+}
+
+/**
+ * @brief SIGBUS from reading the -mmap mapping.
+ *        If a block is being checked, copied or decompressed in this thread,
+ *        jump back to have it handled like a read error.
+ *        Otherwise, it is a fault that was not expected, so give up.
+ */
+static void sigbushand (int signum)
+{
+    static char const msg[] = "ftbackup: unexpected SIGBUS\n";
+
+    if (sigbusarmed) siglongjmp (sigbusjmp, 1);
+    UNUSED (write (STDERR_FILENO, msg, sizeof msg - 1));
+    _exit (EX_SSIO);
+}
+
+/**
+ * @brief Scan forward trying to read or recover block lastseqno.
+ * @returns pointer to block from get_block()
+ *          also, readoffset incremented past what was last read
+ *                xorblocks, gotxors updated
+ *                possibly intermediate blocks stacked in blkwindow
+ */
+Block *FTBReader::read_or_recover_block ()
+{
+    Block *block;
+    bool hashok;
+    int rc;
+    uint32_T bs, bsnh, i, xorno;
+    uint64_T lastreadoffs;
+
+    bs = 1 << l2bs;
+    if (readoffset % bs != 0) abort ();
+    bsnh = bs - hashsize ();
+
+    /*
+     * Maybe block has already been read by a previous recovery operation.
+     * If found, take it out of the window and return.
+     */
+    block = unstack_block (lastseqno);
+    if (block != NULL) return block;
+
+    /*
+     * If no XOR blocks, just a simple read will hopefully work.
+     * If read error, return NULL and hopefully there is stuff later in the saveset we can process.
+     * If end of file, print error message and exit cuz there's nothing more that can be handled.
+     */
+    if (xorgc == 0) {
+
+        // if any stacked blocks, they are all ahead of us, so return NULL for now.
+        // all any more reading could do is stack more blocks even farther out.
+        if (blkwinused > 0) goto unrecoverable;
+
+        // read from saveset
+        block = get_block ();
+noxoread:
+        lastreadoffs = readoffset;
+        rc = read_ssblock (&block, &hashok);
+
+        // if read error, output message and read again.
+        // if the lastseqno block is lost, it will be detected on next read.
+        if (rc < 0) {
+            read_error ("ftbackup: pread(%llu) saveset error: %s\n", lastreadoffs, mystrerr (errno));
+            goto noxoread;
+        }
+
+        // if short read, means we are at the end of file and there is nothing more we can do.
+        if ((uint32_T) rc < bs) {
+            read_error ("ftbackup: pread(%llu) saveset error: end of file\n", lastreadoffs);
+            free_block (block);
+            throw new EndOfSSFile ();
+        }
+
+        // read_ssblock() decrypted it if needed and checked the digest
+        if (!hashok) {
+            read_error ("ftbackup: pread(%llu) saveset error: block digest not valid\n", lastreadoffs);
+            goto noxoread;
+        }
+
+        // make sure the magic number etc are valid
+        // if not, treat it just like a read error
+        if (!blockisvalid (block)) {
+            read_error ("ftbackup: pread(%llu) saveset error: block not valid\n", lastreadoffs);
+            goto noxoread;
+        }
+
+        // make sure we aren't missing any blocks.
+        // if there is a gap, save this block for later
+        // and return a NULL cuz we are missing this one.
+        if (block->seqno < lastseqno) goto noxoread;
+        if (block->seqno > lastseqno) {
+            stack_block (block);
+            block = NULL;
+            goto unrecoverable;
+        }
+
+        // we got the block asked for
+        return block;
+    }
+
+    /*
+     * If we have completed processing all XOR blocks in the span containing lastseqno,
+     * it is hopeless to read more as it can't be recovered.
+     *
+     *   lastxorno / xorgc = number of fully completed spans including all XOR blocks
+     *   lastseqno-1 / xorsc / xorgc = zero-based span number for wanted block
+     *
+     *   span0 (1)(2) span1 (3)(4) span2  ...
+     *    lastxorno^  ^lastseqno
+     *
+     * So if we want a block in span #1 and have completed 1 span, keep reading.
+     *
+     * Note that lastxorno is always a multiple of xorgc, ie, we have either
+     * completed all XOR blocks or we haven't.
+     */
+    while (lastxorno <= (lastseqno - 1) / xorsc) {
+
+        /*
+         * Try to read a whole 'bs' sized block.
+         * The next read will be at beginning of next block no matter if this one was an error or not.
+         */
+        if (block == NULL) block = get_block ();
+        lastreadoffs = readoffset;
+        rc = read_ssblock (&block, &hashok);
+
+        /*
+         * If it failed to read, output message and try to read next.
+         */
+        if ((rc < 0) || ((uint32_T) rc != bs)) {
+            read_error ("ftbackup: pread(%llu) saveset error: %s\n", lastreadoffs,
+                    ((rc > 0) ? "partial read" : (rc == 0) ? "end of file" : mystrerr (errno)));
+
+            /*
+             * If IO error, try to read more.
+             */
+            if (rc != 0) continue;
+
+            /*
+             * If end of file with no stacked blocks, we are done
+             * as there isn't anything more to process.  Otherwise,
+             * say the lastseqno is unrecoverable and we will be
+             * called back later to process the stacked blocks.
+             */
+            if (blkwinused == 0) {
+                free_block (block);
+                throw new EndOfSSFile ();
+            }
+            goto unrecoverable;
+        }
+
+        /*
+         * read_ssblock() decrypted it if needed and checked the digest.
+         */
+        if (!hashok) {
+            read_error ("ftbackup: pread(%llu) saveset error: block digest not valid\n", lastreadoffs);
+            continue;
+        }
+
+        /*
+         * They should all have basic validity.
+         */
+        if (!blockbaseisvalid (block)) {
+            read_error ("ftbackup: pread(%llu) saveset error: block invalid\n", lastreadoffs);
+            continue;
+        }
+
+        /*
+         * If just read an XOR block, XOR the data in and hopefully recover a missing block.
+         */
+        if (block->xorbc > 0) {
+            xorno = block->xorno;
+
+            /*
+             * Make sure this XOR block is for what we think is the current span.
+             * If it is old, it is a duplicate somehow, so just ignore it.
+             * If it is newer, then we missed a whole span, so reset all the XOR groups first.
+             *
+             * lastxorno = number of whole XOR blocks completed before current span,
+             *   ie, this one should be at lastxorno+1..lastxorno+xorgc.
+             *
+             * The normal case:
+             *     ... (1)(2) ... (3)(4)
+             *    lastxorno^   ^   ^block->xorno (could be 3 or 4 actually)
+             * xorblocks covers^
+             *
+             * The case where lots of stuff missing:
+             *     ... (1)(2) ... (3)(4) ... (5)(6)
+             *    lastxorno^   ^         ^ ^  ^block->xorno (could be 5 or 6 actually)
+             * xorblocks covers^         ^-^all of this stuff missing
+             *                              so lastxorno never got set to 4
+             */
+            if (xorno <= lastxorno) continue;
+            if (xorno >  lastxorno + xorgc) {
+                lastxorno = xorno - xorgc;
+                memset (gotxors, 0, xorgc * sizeof *gotxors);
+                for (i = 0; i < xorgc; i ++) memset (xorblocks[i], 0, bsnh);
+            }
+
+            /*
+             * Get which XOR group this XOR block beints to, ie, which of (3) or (4) it is.
+             */
+            i = (xorno - 1) % xorgc;
+            if (gotxors[i] + 1 == block->xorbc) {
+
+                /*
+                 * There is exactly one missing data block from the group,
+                 * so XORing in this one should recover the missing block.
+                 */
+                xorblockdata (block, xorblocks[i], bsnh);
+
+                /*
+                 * The result should be a valid data block.
+                 * If not, just go on reading.
+                 */
+                memcpy (block->magic, BLOCK_MAGIC, 8);
+                block->xorno = 0;
+                block->xorbc = 0;
+                if (!blockisvalid (block)) {
+                    read_error ("ftbackup: recovered block at %llu is not valid\n", lastreadoffs);
+                    continue;
+                }
+                read_error ("ftbackup: block %u recovered via XOR\n", block->seqno);
+
+                /*
+                 * If it is the block we are looking for, we are all done.
+                 */
+                if (block->seqno == lastseqno) return block;
+
+                /*
+                 * Not looking for it yet, stack it for later if we will want it later.
+                 */
+                if (block->seqno > lastseqno) {
+                    stack_block (block);
+                    block = NULL;
+                }
+            }
+
+            /*
+             * If there aren't any missing data blocks, check the XOR just to be sure and
+             * output a warning if not.
+             */
+            else if (gotxors[i] == block->xorbc) {
+                xorblockdata (block, xorblocks[i], bsnh);
+                memset (block->magic, 0, sizeof block->magic);
+                block->xorno = 0;
+                block->xorbc = 0;
+                for (i = 0; i < bsnh; i ++) {
+                    if (((uint8_T *)block)[i] != 0) {
+                        read_error ("ftbackup: xor block %u verify error\n", xorno);
+                        break;
+                    }
+                }
+            }
+
+            continue;
+        }
+
+        /*
+         * If data block is not valid, treat it like a read error, ie,
+         * ignore it and try to read next block.
+        */
+        if (!blockisvalid (block)) continue;
+
+        /*
+         * Should never get a duplicate, ignore if so.
+         */
+        if (block->seqno < lastseqno) continue;
+
+        /*
+         * If first data block in span, clear all XOR groups.
+         *
+         *   lastxorno / xorgc = previously completed spans
+         *   block->seqno-1 / xorgc / xorsc = which zero-based span we are in
+         *
+         *   span0 (1)(2) span1 (3)(4) span2 ...
+         *
+         * So if lastxorno points to (2) and we are in span1, that is ok.
+         * But if we are in span2, clear the XOR groups and point lastxorno at (4).
+         */
+        i = ((block->seqno - 1) / xorgc / xorsc) * xorgc;
+        if (lastxorno < i) {
+            lastxorno = i;
+            memset (gotxors, 0, xorgc * sizeof *gotxors);
+            for (i = 0; i < xorgc; i ++) memset (xorblocks[i], 0, bsnh);
+        }
+
+        /*
+         * Valid data block, XOR it into group.
+         */
+        i = (block->seqno - 1) % xorgc;
+        xorblockdata (xorblocks[i], block, bsnh);
+        gotxors[i] ++;
+
+        /*
+         * If it is the block we are looking for, we are all done.
+         */
+        if (block->seqno == lastseqno) return block;
+
+        /*
+         * Not the block we want, stack it for later and read another.
+         */
+        stack_block (block);
+        block = NULL;
+    }
+    block_error (lastseqno, "ftbackup: reached end of xor span\n");
+
+unrecoverable:
+    if (block != NULL) free_block (block);
+    block_error (lastseqno, "ftbackup: block %u unrecoverable\n", lastseqno);
+    throw new LostSSBlock (lastseqno);
+}
+
+/**
+ * @brief Read the saveset block at readoffset, decrypt it and check its digest.
+ *        With -rthreads, it has already been read and decrypted by the read-ahead
+ *        and worker threads, so just swap buffers with the oldest one they did.
+ *        With -mmap, it is taken from the mapping instead of read with pread().
+ * @param block = buffer from get_block() to read into, or block returned last time
+ *                returns pointer to buffer with block in it
+ * @param hashok = returns whether the digest is valid (only if whole block read)
+ * @returns what wrapped_pread() returned, errno set if error
+ *          readoffset incremented past the block
+ */
+long FTBReader::read_ssblock (Block **block, bool *hashok)
+{
+    Block *b;
+    int err;
+    long rc;
+    ReadJob *job;
+    uint32_T bs;
 
     bs = 1 << l2bs;
-    if (readoffset % bs != 0) abort ();
-    bsnh = bs - hashsize ();
 
-    /*
-     * Maybe block has already been read by a previous recovery operation.
-     * If found, unlink it from list and return.
-     */
-    for (lLinkedBlock = &linkedBlocks; (linkedBlock = *lLinkedBlock) != NULL; lLinkedBlock = &linkedBlock->next) {
-        if (linkedBlock->block.seqno == lastseqno) {
-            *lLinkedBlock = linkedBlock->next;
-            return linkedBlock;
-        }
+    if (rdjobs == NULL) {
+        if (ismapped (*block)) {
+            free_block (*block);
+            *block = get_block ();
+        }
+        if (opt_mmap && mapped_read (block, readoffset, bs, hashok)) {
+            readoffset += bs;
+            return bs;
+        }
+        rc = wrapped_pread (*block, bs, readoffset);
+        readoffset += bs;
+        *hashok = ((rc >= 0) && ((uint32_T) rc == bs) && decrypt_block (*block, bs));
+        return rc;
+    }
+
+    /*
+     * Wait for the oldest block to be read and decrypted.
+     * While waiting, maybe the read-ahead thread wants us to prompt for what to do about a read error.
+     */
+    job = &rdjobs[rdoldest];
+    pthread_mutex_lock (&rdmutex);
+    while (!job->done) {
+        if (rdprompt) {
+            pthread_mutex_unlock (&rdmutex);
+            errno = rdprerr;
+            rc  = handle_pread_error (rdprbuf, rdprlen, rdprpos);
+            err = errno;
+            pthread_mutex_lock (&rdmutex);
+            rdprrc   = rc;
+            rdprerr  = err;
+            rdprompt = false;
+            pthread_cond_broadcast (&rdcond);
+            continue;
+        }
+        pthread_cond_wait (&rdcond, &rdmutex);
+    }
+    pthread_mutex_unlock (&rdmutex);
+    if (job->pos != readoffset) abort ();
+
+    /*
+     * Take its buffer and give it ours to read a later block into.
+     */
+    b   = job->block;
+    job->block = *block;
+    *block = b;
+    rc  = job->rc;
+    err = job->err;
+    *hashok = job->hashok;
+
+    pthread_mutex_lock (&rdmutex);
+    job->done = false;
+    job->busy = false;
+    pthread_cond_broadcast (&rdcond);
+    pthread_mutex_unlock (&rdmutex);
+
+    rdoldest = (rdoldest + 1) % rdnjobs;
+    readoffset += bs;
+    errno = err;
+    return rc;
+}
+
+/**
+ * @brief Start the -rthreads threads:
+ *          read-ahead thread reads blocks from saveset in order
+ *          worker threads decrypt them and check their digests
+ *          file writing thread writes file data to disk
+ *        leaving the calling thread to recover blocks, decompress and create files.
+ *        Called once block size is known and readoffset is just past the first block.
+ */
+void FTBReader::rdpipe_start ()
+{
+    int i, rc;
+    uint32_T j;
+    uint8_T *buf;
+
+    rdnjobs = opt_rthreads * RD_PERTHREAD + RQ_DEFDEPTH;
+    rdjobs  = (ReadJob *) calloc (rdnjobs, sizeof *rdjobs);
+    if (rdjobs == NULL) NOMEM ();
+    for (j = 0; j < rdnjobs; j ++) {
+        rdjobs[j].block = malloc_block ();
+    }
+    rdoldest   = 0;
+    rdreadoffs = readoffset;
+    rdstop     = false;
+    rdworkqueue.setdepth (rdnjobs);
+
+    rwbufqueue.setdepth (RD_NWBUFS);
+    rwritequeue.setdepth (RD_NWBUFS + 1);
+    for (i = 0; i < RD_NWBUFS; i ++) {
+        buf = (uint8_T *) malloc (FILEIOSIZE);
+        if (buf == NULL) NOMEM ();
+        rwbufqueue.enqueue (buf);
+    }
+
+    rdhandls = (pthread_t *) malloc (opt_rthreads * sizeof *rdhandls);
+    if (rdhandls == NULL) NOMEM ();
+    for (i = 0; i < opt_rthreads; i ++) {
+        rc = pthread_create (&rdhandls[i], NULL, rdwork_thread_wrapper, this);
+        if (rc != 0) SYSERR (pthread_create, rc);
+    }
+    rc = pthread_create (&rwhandl, NULL, rwrite_thread_wrapper, this);
+    if (rc != 0) SYSERR (pthread_create, rc);
+    rc = pthread_create (&rahandl, NULL, rahead_thread_wrapper, this);
+    if (rc != 0) SYSERR (pthread_create, rc);
+}
+
+/**
+ * @brief Stop the -rthreads threads, if running, and free what they were using.
+ *        Must be called before closing the saveset as the read-ahead thread reads it.
+ */
+void FTBReader::rdpipe_stop ()
+{
+    FileWrite fw;
+    int i, rc;
+    uint32_T j;
+
+    if (rdjobs == NULL) return;
+
+    pthread_mutex_lock (&rdmutex);
+    rdstop = true;
+    pthread_cond_broadcast (&rdcond);
+    pthread_mutex_unlock (&rdmutex);
+    rc = pthread_join (rahandl, NULL);
+    if (rc != 0) SYSERR (pthread_join, rc);
+
+    for (i = 0; i < opt_rthreads; i ++) {
+        rdworkqueue.enqueue (NULL);
+    }
+    for (i = 0; i < opt_rthreads; i ++) {
+        rc = pthread_join (rdhandls[i], NULL);
+        if (rc != 0) SYSERR (pthread_join, rc);
+    }
+    free (rdhandls);
+    rdhandls = NULL;
+
+    memset (&fw, 0, sizeof fw);
+    rwritequeue.enqueue (fw);
+    rc = pthread_join (rwhandl, NULL);
+    if (rc != 0) SYSERR (pthread_join, rc);
+    for (i = 0; i < RD_NWBUFS; i ++) {
+        free (rwbufqueue.dequeue ());
+    }
+
+    for (j = 0; j < rdnjobs; j ++) {
+        free (rdjobs[j].block);
+    }
+    free (rdjobs);
+    rdjobs  = NULL;
+    rdnjobs = 0;
+}
+
+/**
+ * @brief Read blocks from the saveset in order and pass them to the worker threads.
+ *        Keeps up to rdnjobs blocks ahead of read_ssblock().
+ */
+void *FTBReader::rahead_thread_wrapper (void *ftbr)
+{
+    return ((FTBReader *) ftbr)->rahead_thread ();
+}
+void *FTBReader::rahead_thread ()
+{
+    ReadJob *job;
+    uint32_T bs, i;
+
+    bs = 1 << l2bs;
+
+    for (i = 0;; i = (i + 1) % rdnjobs) {
+
+        /*
+         * Wait for read_ssblock() to be done with the block that was in this slot.
+         */
+        job = &rdjobs[i];
+        pthread_mutex_lock (&rdmutex);
+        while (job->busy && !rdstop) {
+            pthread_cond_wait (&rdcond, &rdmutex);
+        }
+        pthread_mutex_unlock (&rdmutex);
+        if (rdstop) break;
+        job->busy = true;
+
+        /*
+         * Read block into it.
+         */
+        job->pos    = rdreadoffs;
+        job->rc     = wrapped_pread (job->block, bs, rdreadoffs);
+        job->err    = errno;
+        job->hashok = false;
+        rdreadoffs += bs;
+
+        /*
+         * If whole block read, have a worker decrypt it, otherwise pass error along as is.
+         */
+        if ((job->rc >= 0) && ((uint32_T) job->rc == bs)) {
+            rdworkqueue.enqueue (job);
+        } else {
+            pthread_mutex_lock (&rdmutex);
+            job->done = true;
+            pthread_cond_broadcast (&rdcond);
+            pthread_mutex_unlock (&rdmutex);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Read error on the read-ahead thread.  Prompting the user changes the current
+ *        directory, which would upset files being created with relative names, so have
+ *        read_ssblock() prompt on the main thread while we wait.
+ */
+long FTBReader::rahead_prompt (void *buf, long len, uint64_T pos)
+{
+    int err;
+    long rc;
+
+    pthread_mutex_lock (&rdmutex);
+    rdprbuf  = buf;
+    rdprlen  = len;
+    rdprpos  = pos;
+    rdprerr  = errno;
+    rdprrc   = -1;
+    rdprompt = true;
+    pthread_cond_broadcast (&rdcond);
+    while (rdprompt && !rdstop) {
+        pthread_cond_wait (&rdcond, &rdmutex);
+    }
+    rdprompt = false;
+    rc  = rdprrc;
+    err = rdprerr;
+    pthread_mutex_unlock (&rdmutex);
+
+    errno = err;
+    return rc;
+}
+
+/**
+ * @brief Decrypt blocks read by the read-ahead thread and check their digests.
+ *        Each thread has its own hasher and cipher contexts.
+ */
+void *FTBReader::rdwork_thread_wrapper (void *ftbr)
+{
+    return ((FTBReader *) ftbr)->rdwork_thread ();
+}
+void *FTBReader::rdwork_thread ()
+{
+    CryptoPP::BlockCipher *blkdecipher, *blkencipher;
+    CryptoPP::HashTransformation *blkhasher;
+    ReadJob *job;
+    uint32_T bs;
+
+    bs = 1 << l2bs;
+    blkhasher   = newhasher ();
+    blkdecipher = newcipher (false);
+    blkencipher = newcipher (true);
+
+    while ((job = rdworkqueue.dequeue ()) != NULL) {
+        job->hashok = decrypt_block (job->block, bs, blkhasher, blkdecipher, blkencipher);
+
+        pthread_mutex_lock (&rdmutex);
+        job->done = true;
+        pthread_cond_broadcast (&rdcond);
+        pthread_mutex_unlock (&rdmutex);
+    }
+
+    delete blkhasher;
+    if (blkdecipher != NULL) delete blkdecipher;
+    if (blkencipher != NULL) delete blkencipher;
+
+    return NULL;
+}
+
+/**
+ * @brief Write file data queued by read_regular().
+ *        After a write error, the rest of the file's data is discarded.
+ */
+void *FTBReader::rwrite_thread_wrapper (void *ftbr)
+{
+    return ((FTBReader *) ftbr)->rwrite_thread ();
+}
+void *FTBReader::rwrite_thread ()
+{
+    FileWrite fw;
+    int rc;
+    uint32_T wofs;
+
+    while ((fw = rwritequeue.dequeue ()).buf != NULL) {
+        if (!__atomic_load_n (&rwfailed, __ATOMIC_ACQUIRE)) {
+            for (wofs = 0; wofs < fw.len; wofs += rc) {
+                rc = tfs->fswrite (fw.fd, fw.buf + wofs, fw.len - wofs);
+                if (rc <= 0) {
+                    fprintf (stderr, "ftbackup: write(%s) error: %s\n", fw.name, ((rc == 0) ? "end of file" : mystrerr (errno)));
+                    __atomic_store_n (&rwfailed, true, __ATOMIC_RELEASE);
+                    break;
+                }
+            }
+        }
+        rwbufqueue.enqueue (fw.buf);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Wait for the file writing thread to write everything queued to it.
+ * @returns true: all written (or no file writing thread)
+ *         false: there was a write error (message printed)
+ */
+bool FTBReader::rwrite_drain ()
+{
+    bool ok;
+    int i;
+    uint8_T *bufs[RD_NWBUFS];
+
+    if (rdjobs == NULL) return true;
+
+    // it is done with everything once it has given all the buffers back
+    for (i = 0; i < RD_NWBUFS; i ++) {
+        bufs[i] = rwbufqueue.dequeue ();
+    }
+    for (i = 0; i < RD_NWBUFS; i ++) {
+        rwbufqueue.enqueue (bufs[i]);
+    }
+
+    ok = !rwfailed;
+    rwfailed = false;
+    return ok;
+}
+
+/**
+ * @brief Start the -wthreads threads that restore regular files.
+ *        Each file is a job with its own queue of data buffers, so a thread can
+ *        be finishing one file while the next is being read from the saveset.
+ */
+void FTBReader::wpool_start ()
+{
+    int i, rc;
+    uint32_T j;
+    uint8_T *buf;
+
+    wjnjobs = opt_wthreads * 2;
+    wjnbufs = opt_wthreads * WR_PERTHREAD;
+    wjobs   = new WriteJob[wjnjobs];
+    for (j = 0; j < wjnjobs; j ++) {
+        wjobs[j].hdr     = NULL;
+        wjobs[j].dstname = NULL;
+        wjobs[j].busy    = false;
+        wjobs[j].dataqueue.setdepth (wjnbufs + 1);
+    }
+    wjobqueue.setdepth (wjnjobs + opt_wthreads);
+    wjbufqueue.setdepth (wjnbufs);
+    for (j = 0; j < wjnbufs; j ++) {
+        buf = (uint8_T *) malloc (FILEIOSIZE);
+        if (buf == NULL) NOMEM ();
+        wjbufqueue.enqueue (buf);
+    }
+    wjok = true;
+
+    wjhandls = (pthread_t *) malloc (opt_wthreads * sizeof *wjhandls);
+    if (wjhandls == NULL) NOMEM ();
+    for (i = 0; i < opt_wthreads; i ++) {
+        rc = pthread_create (&wjhandls[i], NULL, wjob_thread_wrapper, this);
+        if (rc != 0) SYSERR (pthread_create, rc);
+    }
+}
+
+/**
+ * @brief Wait for the -wthreads threads to finish all queued files, then stop them.
+ *        wjok tells if all files were restored successfully.
+ */
+void FTBReader::wpool_stop ()
+{
+    int i, rc;
+    uint32_T j;
+
+    if (wjobs == NULL) return;
+
+    for (i = 0; i < opt_wthreads; i ++) {
+        wjobqueue.enqueue (NULL);
+    }
+    for (i = 0; i < opt_wthreads; i ++) {
+        rc = pthread_join (wjhandls[i], NULL);
+        if (rc != 0) SYSERR (pthread_join, rc);
+    }
+    free (wjhandls);
+    wjhandls = NULL;
+
+    wpool_reap ();
+    for (j = 0; j < wjnbufs; j ++) {
+        free (wjbufqueue.dequeue ());
+    }
+    delete[] wjobs;
+    wjobs   = NULL;
+    wjnjobs = 0;
+    wjnbufs = 0;
+}
+
+/**
+ * @brief Queue regular file to a -wthreads thread, waiting for a free job if necessary.
+ *        Caller then queues the file data to job->dataqueue as it reads it.
+ */
+FTBReader::WriteJob *FTBReader::wpool_newjob (Header const *hdr, char const *dstname)
+{
+    uint32_T j;
+    WriteJob *job;
+
+    pthread_mutex_lock (&wjmutex);
+    while (true) {
+        for (j = 0; j < wjnjobs; j ++) {
+            job = &wjobs[j];
+            if (!job->busy) goto gotit;
+        }
+        pthread_cond_wait (&wjcond, &wjmutex);
+    }
+gotit:
+    pthread_mutex_unlock (&wjmutex);
+    wpool_reap ();
+
+    job->hdr = (Header *) malloc (sizeof *hdr + hdr->nameln);
+    if (job->hdr == NULL) NOMEM ();
+    memcpy (job->hdr, hdr, sizeof *hdr + hdr->nameln);
+    job->dstname = strdup (dstname);
+    if (job->dstname == NULL) NOMEM ();
+    job->created = false;
+    job->ok      = false;
+    job->busy    = true;
+    wjobqueue.enqueue (job);
+    return job;
+}
+
+/**
+ * @brief Wait for -wthreads threads to finish restoring files whose names begin with the given string.
+ * @param name = name or directory name prefix
+ * @param len = number of chars to compare, strlen+1 to match the whole name
+ */
+void FTBReader::wpool_wait (char const *name, uint32_T len)
+{
+    uint32_T j;
+    WriteJob *job;
+
+    if (wjobs == NULL) return;
+
+    pthread_mutex_lock (&wjmutex);
+    for (j = 0; j < wjnjobs; j ++) {
+        job = &wjobs[j];
+        while (job->busy && (strncmp (job->dstname, name, len) == 0)) {
+            pthread_cond_wait (&wjcond, &wjmutex);
+        }
+    }
+    pthread_mutex_unlock (&wjmutex);
+    wpool_reap ();
+}
+
+/**
+ * @brief Collect results of files the -wthreads threads have finished.
+ *        A file that couldn't be created is taken out of the hardlinkable files list,
+ *        as read_regular() does when it creates the file itself.
+ */
+void FTBReader::wpool_reap ()
+{
+    uint32_T j;
+    WriteJob *job;
+
+    pthread_mutex_lock (&wjmutex);
+    for (j = 0; j < wjnjobs; j ++) {
+        job = &wjobs[j];
+        if (!job->busy && (job->hdr != NULL)) {
+            if (!job->ok) wjok = false;
+            if (!job->created && (job->hdr->fileno < inodesused)) {
+                free (inodesname[job->hdr->fileno]);
+                inodesname[job->hdr->fileno] = NULL;
+            }
+            free (job->hdr);
+            free (job->dstname);
+            job->hdr     = NULL;
+            job->dstname = NULL;
+        }
+    }
+    pthread_mutex_unlock (&wjmutex);
+}
+
+/**
+ * @brief Restore regular files queued by read_regular().
+ */
+void *FTBReader::wjob_thread_wrapper (void *ftbr)
+{
+    return ((FTBReader *) ftbr)->wjob_thread ();
+}
+void *FTBReader::wjob_thread ()
+{
+    bool ok;
+    WriteJob *job;
+
+    while ((job = wjobqueue.dequeue ()) != NULL) {
+        ok = write_job (job);
+        pthread_mutex_lock (&wjmutex);
+        job->ok   = ok;
+        job->busy = false;
+        pthread_cond_broadcast (&wjcond);
+        pthread_mutex_unlock (&wjmutex);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Create, write and close a regular file, then set its attributes.
+ *        After an error, the rest of the file's data is discarded.
+ * @returns true: success
+ *         false: failure (message printed)
+ */
+bool FTBReader::write_job (WriteJob *job)
+{
+    char *tmpname;
+    FileWrite fw;
+    int fd, rc;
+
+    tmpname = (char *) alloca (strlen (job->dstname) + 15);
+    sprintf (tmpname, "%s.$$ftbackup$$", job->dstname);
+    fd = creat_regular (job->hdr, job->dstname, tmpname);
+    job->created = (fd >= 0);
+
+    while ((fw = job->dataqueue.dequeue ()).buf != NULL) {
+        if (fd >= 0) fd = write_regular (fd, fw.buf, fw.len, job->dstname);
+        wjbufqueue.enqueue (fw.buf);
+    }
+
+    if (fw.len != 0) {
+        if (fd >= 0) {
+            fprintf (stderr, "ftbackup: file %s corrupt due to unrecoverable saveset media errors\n", job->dstname);
+            tfs->fsclose (fd);
+        }
+        return false;
+    }
+
+    if ((fd >= 0) && ((rc = tfs->fsclose (fd, job->dstname, tmpname, opt_overwrite)) < 0)) {
+        fprintf (stderr, "ftbackup: close(%s) error %s [%d]\n", job->dstname, mystrerr (errno), rc);
+        fd = -1;
+    }
+    if (fd < 0) return false;
+
+    return restore_attrs (job->hdr, job->dstname);
+}
+
+/**
+ * @brief Start the -dthreads threads that decode the saveset in chunks.
+ *
+ *        The data blocks are split into chunks of whole XOR spans, and each thread
+ *        decodes a chunk at a time with its own file descriptor.  It starts at the
+ *        first file header in the chunk, the way read_block() finds one after a lost
+ *        block, and decodes each file whose header starts in the chunk to the end of
+ *        its data, even if that is in later chunks.  So the chunk after starts right
+ *        at the header after the last file.
+ *
+ *        The bytes read_raw() would return are passed to the main thread in a queue
+ *        per chunk, along with where read_block() resynced and what skip_data() and
+ *        read_or_recover_block() did.  The main thread takes the chunks in order, so
+ *        it sees the files in fileno order as if it had decoded them itself and does
+ *        the selecting, restoring, hardlinks and directory times as usual.
+ */
+void FTBReader::pdpool_start ()
+{
+    int i, rc;
+    uint32_T j, spanblks;
+
+    pdsegno = thissegno;
+    if (sssegname != NULL) {
+        pdsegname = strdup (sssegname);
+        if (pdsegname == NULL) NOMEM ();
+    }
+
+    /*
+     * Get block size and XOR counts, and make sure blocks are where block_offset() says.
+     */
+    read_first_block ();
+    if ((pdsegname == NULL) || !blkseekable) {
+        fprintf (stderr, "ftbackup: saveset can't be read in chunks, decoding in main thread\n");
+        free (pdsegname);
+        pdsegname = NULL;
+        return;
+    }
+
+    spanblks    = (xorgc > 0) ? xorgc * xorsc : 1;
+    pdchunkblks = (PD_CHUNKSIZE >> l2bs) / spanblks * spanblks;
+    if (pdchunkblks == 0) pdchunkblks = spanblks;
+
+    pdnjobs = opt_dthreads * 2;
+    pdjobs  = new PDJob[pdnjobs];
+    for (j = 0; j < pdnjobs; j ++) {
+        memset (&pdjobs[j].piece, 0, sizeof pdjobs[j].piece);
+        pdjobs[j].pieces.setdepth (PD_SPOOLBUFS);
+    }
+    pdbufqueue.setdepth (pdnjobs * (PD_SPOOLBUFS + 1) + 1);
+    memset (&pdpiece, 0, sizeof pdpiece);
+    pdpieceofs = 0;
+    pdmsgofs   = readoffset - (1 << l2bs);  // read_first_block() quietly skips bad blocks before the first good one
+    pdmsgseqno = 0;
+    pdhead = 0;
+    pdnext = 0;
+    pdlast = 0xFFFFFFFFU;
+    pdstop = false;
+
+    pdhandls = (pthread_t *) malloc (opt_dthreads * sizeof *pdhandls);
+    if (pdhandls == NULL) NOMEM ();
+    for (i = 0; i < opt_dthreads; i ++) {
+        rc = pthread_create (&pdhandls[i], NULL, pdwork_thread_wrapper, this);
+        if (rc != 0) SYSERR (pthread_create, rc);
+    }
+}
+
+/**
+ * @brief Stop the -dthreads threads, discarding whatever they decoded that wasn't used.
+ */
+void FTBReader::pdpool_stop ()
+{
+    int i, rc;
+    PDPiece piece;
+    uint32_T chunk, next;
+    uint8_T *buf;
+
+    if (pdjobs == NULL) return;
+
+    pthread_mutex_lock (&pdmutex);
+    __atomic_store_n (&pdstop, true, __ATOMIC_RELEASE);
+    next = pdnext;
+    pthread_cond_broadcast (&pdcond);
+    pthread_mutex_unlock (&pdmutex);
+
+    if (pdpiece.buf != NULL) pdbufqueue.enqueue (pdpiece.buf);
+    memset (&pdpiece, 0, sizeof pdpiece);
+    for (chunk = pdhead; chunk < next; chunk ++) {
+        do {
+            piece = pdjobs[chunk%pdnjobs].pieces.dequeue ();
+            if (piece.kind == PD_MSG) free (piece.buf);
+            else if (piece.buf != NULL) pdbufqueue.enqueue (piece.buf);
+        } while (piece.kind != PD_END);
+    }
+
+    for (i = 0; i < opt_dthreads; i ++) {
+        rc = pthread_join (pdhandls[i], NULL);
+        if (rc != 0) SYSERR (pthread_join, rc);
     }
+    free (pdhandls);
+    pdhandls = NULL;
+
+    while (pdbufqueue.trydequeue (&buf)) free (buf);
+    delete[] pdjobs;
+    pdjobs  = NULL;
+    pdnjobs = 0;
+    free (pdsegname);
+    pdsegname = NULL;
+}
 
-    /*
-     * If no XOR blocks, just a simple read will hopefully work.
-     * If read error, return NULL and hopefully there is stuff later in the saveset we can process.
-     * If end of file, print error message and exit cuz there's nothing more that can be handled.
-     */
-    if (xorgc == 0) {
+/**
+ * @brief Main thread's read_raw() with -dthreads, the threads have already done the decoding.
+ */
+void FTBReader::pd_read (void *buf, uint32_T len)
+{
+    uint32_T n;
 
-        // if any stacked blocks, they are all ahead of us, so return NULL for now.
-        // all any more reading could do is stack more blocks even farther out.
-        if (linkedBlocks != NULL) goto unrecoverable;
+    while (len > 0) {
+        if ((pdpiece.kind == PD_NONE) || ((pdpiece.kind == PD_DATA) && (pdpieceofs >= pdpiece.len))) {
+            pd_next ();
+        }
+        switch (pdpiece.kind) {
+            case PD_DATA: {
+                n = pdpiece.len - pdpieceofs;
+                if (n > len) n = len;
+                memcpy (buf, pdpiece.buf + pdpieceofs, n);
+                buf  = (uint8_T *) buf + n;
+                len -= n;
+                pdpieceofs += n;
+                break;
+            }
 
-        // read from saveset
-        linkedBlock = (LinkedBlock *) malloc (bs + sizeof *linkedBlock);
-        if (linkedBlock == NULL) NOMEM ();
-noxoread:
-        lastreadoffs = readoffset;
-        rc = wrapped_pread (&linkedBlock->block, bs, readoffset);
-        readoffset += bs;
+            // chunk starts at its first header, which is the next one anyway
+            case PD_RESYNC: {
+                pdpiece.kind = PD_NONE;
+                break;
+            }
 
-        // if read error, output message and read again.
-        // if the lastseqno block is lost, it will be detected on next read.
-        if (rc < 0) {
-            fprintf (stderr, "ftbackup: pread(%llu) saveset error: %s\n", lastreadoffs, mystrerr (errno));
-            goto noxoread;
-        }
+            case PD_LOST: {
+                pdpiece.kind = PD_NONE;
+                throw new LostSSBlock (0);
+            }
 
-        // if short read, means we are at the end of file and there is nothing more we can do.
-        if ((uint32_T) rc < bs) {
-            fprintf (stderr, "ftbackup: pread(%llu) saveset error: end of file\n", lastreadoffs);
-            throw new EndOfSSFile ();
-        }
+            case PD_EOF: {
+                throw new EndOfSSFile ();
+            }
 
-        // maybe decrypt the block
-        if (!decrypt_block (&linkedBlock->block, bs)) {
-            fprintf (stderr, "ftbackup: pread(%llu) saveset error: block digest not valid\n", lastreadoffs);
-            goto noxoread;
+            // threads only skip data that select_file() says to skip
+            default: abort ();
         }
+    }
+}
 
-        // make sure the magic number etc are valid
-        // if not, treat it just like a read error
-        if (!blockisvalid (&linkedBlock->block)) {
-            fprintf (stderr, "ftbackup: pread(%llu) saveset error: block not valid\n", lastreadoffs);
-            goto noxoread;
+/**
+ * @brief Main thread's skip_data() with -dthreads.
+ * @returns true: the thread skipped over the data
+ *         false: the thread decoded the data, read it with read_raw()
+ */
+bool FTBReader::pd_skipped ()
+{
+    if ((pdpiece.kind == PD_DATA) && (pdpieceofs < pdpiece.len)) return false;
+    if ((pdpiece.kind == PD_NONE) || (pdpiece.kind == PD_DATA)) pd_next ();
+    if (pdpiece.kind != PD_SKIPPED) return false;
+    pdpiece.kind = PD_NONE;
+    return true;
+}
+
+/**
+ * @brief Main thread's read_block (true) with -dthreads, ie, after a lost block or bad header,
+ *        discard everything up to where the thread found the next file header.
+ * @returns block with just seqno and hdroffs filled in
+ */
+Block *FTBReader::pd_resynced ()
+{
+    while (true) {
+        if ((pdpiece.kind == PD_NONE) || (pdpiece.kind == PD_DATA)) pd_next ();
+        if (pdpiece.kind == PD_RESYNC) break;
+        if (pdpiece.kind == PD_EOF) throw new EndOfSSFile ();
+        pdpiece.kind = PD_NONE;
+    }
+    pdblock.seqno   = pdpiece.seqno;
+    pdblock.hdroffs = pdpiece.hdroffs;
+    pdpiece.kind    = PD_NONE;
+    return &pdblock;
+}
+
+/**
+ * @brief Get next piece from the -dthreads threads in saveset order,
+ *        freeing the previous one's buffer.  Once all of a chunk's pieces
+ *        have been gotten, its job can be given to a thread for another chunk.
+ */
+void FTBReader::pd_next ()
+{
+    bool ended;
+
+    if (pdpiece.buf != NULL) pdbufqueue.enqueue (pdpiece.buf);
+    pdpieceofs = 0;
+    while (true) {
+        pthread_mutex_lock (&pdmutex);
+        ended = (pdhead >= pdlast);
+        pthread_mutex_unlock (&pdmutex);
+        if (ended) {
+            memset (&pdpiece, 0, sizeof pdpiece);
+            pdpiece.kind = PD_EOF;
+            return;
         }
 
-        // make sure we aren't missing any blocks.
-        // if there is a gap, save this block for later
-        // and return a NULL cuz we are missing this one.
-        if (linkedBlock->block.seqno < lastseqno) goto noxoread;
-        if (linkedBlock->block.seqno > lastseqno) {
-            linkedBlock->next = NULL;
-            linkedBlocks = linkedBlock;
-            goto unrecoverable;
+        pdpiece = pdjobs[pdhead%pdnjobs].pieces.dequeue ();
+
+        /*
+         * A thread reads the start of its chunk looking for the first header,
+         * and the thread of the chunk before may have read it to finish its last file.
+         * So only print messages about the saveset past what earlier chunks' threads read.
+         */
+        if (pdpiece.kind == PD_MSG) {
+            if ((pdpiece.seqno != 0) ? (pdpiece.seqno > pdmsgseqno) : (pdpiece.rdofs > pdmsgofs)) {
+                fputs ((char *) pdpiece.buf, stderr);
+            }
+            free (pdpiece.buf);
+            continue;
         }
+        if (pdpiece.kind != PD_END) break;
+        if (pdmsgofs   < pdpiece.rdofs) pdmsgofs   = pdpiece.rdofs;
+        if (pdmsgseqno < pdpiece.seqno) pdmsgseqno = pdpiece.seqno;
+
+        pthread_mutex_lock (&pdmutex);
+        pdhead ++;
+        pthread_cond_broadcast (&pdcond);
+        pthread_mutex_unlock (&pdmutex);
+    }
 
-        // we got the block asked for
-        return linkedBlock;
+    // thread found its chunk is past the end without reading, say so like it would have
+    if ((pdpiece.kind == PD_EOF) && (pdpiece.seqno != 0)) {
+        fprintf (stderr, "ftbackup: pread(%llu) saveset error: end of file\n", block_offset (pdpiece.seqno));
+        pdpiece.seqno = 0;
     }
+}
+
+/**
+ * @brief Decode chunks of the saveset given out by pdpool_start() until told to stop.
+ */
+void *FTBReader::pdwork_thread_wrapper (void *ftbr)
+{
+    return ((FTBReader *) ftbr)->pdwork_thread ();
+}
+void *FTBReader::pdwork_thread ()
+{
+    PartReader pr;
+    PDJob *job;
+    uint32_T bs, chunk, i;
 
     /*
-     * If we have completed processing all XOR blocks in the span containing lastseqno,
-     * it is hopeless to read more as it can't be recovered.
-     *
-     *   lastxorno / xorgc = number of fully completed spans including all XOR blocks
-     *   lastseqno-1 / xorsc / xorgc = zero-based span number for wanted block
-     *
-     *   span0 (1)(2) span1 (3)(4) span2  ...
-     *    lastxorno^  ^lastseqno
-     *
-     * So if we want a block in span #1 and have completed 1 span, keep reading.
-     *
-     * Note that lastxorno is always a multiple of xorgc, ie, we have either
-     * completed all XOR blocks or we haven't.
+     * Set up a reader like this one once read_first_block() is done,
+     * only with its own segment file descriptor, block buffers and crypto contexts.
+     * Prompting for what to do about read errors is left to the main thread.
      */
-    while (lastxorno <= (lastseqno - 1) / xorsc) {
+    bs = 1 << l2bs;
+    pr.pdmain        = this;
+    pr.l2bs          = l2bs;
+    pr.xorgc         = xorgc;
+    pr.xorsc         = xorsc;
+    pr.hasher        = newhasher ();
+    pr.decipher      = newcipher (false);
+    pr.encipher      = newcipher (true);
+    pr.opt_idirect   = opt_idirect;
+    pr.opt_mmap      = opt_mmap;
+    pr.opt_readahead = opt_readahead;
+    pr.skipall       = true;
+    pr.mansegs       = mansegs;
+    pr.mannsegs      = mannsegs;
+    pr.ssbasename    = ssbasename;
+
+    // don't read ahead into chunks other threads are doing
+    if (pr.opt_readahead > block_offset (pdchunkblks + 1)) {
+        pr.opt_readahead = block_offset (pdchunkblks + 1);
+    }
 
-        /*
-         * Try to read a whole 'bs' sized block.
-         */
-        if (linkedBlock == NULL) linkedBlock = (LinkedBlock *) malloc (bs + sizeof *linkedBlock);
-        if (linkedBlock == NULL) NOMEM ();
-        lastreadoffs = readoffset;
-        rc = wrapped_pread (&linkedBlock->block, bs, lastreadoffs);
+    pr.sssegname = (char *) malloc (strlen (ssbasename) + strlen (pdsegname) + SEGNODECDIGS + 4);
+    if (pr.sssegname == NULL) NOMEM ();
+    pr.pd_open ();
 
-        /*
-         * The next read will be at beginning of next block no matter if this one was an error or not.
-         */
-        readoffset += bs;
+    if (xorgc > 0) {
+        pr.xorblocks = (Block **) malloc (xorgc * sizeof *pr.xorblocks);
+        if (pr.xorblocks == NULL) NOMEM ();
+        for (i = 0; i < xorgc; i ++) {
+            pr.xorblocks[i] = (Block *) calloc (1, bs - hashsize ());
+            if (pr.xorblocks[i] == NULL) NOMEM ();
+        }
+        pr.gotxors = (uint8_T *) calloc (xorgc, sizeof *pr.gotxors);
+        if (pr.gotxors == NULL) NOMEM ();
+    }
 
-        /*
-         * If it failed to read, output message and try to read next.
-         */
-        if ((rc < 0) || ((uint32_T) rc != bs)) {
-            fprintf (stderr, "ftbackup: pread(%llu) saveset error: %s\n", lastreadoffs,
-                    ((rc > 0) ? "partial read" : (rc == 0) ? "end of file" : mystrerr (errno)));
+    // blkpool_init() leaves one out for the first block, which this one doesn't have
+    pr.blkpool_init ();
+    pr.blkpool[pr.blkpoolused++] = pr.malloc_block ();
 
-            /*
-             * If IO error, try to read more.
-             */
-            if (rc != 0) continue;
+    pr.pdhdrall = sizeof *pr.pdhdr;
+    pr.pdhdr    = (Header *) malloc (pr.pdhdrall);
+    if (pr.pdhdr == NULL) NOMEM ();
 
-            /*
-             * If end of file with no stacked blocks, we are done
-             * as there isn't anything more to process.  Otherwise,
-             * say the lastseqno is unrecoverable and we will be
-             * called back later to process the stacked blocks.
-             */
-            if (linkedBlocks == NULL) throw new EndOfSSFile ();
-            goto unrecoverable;
+    /*
+     * Decode chunks as long as the main thread has a job free for them.
+     */
+    while (true) {
+        pthread_mutex_lock (&pdmutex);
+        while (!pdstop && (pdnext < pdlast) && (pdnext >= pdhead + pdnjobs)) {
+            pthread_cond_wait (&pdcond, &pdmutex);
         }
+        if (pdstop || (pdnext >= pdlast)) {
+            pthread_mutex_unlock (&pdmutex);
+            break;
+        }
+        chunk = pdnext ++;
+        pthread_mutex_unlock (&pdmutex);
+
+        job = &pdjobs[chunk%pdnjobs];
+        job->chunk = chunk;
+        pr.pd_chunk (job);
+    }
+
+    // the manifest belongs to the main reader
+    pr.mansegs  = NULL;
+    pr.mannsegs = 0;
+    free (pr.sssegname);
+
+    return NULL;
+}
+
+/**
+ * @brief Open the segment file the saveset starts with, in a -dthreads thread's reader.
+ */
+void FTBReader::pd_open ()
+{
+    if (ssfd >= 0) close (ssfd);
+    thissegno = pdmain->pdsegno;
+    strcpy (sssegname, pdmain->pdsegname);
+    ssfd = open_saveset (sssegname);
+    if (ssfd < 0) {
+        fprintf (stderr, "ftbackup: open(%s) error: %s\n", sssegname, mystrerr (errno));
+        exit (EX_SSIO);
+    }
+    if (fstat (ssfd, &ssstat) < 0) SYSERRNO (fstat);
+    pipepos    = 0;
+    segskipped = false;
+}
+
+/**
+ * @brief Decode the files whose headers start in a chunk, in a -dthreads thread's reader.
+ */
+void FTBReader::pd_chunk (PDJob *job)
+{
+    bool more;
+    uint32_T end, eofseqno, start;
+
+    start    = job->chunk * pdmain->pdchunkblks + 1;
+    end      = start + pdmain->pdchunkblks;
+    eofseqno = 0;
+    pdjob    = job;
+    try {
 
         /*
-         * Maybe decrypt the block.
+         * Skip to the chunk, which may be in an earlier segment file.
+         * If it is past the end of the saveset, the main thread says so if it gets that far,
+         * which it won't if an earlier chunk has the end-of-saveset header.
          */
-        if (!decrypt_block (&linkedBlock->block, bs)) {
-            fprintf (stderr, "ftbackup: pread(%llu) saveset error: block digest not valid\n", lastreadoffs);
-            continue;
+        seek_saveset (start);
+        if (S_ISREG (ssstat.st_mode) && (readoffset - pipepos >= (uint64_T) ssstat.st_size) &&
+                ((thissegno == 0) || (next_segno (ssbasename, thissegno) == 0))) {
+            eofseqno = start;
+            throw new EndOfSSFile ();
         }
 
         /*
-         * They should all have basic validity.
+         * Decode files from the first header in the chunk till the next header is past it.
+         * After a lost block, find the next header as read_saveset() does.
          */
-        if (!blockbaseisvalid (&linkedBlock->block)) {
-            fprintf (stderr, "ftbackup: pread(%llu) saveset error: block invalid\n", lastreadoffs);
+        more = pd_resync (job, end);
+        while (more && !pd_stopping ()) {
+            try {
+                more = pd_file (job, end);
+            } catch (LostSSBlock *lssb) {
+                delete lssb;
+                pd_mark (job, PD_LOST, 0, 0);
+                more = pd_resync (job, end);
+            }
+        }
+    } catch (EndOfSSFile *eossf) {
+        delete eossf;
+        pd_mark (job, PD_EOF, eofseqno, 0);
+        pd_setlast (job);
+    }
+
+    pd_mark (job, PD_END, lastseqno, 0);
+    if (job->piece.buf != NULL) {
+        pdmain->pdbufqueue.enqueue (job->piece.buf);
+        job->piece.buf = NULL;
+    }
+    pdjob = NULL;
+}
+
+/**
+ * @brief Read blocks till one with a file header, like read_block (true), but only up to the end of the chunk.
+ *        A block lost before the header is passed on, in case the main thread is reading a header
+ *        from it, such as the first one.  If it is already skipping to the next header, it ignores it.
+ *        The first block of the next chunk is read too, as pd_file() does.
+ * @returns true: zstrm positioned at the header, main thread told decoding starts over there
+ *         false: no header starts in the rest of the chunk
+ */
+bool FTBReader::pd_resync (PDJob *job, uint32_T end)
+{
+    Block *rblock;
+
+    while (lastseqno < end) {
+        try {
+            rblock = read_block (false);
+        } catch (LostSSBlock *lssb) {
+            delete lssb;
+            pd_mark (job, PD_LOST, 0, 0);
             continue;
         }
+        if (lastseqno >= end) break;
+        if (rblock->hdroffs != 0) {
+            zstrm.avail_in = (1 << l2bs) - rblock->hdroffs - hashsize ();
+            zstrm.next_in  = (uint8_T *)rblock + rblock->hdroffs;
+            zisopen = false;
+            pd_mark (job, PD_RESYNC, rblock->seqno, rblock->hdroffs);
+            return true;
+        }
+    }
+    return false;
+}
 
-        /*
-         * If just read an XOR block, XOR the data in and hopefully recover a missing block.
-         */
-        if (linkedBlock->block.xorbc > 0) {
-            xorno = linkedBlock->block.xorno;
+/**
+ * @brief Decode next file in a -dthreads thread's chunk, passing the header and data
+ *        to the main thread as read_saveset() and the read_...() functions read them.
+ * @returns true: file done, there may be another
+ *         false: next header is past the chunk, or end of saveset
+ */
+bool FTBReader::pd_file (PDJob *job, uint32_T end)
+{
+    Header *hdr;
+    uint32_T fixed;
+    uint64_T len, rofs;
+    uint8_T junk[FILEIOSIZE];
 
-            /*
-             * Make sure this XOR block is for what we think is the current span.
-             * If it is old, it is a duplicate somehow, so just ignore it.
-             * If it is newer, then we missed a whole span, so reset all the XOR groups first.
-             *
-             * lastxorno = number of whole XOR blocks completed before current span,
-             *   ie, this one should be at lastxorno+1..lastxorno+xorgc.
-             *
-             * The normal case:
-             *     ... (1)(2) ... (3)(4)
-             *    lastxorno^   ^   ^linkedBlock->block.xorno (could be 3 or 4 actually)
-             * xorblocks covers^
-             *
-             * The case where lots of stuff missing:
-             *     ... (1)(2) ... (3)(4) ... (5)(6)
-             *    lastxorno^   ^         ^ ^  ^linkedBlock->block.xorno (could be 5 or 6 actually)
-             * xorblocks covers^         ^-^all of this stuff missing
-             *                              so lastxorno never got set to 4
-             */
-            if (xorno <= lastxorno) continue;
-            if (xorno >  lastxorno + xorgc) {
-                lastxorno = xorno - xorgc;
-                memset (gotxors, 0, xorgc * sizeof *gotxors);
-                for (i = 0; i < xorgc; i ++) memset (xorblocks[i], 0, bsnh);
+    /*
+     * Finish the previous file's run as read_raw() would before reading the header,
+     * then leave the header to the next chunk's thread if it starts in that chunk.
+     * But read the block it is in, and any XOR blocks before it, as read_raw() would,
+     * so errors reading them are reported in order even though the thread starts past the XOR blocks.
+     */
+    while (zisopen) {
+        if (zstrm.avail_in == 0) read_block (false);
+        if (read_decode (junk, 64) != 0) zisopen = false;
+    }
+    if (((zstrm.avail_in > 0) ? lastseqno : lastseqno + 1) >= end) {
+        if (zstrm.avail_in == 0) read_block (false);
+        return false;
+    }
+
+    /*
+     * Header, then name and extended attributes.
+     * If bad, the main thread says so and we both go on to the next header.
+     */
+    hdr   = pdhdr;
+    fixed = (ulong_T)hdr->name - (ulong_T)hdr;
+    read_raw (hdr, fixed, false);
+    pd_copy (job, hdr, fixed);
+    if (memcmp (hdr->magic, HEADER_MAGIC, 8) != 0) return pd_resync (job, end);
+    if (hdr->nameln == 0) {
+        pd_setlast (job);
+        return false;
+    }
+    if (pdhdrall < hdr->nameln + sizeof *hdr) {
+        pdhdrall = hdr->nameln + sizeof *hdr;
+        hdr = pdhdr = (Header *) realloc (pdhdr, pdhdrall);
+        if (hdr == NULL) NOMEM ();
+    }
+    read_raw (hdr->name, hdr->nameln, false);
+    pd_copy (job, hdr->name, hdr->nameln);
+
+    /*
+     * Data as the read_...() function for the file type reads it.
+     * Data the main thread is going to skip is skipped here instead.
+     */
+    if (S_ISREG (hdr->stmode)) {
+        if (hdr->flags & HFL_HDLINK) {
+            pd_data (job, sizeof (uint32_T), false, false);
+        } else if ((hdr->size > 0) && pdmain->skips_data (hdr)) {
+            for (rofs = 0; rofs < hdr->size; rofs += len) {
+                if (pd_stopping () || skip_data ()) break;
+                len = hdr->size - rofs;
+                if (len > sizeof junk) len = sizeof junk;
+                read_raw (junk, len, true);
             }
+            pd_mark (job, PD_SKIPPED, 0, 0);
+        } else {
+            pd_data (job, hdr->size, true, true);
+        }
+    }
+    else if (S_ISDIR (hdr->stmode)) pd_data (job, hdr->size, true, false);
+    else if (S_ISLNK (hdr->stmode)) pd_data (job, hdr->size, false, false);
+                               else pd_data (job, sizeof (dev_t), false, false);
+    return true;
+}
 
-            /*
-             * Get which XOR group this XOR block beints to, ie, which of (3) or (4) it is.
-             */
-            i = (xorno - 1) % xorgc;
-            if (gotxors[i] + 1 == linkedBlock->block.xorbc) {
+/**
+ * @brief Read data from the saveset straight into pieces for the main thread.
+ * @param whole = use read_whole() if it all fits in one piece, as read_regular() does
+ */
+void FTBReader::pd_data (PDJob *job, uint64_T size, bool zip, bool whole)
+{
+    uint32_T len;
+    uint64_T rofs;
+
+    if (whole && zip && (size > 0) && (size <= FILEIOSIZE)) {
+        if (!zisopen && (zstrm.avail_in == 0)) read_block (false);  // so any message about it goes ahead of the piece
+        if (size > FILEIOSIZE - job->piece.len) pd_flush (job);
+        pd_room (job);
+        if (read_whole (job->piece.buf + job->piece.len, size)) {
+            job->piece.len += size;
+            return;
+        }
+    }
 
-                /*
-                 * There is exactly one missing data block from the group,
-                 * so XORing in this one should recover the missing block.
-                 */
-                xorblockdata (&linkedBlock->block, xorblocks[i], bsnh);
+    for (rofs = 0; rofs < size; rofs += len) {
+        if (pd_stopping ()) break;
+        pd_room (job);
+        len = FILEIOSIZE - job->piece.len;
+        if (len > size - rofs) len = size - rofs;
+
+        // the main thread reads in different sized pieces, so it gets what was decoded before a lost block too
+        // read_verror() may pass what is decoded so far and have read_raw() go on in a new piece
+        pdfilling = true;
+        try {
+            read_raw (job->piece.buf + job->piece.len, len, zip);
+        } catch (...) {
+            pdfilling = false;
+            job->piece.len = zstrm.next_out - job->piece.buf;
+            throw;
+        }
+        pdfilling = false;
+        job->piece.len = zstrm.next_out - job->piece.buf;
+    }
+}
 
-                /*
-                 * The result should be a valid data block.
-                 * If not, just go on reading.
-                 */
-                memcpy (linkedBlock->block.magic, BLOCK_MAGIC, 8);
-                linkedBlock->block.xorno = 0;
-                linkedBlock->block.xorbc = 0;
-                if (!blockisvalid (&linkedBlock->block)) {
-                    fprintf (stderr, "ftbackup: recovered block at %llu is not valid\n", lastreadoffs);
-                    continue;
-                }
-                fprintf (stderr, "ftbackup: block %u recovered via XOR\n", linkedBlock->block.seqno);
+/**
+ * @brief Copy bytes already read from the saveset into pieces for the main thread.
+ */
+void FTBReader::pd_copy (PDJob *job, void const *buf, uint32_T len)
+{
+    uint32_T n;
+
+    while (len > 0) {
+        pd_room (job);
+        n = FILEIOSIZE - job->piece.len;
+        if (n > len) n = len;
+        memcpy (job->piece.buf + job->piece.len, buf, n);
+        job->piece.len += n;
+        buf  = (uint8_T const *) buf + n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Make sure the piece being filled has room for at least one more byte.
+ */
+void FTBReader::pd_room (PDJob *job)
+{
+    if (job->piece.len == FILEIOSIZE) pd_flush (job);
+    if (job->piece.buf == NULL) {
+        if (!pdmain->pdbufqueue.trydequeue (&job->piece.buf)) {
+            job->piece.buf = (uint8_T *) malloc (FILEIOSIZE);
+            if (job->piece.buf == NULL) NOMEM ();
+        }
+        job->piece.len = 0;
+    }
+}
+
+/**
+ * @brief Pass the piece being filled, if any, to the main thread.
+ */
+void FTBReader::pd_flush (PDJob *job)
+{
+    if (job->piece.len > 0) {
+        job->piece.kind = PD_DATA;
+        job->pieces.enqueue (job->piece);
+        job->piece.buf = NULL;
+        job->piece.len = 0;
+    }
+}
 
-                /*
-                 * If it is the block we are looking for, we are all done.
-                 */
-                if (linkedBlock->block.seqno == lastseqno) return linkedBlock;
+/**
+ * @brief Pass a marker to the main thread after any data before it.
+ */
+void FTBReader::pd_mark (PDJob *job, int kind, uint32_T seqno, uint32_T hdroffs)
+{
+    PDPiece piece;
+
+    pd_flush (job);
+    memset (&piece, 0, sizeof piece);
+    piece.kind    = kind;
+    piece.seqno   = seqno;
+    piece.hdroffs = hdroffs;
+    piece.rdofs   = readoffset;
+    job->pieces.enqueue (piece);
+}
 
-                /*
-                 * Not looking for it yet, stack it for later if we will want it later.
-                 */
-                if (linkedBlock->block.seqno > lastseqno) {
-                    linkedBlock->next = linkedBlocks;
-                    linkedBlocks = linkedBlock;
-                    linkedBlock = NULL;
-                }
-            }
+/**
+ * @brief Saveset ends in this chunk, so no later chunks are given out.
+ */
+void FTBReader::pd_setlast (PDJob *job)
+{
+    pthread_mutex_lock (&pdmain->pdmutex);
+    if (pdmain->pdlast > job->chunk + 1) pdmain->pdlast = job->chunk + 1;
+    pthread_cond_broadcast (&pdmain->pdcond);
+    pthread_mutex_unlock (&pdmain->pdmutex);
+}
 
-            /*
-             * If there aren't any missing data blocks, check the XOR just to be sure and
-             * output a warning if not.
-             */
-            else if (gotxors[i] == linkedBlock->block.xorbc) {
-                xorblockdata (&linkedBlock->block, xorblocks[i], bsnh);
-                memset (linkedBlock->block.magic, 0, sizeof linkedBlock->block.magic);
-                linkedBlock->block.xorno = 0;
-                linkedBlock->block.xorbc = 0;
-                for (i = 0; i < bsnh; i ++) {
-                    if (((uint8_T *)&linkedBlock->block)[i] != 0) {
-                        fprintf (stderr, "ftbackup: xor block %u verify error\n", xorno);
-                        break;
-                    }
-                }
-            }
+/**
+ * @brief See if the main thread is done with the saveset.
+ */
+bool FTBReader::pd_stopping ()
+{
+    return __atomic_load_n (&pdmain->pdstop, __ATOMIC_ACQUIRE);
+}
 
-            continue;
-        }
+/**
+ * @brief Print a message about an error reading the saveset.
+ */
+void FTBReader::read_error (char const *fmt, ...)
+{
+    va_list ap;
 
-        /*
-         * If data block is not valid, treat it like a read error, ie,
-         * ignore it and try to read next block.
-        */
-        if (!blockisvalid (&linkedBlock->block)) continue;
+    va_start (ap, fmt);
+    read_verror (0, fmt, ap);
+    va_end (ap);
+}
 
-        /*
-         * Should never get a duplicate, ignore if so.
-         */
-        if (linkedBlock->block.seqno < lastseqno) continue;
+/**
+ * @brief Print a message about a saveset block that can't be used.
+ */
+void FTBReader::block_error (uint32_T seqno, char const *fmt, ...)
+{
+    va_list ap;
 
-        /*
-         * If first data block in span, clear all XOR groups.
-         *
-         *   lastxorno / xorgc = previously completed spans
-         *   linkedBlock->block.seqno-1 / xorgc / xorsc = which zero-based span we are in
-         *
-         *   span0 (1)(2) span1 (3)(4) span2 ...
-         *
-         * So if lastxorno points to (2) and we are in span1, that is ok.
-         * But if we are in span2, clear the XOR groups and point lastxorno at (4).
-         */
-        i = ((linkedBlock->block.seqno - 1) / xorgc / xorsc) * xorgc;
-        if (lastxorno < i) {
-            lastxorno = i;
-            memset (gotxors, 0, xorgc * sizeof *gotxors);
-            for (i = 0; i < xorgc; i ++) memset (xorblocks[i], 0, bsnh);
-        }
+    va_start (ap, fmt);
+    read_verror (seqno, fmt, ap);
+    va_end (ap);
+}
 
-        /*
-         * Valid data block, XOR it into group.
-         */
-        i = (linkedBlock->block.seqno - 1) % xorgc;
-        xorblockdata (xorblocks[i], &linkedBlock->block, bsnh);
-        gotxors[i] ++;
+/**
+ * @brief Print a read_error() or block_error() message.
+ *        In a -dthreads thread's reader, pass it to the main thread to print in order,
+ *        with what it is about so the main thread can tell if it was printed for an earlier chunk.
+ *        Before it has a chunk, the main thread has said it already, opening the same file.
+ * @param seqno = 0: about the saveset just read, up to readoffset
+ *             else: about that block
+ */
+void FTBReader::read_verror (uint32_T seqno, char const *fmt, va_list ap)
+{
+    char *msg;
+    PDPiece piece;
 
-        /*
-         * If it is the block we are looking for, we are all done.
-         */
-        if (linkedBlock->block.seqno == lastseqno) return linkedBlock;
+    if (pdmain == NULL) {
+        vfprintf (stderr, fmt, ap);
+    } else if (pdjob != NULL) {
+        if (vasprintf (&msg, fmt, ap) < 0) NOMEM ();
 
         /*
-         * Not the block we want, stack it for later and read another.
+         * It goes after what has been decoded so far.  If read_raw() is decoding into
+         * the piece being filled, pass that part and have it go on in a new piece.
          */
-        linkedBlock->next = linkedBlocks;
-        linkedBlocks      = linkedBlock;
-        linkedBlock       = NULL;
+        if (pdfilling) {
+            pdjob->piece.len = zstrm.next_out - pdjob->piece.buf;
+            pd_flush (pdjob);
+            pd_room (pdjob);
+            zstrm.next_out = pdjob->piece.buf;
+        } else {
+            pd_flush (pdjob);
+        }
+        memset (&piece, 0, sizeof piece);
+        piece.buf   = (uint8_T *) msg;
+        piece.kind  = PD_MSG;
+        piece.seqno = seqno;
+        piece.rdofs = readoffset;
+        pdjob->pieces.enqueue (piece);
     }
-    fprintf (stderr, "ftbackup: reached end of xor span\n");
-
-unrecoverable:
-    fprintf (stderr, "ftbackup: block %u unrecoverable\n", lastseqno);
-    throw new LostSSBlock (lastseqno);
 }
 
 /**
@@ -1417,6 +3799,7 @@ long FTBReader::wrapped_pread (void *buf, long len, uint64_T pos)
 {
     long ofs, rc;
     struct timeval nowtv;
+    uint32_T segno;
     uint64_T rpos;
 
     /*
@@ -1467,7 +3850,7 @@ long FTBReader::wrapped_pread (void *buf, long len, uint64_T pos)
          * If not doing segments, do the read anyway and let it error out.
          */
         if ((pos - pipepos < (uint64_T) ssstat.st_size) || (thissegno == 0)) {
-            rc = pread (ssfd, buf, len, pos - pipepos);
+            rc = extent_pread (buf, len, pos - pipepos);
             if (rc < 0) rc = handle_pread_error (buf, len, pos - pipepos);
             return rc;
         }
@@ -1476,7 +3859,9 @@ long FTBReader::wrapped_pread (void *buf, long len, uint64_T pos)
          * At the end of that segment file, see if there is another segment file.
          * If not, return end-of-file status just like the pread() above would have.
          */
-        thissegno = findnextsegno (ssbasename, thissegno);
+        segno = next_segno (ssbasename, thissegno);
+        if ((segno != 0) && (segno != thissegno + 1)) segskipped = true;
+        thissegno = segno;
         if (thissegno == 0) return 0;
 
         /*
@@ -1484,7 +3869,7 @@ long FTBReader::wrapped_pread (void *buf, long len, uint64_T pos)
          */
         close (ssfd);
         sprintf (sssegname, "%s%.*u", ssbasename, SEGNODECDIGS, thissegno);
-        ssfd = open (sssegname, O_RDONLY);
+        ssfd = open_saveset (sssegname);
         if (ssfd < 0) {
             fprintf (stderr, "ftbackup: open(%s) error: %s\n", sssegname, mystrerr (errno));
             exit (EX_SSIO);
@@ -1524,6 +3909,154 @@ long FTBReader::wrapped_pread (void *buf, long len, uint64_T pos)
     return ofs;
 }
 
+/**
+ * @brief Open saveset segment file for reading, with O_DIRECT if -idirect.
+ * @returns file descriptor or -1 with errno set
+ */
+int FTBReader::open_saveset (char const *name)
+{
+    int fd;
+
+    /*
+     * Whatever was read ahead or mapped from the previous file is no longer valid.
+     */
+    unmap_saveset ();
+    rxlen    = 0;
+    rxbadend = 0;
+
+    /*
+     * Some filesystems do not support O_DIRECT so say so and read the usual way.
+     */
+    if (opt_idirect) {
+        fd = open (name, O_RDONLY | O_DIRECT);
+        if ((fd >= 0) || (errno != EINVAL)) goto gotit;
+        fprintf (stderr, "ftbackup: open(%s) O_DIRECT error: %s, reading normally\n", name, mystrerr (errno));
+        opt_idirect = false;
+    }
+    fd = open (name, O_RDONLY);
+gotit:
+
+    /*
+     * Tell the kernel we will be reading it from beginning to end.
+     */
+    if ((fd >= 0) && (opt_readahead > 0) && !opt_idirect) {
+        posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    return fd;
+}
+
+/**
+ * @brief Just like pread() from segment file, but reads -readahead bytes
+ *        at a time and gives out the blocks from that buffer.
+ *        If the big read fails, just the requested block is read so the
+ *        caller sees the error for that block only, as it would without
+ *        the read-ahead, and can skip or recover just that block.
+ * @param pos = position within segment file
+ */
+long FTBReader::extent_pread (void *buf, long len, uint64_T pos)
+{
+    long rc;
+    uint32_T size;
+    uint64_T start;
+
+    if ((opt_readahead == 0) && !opt_idirect) {
+        return pread (ssfd, buf, len, pos);
+    }
+
+    /*
+     * Block may already be in buffer from last big read.
+     */
+    if ((rxlen > 0) && (pos >= rxpos) && (pos + len <= rxpos + rxlen)) {
+        memcpy (buf, rxbuf + pos - rxpos, len);
+        return len;
+    }
+
+    /*
+     * After an extent read error, read blocks one at a time to the end of that extent.
+     */
+    if ((pos >= rxpos) && (pos < rxbadend)) {
+        return block_pread (buf, len, pos);
+    }
+
+    /*
+     * Read extent starting at page containing the block.
+     * Make sure it is big enough to hold the whole block.
+     */
+    start = pos - pos % PAGESIZE;
+    size  = (pos + len - start + PAGESIZE - 1) & -PAGESIZE;
+    if (size < opt_readahead) size = opt_readahead;
+    rxbuf_alloc (size);
+    rxlen = 0;
+    rxpos = start;
+    rc = pread (ssfd, rxbuf, size, start);
+    if (rc < 0) {
+        rxbadend = start + size;
+        return block_pread (buf, len, pos);
+    }
+    rxbadend = 0;
+    rxlen = rc;
+
+    /*
+     * Have kernel start reading the next extent while this one is being processed.
+     */
+    if ((rc == size) && !opt_idirect) {
+        posix_fadvise (ssfd, start + size, size, POSIX_FADV_WILLNEED);
+    }
+
+    /*
+     * Return as much of the requested block as we got, 0 if at end-of-file.
+     */
+    if (pos + len > rxpos + rxlen) {
+        if (pos >= rxpos + rxlen) return 0;
+        len = rxpos + rxlen - pos;
+    }
+    memcpy (buf, rxbuf + pos - rxpos, len);
+    return len;
+}
+
+/**
+ * @brief Read just the one block from segment file.
+ *        With O_DIRECT, the caller's buffer might not be aligned,
+ *        so read the pages containing the block into rxbuf first.
+ * @param pos = position within segment file
+ */
+long FTBReader::block_pread (void *buf, long len, uint64_T pos)
+{
+    long rc;
+    uint32_T size;
+    uint64_T start;
+
+    if (!opt_idirect) {
+        return pread (ssfd, buf, len, pos);
+    }
+
+    start = pos - pos % PAGESIZE;
+    size  = (pos + len - start + PAGESIZE - 1) & -PAGESIZE;
+    rxbuf_alloc (size);
+    rxlen = 0;
+    rc = pread (ssfd, rxbuf, size, start);
+    if (rc < 0) return rc;
+    rc -= pos - start;
+    if (rc <= 0) return 0;
+    if (rc > len) rc = len;
+    memcpy (buf, rxbuf + pos - start, rc);
+    return rc;
+}
+
+/**
+ * @brief Make sure rxbuf is at least the given size and page aligned for O_DIRECT.
+ */
+void FTBReader::rxbuf_alloc (uint32_T size)
+{
+    if (rxalloc < size) {
+        free (rxbuf);
+        rxbuf   = NULL;
+        rxalloc = 0;
+        if (posix_memalign ((void **) &rxbuf, PAGESIZE, size) != 0) NOMEM ();
+        rxalloc = size;
+    }
+}
+
 /**
  * @brief There was an error reading block from saveset,
  *        give the user option to retry or skip it.
@@ -1539,6 +4072,9 @@ long FTBReader::handle_pread_error (void *buf, long len, uint64_T pos)
         errno = saverrno;
         return -1;
     }
+    if ((rdjobs != NULL) && pthread_equal (pthread_self (), rahandl)) {
+        return rahead_prompt (buf, len, pos);
+    }
 
     sprintf (ttyname, "/proc/self/fd/%d", STDIN_FILENO);
     ttyfd = open (ttyname, O_RDWR);
@@ -1613,6 +4149,7 @@ long FTBReader::handle_pread_error (void *buf, long len, uint64_T pos)
          */
         if (strcasecmp (ttybuff, "close\n") == 0) {
             if (ssfd >= 0) {
+                unmap_saveset ();
                 close (ssfd);
                 ssfd = -1;
                 dprintf (ttyfd, "ftbackup: saveset %s closed\n", sssegname);
@@ -1626,13 +4163,13 @@ long FTBReader::handle_pread_error (void *buf, long len, uint64_T pos)
          */
         if (strcasecmp (ttybuff, "retry\n") == 0) {
             if (ssfd < 0) {
-                ssfd = open (sssegname, O_RDONLY);
+                ssfd = open_saveset (sssegname);
                 if (ssfd < 0) {
                     dprintf (ttyfd, "ftbackup: open(%s) error: %s\n", sssegname, mystrerr (errno));
                     continue;
                 }
             }
-            rc = pread (ssfd, buf, len, pos);
+            rc = block_pread (buf, len, pos);
             if (rc < 0) {
                 dprintf (ttyfd, "ftbackup: pread(%s,%llu) error: %s\n", sssegname, pos, mystrerr (errno));
                 continue;
@@ -1646,7 +4183,7 @@ long FTBReader::handle_pread_error (void *buf, long len, uint64_T pos)
          */
         if ((strcasecmp (ttybuff, "skip\n") == 0) || (strcasecmp (ttybuff, "skipall\n") == 0)) {
             if (ssfd < 0) {
-                ssfd = open (sssegname, O_RDONLY);
+                ssfd = open_saveset (sssegname);
                 if (ssfd < 0) {
                     dprintf (ttyfd, "ftbackup: open(%s) error: %s\n", sssegname, mystrerr (errno));
                     continue;
@@ -1671,36 +4208,47 @@ long FTBReader::handle_pread_error (void *buf, long len, uint64_T pos)
  */
 bool FTBReader::decrypt_block (Block *block, uint32_T bs)
 {
-    uint32_T i;
-    uint64_T *array, temp[2];
-
-    if (decipher != NULL) {
-        // modified CBC: clr[i] = decrypt ( enc[i] ) ^ encrypt ( enc[i+1] )
-        array = (uint64_T *) block;
-        i     = offsetof (Block, crip) / 8;
-        switch (decipher->BlockSize ()) {
-            case  8: {
-                do {
-                    encipher->ProcessAndXorBlock ((CryptoPP::byte *) &array[i+1], NULL, (CryptoPP::byte *) temp);
-                    decipher->ProcessAndXorBlock ((CryptoPP::byte *) &array[i], (CryptoPP::byte *) temp, (CryptoPP::byte *) &array[i]);
-                } while (++ i < (bs / 8) - 1);
-                break;
-            }
-            case 16: {
-                do {
-                    encipher->ProcessAndXorBlock ((CryptoPP::byte *) &array[i+2], NULL, (CryptoPP::byte *) temp);
-                    decipher->ProcessAndXorBlock ((CryptoPP::byte *) &array[i], (CryptoPP::byte *) temp, (CryptoPP::byte *) &array[i]);
-                    i += 2;
-                } while (i < (bs / 8) - 2);
-                break;
-            }
-            default: abort ();
+    return decrypt_block (block, bs, hasher, decipher, encipher);
+}
+
+/**
+ * @brief Same as above using the given hasher and cipher contexts,
+ *        so -rthreads threads can decrypt blocks at the same time.
+ */
+bool FTBReader::decrypt_block (Block *block, uint32_T bs, CryptoPP::HashTransformation *blkhasher,
+        CryptoPP::BlockCipher *blkdecipher, CryptoPP::BlockCipher *blkencipher)
+{
+    uint32_T cbs, i, n, nblks;
+    uint8_T *array;
+    uint64_T temp[DC_TEMPSIZE/8];
+
+    if (blkdecipher != NULL) {
+
+        /*
+         * modified CBC: clr[i] = decrypt ( enc[i] ) ^ encrypt ( enc[i+1] )
+         * No cipher block depends on another's cleartext, so pass a whole
+         * run of them to the cipher at once so it can pipeline them.  Do
+         * the encrypt pass for a run into temp, then decrypt the run in
+         * place xoring with temp.  The next run's encrypt pass starts one
+         * cipher block beyond what was just overwritten so it still sees
+         * ciphertext.  The last cipher block (the nonce) is left as is.
+         */
+        cbs   = blkdecipher->BlockSize ();
+        array = (uint8_T *) block + offsetof (Block, crip);
+        nblks = (bs - offsetof (Block, crip)) / cbs - 1;
+        for (i = 0; i < nblks; i += n) {
+            n = nblks - i;
+            if (n > DC_TEMPSIZE / cbs) n = DC_TEMPSIZE / cbs;
+            blkencipher->AdvancedProcessBlocks (array + (i + 1) * cbs, NULL, (CryptoPP::byte *) temp,
+                                                n * cbs, CryptoPP::BlockTransformation::BT_AllowParallel);
+            blkdecipher->AdvancedProcessBlocks (array + i * cbs, (CryptoPP::byte *) temp, array + i * cbs,
+                                                n * cbs, CryptoPP::BlockTransformation::BT_AllowParallel);
         }
     }
 
     bs -= hashsize ();
-    hasher->Update ((uint8_T *)block, bs);
-    return hasher->Verify ((uint8_T *)block + bs);
+    blkhasher->Update ((uint8_T *)block, bs);
+    return blkhasher->Verify ((uint8_T *)block + bs);
 }
 
 /**
@@ -1836,6 +4384,7 @@ FTBReadMapper::FTBReadMapper ()
     dstnamebuf = NULL;
     mappings   = NULL;
     dstnameall = 0;
+    pthread_mutex_init (&mapmutex, NULL);
 }
 
 FTBReadMapper::~FTBReadMapper ()
@@ -1845,8 +4394,9 @@ FTBReadMapper::~FTBReadMapper ()
     free (dstnamebuf);
     while ((readmap = mappings) != NULL) {
         mappings = readmap->next;
-        free (readmap);
+        delete readmap;
     }
+    pthread_mutex_destroy (&mapmutex);
 }
 
 /**
@@ -1858,11 +4408,11 @@ void FTBReadMapper::add_mapping (char const *savewildcard, char const *outputmap
 {
     FTBReadMap *map;
 
-    map = (FTBReadMap *) malloc (sizeof *map);
-    if (map == NULL) NOMEM ();
+    map = new FTBReadMap;
     map->next = mappings;
     map->savewildcard  = savewildcard;
     map->outputmapping = outputmapping;
+    map->savewildmatch.add (savewildcard);
     mappings = map;
 }
 
@@ -1875,14 +4425,87 @@ void FTBReadMapper::add_mapping (char const *savewildcard, char const *outputmap
  */
 char const *FTBReadMapper::select_file (Header const *hdr)
 {
-    char const *outputmapping, *rc, *savewildcard;
-    char namechar, wildchar;
+    char const *outputmapping, *rc;
     FTBReadMap *readmap;
-    int dstnamelen, i, j, outputmappinglen, srcnamelen, savewildcardlen;
+    int dstnamelen, outputmappinglen, srcnamelen, savewildcardlen;
     time_t now;
 
-    rc = FTBREADER_SELECT_DONE;
+    readmap = find_mapping (hdr, &rc, &savewildcardlen);
+    if (readmap != NULL) {
+
+        /*
+         * Splice non-wildcard off front of name and splice outputmapping in its place.
+         */
+        outputmapping    = readmap->outputmapping;
+        outputmappinglen = strlen (outputmapping);
+        srcnamelen       = strlen (hdr->name) + 1;
+        dstnamelen       = outputmappinglen + srcnamelen - savewildcardlen;
+        if (dstnameall < dstnamelen) {
+            dstnameall = dstnamelen;
+            dstnamebuf = (char *) realloc (dstnamebuf, dstnameall);
+            if (dstnamebuf == NULL) NOMEM ();
+        }
+        memcpy (dstnamebuf, outputmapping, outputmappinglen);
+        memcpy (dstnamebuf + outputmappinglen, hdr->name + savewildcardlen, srcnamelen - savewildcardlen);
+
+        /*
+         * Maybe output listing line.
+         */
+        now = time (NULL);
+        if (opt_verbose || ((opt_verbsec > 0) && (now >= lastverbsec + opt_verbsec))) {
+            lastverbsec = now;
+            print_header (stderr, hdr, dstnamebuf, 0);
+        }
+
+        /*
+         * Tell FTBReader where to restore file to.
+         */
+        return dstnamebuf;
+    }
+
+    /*
+     * File not selected, either go on to next file (SKIP) because another
+     * name might match, or finish up (DONE) because it isn't possible for
+     * another name to match.
+     */
+    now = time (NULL);
+    if (opt_xverbose || ((opt_xverbsec > 0) && (now >= lastxverbsec + opt_xverbsec))) {
+        lastxverbsec = now;
+        fputc ('~', stderr);
+        print_header (stderr, hdr, hdr->name, 0);
+    }
+    return rc;
+}
+
+/**
+ * @brief Say whether select_file() will skip a file, for -dthreads threads.
+ */
+bool FTBReadMapper::skips_data (Header const *hdr)
+{
+    char const *rc;
+    int prefixlen;
+
+    return find_mapping (hdr, &rc, &prefixlen) == NULL;
+}
+
+/**
+ * @brief Find the first mapping whose wildcard the file matches.
+ *        Locked as the compiled wildcards are also used by -dthreads threads.
+ * @param hdr = file just seen in saveset
+ * @returns NULL: no match, *rc = FTBREADER_SELECT_SKIP: a later file might match
+ *                                FTBREADER_SELECT_DONE: no later file can match
+ *          else: mapping matched, *prefixlen = length of non-wildcard part of name
+ */
+FTBReadMapper::FTBReadMap *FTBReadMapper::find_mapping (Header const *hdr, char const **rc, int *prefixlen)
+{
+    char const *savewildcard;
+    char namechar, wildchar;
+    FTBReadMap *readmap;
+    int i, j;
 
+    *rc = FTBREADER_SELECT_DONE;
+
+    pthread_mutex_lock (&mapmutex);
     for (readmap = mappings; readmap != NULL; readmap = readmap->next) {
 
         /*
@@ -1898,12 +4521,12 @@ char const *FTBReadMapper::select_file (Header const *hdr)
         for (i = j = 0;; j ++) {
             wildchar = savewildcard[i++];
 
-            // wildcard char means match the whole thing using wildcardmatch()
+            // wildcard char means match the whole thing using compiled wildcard
             if (wildcardchar (wildchar)) {
-                if (wildcardmatch (savewildcard, hdr->name)) break;
+                if (readmap->savewildmatch.match (hdr->name) >= 0) break;
 
                 // didn't match this wildcard but a later file in saveset might match
-                rc = FTBREADER_SELECT_SKIP;
+                *rc = FTBREADER_SELECT_SKIP;
                 goto nextmap;
             }
 
@@ -1921,7 +4544,7 @@ char const *FTBReadMapper::select_file (Header const *hdr)
 
             // if end of name but more prefix, name is .lt. prefix
             if (namechar == 0) {
-                rc = FTBREADER_SELECT_SKIP;
+                *rc = FTBREADER_SELECT_SKIP;
                 goto nextmap;
             }
 
@@ -1931,7 +4554,7 @@ char const *FTBReadMapper::select_file (Header const *hdr)
 
             // if name is .lt. prefix, just skip this file but go on to next file in saveset
             if (namechar < wildchar) {
-                rc = FTBREADER_SELECT_SKIP;
+                *rc = FTBREADER_SELECT_SKIP;
                 goto nextmap;
             }
 
@@ -1939,48 +4562,11 @@ char const *FTBReadMapper::select_file (Header const *hdr)
             if (namechar > wildchar) goto nextmap;
         }
 
-        /*
-         * Splice non-wildcard off front of name and splice outputmapping in its place.
-         */
-        savewildcardlen  = j;
-        outputmapping    = readmap->outputmapping;
-        outputmappinglen = strlen (outputmapping);
-        srcnamelen       = strlen (hdr->name) + 1;
-        dstnamelen       = outputmappinglen + srcnamelen - savewildcardlen;
-        if (dstnameall < dstnamelen) {
-            dstnameall = dstnamelen;
-            dstnamebuf = (char *) realloc (dstnamebuf, dstnameall);
-            if (dstnamebuf == NULL) NOMEM ();
-        }
-        memcpy (dstnamebuf, outputmapping, outputmappinglen);
-        memcpy (dstnamebuf + outputmappinglen, hdr->name + savewildcardlen, srcnamelen - savewildcardlen);
-
-        /*
-         * Maybe output listing line.
-         */
-        now = time (NULL);
-        if (opt_verbose || ((opt_verbsec > 0) && (now >= lastverbsec + opt_verbsec))) {
-            lastverbsec = now;
-            print_header (stderr, hdr, dstnamebuf, 0);
-        }
-
-        /*
-         * Tell FTBReader where to restore file to.
-         */
-        return dstnamebuf;
+        *prefixlen = j;
+        pthread_mutex_unlock (&mapmutex);
+        return readmap;
 nextmap:;
     }
-
-    /*
-     * File not selected, either go on to next file (SKIP) because another
-     * name might match, or finish up (DONE) because it isn't possible for
-     * another name to match.
-     */
-    now = time (NULL);
-    if (opt_xverbose || ((opt_xverbsec > 0) && (now >= lastxverbsec + opt_xverbsec))) {
-        lastxverbsec = now;
-        fputc ('~', stderr);
-        print_header (stderr, hdr, hdr->name, 0);
-    }
-    return rc;
+    pthread_mutex_unlock (&mapmutex);
+    return NULL;
 }
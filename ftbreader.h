@@ -22,11 +22,40 @@
 #define FTBREADER_SELECT_SKIP ((char const *)1)
 #define FTBREADER_SELECT_DONE ((char const *)2)
 
+#define DC_TEMPSIZE 4096  // bytes of cipher blocks decrypt_block() passes to the cipher at once
+#define RD_PERTHREAD 4    // saveset blocks per -rthreads thread read ahead of the decoder
+#define RD_NWBUFS 8       // file data buffers queued to the -rthreads file writing thread
+#define WR_PERTHREAD 4    // file data buffers per -wthreads thread
+#define RX_DEFSIZE (4*1024*1024)  // default bytes of saveset read at once by extent_pread()
+#define RX_MAXSIZE (1024*1024*1024)  // maximum -readahead
+#define CAT_MAXNAME 65536  // longest -catalog record name considered valid
+#define MAN_MAXLINE 4096   // longest -manifest line considered valid
+#define PD_CHUNKSIZE (1024*1024)  // bytes of saveset data blocks per -dthreads chunk
+#define PD_MAXTHREADS 64   // maximum -dthreads
+#define PD_SPOOLBUFS 256   // pieces queued per -dthreads chunk ahead of the main thread
+
+#define PD_NONE 0       // -dthreads piece: nothing, main thread has used it up
+#define PD_DATA 1       // saveset bytes as read_raw() returns them
+#define PD_RESYNC 2     // decoding starts over at the first header in block seqno at hdroffs
+#define PD_SKIPPED 3    // file's data skipped over as skip_data() does
+#define PD_LOST 4       // LostSSBlock thrown
+#define PD_EOF 5        // EndOfSSFile thrown
+#define PD_END 6        // end of chunk
+#define PD_MSG 7        // saveset read error message for the main thread to print
+
 struct FTBReader : FTBackup {
+    bool opt_idirect;
     bool opt_incrmntl;
     bool opt_mkdirs;
+    bool opt_mmap;
     bool opt_overwrite;
+    char const *opt_catalog;
+    char const *opt_manifest;
+    int opt_dthreads;
+    int opt_rthreads;
+    uint32_T opt_readahead;
     uint32_T opt_simrderrs;
+    int opt_wthreads;
 
     bool opt_verbose;
     int opt_verbsec;
@@ -39,52 +68,258 @@ struct FTBReader : FTBackup {
     ~FTBReader ();
     int read_saveset (char const *ssname);
     virtual char const *select_file (Header const *hdr) =0;
+    virtual bool skips_data (Header const *hdr);
     bool decrypt_block (Block *block, uint32_T bs);
+    bool decrypt_block (Block *block, uint32_T bs, CryptoPP::HashTransformation *blkhasher,
+            CryptoPP::BlockCipher *blkdecipher, CryptoPP::BlockCipher *blkencipher);
 
 protected:
+    ManifestSeg *mansegs;       // -manifest segment files, in segno order
     time_t lastverbsec;
     time_t lastxverbsec;
+    uint32_T mannsegs;
+
+    bool manifest_load ();
+    void manifest_check (char const *basename);
+    ManifestSeg *manifest_seg (uint32_T segno);
+    uint32_T next_segno (char const *basename, uint32_T lastsegno);
 
 private:
-    struct LinkedBlock {
-        LinkedBlock *next;
-        Block block;
+    // saveset block being read ahead and decrypted by -rthreads threads
+    struct ReadJob {
+        Block *block;               // block read, swapped with caller's by read_ssblock()
+        uint64_T pos;               // saveset position it was read from
+        long rc;                    // wrapped_pread() return value
+        int err;                    // wrapped_pread() errno
+        bool hashok;                // decrypt_block() return value
+        bool done;                  // read and decrypted, ready for read_ssblock()
+        bool busy;                  // being read and decrypted
+    };
+
+    // file data queued to the -rthreads file writing thread
+    struct FileWrite {
+        uint8_T *buf;               // FILEIOSIZE buffer from rwbufqueue, NULL to exit thread
+        uint32_T len;
+        int fd;
+        char const *name;
+    };
+
+    // regular file being restored by a -wthreads thread
+    struct WriteJob {
+        Header *hdr;                // copy of header incl name and xattrs, NULL once reaped
+        char *dstname;
+        RingQueue<FileWrite> dataqueue;  // file data from wjbufqueue, then buf NULL: len 0 end, len 1 corrupt
+        bool busy;                  // queued to or being restored by a thread
+        bool created;               // temp file was created
+        bool ok;                    // created and attributes all set
+    };
+
+    // decoded saveset bytes or marker passed from a -dthreads thread to the main thread
+    struct PDPiece {
+        uint8_T *buf;               // PD_DATA: FILEIOSIZE buffer from pdbufqueue
+                                    // PD_MSG: malloc()d message text, else NULL
+        uint32_T len;               // PD_DATA: bytes in buf
+        uint32_T seqno;             // PD_RESYNC: block the header is in
+                                    // PD_EOF: block found past end of saveset, 0 if message printed
+                                    // PD_MSG: block the message is about, 0 if about what was just read
+                                    // PD_END: thread's lastseqno
+        uint32_T hdroffs;           // PD_RESYNC: offset of the header in the block
+        int kind;                   // PD_DATA, PD_RESYNC, etc
+        uint64_T rdofs;             // PD_MSG, PD_END: thread's readoffset
+    };
+
+    // chunk of saveset blocks being decoded by a -dthreads thread
+    struct PDJob {
+        RingQueue<PDPiece> pieces;  // pieces in saveset order, ending with PD_END
+        PDPiece piece;              // PD_DATA piece being filled by the thread
+        uint32_T chunk;             // chunk being decoded
     };
 
+    struct PartReader;
+
+    Block **blkpool;            // free block buffers
+    Block **blkwindow;          // blocks read ahead, indexed by seqno % blkwinsize
+    Block *curRBlock;           // block last returned by read_block()
+    Block pdblock;              // -dthreads: seqno and hdroffs of block read_block() resynced at
     Block **xorblocks;
+    Codec *deccodec;
+    Codec *decoders[CODEC_NUM];
+    CodecDict rundict;
+    CatalogRec *catrec;         // -catalog record last read
+    bool blkseekable;           // saveset blocks are where block_offset() computes them to be
+    bool manchecked;            // manifest_check() done
+    bool pdfilling;             // -dthreads thread's reader: read_raw() is decoding into the piece being filled
+    bool pdstop;                // -dthreads threads are to stop
+    bool rdprompt;
+    bool rdstop;
+    bool runfresh;
+    bool rwfailed;
+    bool segskipped;            // wrapped_pread() went on past a missing segment file
     bool skipall;
+    bool wjok;
     bool wprwrite;
     bool zisopen;
     char **inodesname;
     char const *ssbasename;
+    char *pdsegname;            // -dthreads: segment file the saveset starts with
     char *sssegname;
+    FILE *catfile;
     FILE *wprfile;
+    FTBReader *pdmain;          // -dthreads thread's reader: reader it decodes chunks for
+    Header *pdhdr;              // -dthreads thread's reader: header being decoded
+    int rdprerr;
     int ssfd;
-    LinkedBlock *linkedBlocks;
-    LinkedBlock *linkedRBlock;
+    long rdprlen;
+    long rdprrc;
+    PDJob *pdjob;               // -dthreads thread's reader: chunk being decoded
+    PDJob *pdjobs;              // -dthreads chunks being decoded, indexed by chunk % pdnjobs
+    PDPiece pdpiece;            // -dthreads piece being used by the main thread
+    pthread_cond_t pdcond;
+    pthread_cond_t rdcond;
+    pthread_cond_t wjcond;
+    pthread_mutex_t pdmutex;
+    pthread_mutex_t rdmutex;
+    pthread_mutex_t wjmutex;
+    pthread_t rahandl;
+    pthread_t rwhandl;
+    pthread_t *pdhandls;
+    pthread_t *rdhandls;
+    pthread_t *wjhandls;
+    ReadJob *rdjobs;
+    RingQueue<uint8_T *> pdbufqueue;
+    RingQueue<ReadJob *> rdworkqueue;
+    RingQueue<FileWrite> rwritequeue;
+    RingQueue<uint8_T *> rwbufqueue;
+    RingQueue<uint8_T *> wjbufqueue;
+    RingQueue<WriteJob *> wjobqueue;
     struct stat ssstat;
+    uint32_T blkpoolsize;       // number of buffers in blkpool when all are free
+    uint32_T blkpoolused;       // number of free buffers in blkpool
+    uint32_T blkwinsize;
+    uint32_T blkwinused;        // number of blocks in blkwindow
+    uint32_T catrecall;         // bytes allocated for catrec
     uint32_T inodessize;
     uint32_T inodesused;
     uint32_T lastfileno;
     uint32_T lastseqno;
     uint32_T lastxorno;
+    uint32_T pdchunkblks;       // data blocks per -dthreads chunk, whole XOR spans
+    uint32_T pdhdrall;          // bytes allocated for pdhdr
+    uint32_T pdhead;            // chunk the main thread is using
+    uint32_T pdlast;            // chunk after the one the saveset ends in, once known
+    uint32_T pdnext;            // next chunk to give a -dthreads thread
+    uint32_T pdnjobs;
+    uint32_T pdpieceofs;        // bytes of pdpiece used so far
+    uint32_T pdmsgseqno;        // -dthreads: blocks used by the threads of the chunks used so far
+    uint32_T pdsegno;           // -dthreads: segment number the saveset starts with
+    uint32_T rdnjobs;
+    uint32_T rdoldest;
+    uint32_T rxalloc;           // bytes allocated for rxbuf
+    uint32_T rxlen;             // bytes valid in rxbuf, 0 if none
     uint32_T thissegno;
+    uint32_T wjnbufs;
+    uint32_T wjnjobs;
+    uint64_T mapsize;           // bytes of segment file mapped at mapbase
+    uint64_T pdmsgofs;          // -dthreads: saveset read by the threads of the chunks used so far
     uint64_T pipepos;
+    uint64_T rdprpos;
+    uint64_T rdreadoffs;
     uint64_T readoffset;
+    uint64_T rxbadend;          // read blocks one at a time up to here after extent read error
+    uint64_T rxpos;             // position within segment file rxbuf was read from
     uint8_T *gotxors;
+    uint8_T *mapbase;           // -mmap mapping of current segment file, NULL if none
+    uint8_T *rxbuf;             // saveset extent read ahead by extent_pread()
+    void *rdprbuf;
+    WriteJob *wjobs;
     z_stream zstrm;
 
-    bool read_regular (Header *hdr, char const *dstname);
+    bool read_regular (Header *hdr, char const *dstname, bool *queued);
+    int creat_regular (Header const *hdr, char const *dstname, char const *tmpname);
+    int write_regular (int fd, uint8_T const *buf, uint32_T len, char const *dstname);
+    bool restore_attrs (Header const *hdr, char const *dstname);
     bool read_directory (Header *hdr, char const *dstname, bool *setimes);
     bool read_symlink (Header *hdr, char const *dstname);
     bool read_special (Header *hdr, char const *dstname);
     void do_mkdirs (char const *dstname);
     void read_raw (void *buf, uint32_T len, bool zip);
+    int read_decode (Bytef *out, uint32_T outlen);
+    bool read_whole (void *buf, uint32_T len);
+    bool skip_data ();
+    Codec *read_codec ();
+    bool catalog_open ();
+    bool catalog_read ();
+    char const *catalog_next ();
+    void catalog_seek ();
+    void seek_saveset (uint32_T seqno);
+    uint64_T segment_size (uint32_T segno);
+    uint64_T block_offset (uint32_T seqno);
     Block *read_block (bool skipfh);
     void read_first_block ();
-    LinkedBlock *read_or_recover_block ();
+    Block *read_or_recover_block ();
+    long read_ssblock (Block **block, bool *hashok);
+    void blkpool_init ();
+    Block *malloc_block ();
+    Block *get_block ();
+    void free_block (Block *block);
+    void stack_block (Block *block);
+    Block *unstack_block (uint32_T seqno);
+    bool mapped_read (Block **block, uint64_T pos, uint32_T bs, bool *hashok);
+    int verify_mapped (Block *block, uint32_T bs);
+    bool ismapped (Block const *block);
+    Block *keep_mapped (Block *block);
+    void mapped_fault ();
+    void map_saveset ();
+    void unmap_saveset ();
     long wrapped_pread (void *buf, long len, uint64_T pos);
+    int open_saveset (char const *name);
+    long extent_pread (void *buf, long len, uint64_T pos);
+    long block_pread (void *buf, long len, uint64_T pos);
+    void rxbuf_alloc (uint32_T size);
     long handle_pread_error (void *buf, long len, uint64_T pos);
+    long rahead_prompt (void *buf, long len, uint64_T pos);
+    void rdpipe_start ();
+    void rdpipe_stop ();
+    bool rwrite_drain ();
+
+    static void *rahead_thread_wrapper (void *ftbr);
+    void *rahead_thread ();
+    static void *rdwork_thread_wrapper (void *ftbr);
+    void *rdwork_thread ();
+    static void *rwrite_thread_wrapper (void *ftbr);
+    void *rwrite_thread ();
+
+    void wpool_start ();
+    void wpool_stop ();
+    WriteJob *wpool_newjob (Header const *hdr, char const *dstname);
+    void wpool_wait (char const *name, uint32_T len);
+    void wpool_reap ();
+    bool write_job (WriteJob *job);
+    static void *wjob_thread_wrapper (void *ftbr);
+    void *wjob_thread ();
+
+    void pdpool_start ();
+    void pdpool_stop ();
+    void pd_read (void *buf, uint32_T len);
+    bool pd_skipped ();
+    Block *pd_resynced ();
+    void pd_next ();
+    static void *pdwork_thread_wrapper (void *ftbr);
+    void *pdwork_thread ();
+    void pd_open ();
+    void pd_chunk (PDJob *job);
+    bool pd_resync (PDJob *job, uint32_T end);
+    bool pd_file (PDJob *job, uint32_T end);
+    void pd_data (PDJob *job, uint64_T size, bool zip, bool whole);
+    void pd_copy (PDJob *job, void const *buf, uint32_T len);
+    void pd_room (PDJob *job);
+    void pd_flush (PDJob *job);
+    void pd_mark (PDJob *job, int kind, uint32_T seqno, uint32_T hdroffs);
+    void pd_setlast (PDJob *job);
+    bool pd_stopping ();
+    void read_error (char const *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+    void block_error (uint32_T seqno, char const *fmt, ...) __attribute__ ((format (printf, 3, 4)));
+    void read_verror (uint32_T seqno, char const *fmt, va_list ap);
 };
 
 struct FTBReadMapper : FTBReader {
@@ -92,17 +327,22 @@ struct FTBReadMapper : FTBReader {
     ~FTBReadMapper ();
     void add_mapping (char const *savwild, char const *outwild);
     virtual char const *select_file (Header const *hdr);
+    virtual bool skips_data (Header const *hdr);
 
 private:
     struct FTBReadMap {
         FTBReadMap *next;
         char const *savewildcard;
         char const *outputmapping;
+        WildMatcher savewildmatch;  // savewildcard compiled
     };
 
     char *dstnamebuf;
     FTBReadMap *mappings;
     int dstnameall;
+    pthread_mutex_t mapmutex;   // savewildmatch is also used by -dthreads threads
+
+    FTBReadMap *find_mapping (Header const *hdr, char const **rc, int *prefixlen);
 };
 
 #endif
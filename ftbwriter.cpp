@@ -20,16 +20,58 @@
 #include "ftbackup.h"
 #include "ftbwriter.h"
 
-struct SkipName {
-    SkipName *next;     // next line in this ~SKIPNAMES.FTB or next outer ~SKIPNAMES.FTB
-    char const *dir;    // directory path the ~SKIPNAMES.FTB file is in (wildcard relative to this dir)
-    char wild[1];       // wildcard line from the ~SKIPNAMES.FTB file
+/*
+ * A ~SKIPNAMES.FTB file is compiled into a tree of nodes, one for the
+ * directory the file is in and one for each subdirectory reached by
+ * literal names on the front of its lines.  Lines that are entirely
+ * literal are looked up in a hash table, the rest are matched by the
+ * node's WildMatchers.
+ */
+struct SkipNode {
+    SkipNode *nextnode;     // next node of the same ~SKIPNAMES.FTB
+    WildMatcher shallow;    // wildcards that only match names in this directory
+    WildMatcher deep;       // wildcards that might match in subdirectories, relative to this directory
+};
+
+struct SkipEnt {
+    SkipNode const *parent; // node the name is in
+    char *name;             // name in that node's directory, NULL if slot is empty
+    SkipNode *child;        // node for subdirectory of that name, else NULL
+    bool leaf;              // a line names this exact file
+};
+
+struct SkipFile {
+    SkipNode *root;         // node for directory the ~SKIPNAMES.FTB is in
+    SkipEnt *ents;          // hash table of names in each node
+    uint32_T entmask;       // number of slots in ents minus one
+    uint32_T entsused;      // number of slots in use
+};
+
+struct SkipTrie {
+    SkipFile *file;         // ~SKIPNAMES.FTB in this or a parent directory
+    SkipNode *node;         // its node for this directory
+};
+
+struct SkipDeep {
+    WildMatcher *wilds;     // wildcards that might match files in this directory
+    int pathoff;            // offset in path of name they are relative to
+};
+
+struct SkipActive {         // ~SKIPNAMES.FTB rules that might apply to files in a directory
+    SkipTrie *tries;
+    SkipDeep *deeps;
+    int ntries;
+    int ndeeps;
 };
 
+static SkipFile *skipfile_compile (char const *buf, int len);
+static SkipEnt *skipfile_lookup (SkipFile *file, SkipNode const *parent, char const *name, int namelen, bool add);
+static void skipfile_free (SkipFile *file);
 static int pathcmp (char const *p1, char const *p2);
 static uint32_T inspackeduint32 (char *buf, uint32_T idx, uint32_T val);
-static bool skipbyname (SkipName *skipname, char const *path);
+static bool skipbyname (SkipActive const *skipact, char const *path, int pathlen);
 static bool writeall (int fd, uint8_T const *buf, int len);
+static uint64_T getcputime ();
 static uint64_T getruntime ();
 static void printthreadcputime (char const *name);
 static void printthreadruntime (char const *name, uint64_T runtime);
@@ -147,49 +189,120 @@ FTBWriter::FTBWriter ()
     opt_verbose    = 0;
     histdbname     = NULL;
     histssname     = NULL;
+    opt_catalog    = NULL;
+    opt_manifest   = NULL;
     opt_record     = NULL;
     opt_since      = NULL;
     ioptions       = 0;
     ooptions       = 0;
+    opt_adaptive   = false;
+    opt_chaindict  = false;
+    opt_codec      = CODEC_ZLIB;
+    opt_codeclevel = CODEC_DEFLEVEL;
+    opt_cthreads   = 0;
+    opt_hthreads   = 0;
+    opt_lthreads   = 0;
     opt_verbsec    = 0;
+    opt_comprdepth = RQ_DEFDEPTH;
+    opt_frblkdepth = 0;
+    opt_frbufdepth = 0;
+    opt_histdepth  = RQ_DEFDEPTH;
+    opt_iouring    = 0;
+    opt_owrites    = 0;
+    opt_writedepth = RQ_DEFDEPTH;
     opt_segsize    = 0;
 
+    archunk        = NULL;
+    comprblock     = NULL;
+    comprcodec     = NULL;
+    comprdict      = NULL;
+    wholebuf       = NULL;
+    wholesize      = 0;
+    comprhdrfirst  = false;
+    comprrun       = NULL;
+    storecodec     = NULL;
     xorblocks      = NULL;
+    xorfree        = NULL;
+    ctrunopen      = false;
+    ctrunstored    = false;
     zisopen        = false;
     ssbasename     = NULL;
+    dirbuf         = NULL;
+    linkbuf        = NULL;
     sssegname      = NULL;
-    inodesdevno    = 0;
+    ctfree         = NULL;
+    ctoldest       = NULL;
+    ctnewest       = NULL;
+    ctnewraw       = NULL;
+    ctunits        = NULL;
+    htjobs         = NULL;
+    hdrbufs        = NULL;
+    ioreads        = NULL;
+    owrites        = NULL;
+    lafree         = NULL;
+    inodesdevs     = NULL;
+    catfile        = NULL;
+    manfile        = NULL;
     noncefile      = NULL;
-    inodeslist     = NULL;
+    inodestable    = NULL;
     recofd         = -1;
     ssfd           = -1;
-    skipnames      = NULL;
+    skipactive     = NULL;
     lastverbsec    = 0;
-    inodessize     = 0;
+    arused         = 0;
+    dirbufsize     = 0;
+    hdrbufdepth    = 0;
+    hdrbufsused    = 0;
+    inodesmask     = 0;
+    inodesndevs    = 0;
+    laopenfds      = 0;
+    lawindow       = 1;
     inodesused     = 0;
     lastfileno     = 0;
     lastseqno      = 0;
     lastxorno      = 0;
+    linkbufsize    = 0;
+    owmaxblocks    = 0;
+    owoldest       = 0;
+    owused         = 0;
+    xorfreesize    = 0;
+    ctnunits       = 0;
+    ctoutsize      = 0;
+    adbypassbytes  = 0;
+    adbypassns     = 0;
+    adcomprbytes   = 0;
+    adcomprns      = 0;
+    ctrunadler     = 0;
+    frblkcount     = RQ_DEFDEPTH;
+    frbufcount     = RQ_DEFDEPTH;
+    htnjobs        = 0;
+    nxorfree       = 0;
+    htoldest       = 0;
+    htused         = 0;
     reconamelen    = 0;
     thissegno      = 0;
     byteswrittentoseg = 0;
-    inodesmtim     = NULL;
+    sspos          = 0;
+    memset (&manseg, 0, sizeof manseg);
     memset (&zreco, 0, sizeof zreco);
     memset (&zstrm, 0, sizeof zstrm);
 
-    frbufqueue = SlotQueue<void *> ();
-    comprqueue = SlotQueue<ComprSlot> ();
-    frblkqueue = SlotQueue<Block *> ();
-    histqueue  = SlotQueue<HistSlot> ();
-    writequeue = SlotQueue<Block *> ();
+    pthread_cond_init  (&ctcond,  NULL);
+    pthread_cond_init  (&htcond,  NULL);
+    pthread_cond_init  (&lacond,  NULL);
+    pthread_mutex_init (&ctmutex, NULL);
+    pthread_mutex_init (&htmutex, NULL);
+    pthread_mutex_init (&lamutex, NULL);
 }
 
 FTBWriter::~FTBWriter ()
 {
+    ArenaChunk *ac;
     Block *b;
     ComprSlot cs;
     HistSlot hs;
-    uint32_T i;
+    LookAhead *la;
+    uint32_T i, j;
     void *f;
 
     if (xorblocks != NULL) {
@@ -199,6 +312,61 @@ FTBWriter::~FTBWriter ()
         free (xorblocks);
     }
 
+    if (xorfree != NULL) {
+        for (i = 0; i < nxorfree; i ++) {
+            free (xorfree[i]);
+        }
+        free (xorfree);
+    }
+
+    if (htjobs != NULL) {
+        for (i = 0; i < htused; i ++) {
+            free (htjobs[(htoldest+i)%htnjobs].block);
+        }
+        free (htjobs);
+    }
+
+    if (hdrbufs != NULL) {
+        for (i = 0; i < hdrbufsused; i ++) {
+            free (hdrbufs[i].hdr);
+        }
+        free (hdrbufs);
+    }
+
+    while ((la = lafree) != NULL) {
+        lafree = la->next;
+        free (la->path);
+        free (la->xattrs);
+        free (la);
+    }
+
+    if (ioreads != NULL) {
+        free (ioreads);
+    }
+
+    if (owrites != NULL) {
+        for (i = 0; i < opt_owrites; i ++) {
+            for (j = 0; j < owrites[i].nblocks; j ++) {
+                free (owrites[i].blocks[j]);
+            }
+            free (owrites[i].blocks);
+            free (owrites[i].iov);
+        }
+        free (owrites);
+    }
+
+    if (dirbuf != NULL) {
+        free (dirbuf);
+    }
+
+    if (linkbuf != NULL) {
+        free (linkbuf);
+    }
+
+    if (archunk != NULL) {
+        free (archunk);
+    }
+
     if (noncefile != NULL) {
         fclose (noncefile);
     }
@@ -207,30 +375,50 @@ FTBWriter::~FTBWriter ()
         close (recofd);
     }
 
-    if (inodeslist != NULL) {
-        free (inodeslist);
+    if (catfile != NULL) {
+        fclose (catfile);
+    }
+
+    if (manfile != NULL) {
+        fclose (manfile);
+    }
+
+    if (inodestable != NULL) {
+        free (inodestable);
     }
 
     if (ssfd >= 0) {
         close (ssfd);
     }
 
-    if (inodesmtim != NULL) {
-        free (inodesmtim);
+    if (inodesdevs != NULL) {
+        free (inodesdevs);
     }
 
-    if (zisopen) {
-        zstrm.avail_out = 0;
-        zstrm.next_out  = NULL;
-        deflateEnd (&zstrm);
+    delete comprcodec;
+    delete comprdict;
+    free (wholebuf);
+    delete storecodec;
+
+    if (ctunits != NULL) {
+        for (i = 0; i < ctnunits; i ++) {
+            free (ctunits[i].inbuf);
+            free (ctunits[i].outbuf);
+        }
+        free (ctunits);
     }
 
     while (frbufqueue.trydequeue (&f)) {
         free (f);
     }
 
+    while (frchkqueue.trydequeue (&ac)) {
+        free (ac);
+    }
+
+    // arena records are freed with their chunks
     while (comprqueue.trydequeue (&cs)) {
-        free (cs.buf);
+        if (cs.dty >= 2) free (cs.buf);
     }
 
     while (frblkqueue.trydequeue (&b)) {
@@ -238,7 +426,7 @@ FTBWriter::~FTBWriter ()
     }
 
     while (histqueue.trydequeue (&hs)) {
-        if (hs.fname != NULL) free (hs.fname);
+        if (hs.chunk != NULL) free (hs.chunk);
     }
 
     while (writequeue.trydequeue (&b)) {
@@ -254,16 +442,19 @@ FTBWriter::~FTBWriter ()
  */
 int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
 {
+    ArenaChunk *ac;
     bool ok;
+    CatalogHdr cathdr;
     Header endhdr;
     int i, rc;
-    pthread_t compr_thandl, hist_thandl, write_thandl;
+    LookAhead *la;
+    pthread_t compr_thandl, hist_thandl, *lthandls, write_thandl;
     void *buf;
 
     maybesetdefaulthasher ();
 
     /*
-     * Open record and since files if any.
+     * Open record, since, catalog and manifest files if any.
      */
     if ((opt_since != NULL) && !sincrdr.open (opt_since)) {
         return EX_SSIO;
@@ -282,6 +473,32 @@ int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
         zreco.avail_out = sizeof recozbuf;
     }
 
+    if (opt_catalog != NULL) {
+        catfile = fopen (opt_catalog, "w");
+        if (catfile == NULL) {
+            fprintf (stderr, "ftbackup: fopen(%s) error: %s\n", opt_catalog, mystrerr (errno));
+            return EX_SSIO;
+        }
+        memcpy (cathdr.magic, CATALOG_MAGIC, 8);
+        cathdr.flags = opt_chaindict ? CFL_CHAINDICT : 0;
+        if (fwrite (&cathdr, sizeof cathdr, 1, catfile) != 1) {
+            fprintf (stderr, "ftbackup: fwrite(%s) error: %s\n", opt_catalog, mystrerr (errno));
+            return EX_SSIO;
+        }
+    }
+
+    if (opt_manifest != NULL) {
+        manfile = fopen (opt_manifest, "w");
+        if (manfile == NULL) {
+            fprintf (stderr, "ftbackup: fopen(%s) error: %s\n", opt_manifest, mystrerr (errno));
+            return EX_SSIO;
+        }
+        if (fprintf (manfile, "%s\n", MANIFEST_MAGIC) < 0) {
+            fprintf (stderr, "ftbackup: fprintf(%s) error: %s\n", opt_manifest, mystrerr (errno));
+            return EX_SSIO;
+        }
+    }
+
     /*
      * Create saveset file.
      */
@@ -308,6 +525,68 @@ int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
         return EX_SSIO;
     }
 
+    /*
+     * Maybe set up io_uring for reading files, else read them with pread().
+     */
+    if (opt_iouring > 0) {
+        rc = iouring.setup (opt_iouring);
+        if (rc < 0) {
+            fprintf (stderr, "ftbackup: io_uring setup error: %s, reading files with pread\n", mystrerr (- rc));
+        } else {
+            ioreads = (IoRead *) calloc (opt_iouring, sizeof *ioreads);
+            if (ioreads == NULL) NOMEM ();
+        }
+    }
+
+    /*
+     * Maybe set up io_uring for writing the saveset with several writes in flight,
+     * each of up to owmaxblocks consecutive blocks.  Needs a seekable saveset.
+     */
+    if (opt_owrites > 0) {
+        sspos = lseek (ssfd, 0, SEEK_CUR);
+        rc = ((off_t) sspos == (off_t) -1) ? - errno : owring.setup (opt_owrites);
+        if (rc < 0) {
+            fprintf (stderr, "ftbackup: saveset io_uring setup error: %s, writing one block at a time\n", mystrerr (- rc));
+        } else {
+            owmaxblocks = OW_COALESCE >> l2bs;
+
+            // frblkqueue needs a slot for every block of every write in flight
+            if (owmaxblocks > (RQ_MAXDEPTH - RQ_DEFDEPTH - opt_hthreads * 2 - xorgc) / opt_owrites) {
+                owmaxblocks = (RQ_MAXDEPTH - RQ_DEFDEPTH - opt_hthreads * 2 - xorgc) / opt_owrites;
+            }
+            if (owmaxblocks == 0) owmaxblocks = 1;
+            owrites = (OutWrite *) calloc (opt_owrites, sizeof *owrites);
+            if (owrites == NULL) NOMEM ();
+            for (i = 0; i < (int) opt_owrites; i ++) {
+                owrites[i].blocks = (Block **) malloc (owmaxblocks * sizeof *owrites[i].blocks);
+                owrites[i].iov    = (struct iovec *) malloc (owmaxblocks * sizeof *owrites[i].iov);
+                if ((owrites[i].blocks == NULL) || (owrites[i].iov == NULL)) NOMEM ();
+            }
+        }
+    }
+
+    /*
+     * Set queue depths.  There is one file read buffer per frbufqueue slot and one
+     * block per frblkqueue slot.  Reads and writes in flight and hashing threads
+     * need more buffers and blocks in circulation to keep busy.
+     */
+    frbufcount = (opt_frbufdepth > 0) ? opt_frbufdepth : RQ_DEFDEPTH + (iouring.isopen () ? opt_iouring : 0);
+    frblkcount = (opt_frblkdepth > 0) ? opt_frblkdepth : RQ_DEFDEPTH + opt_hthreads * 2 + opt_owrites * owmaxblocks;
+    frbufqueue.setdepth (frbufcount);
+    frchkqueue.setdepth (AR_NCHUNKS);
+    comprqueue.setdepth (opt_comprdepth);
+    frblkqueue.setdepth (frblkcount);
+    histqueue.setdepth  (opt_histdepth);
+    writequeue.setdepth (opt_writedepth);
+
+    /*
+     * Each directory keeps lawindow files at a time queued for the lookahead threads.
+     */
+    if (opt_lthreads > 0) {
+        lawindow = opt_lthreads * LA_PERTHREAD;
+        lworkqueue.setdepth (lawindow);
+    }
+
     /*
      * Create compression, history and writing threads.
      */
@@ -319,6 +598,11 @@ int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
     }
     rc = pthread_create (&write_thandl, NULL, write_thread_wrapper, this);
     if (rc != 0) SYSERR (pthread_create, rc);
+    lthandls = (pthread_t *) alloca (opt_lthreads * sizeof *lthandls);
+    for (i = 0; i < opt_lthreads; i ++) {
+        rc = pthread_create (&lthandls[i], NULL, lwork_thread_wrapper, this);
+        if (rc != 0) SYSERR (pthread_create, rc);
+    }
 
     /*
      * Start counting runtime for this thread.
@@ -328,22 +612,35 @@ int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
     /*
      * Malloc some page-aligned buffers for reading from files.
      */
-    for (i = 0; i < SQ_NSLOTS; i ++) {
+    for (i = 0; i < (int) frbufcount; i ++) {
         rc = posix_memalign ((void **)&buf, PAGESIZE, FILEIOSIZE);
         if (rc != 0) NOMEM ();
         frbufqueue.enqueue (buf);
     }
 
+    /*
+     * Malloc arena chunks that headers and other small records get copied to.
+     */
+    for (i = 0; i < AR_NCHUNKS; i ++) {
+        ac = (ArenaChunk *) malloc (AR_CHUNKSIZE + sizeof *ac);
+        if (ac == NULL) NOMEM ();
+        ac->size = AR_CHUNKSIZE;
+        frchkqueue.enqueue (ac);
+    }
+
     /*
      * Process root path of files to back up.
      */
-    ok = write_file (rootpath, NULL);
+    la = lookahead_get (rootpath, NULL);
+    ok = write_file (la, NULL);
+    lookahead_put (la);
 
     /*
      * Write EOF header so reader knows it got the whole saveset.
      */
     memset (&endhdr, 0, sizeof endhdr);
     write_header (&endhdr);
+    arena_release ();
 
     /*
      * Tell the other threads to flush and terminate.
@@ -359,6 +656,13 @@ int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
     /*
      * Wait for other threads to finish.
      */
+    for (i = 0; i < opt_lthreads; i ++) {
+        lworkqueue.enqueue (NULL);
+    }
+    for (i = 0; i < opt_lthreads; i ++) {
+        rc = pthread_join (lthandls[i], NULL);
+        if (rc != 0) SYSERR (pthread_join, rc);
+    }
     rc = pthread_join (compr_thandl, NULL);
     if (rc != 0) SYSERR (pthread_join, rc);
     if (histdbname != NULL) {
@@ -368,6 +672,10 @@ int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
     rc = pthread_join (write_thandl, NULL);
     if (rc != 0) SYSERR (pthread_join, rc);
 
+    while (frchkqueue.trydequeue (&ac)) {
+        free (ac);
+    }
+
     /*
      * Finished, close saveset file.
      */
@@ -377,6 +685,15 @@ int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
         return EX_SSIO;
     }
     ssfd = -1;
+    if (manfile != NULL) {
+        manifest_segment ();
+        rc = fclose (manfile);
+        manfile = NULL;
+        if (rc != 0) {
+            fprintf (stderr, "ftbackup: fclose(%s) error: %s\n", opt_manifest, mystrerr (errno));
+            return EX_SSIO;
+        }
+    }
 
     /*
      * Close record and since files too.
@@ -407,72 +724,75 @@ int FTBWriter::write_saveset (char const *ssname, char const *rootpath)
         }
     }
 
+    if (catfile != NULL) {
+        rc = fclose (catfile);
+        catfile = NULL;
+        if (rc != 0) {
+            fprintf (stderr, "ftbackup: fclose(%s) error: %s\n", opt_catalog, mystrerr (errno));
+            return EX_SSIO;
+        }
+    }
+
     return ok ? EX_OK : EX_FILIO;
 }
 
 /**
  * @brief Write the given file/directory/whatever to the currently open saveset.
- * @param path = path to file
+ * @param la = file as looked up by lookahead_get()
+ * @param dirstat = attributes of directory containing the file, NULL for root path
  * @returns true: no file io errors
  *         false: some io errors
  */
-bool FTBWriter::write_file (char const *path, struct stat const *dirstat)
+bool FTBWriter::write_file (LookAhead *la, struct stat const *dirstat)
 {
     bool ok;
-    char *xattrslistbuf;
+    char const *path;
+    HdrBuf *hb;
     Header *hdr;
-    int rc;
-    struct stat statbuf;
-    uint32_T hdrnamealloc, i, j, pathlen, xattrslistlen, xattrsvalslen;
+    struct stat const *statbuf;
+    uint32_T hdrnamealloc, i, pathlen, vallen;
+
+    /*
+     * Wait for lookahead thread to finish looking it up.
+     */
+    if (!__atomic_load_n (&la->done, __ATOMIC_ACQUIRE)) {
+        rft_runtime += getruntime ();
+        pthread_mutex_lock (&lamutex);
+        while (!la->done) {
+            pthread_cond_wait (&lacond, &lamutex);
+        }
+        pthread_mutex_unlock (&lamutex);
+        rft_runtime -= getruntime ();
+    }
+    path    = la->path;
+    statbuf = &la->statbuf;
 
     /*
      * See what type of thing we are dealing with.
      */
-    if (tfs->fslstat (path, &statbuf) < 0) {
-        fprintf (stderr, "ftbackup: lstat(%s) error: %s\n", path, mystrerr (errno));
+    if ((la->errfunc != NULL) && (strcmp (la->errfunc, "lstat") == 0)) {
+        fprintf (stderr, "ftbackup: lstat(%s) error: %s\n", path, mystrerr (la->err));
         return false;
     }
 
     /*
      * We can't restore sockets so no sense trying to save them.
      */
-    if (S_ISSOCK (statbuf.st_mode)) {
+    if (S_ISSOCK (statbuf->st_mode)) {
         fprintf (stderr, "ftbackup: skipping socket %s\n", path);
         return true;
     }
 
     /*
-     * Get extended attributes length, if any.
+     * Make sure we got the extended attributes, if any.
      */
-    rc = tfs->fsllistxattr (path, NULL, 0);
-    if (rc < 0) {
-        if (errno != ENOTSUP) {
-            fprintf (stderr, "ftbackup: llistxattr(%s) error: %s\n", path, strerror (errno));
-            return false;
-        }
-        rc = 0;
-    }
-    xattrslistlen = rc;
-    xattrsvalslen = 0;
-    xattrslistbuf = NULL;
-    if (xattrslistlen > 0) {
-        xattrslistbuf = (char *) alloca (xattrslistlen);
-        rc = tfs->fsllistxattr (path, xattrslistbuf, xattrslistlen);
-        if (rc < 0) {
-            fprintf (stderr, "ftbackup: llistxattr(%s) error: %s\n", path, strerror (errno));
-            return false;
-        }
-        xattrslistlen = rc;
-        for (i = 0; i < xattrslistlen; i += ++ j) {
-            rc = tfs->fslgetxattr (path, xattrslistbuf + i, NULL, 0);
-            if (rc < 0) {
-                fprintf (stderr, "ftbackup: lgetxattr(%s,%s) error: %s\n", path, xattrslistbuf + i, strerror (errno));
-                return false;
-            }
-            xattrsvalslen += rc + 5;
-            j = strlen (xattrslistbuf + i);
+    if (la->errfunc != NULL) {
+        if (strcmp (la->errfunc, "lgetxattr") == 0) {
+            fprintf (stderr, "ftbackup: lgetxattr(%s,%s) error: %s\n", path, la->xattrs + la->errxattr, strerror (la->err));
+        } else {
+            fprintf (stderr, "ftbackup: %s(%s) error: %s\n", la->errfunc, path, strerror (la->err));
         }
-        xattrslistlen += 5;
+        return false;
     }
 
     /*
@@ -484,49 +804,58 @@ bool FTBWriter::write_file (char const *path, struct stat const *dirstat)
 
     /*
      * Set up file header with the file's name and attributes.
+     * Each level of directory recursion keeps its header buffer
+     * from one file to the next, enlarging it as needed.
      */
-    hdrnamealloc = pathlen + 1 + xattrslistlen + xattrsvalslen;
-    hdr = (Header *) malloc (hdrnamealloc + sizeof *hdr);
-    if (hdr == NULL) NOMEM ();
+    hdrnamealloc = pathlen + 1;
+    if (la->xattrslistlen > 0) hdrnamealloc += la->xattrslistlen + 5 + la->xattrsvalslen;
+    if (hdrbufdepth == hdrbufsused) {
+        hdrbufs = (HdrBuf *) realloc (hdrbufs, ++ hdrbufsused * sizeof *hdrbufs);
+        if (hdrbufs == NULL) NOMEM ();
+        hdrbufs[hdrbufdepth].hdr  = NULL;
+        hdrbufs[hdrbufdepth].size = 0;
+    }
+    hb = &hdrbufs[hdrbufdepth];
+    if (hb->size < hdrnamealloc + sizeof *hdr) {
+        free (hb->hdr);
+        hb->size = hdrnamealloc + sizeof *hdr;
+        hb->hdr  = (Header *) malloc (hb->size);
+        if (hb->hdr == NULL) NOMEM ();
+    }
+    hdr = hb->hdr;
     memset (hdr, 0, sizeof *hdr);
 
-    hdr->mtimns = NANOTIME (statbuf.st_mtim);
-    hdr->ctimns = NANOTIME (statbuf.st_ctim);
-    hdr->atimns = NANOTIME (statbuf.st_atim);
-    hdr->size   = statbuf.st_size;
-    hdr->stmode = statbuf.st_mode;
-    hdr->ownuid = statbuf.st_uid;
-    hdr->owngid = statbuf.st_gid;
+    hdr->mtimns = NANOTIME (statbuf->st_mtim);
+    hdr->ctimns = NANOTIME (statbuf->st_ctim);
+    hdr->atimns = NANOTIME (statbuf->st_atim);
+    hdr->size   = statbuf->st_size;
+    hdr->stmode = statbuf->st_mode;
+    hdr->ownuid = statbuf->st_uid;
+    hdr->owngid = statbuf->st_gid;
 
     memcpy (hdr->name, path, pathlen);
     hdr->name[pathlen++] = 0;
 
-    if (xattrslistlen > 0) {
+    if (la->xattrslistlen > 0) {
         hdr->flags = HFL_XATTRS;
-        xattrslistlen -= 5;
-        pathlen = inspackeduint32 (hdr->name, pathlen, xattrslistlen);
-        memcpy (hdr->name + pathlen, xattrslistbuf, xattrslistlen);
-        pathlen += xattrslistlen;
-        for (i = 0; i < xattrslistlen; i += ++ j) {
-            rc = tfs->fslgetxattr (path, xattrslistbuf + i, hdr->name + pathlen + 5, hdrnamealloc - pathlen - 5);
-            if (rc < 0) {
-                fprintf (stderr, "ftbackup: lgetxattr(%s,%s) error: %s\n", path, xattrslistbuf + i, strerror (errno));
-                free (hdr);
-                return false;
-            }
-            j = inspackeduint32 (hdr->name, pathlen, (uint32_T) rc);
-            memmove (hdr->name + j, hdr->name + pathlen + 5, rc);
-            pathlen = j + rc;
-            j = strlen (xattrslistbuf + i);
+        pathlen = inspackeduint32 (hdr->name, pathlen, la->xattrslistlen);
+        memcpy (hdr->name + pathlen, la->xattrs, la->xattrslistlen);
+        pathlen += la->xattrslistlen;
+        for (i = la->xattrslistlen; i < la->xattrsused; i += 4 + vallen) {
+            memcpy (&vallen, la->xattrs + i, 4);
+            pathlen = inspackeduint32 (hdr->name, pathlen, vallen);
+            memcpy (hdr->name + pathlen, la->xattrs + i + 4, vallen);
+            pathlen += vallen;
         }
     }
 
     hdr->nameln = pathlen;
+    hdrbufdepth ++;
 
     /*
      * Mountpoints get an empty directory instead of descending into the filesystem.
      */
-    if ((dirstat != NULL) && (statbuf.st_dev != dirstat->st_dev)) {
+    if ((dirstat != NULL) && (statbuf->st_dev != dirstat->st_dev)) {
         fprintf (stderr, "ftbackup: skipping mountpoint %s\n", hdr->name);
         ok = write_mountpoint (hdr);
     }
@@ -534,15 +863,131 @@ bool FTBWriter::write_file (char const *path, struct stat const *dirstat)
     /*
      * Otherwise, write it out to saveset based on what its type is.
      */
-    else if (S_ISREG (statbuf.st_mode)) ok = write_regular (hdr, &statbuf);
-    else if (S_ISDIR (statbuf.st_mode)) ok = write_directory (hdr, &statbuf);
-    else if (S_ISLNK (statbuf.st_mode)) ok = write_symlink (hdr);
-                                   else ok = write_special (hdr, statbuf.st_rdev);
+    else if (S_ISREG (statbuf->st_mode)) ok = write_regular (hdr, la);
+    else if (S_ISDIR (statbuf->st_mode)) ok = write_directory (hdr, la);
+    else if (S_ISLNK (statbuf->st_mode)) ok = write_symlink (hdr);
+                                    else ok = write_special (hdr, statbuf->st_rdev);
+
+    -- hdrbufdepth;
+    return ok;
+}
+
+/**
+ * @brief Read file contents with up to opt_iouring reads in flight,
+ *        queuing the buffers to comprqueue in order as they complete.
+ * @param hdr = file's header, hdr->size bytes are to be read
+ * @param fd = file open for reading
+ * @param ofs_r = where to start reading, updated to where reading stopped
+ * @returns true: read all hdr->size bytes
+ *         false: error reading at *ofs_r, message printed
+ */
+bool FTBWriter::read_iouring (Header const *hdr, int fd, uint64_T *ofs_r)
+{
+    bool ok;
+    int rc;
+    IoRead *rd;
+    time_t now;
+    uint32_T ncons, nsubs, plen;
+    uint64_T len, ofs, subofs;
+    void *buf;
+
+    ok     = true;
+    ofs    = *ofs_r;
+    subofs = ofs;
+    ncons  = 0;
+    nsubs  = 0;
+
+    while (ofs < hdr->size) {
+
+        /*
+         * Start reading as many following buffers as we can without waiting,
+         * but make sure there is at least one read going.
+         */
+        while ((nsubs - ncons < opt_iouring) && (subofs < hdr->size)) {
+            if (nsubs == ncons) {
+                rft_runtime += getruntime ();
+                buf = frbufqueue.dequeue ();
+                rft_runtime -= getruntime ();
+            } else if (!frbufqueue.trydequeue (&buf)) break;
+            len  = hdr->size - subofs;
+            if (len > FILEIOSIZE) len = FILEIOSIZE;
+            plen = (len + PAGESIZE - 1) & -PAGESIZE;
+            rd   = &ioreads[nsubs%opt_iouring];
+            rd->buf  = buf;
+            rd->len  = len;
+            rd->done = false;
+            if (!iouring.prepread (fd, buf, plen, subofs, nsubs % opt_iouring)) abort ();
+            nsubs  ++;
+            subofs += len;
+        }
+
+        /*
+         * Wait for the oldest one to complete.
+         */
+        rd = &ioreads[(ncons++)%opt_iouring];
+        wait_iouring (rd);
+
+        now = time (NULL);
+        if ((opt_verbose && (now >= lastverbsec)) ||
+            ((opt_verbsec > 0) && (now >= lastverbsec + 2 * opt_verbsec))) {
+            lastverbsec = now;
+            print_header (stderr, hdr, hdr->name, ofs);
+        }
+
+        /*
+         * Queue it to be compressed, same as write_regular() does with pread().
+         */
+        len = rd->len;
+        rc  = rd->res;
+        if (rc < 0) {
+            fprintf (stderr, "ftbackup: pread(%s, ..., %llu, %llu) error: %s\n",
+                    hdr->name, len, ofs, mystrerr (- rc));
+            ok = false;
+            memset (rd->buf, 0x69, len);
+            rc = len;
+        } else if ((uint32_T) rc < len) {
+            fprintf (stderr, "ftbackup: pread(%s, ..., %llu, %llu) error: only got %d byte%s\n",
+                    hdr->name, len, ofs, rc, ((rc == 1) ? "" : "s"));
+            ok = false;
+        } else {
+            rc = len;
+        }
+        write_queue (rd->buf, rc, 2);
+        ofs += rc;
+        if (!ok) break;
+    }
+
+    /*
+     * After an error, wait for the rest to complete and discard them.
+     */
+    while (ncons != nsubs) {
+        rd = &ioreads[(ncons++)%opt_iouring];
+        wait_iouring (rd);
+        frbufqueue.enqueue (rd->buf);
+    }
 
-    free (hdr);
+    *ofs_r = ofs;
     return ok;
 }
 
+/**
+ * @brief Submit any queued reads and wait for the given one to complete.
+ */
+void FTBWriter::wait_iouring (IoRead *rd)
+{
+    int rc, res;
+    uint64_T data;
+
+    while (!rd->done) {
+        rc = iouring.submit (1);
+        if (rc < 0) SYSERR (io_uring_enter, - rc);
+        while (iouring.getcqe (&data, &res)) {
+            ioreads[data].res  = res;
+            ioreads[data].done = true;
+        }
+    }
+}
+
 /**
  * @brief Determine order that two paths get written to saveset.
  * @returns < 0: p1 comes before p2 in saveset
@@ -578,16 +1023,19 @@ static uint32_T inspackeduint32 (char *buf, uint32_T idx, uint32_T val)
 /**
  * @brief Write a regular file out to the saveset.
  */
-bool FTBWriter::write_regular (Header *hdr, struct stat const *statbuf)
+bool FTBWriter::write_regular (Header *hdr, LookAhead *la)
 {
     bool ok;
     int fd, rc;
+    struct stat const *statbuf;
     struct stat statend;
     time_t now;
-    uint32_T i, plen;
+    uint32_T plen;
     uint64_T len, ofs;
     void *buf;
 
+    statbuf = &la->statbuf;
+
     /*
      * Only back up regular files changed since the -since option value.
      */
@@ -595,23 +1043,34 @@ bool FTBWriter::write_regular (Header *hdr, struct stat const *statbuf)
 
     /*
      * If same inode as a previous file, say this is an hardlink.
+     * Only files with more than one link can possibly be one.
      */
-    for (i = 0; i < inodesused; i ++) {
-        if (inodeslist[i] == statbuf->st_ino) break;
-    }
-    if ((i < inodesused) && (inodesmtim[i] == hdr->mtimns)) {
-        uint32_T fileno = i;
-        hdr->flags = HFL_HDLINK;
-        write_header (hdr);
-        write_raw (&fileno, sizeof fileno, false);
-        return true;
+    if (statbuf->st_nlink > 1) {
+        InodeEnt *ient = inodes_lookup (statbuf);
+        if ((ient->fileno != 0) && (ient->mtimns == hdr->mtimns)) {
+            uint32_T fileno = ient->fileno;
+            hdr->flags = HFL_HDLINK;
+            write_header (hdr);
+            write_raw (&fileno, sizeof fileno, 0);
+            return true;
+        }
     }
 
     /*
      * Make sure we can open the file before writing header.
+     * The lookahead thread may have already opened it.
      */
-    fd = tfs->fsopen (hdr->name, O_RDONLY | O_NOATIME | ioptions);
-    if (fd < 0) fd = tfs->fsopen (hdr->name, O_RDONLY | ioptions);
+    if (la->fd >= 0) {
+        fd = la->fd;
+        la->fd = -1;
+        __atomic_sub_fetch (&laopenfds, 1, __ATOMIC_RELAXED);
+    } else if (la->openerr != 0) {
+        fd = -1;
+        errno = la->openerr;
+    } else {
+        fd = tfs->fsopen (hdr->name, O_RDONLY | O_NOATIME | ioptions);
+        if (fd < 0) fd = tfs->fsopen (hdr->name, O_RDONLY | ioptions);
+    }
     if (fd < 0) {
         fprintf (stderr, "ftbackup: open(%s) error: %s\n", hdr->name, mystrerr (errno));
         return false;
@@ -625,6 +1084,11 @@ bool FTBWriter::write_regular (Header *hdr, struct stat const *statbuf)
      */
     write_header (hdr);
 
+    /*
+     * Maybe read with several reads in flight, stopping at the first error.
+     */
+    if (iouring.isopen ()) ok = read_iouring (hdr, fd, &ofs);
+
     /*
      * Write file contents to saveset.
      * We always write the exact number of bytes shown in the header.
@@ -668,28 +1132,7 @@ bool FTBWriter::write_regular (Header *hdr, struct stat const *statbuf)
     /*
      * Save inode number in case there is an hardlink to the file later.
      */
-    i = hdr->fileno;
-    if (inodessize <= i) {
-        if (inodessize == 0) inodesdevno = statbuf->st_dev;
-        do inodessize += inodessize / 2 + 10;
-        while (inodessize <= i);
-        inodeslist = (ino_t *) realloc (inodeslist, inodessize * sizeof *inodeslist);
-        inodesmtim = (uint64_T *) realloc (inodesmtim, inodessize * sizeof *inodesmtim);
-        if ((inodeslist == NULL) || (inodesmtim == NULL)) NOMEM ();
-    }
-    if (inodesdevno != statbuf->st_dev) {
-        fprintf (stderr, "ftbackup: %s different dev_t %llu than %llu\n",
-                hdr->name, (unsigned long long) statbuf->st_dev, (unsigned long long) inodesdevno);
-        ok = false;
-    } else {
-        while (inodesused <= i) {
-            inodeslist[inodesused] = 0;
-            inodesmtim[inodesused] = 0;
-            inodesused ++;
-        }
-        inodeslist[i] = statbuf->st_ino;
-        inodesmtim[i] = hdr->mtimns;
-    }
+    if (statbuf->st_nlink > 1) inodes_save (statbuf, hdr);
 
     /*
      * If different mtime than when started, output warning message.
@@ -711,32 +1154,49 @@ bool FTBWriter::write_regular (Header *hdr, struct stat const *statbuf)
 /**
  * @brief Write a directory out to the saveset followed by all the files in the directory.
  */
-bool FTBWriter::write_directory (Header *hdr, struct stat const *statbuf)
+bool FTBWriter::write_directory (Header *hdr, LookAhead *la)
 {
     bool ok;
-    char *bbb, *buf, *p, *path, *q, *snbuf, *snname;
+    char *bbb, *buf, *path, *snbuf, *snname;
     char const *name;
-    int i, j, len, longest, nents, pathlen, snfd, snlen;
-    SkipName *saveskipnames, *skipname;
+    int i, j, k, len, longest, nents, nposted, pathlen, snfd, snlen;
+    LookAhead **las, *sla;
+    SkipActive skipact, *saveskipactive;
+    SkipEnt *skipent;
+    SkipFile *skipfile;
+    SkipNode *skipnode;
     struct dirent *de, **names;
+    struct stat const *statbuf;
     struct stat statend;
 
     ok = true;
+    statbuf = &la->statbuf;
 
     /*
      * Read and sort the directory contents.
+     * The lookahead thread may have already done it.
      */
-    nents = tfs->fsscandir (hdr->name, &names, NULL, myalphasort);
+    if (la->nents >= 0) {
+        nents = la->nents;
+        names = la->names;
+        la->nents = -1;
+        la->names = NULL;
+    } else if (la->scanerr != 0) {
+        nents = -1;
+        errno = la->scanerr;
+    } else {
+        nents = tfs->fsscandir (hdr->name, &names, NULL, myalphasort);
+    }
     if (nents < 0) {
         fprintf (stderr, "ftbackup: scandir(%s) error: %s\n", hdr->name, mystrerr (errno));
         return false;
     }
 
     /*
-     * If directory contains ~SKIPNAMES.FTB, add those names as wildcards
-     * to list of files to skip.
+     * If directory contains ~SKIPNAMES.FTB, compile those names as wildcards
+     * of files to skip.
      */
-    saveskipnames = skipnames;
+    skipfile = NULL;
     snbuf  = NULL;
     snname = (char *) alloca (strlen (hdr->name) + 16);
     sprintf (snname, "%s/~SKIPNAMES.FTB", hdr->name);
@@ -756,18 +1216,7 @@ bool FTBWriter::write_directory (Header *hdr, struct stat const *statbuf)
         close (snfd);
     }
     if (snbuf != NULL) {
-        for (p = snbuf; p < snbuf + snlen; p = ++ q) {
-            q = strchr (p, '\n');
-            if (q == NULL) q = snbuf + snlen;
-            if (q > p) {
-                skipname = (SkipName *) alloca (q - p + sizeof *skipname);
-                skipname->next = skipnames;
-                skipname->dir  = hdr->name;
-                memcpy (skipname->wild, p, q - p);
-                skipname->wild[q-p] = 0;
-                skipnames = skipname;
-            }
-        }
+        skipfile = skipfile_compile (snbuf, snlen);
         munmap (snbuf, snlen);
     }
 
@@ -808,6 +1257,53 @@ bool FTBWriter::write_directory (Header *hdr, struct stat const *statbuf)
     path = (char *) alloca (pathlen + longest + 2);
     memcpy (path, hdr->name, pathlen);
     path[pathlen++] = '/';
+    path[pathlen] = 0;
+
+    /*
+     * Get skip rules that might apply to files in this directory.
+     * Rules from the parent directory's ~SKIPNAMES.FTB files carry on
+     * down to here only if they might still match something in here.
+     * The deep wildcards' offsets still work as parent's path is on
+     * the front of ours.
+     */
+    saveskipactive = skipactive;
+    k = 0;
+    if (saveskipactive != NULL) {
+        k = saveskipactive->ndeeps + saveskipactive->ntries;
+        j = pathlen - 1;
+        for (i = j; (i > 0) && (path[i-1] != '/');) -- i;
+    }
+    skipact.tries  = (SkipTrie *) alloca ((k + 1) * sizeof *skipact.tries);
+    skipact.deeps  = (SkipDeep *) alloca ((k + 1) * sizeof *skipact.deeps);
+    skipact.ntries = 0;
+    skipact.ndeeps = 0;
+    if (saveskipactive != NULL) {
+        for (k = 0; k < saveskipactive->ndeeps; k ++) {
+            if (saveskipactive->deeps[k].wilds->canmatch (path + saveskipactive->deeps[k].pathoff)) {
+                skipact.deeps[skipact.ndeeps++] = saveskipactive->deeps[k];
+            }
+        }
+        for (k = 0; k < saveskipactive->ntries; k ++) {
+            skipent = skipfile_lookup (saveskipactive->tries[k].file, saveskipactive->tries[k].node, path + i, j - i, false);
+            if ((skipent != NULL) && ((skipnode = skipent->child) != NULL)) {
+                skipact.tries[skipact.ntries].file = saveskipactive->tries[k].file;
+                skipact.tries[skipact.ntries++].node = skipnode;
+                if (skipnode->deep.count () > 0) {
+                    skipact.deeps[skipact.ndeeps].wilds = &skipnode->deep;
+                    skipact.deeps[skipact.ndeeps++].pathoff = pathlen;
+                }
+            }
+        }
+    }
+    if (skipfile != NULL) {
+        skipact.tries[skipact.ntries].file = skipfile;
+        skipact.tries[skipact.ntries++].node = skipfile->root;
+        if (skipfile->root->deep.count () > 0) {
+            skipact.deeps[skipact.ndeeps].wilds = &skipfile->root->deep;
+            skipact.deeps[skipact.ndeeps++].pathoff = pathlen;
+        }
+    }
+    skipactive = ((skipact.ntries > 0) || (skipact.ndeeps > 0)) ? &skipact : NULL;
 
     /*
      * Total up length needed for all filenames in the directory.
@@ -841,9 +1337,13 @@ bool FTBWriter::write_directory (Header *hdr, struct stat const *statbuf)
          *   <number-of-beginning-chars-same-as-last><different-chars-on-end><null>
          */
         if (hdr->size > 0) {
-            buf = (char *) malloc (hdr->size);
-            if (buf == NULL) NOMEM ();
-            bbb = buf;
+            if (dirbufsize < hdr->size) {
+                free (dirbuf);
+                dirbufsize = hdr->size;
+                dirbuf = (char *) malloc (dirbufsize);
+                if (dirbuf == NULL) NOMEM ();
+            }
+            buf = bbb = dirbuf;
             path[pathlen] = 0;
             for (i = 0; i < nents; i ++) {
                 de = names[i];
@@ -858,26 +1358,39 @@ bool FTBWriter::write_directory (Header *hdr, struct stat const *statbuf)
                 }
             }
             if ((ulong_T) (bbb - buf) != hdr->size) abort ();
-            write_queue (buf, bbb - buf, 1);
+            write_raw (buf, bbb - buf, 1);
         }
     }
 
     /*
      * Write the files in the directory out to the saveset.
+     * Keep the next lawindow files queued to the lookahead threads, if any,
+     * so they are looked up while we write the ones before them.
      */
+    las = (LookAhead **) alloca (lawindow * sizeof *las);
+    nposted = 0;
     for (i = 0; i < nents; i ++) {
-        de = names[i];
-        name = de->d_name;
-        if ((strcmp (name, ".") != 0) && (strcmp (name, "..") != 0)) {
-            strcpy (path + pathlen, name);
-            if (!skipbyname (skipnames, path)) {
-                ok &= write_file (path, statbuf);
+        for (; (nposted < nents) && (nposted < i + (int) lawindow); nposted ++) {
+            sla  = NULL;
+            name = names[nposted]->d_name;
+            if ((strcmp (name, ".") != 0) && (strcmp (name, "..") != 0)) {
+                strcpy (path + pathlen, name);
+                if (!skipbyname (skipactive, path, pathlen)) {
+                    sla = lookahead_get (path, statbuf);
+                }
             }
+            las[nposted%lawindow] = sla;
         }
-        free (de);
+        sla = las[i%lawindow];
+        if (sla != NULL) {
+            ok &= write_file (sla, statbuf);
+            lookahead_put (sla);
+        }
+        free (names[i]);
     }
     free (names);
-    skipnames = saveskipnames;
+    skipactive = saveskipactive;
+    if (skipfile != NULL) skipfile_free (skipfile);
 
     /*
      * If different mtime than when started, output warning message.
@@ -892,104 +1405,291 @@ bool FTBWriter::write_directory (Header *hdr, struct stat const *statbuf)
 }
 
 /**
- * @brief See if a file is in the current ~SKIPNAMES.FTB list.
- * @param skipname = list of names to skip
+ * @brief See if a file is matched by the current ~SKIPNAMES.FTB rules.
+ * @param skipact = rules that might apply to files in the directory, NULL if none
  * @param path = full path being tested
- * @returns true: file matched by skip list
- *         false: file not in skip list
+ * @param pathlen = offset in path of file's name within its directory
+ * @returns true: file matched by skip rules
+ *         false: file not matched
  */
-static bool skipbyname (SkipName *skipname, char const *path)
+static bool skipbyname (SkipActive const *skipact, char const *path, int pathlen)
 {
-    for (; skipname != NULL; skipname = skipname->next) {
+    char const *name;
+    int i;
+    SkipEnt *skipent;
 
-        // get directory the ~SKIPNAMES.FTB file was in
-        // it is the directory its wild applies to
-        int sndirlen = strlen (skipname->dir);
-        while ((sndirlen > 0) && (skipname->dir[sndirlen-1] == '/')) -- sndirlen;
+    if (skipact == NULL) return false;
 
-        // see if the file being tested is in that directory
-        if (memcmp (skipname->dir, path, sndirlen) != 0) continue;
-        if (path[sndirlen] != '/') continue;
-        do sndirlen ++;
-        while (path[sndirlen] == '/');
+    // literal names and shallow wildcards of the nodes for this directory
+    name = path + pathlen;
+    for (i = 0; i < skipact->ntries; i ++) {
+        skipent = skipfile_lookup (skipact->tries[i].file, skipact->tries[i].node, name, strlen (name), false);
+        if ((skipent != NULL) && skipent->leaf) return true;
+        if (skipact->tries[i].node->shallow.match (name) >= 0) return true;
+    }
 
-        // if name matches wildcard, skip the file
-        char const *wild = skipname->wild;
-        if (wildcardmatch (wild, path + sndirlen)) return true;
+    // deep wildcards, relative to the directory they came from
+    for (i = 0; i < skipact->ndeeps; i ++) {
+        if (skipact->deeps[i].wilds->match (path + skipact->deeps[i].pathoff) >= 0) return true;
     }
 
     return false;
 }
 
 /**
- * @brief Write a directory used as a mountpoint, ie, write it as being empty.
+ * @brief Compile the contents of a ~SKIPNAMES.FTB file.
+ * @param buf = file contents, one wildcard per line
+ * @param len = length of file contents
+ * @returns NULL: file has no wildcards
+ *          else: compiled file, free with skipfile_free()
  */
-bool FTBWriter::write_mountpoint (Header *hdr)
+static SkipFile *skipfile_compile (char const *buf, int len)
 {
-    /*
-     * Only back up mountpoints changed since the -since option value.
-     */
-    if (!skipbysince (hdr)) {
+    bool deep;
+    char c, *comp, *line;
+    char const *p, *q, *r, *s;
+    int complen, nlines;
+    SkipEnt *skipent;
+    SkipFile *file;
+    SkipNode *node;
+
+    file = (SkipFile *) malloc (sizeof *file);
+    if (file == NULL) NOMEM ();
+    file->root     = new SkipNode;
+    file->root->nextnode = NULL;
+    file->entmask  = 15;
+    file->entsused = 0;
+    file->ents     = (SkipEnt *) calloc (file->entmask + 1, sizeof *file->ents);
+    comp = (char *) malloc (len + 1);
+    if ((file->ents == NULL) || (comp == NULL)) NOMEM ();
+
+    nlines = 0;
+    for (p = buf; p < buf + len; p = ++ q) {
+        q = (char const *) memchr (p, '\n', buf + len - p);
+        if (q == NULL) q = buf + len;
+        if (q == p) continue;
+        nlines ++;
 
         /*
-         * Write header out with hdr->size = 0 indicating an empty directory.
+         * Strip literal names followed by '/' off the front, walking down the tree.
+         * Stop at the first name with a wildcard char in it.
          */
-        hdr->size = 0;
-        write_header (hdr);
-    }
-    return true;
-}
+        node = file->root;
+        for (r = p;;) {
+            complen = 0;
+            for (s = r; s < q; s ++) {
+                c = *s;
+                if (c == '\\') {
+                    // escaped '/' is left to the wildcard matcher, which treats it as a separator
+                    if ((++ s >= q) || (*s == '/')) goto wild;
+                    c = *s;
+                } else if (c == '/') {
+                    break;
+                } else if (wildcardchar (c)) {
+                    goto wild;
+                }
+                comp[complen++] = c;
+            }
+            skipent = skipfile_lookup (file, node, comp, complen, true);
 
-/**
- * @brief Write a symlink out to the saveset.
- */
-bool FTBWriter::write_symlink (Header *hdr)
-{
-    char *buf;
-    int rc;
+            // end of line, it names an exact file
+            if (s >= q) {
+                skipent->leaf = true;
+                goto nextline;
+            }
 
-    if (skipbysince (hdr)) return true;
+            // name followed by '/', step down to subdirectory's node
+            if (skipent->child == NULL) {
+                skipent->child = new SkipNode;
+                skipent->child->nextnode = file->root->nextnode;
+                file->root->nextnode = skipent->child;
+            }
+            node = skipent->child;
+            r = s + 1;
+        }
 
-    buf = (char *) malloc (hdr->size + 1);
-    while (true) {
-        if (buf == NULL) NOMEM ();
-        rc = tfs->fsreadlink (hdr->name, buf, hdr->size + 1);
-        if (rc < 0) {
-            fprintf (stderr, "ftbackup: readlink(%s) error: %s\n", hdr->name, mystrerr (errno));
-            return false;
+        /*
+         * Rest of line starting with the name that has a wildcard char.
+         * If it has no '/', '**', '?' or '[' it can only match names in
+         * the node's directory, otherwise it might match in subdirectories.
+         */
+    wild:
+        deep = false;
+        for (s = r; s < q; s ++) {
+            c = *s;
+            if (c == '\\') {
+                if ((++ s < q) && (*s == '/')) deep = true;
+            } else if ((c == '/') || (c == '?') || (c == '[') || ((c == '*') && (s + 1 < q) && (s[1] == '*'))) {
+                deep = true;
+            }
         }
-        if ((uint32_T) rc <= hdr->size) break;
-        hdr->size += hdr->size / 2 + 1;
-        buf = (char *) realloc (buf, hdr->size + 1);
+        line = strndup (r, q - r);
+        if (line == NULL) NOMEM ();
+        if (deep) node->deep.add (line);
+             else node->shallow.add (line);
+        free (line);
+    nextline:;
     }
 
-    hdr->size = rc;
-    write_header (hdr);
-    write_queue (buf, rc, 0);
-    return true;
+    free (comp);
+    if (nlines == 0) {
+        skipfile_free (file);
+        file = NULL;
+    }
+    return file;
 }
 
 /**
- * @brief Write a special file (mknod) out to the saveset.
+ * @brief Hash a node and name to the first slot to probe in a compiled ~SKIPNAMES.FTB file's table.
  */
-bool FTBWriter::write_special (Header *hdr, dev_t strdev)
+static inline uint32_T skipfile_hash (SkipNode const *parent, char const *name, int namelen)
 {
-    if (!skipbysince (hdr)) {
-        hdr->size = sizeof strdev;
-        write_header (hdr);
-        write_raw (&strdev, sizeof strdev, false);
-    }
-    return true;
+    int i;
+    uint32_T h;
+
+    h = (uint32_T) ((ulong_T) parent >> 4) * 0x9E3779B1U;
+    for (i = 0; i < namelen; i ++) h = (h ^ (uint8_T) name[i]) * 16777619U;
+    return h;
 }
 
 /**
- * @brief Write a saveset file's header block to the saveset.
+ * @brief Look up a name in a node of a compiled ~SKIPNAMES.FTB file.
+ * @param file = compiled ~SKIPNAMES.FTB file
+ * @param parent = node for the directory the name is in
+ * @param name = name to look up (need not be null terminated)
+ * @param namelen = length of name
+ * @param add = add entry if not found
+ * @returns NULL: not found (and add is false)
+ *          else: entry for the name
  */
-void FTBWriter::write_header (Header *hdr)
+static SkipEnt *skipfile_lookup (SkipFile *file, SkipNode const *parent, char const *name, int namelen, bool add)
 {
-    time_t now;
+    SkipEnt *newents, *oldents, *skipent;
+    uint32_T h, j, oldmask;
 
-    memcpy (hdr->magic, HEADER_MAGIC, 8);
+    /*
+     * Keep table at most 3/4 full so probe sequences stay short.
+     */
+    if (add && (file->entsused >= (file->entmask + 1) / 4 * 3)) {
+        oldents = file->ents;
+        oldmask = file->entmask;
+        file->entmask = oldmask * 2 + 1;
+        newents = (SkipEnt *) calloc (file->entmask + 1, sizeof *newents);
+        if (newents == NULL) NOMEM ();
+        for (h = 0; h <= oldmask; h ++) {
+            if (oldents[h].name != NULL) {
+                j = skipfile_hash (oldents[h].parent, oldents[h].name, strlen (oldents[h].name));
+                while (newents[j&file->entmask].name != NULL) j ++;
+                newents[j&file->entmask] = oldents[h];
+            }
+        }
+        file->ents = newents;
+        free (oldents);
+    }
+
+    for (h = skipfile_hash (parent, name, namelen);; h ++) {
+        skipent = &file->ents[h&file->entmask];
+        if (skipent->name == NULL) break;
+        if ((skipent->parent == parent) && (memcmp (skipent->name, name, namelen) == 0) && (skipent->name[namelen] == 0)) return skipent;
+    }
+    if (!add) return NULL;
+
+    skipent->parent = parent;
+    skipent->name   = strndup (name, namelen);
+    if (skipent->name == NULL) NOMEM ();
+    file->entsused ++;
+    return skipent;
+}
+
+/**
+ * @brief Free a compiled ~SKIPNAMES.FTB file.
+ */
+static void skipfile_free (SkipFile *file)
+{
+    SkipNode *node;
+    uint32_T h;
+
+    for (h = 0; h <= file->entmask; h ++) {
+        free (file->ents[h].name);
+    }
+    free (file->ents);
+    while ((node = file->root) != NULL) {
+        file->root = node->nextnode;
+        delete node;
+    }
+    free (file);
+}
+
+/**
+ * @brief Write a directory used as a mountpoint, ie, write it as being empty.
+ */
+bool FTBWriter::write_mountpoint (Header *hdr)
+{
+    /*
+     * Only back up mountpoints changed since the -since option value.
+     */
+    if (!skipbysince (hdr)) {
+
+        /*
+         * Write header out with hdr->size = 0 indicating an empty directory.
+         */
+        hdr->size = 0;
+        write_header (hdr);
+    }
+    return true;
+}
+
+/**
+ * @brief Write a symlink out to the saveset.
+ */
+bool FTBWriter::write_symlink (Header *hdr)
+{
+    int rc;
+
+    if (skipbysince (hdr)) return true;
+
+    while (true) {
+        if (linkbufsize < hdr->size + 1) {
+            linkbufsize = hdr->size + 1;
+            linkbuf = (char *) realloc (linkbuf, linkbufsize);
+            if (linkbuf == NULL) NOMEM ();
+        }
+        rc = tfs->fsreadlink (hdr->name, linkbuf, hdr->size + 1);
+        if (rc < 0) {
+            fprintf (stderr, "ftbackup: readlink(%s) error: %s\n", hdr->name, mystrerr (errno));
+            return false;
+        }
+        if ((uint32_T) rc <= hdr->size) break;
+        hdr->size += hdr->size / 2 + 1;
+    }
+
+    hdr->size = rc;
+    write_header (hdr);
+    write_raw (linkbuf, rc, 0);
+    return true;
+}
+
+/**
+ * @brief Write a special file (mknod) out to the saveset.
+ */
+bool FTBWriter::write_special (Header *hdr, dev_t strdev)
+{
+    if (!skipbysince (hdr)) {
+        hdr->size = sizeof strdev;
+        write_header (hdr);
+        write_raw (&strdev, sizeof strdev, 0);
+    }
+    return true;
+}
+
+/**
+ * @brief Write a saveset file's header block to the saveset.
+ */
+void FTBWriter::write_header (Header *hdr)
+{
+    time_t now;
+
+    memcpy (hdr->magic, HEADER_MAGIC, 8);
     hdr->fileno = ++ lastfileno;
     if (hdr->nameln > 0) {
         now = time (NULL);
@@ -999,9 +1699,202 @@ void FTBWriter::write_header (Header *hdr)
         }
         maybe_record_file (hdr->ctimns, hdr->name);
     }
-    write_raw (hdr, (ulong_T)(&hdr->name[hdr->nameln]) - (ulong_T)hdr, true);
+    write_raw (hdr, (ulong_T)(&hdr->name[hdr->nameln]) - (ulong_T)hdr, -1);
 }
 
+/**
+ * @brief Get a node for looking up a file and start looking it up.
+ *        With lookahead threads, one of them looks it up while we write
+ *        out the files before it, else we look it up right here.
+ * @param path = path of file to look up
+ * @param dirstat = attributes of directory containing the file, NULL for root path
+ * @returns node to pass to write_file() then lookahead_put()
+ */
+FTBWriter::LookAhead *FTBWriter::lookahead_get (char const *path, struct stat const *dirstat)
+{
+    LookAhead *la;
+    uint32_T pathsize;
+
+    la = lafree;
+    if (la != NULL) lafree = la->next;
+    else {
+        la = (LookAhead *) calloc (1, sizeof *la);
+        if (la == NULL) NOMEM ();
+        la->fd    = -1;
+        la->nents = -1;
+    }
+
+    pathsize = strlen (path) + 1;
+    if (la->pathsize < pathsize) {
+        free (la->path);
+        la->pathsize = pathsize;
+        la->path = (char *) malloc (pathsize);
+        if (la->path == NULL) NOMEM ();
+    }
+    memcpy (la->path, path, pathsize);
+
+    la->chkdev = (dirstat != NULL);
+    la->pdev   = la->chkdev ? dirstat->st_dev : 0;
+    la->done   = false;
+    la->early  = (opt_lthreads > 0);
+
+    if (la->early) {
+        rft_runtime += getruntime ();
+        lworkqueue.enqueue (la);
+        rft_runtime -= getruntime ();
+    } else {
+        lookahead_fill (la);
+        la->done = true;
+    }
+    return la;
+}
+
+/**
+ * @brief Done with file's lookup node, close whatever the lookahead thread opened
+ *        that write_file() didn't use.
+ */
+void FTBWriter::lookahead_put (LookAhead *la)
+{
+    int i;
+
+    if (la->fd >= 0) {
+        tfs->fsclose (la->fd);
+        la->fd = -1;
+        __atomic_sub_fetch (&laopenfds, 1, __ATOMIC_RELAXED);
+    }
+    if (la->nents >= 0) {
+        for (i = 0; i < la->nents; i ++) {
+            free (la->names[i]);
+        }
+        free (la->names);
+        la->nents = -1;
+        la->names = NULL;
+    }
+
+    la->next = lafree;
+    lafree   = la;
+}
+
+/**
+ * @brief Look up a file's attributes and extended attributes.
+ *        If in a lookahead thread, open regular files and scan directories too.
+ *        Errors are saved in the node so write_file() prints them in saveset order.
+ */
+void FTBWriter::lookahead_fill (LookAhead *la)
+{
+    int fd, rc;
+    uint32_T i, j, need;
+
+    la->errfunc       = NULL;
+    la->openerr       = 0;
+    la->scanerr       = 0;
+    la->xattrsused    = 0;
+    la->xattrslistlen = 0;
+    la->xattrsvalslen = 0;
+
+    if (tfs->fslstat (la->path, &la->statbuf) < 0) {
+        la->errfunc = "lstat";
+        la->err     = errno;
+        return;
+    }
+    if (S_ISSOCK (la->statbuf.st_mode)) return;
+
+    /*
+     * Get extended attribute names, if any, then each of their values.
+     */
+    rc = tfs->fsllistxattr (la->path, NULL, 0);
+    if (rc < 0) {
+        if (errno != ENOTSUP) {
+            la->errfunc = "llistxattr";
+            la->err     = errno;
+            return;
+        }
+        rc = 0;
+    }
+    if (rc > 0) {
+        need = rc;
+        if (la->xattrsize < need) {
+            la->xattrsize = need;
+            la->xattrs = (char *) realloc (la->xattrs, need);
+            if (la->xattrs == NULL) NOMEM ();
+        }
+        rc = tfs->fsllistxattr (la->path, la->xattrs, need);
+        if (rc < 0) {
+            la->errfunc = "llistxattr";
+            la->err     = errno;
+            return;
+        }
+        la->xattrslistlen = la->xattrsused = rc;
+        for (i = 0; i < la->xattrslistlen; i += ++ j) {
+            rc = tfs->fslgetxattr (la->path, la->xattrs + i, NULL, 0);
+            if (rc >= 0) {
+                need = la->xattrsused + 4 + rc;
+                if (la->xattrsize < need) {
+                    la->xattrsize = need + need / 2;
+                    la->xattrs = (char *) realloc (la->xattrs, la->xattrsize);
+                    if (la->xattrs == NULL) NOMEM ();
+                }
+                rc = tfs->fslgetxattr (la->path, la->xattrs + i, la->xattrs + la->xattrsused + 4, rc);
+            }
+            if (rc < 0) {
+                la->errfunc  = "lgetxattr";
+                la->err      = errno;
+                la->errxattr = i;
+                return;
+            }
+            memcpy (la->xattrs + la->xattrsused, &rc, 4);
+            la->xattrsused    += 4 + rc;
+            la->xattrsvalslen += rc + 5;
+            j = strlen (la->xattrs + i);
+        }
+    }
+
+    /*
+     * Lookahead threads open regular files so the main thread doesn't wait for
+     * the open, as long as there aren't too many open already.  And they scan
+     * directories that aren't mountpoints.
+     */
+    if (la->early) {
+        if (S_ISREG (la->statbuf.st_mode)) {
+            if (__atomic_add_fetch (&laopenfds, 1, __ATOMIC_RELAXED) > LA_MAXOPEN) {
+                __atomic_sub_fetch (&laopenfds, 1, __ATOMIC_RELAXED);
+            } else {
+                fd = tfs->fsopen (la->path, O_RDONLY | O_NOATIME | ioptions);
+                if (fd < 0) fd = tfs->fsopen (la->path, O_RDONLY | ioptions);
+                if (fd < 0) {
+                    la->openerr = errno;
+                    __atomic_sub_fetch (&laopenfds, 1, __ATOMIC_RELAXED);
+                }
+                la->fd = fd;
+            }
+        }
+        if (S_ISDIR (la->statbuf.st_mode) && (!la->chkdev || (la->statbuf.st_dev == la->pdev))) {
+            la->nents = tfs->fsscandir (la->path, &la->names, NULL, myalphasort);
+            if (la->nents < 0) la->scanerr = errno;
+        }
+    }
+}
+
+/**
+ * @brief Look up files queued by lookahead_get().
+ */
+void *FTBWriter::lwork_thread_wrapper (void *ftbw)
+{
+    return ((FTBWriter *) ftbw)->lwork_thread ();
+}
+void *FTBWriter::lwork_thread ()
+{
+    LookAhead *la;
+
+    while ((la = lworkqueue.dequeue ()) != NULL) {
+        lookahead_fill (la);
+        pthread_mutex_lock (&lamutex);
+        __atomic_store_n (&la->done, true, __ATOMIC_RELEASE);
+        pthread_cond_broadcast (&lacond);
+        pthread_mutex_unlock (&lamutex);
+    }
+    return NULL;
+}
 
 /**
  * @brief Skip if listed in the since file.
@@ -1029,6 +1922,91 @@ bool FTBWriter::skipbysince (Header const *hdr)
     return false;
 }
 
+/**
+ * @brief Hash a device index and inode number to the first hardlink table slot to probe.
+ */
+static inline uint32_T inodes_hash (uint32_T devidx, uint64_T ino)
+{
+    return ((ino + ((uint64_T) devidx << 48)) * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+/**
+ * @brief Find slot in hardlink table for a multiply-linked file.
+ * @param statbuf = file's attributes
+ * @returns slot with matching device and inode number, else empty slot where it goes
+ */
+FTBWriter::InodeEnt *FTBWriter::inodes_lookup (struct stat const *statbuf)
+{
+    InodeEnt *ient;
+    uint32_T devidx, i;
+
+    /*
+     * Devices are few, so just keep a list of them and store the index.
+     */
+    for (devidx = inodesndevs; devidx > 0;) {
+        if (inodesdevs[--devidx] == statbuf->st_dev) goto gotdev;
+    }
+    devidx = inodesndevs ++;
+    inodesdevs = (dev_t *) realloc (inodesdevs, inodesndevs * sizeof *inodesdevs);
+    if (inodesdevs == NULL) NOMEM ();
+    inodesdevs[devidx] = statbuf->st_dev;
+gotdev:
+
+    if (inodestable == NULL) {
+        inodesmask  = 1023;
+        inodestable = (InodeEnt *) calloc (inodesmask + 1, sizeof *inodestable);
+        if (inodestable == NULL) NOMEM ();
+    }
+
+    /*
+     * Linear probe from the hashed slot until we find it or an empty slot.
+     */
+    for (i = inodes_hash (devidx, statbuf->st_ino);; i ++) {
+        ient = &inodestable[i&inodesmask];
+        if (ient->fileno == 0) break;
+        if ((ient->ino == (uint64_T) statbuf->st_ino) && (ient->devidx == devidx)) break;
+    }
+    ient->devidx = devidx;
+    return ient;
+}
+
+/**
+ * @brief Save a multiply-linked file in the hardlink table so later links to it can be found.
+ * @param statbuf = file's attributes
+ * @param hdr = file's header as written to the saveset
+ */
+void FTBWriter::inodes_save (struct stat const *statbuf, Header const *hdr)
+{
+    InodeEnt *ient, *newtable, *oldtable;
+    uint32_T i, j, oldmask;
+
+    /*
+     * Keep table at most 3/4 full so probe sequences stay short.
+     */
+    if ((inodestable != NULL) && (inodesused >= (inodesmask + 1) / 4 * 3)) {
+        oldtable = inodestable;
+        oldmask  = inodesmask;
+        inodesmask  = oldmask * 2 + 1;
+        newtable = (InodeEnt *) calloc (inodesmask + 1, sizeof *newtable);
+        if (newtable == NULL) NOMEM ();
+        for (i = 0; i <= oldmask; i ++) {
+            if (oldtable[i].fileno != 0) {
+                j = inodes_hash (oldtable[i].devidx, oldtable[i].ino);
+                while (newtable[j&inodesmask].fileno != 0) j ++;
+                newtable[j&inodesmask] = oldtable[i];
+            }
+        }
+        inodestable = newtable;
+        free (oldtable);
+    }
+
+    ient = inodes_lookup (statbuf);
+    if (ient->fileno == 0) inodesused ++;
+    ient->ino    = statbuf->st_ino;
+    ient->mtimns = hdr->mtimns;
+    ient->fileno = hdr->fileno;
+}
+
 /**
  * @brief Write file's ctime and name to the opt_record file if there is one.
  */
@@ -1065,29 +2043,149 @@ void FTBWriter::write_reco_data (void const *buf, uint32_T len)
 }
 
 /**
- * @brief Write some uncompressed bytes to the saveset, could be header or data.
+ * @brief Write where a file header is in the saveset to the -catalog file.
+ *        Called by the compression thread as headers are copied to blocks,
+ *        so they are written in saveset order, ending with the end-of-saveset header.
+ * @param hdr = file header incl name and xattrs
+ * @param seqno = data block the header starts in
+ * @param hdroffs = offset of header within that block
+ */
+void FTBWriter::catalog_file (Header const *hdr, uint32_T seqno, uint32_T hdroffs)
+{
+    CatalogRec rec;
+    uint32_T namelen;
+
+    namelen = (hdr->nameln > 0) ? strlen (hdr->name) + 1 : 0;
+    rec.seqno   = seqno;
+    rec.hdroffs = hdroffs;
+    memcpy (&rec.hdr, hdr, (ulong_T)hdr->name - (ulong_T)hdr);
+    rec.hdr.nameln = namelen;
+    if ((fwrite (&rec, (ulong_T)rec.hdr.name - (ulong_T)&rec, 1, catfile) != 1) ||
+            ((namelen > 0) && (fwrite (hdr->name, namelen, 1, catfile) != 1))) {
+        fprintf (stderr, "ftbackup: fwrite(%s) error: %s\n", opt_catalog, mystrerr (errno));
+        exit (EX_SSIO);
+    }
+}
+
+/**
+ * @brief Write the -manifest line for the segment file just finished, then start over for the next.
+ *        Called as each segment file is closed, so the lines are in segment order.
+ */
+void FTBWriter::manifest_segment ()
+{
+    char const *name;
+
+    name = strrchr (sssegname, '/');
+    name = (name == NULL) ? sssegname : name + 1;
+    if (fprintf (manfile, "%u %llu %u %u %u %u %08X %s\n", thissegno, byteswrittentoseg,
+            manseg.firstseqno, manseg.lastseqno, manseg.firstxorno, manseg.lastxorno, manseg.crc, name) < 0) {
+        fprintf (stderr, "ftbackup: fprintf(%s) error: %s\n", opt_manifest, mystrerr (errno));
+        exit (EX_SSIO);
+    }
+    memset (&manseg, 0, sizeof manseg);
+}
+
+/**
+ * @brief Write some bytes to the saveset, could be header or data.
+ *        They are copied to the arena so the caller can reuse its buffer.
  * @param buf = address of data to write
  * @param len = length of data to write
- * @param hdr = true iff it is a file header; else it is data
+ * @param dty = 1: data to be compressed
+ *              0: data to be left uncompressed
+ *             -1: file header, kept in one piece
  */
-void FTBWriter::write_raw (void const *buf, uint32_T len, bool hdr)
+void FTBWriter::write_raw (void const *buf, uint32_T len, int dty)
 {
+    uint32_T n;
     void *mem;
 
-    if (len > 0) {
-        mem = malloc (len);
-        if (mem == NULL) NOMEM ();
-        memcpy (mem, buf, len);
-        write_queue (mem, len, hdr ? -1 : 0);
+    while (len > 0) {
+        n = len;
+        if ((dty >= 0) && (n > AR_CHUNKSIZE)) n = AR_CHUNKSIZE;
+        mem = arena_alloc (n);
+        memcpy (mem, buf, n);
+        write_queue (mem, n, dty);
+        buf  = (uint8_T const *) buf + n;
+        len -= n;
     }
 }
 
 /**
- * @brief Queue the malloc()d buffer to be written to saveset.
- * @param buf = malloc()d buffer, will be freed after processing
+ * @brief Allocate space in the current arena chunk for a record.
+ *        The record must be queued with write_queue() before the next
+ *        call so the chunk's records are all queued ahead of its release.
+ * @param len = number of bytes needed
+ * @returns pointer to the space
+ */
+void *FTBWriter::arena_alloc (uint32_T len)
+{
+    void *mem;
+
+    if ((archunk == NULL) || (arused + len > archunk->size)) {
+        arena_release ();
+        if (len > AR_CHUNKSIZE) {
+            archunk = (ArenaChunk *) malloc (len + sizeof *archunk);
+            if (archunk == NULL) NOMEM ();
+            archunk->size = len;
+        } else {
+            rft_runtime += getruntime ();
+            archunk = frchkqueue.dequeue ();
+            rft_runtime -= getruntime ();
+        }
+        arused = 0;
+    }
+
+    mem = (uint8_T *) archunk->data + arused;
+    arused += (len + 7) & -8;
+    return mem;
+}
+
+/**
+ * @brief Queue release of the current arena chunk behind all its records.
+ */
+void FTBWriter::arena_release ()
+{
+    if (archunk != NULL) {
+        write_queue (archunk, 0, 3);
+        archunk = NULL;
+    }
+}
+
+/**
+ * @brief Compression thread is done with all records in the chunk.
+ *        If writing history, the history thread still needs the names
+ *        so it releases the chunk when it gets to it.
+ */
+void FTBWriter::arena_done (ArenaChunk *chunk)
+{
+    HistSlot hs;
+
+    if (histdbname != NULL) {
+        hs.fname = NULL;
+        hs.chunk = chunk;
+        hs.seqno = 0;
+        histqueue.enqueue (hs);
+    } else {
+        arena_free (chunk);
+    }
+}
+
+/**
+ * @brief Give the chunk back to the main thread, or free it if it was a one-off.
+ */
+void FTBWriter::arena_free (ArenaChunk *chunk)
+{
+    if (chunk->size > AR_CHUNKSIZE) free (chunk);
+                               else frchkqueue.enqueue (chunk);
+}
+
+/**
+ * @brief Queue the buffer to be written to saveset.
+ * @param buf = arena record, file read buffer or arena chunk
  * @param len = number of bytes from buf to write
- * @param dty = 1: compress data bytes before writing then call free()
+ * @param dty = 3: release arena chunk buf after all records queued before it are processed
  *              2: compress data bytes before writing then call frbufqueue.enqueue()
+ *              1: compress data bytes before writing
  *              0: write data bytes as given without compression
  *             -1: write file header bytes as given without compression
  */
@@ -1109,20 +2207,20 @@ void FTBWriter::write_queue (void *buf, uint32_T len, int dty)
  *        and put in blocks for writequeue queue.
  */
 #define CHECKROOM do { \
-    if (zstrm.avail_out == 0) {                                         \
-        block = frblkqueue.dequeue ();                                  \
-        memset (block, 0, sizeof *block);                               \
-        block->seqno    = ++ lastseqno;                                 \
-        zstrm.next_out  = block->data;                                  \
-        zstrm.avail_out = (ulong_T)block + bs - (ulong_T)block->data;   \
-    }                                                                   \
+    if (zstrm.avail_out == 0) {                                             \
+        comprblock = frblkqueue.dequeue ();                                 \
+        memset (comprblock, 0, sizeof *comprblock);                         \
+        comprblock->seqno = ++ lastseqno;                                   \
+        zstrm.next_out  = comprblock->data;                                 \
+        zstrm.avail_out = (ulong_T)comprblock + bs - (ulong_T)comprblock->data; \
+    }                                                                       \
 } while (false)
 
 #define CHECKFULL do { \
-    if (zstrm.avail_out == 0) {                                         \
-        writequeue.enqueue (block);                                     \
-        block = NULL;                                                   \
-    }                                                                   \
+    if (zstrm.avail_out == 0) {                                             \
+        writequeue.enqueue (comprblock);                                    \
+        comprblock = NULL;                                                  \
+    }                                                                       \
 } while (false)
 
 void *FTBWriter::compr_thread_wrapper (void *ftbw)
@@ -1131,154 +2229,708 @@ void *FTBWriter::compr_thread_wrapper (void *ftbw)
 }
 void *FTBWriter::compr_thread ()
 {
-    Block *block;
     HistSlot hs;
-    int dty, i, rc;
-    ComprSlot slot;
-    uint32_T bs, len;
-    void *buf;
+    int i;
 
     /*
      * Get some blocks to write to.
      */
-    for (i = 0; i < SQ_NSLOTS; i ++) {
-        block = malloc_block ();
-        frblkqueue.enqueue (block);
+    for (i = 0; i < (int) frblkcount; i ++) {
+        frblkqueue.enqueue (malloc_block ());
+    }
+
+    comprblock = NULL;
+    comprcodec = Codec::create (opt_codec, opt_codeclevel);
+    if (comprcodec == NULL) abort ();
+    if (opt_adaptive) {
+        storecodec = Codec::create (CODEC_ZLIB, 0);
+        if (storecodec == NULL) abort ();
+    }
+    if (opt_chaindict) comprdict = new CodecDict ();
+    if (opt_cthreads == 0) {
+        wholesize = comprcodec->encbound (CT_SLICESIZE) + 16;
+        wholebuf  = (uint8_T *) malloc (wholesize);
+        if (wholebuf == NULL) NOMEM ();
+    }
+
+    /*
+     * Process data from main thread until we get the end marker.
+     */
+    if (opt_cthreads > 0) compr_parallel ();
+                     else compr_serial ();
+
+    /*
+     * Pad and queue final data block.
+     */
+    if (zstrm.avail_out != 0) {
+        memset (zstrm.next_out, 0xFF, zstrm.avail_out);
+        writequeue.enqueue (comprblock);
+    }
+
+    /*
+     * Tell history thread to close database and exit.
+     */
+    if (histdbname != NULL) {
+        hs.fname = NULL;
+        hs.chunk = NULL;
+        hs.seqno = 0;
+        histqueue.enqueue (hs);
+    }
+
+    /*
+     * Tell writer thread to write final blocks out.
+     */
+    writequeue.enqueue (NULL);
+
+    /*
+     * Say how much -adaptive stored without compressing and roughly how much cpu time that saved,
+     * assuming it would have compressed at the same rate as the data that was compressed.
+     */
+    if (opt_adaptive) {
+        uint64_T savedns = 0;
+        if (adcomprbytes > 0) {
+            savedns = (uint64_T) ((double) adbypassbytes * adcomprns / adcomprbytes);
+            savedns = (savedns > adbypassns) ? savedns - adbypassns : 0;
+        }
+        fprintf (stderr, "ftbackup: adaptive stored %llu of %llu bytes uncompressed, saving about %u.%.9u cpu\n",
+                adbypassbytes, adbypassbytes + adcomprbytes,
+                (uint32_T) (savedns / 1000000000U), (uint32_T) (savedns % 1000000000U));
+    }
+
+    printthreadcputime ("compress");
+
+    return NULL;
+}
+
+/**
+ * @brief Compress data from the main thread in this thread.
+ */
+void FTBWriter::compr_serial ()
+{
+    bool done;
+    ComprSlot held, slot;
+    uint32_T bs, nolen;
+    uint8_T const *in;
+
+    bs = (1 << l2bs) - hashsize ();
+
+    held.buf = NULL;
+    while (true) {
+
+        /*
+         * Get data of arbitrary length from main thread to process.
+         */
+        slot = comprqueue.dequeue ();
+
+        /*
+         * Arena chunk release doesn't affect the data stream,
+         * but the held piece might be in that chunk.
+         */
+        if (slot.dty == 3) {
+            if (held.buf != NULL) {
+                compr_piece (held);
+                held.buf = NULL;
+            }
+            arena_done ((ArenaChunk *) slot.buf);
+            continue;
+        }
+
+        /*
+         * Maybe compress it to fixed-size blocks.
+         * Hold on to the first piece of a run in case it is the whole run,
+         * as it might be compressed faster all in one call.
+         */
+        if (slot.dty > 0) {
+            if (held.buf != NULL) {
+                compr_piece (held);
+                held.buf = NULL;
+            } else if (!zisopen && (comprdict == NULL) && Codec::wholeruns && (slot.len <= CT_SLICESIZE)) {
+                held = slot;
+                continue;
+            }
+            compr_piece (slot);
+        }
+
+        /*
+         * Otherwise just copy as is to fixed-size blocks.
+         */
+        else {
+            if (held.buf != NULL) {
+                compr_whole (held);
+                held.buf = NULL;
+            }
+            if (zisopen) {
+                in    = NULL;
+                nolen = 0;
+                do {
+                    CHECKROOM;
+                    done = comprrun->encode (&in, &nolen, &zstrm.next_out, &zstrm.avail_out, true);
+                    CHECKFULL;
+                } while (!done);
+                zisopen = false;
+            }
+
+            // special case of null buffer means we are done!
+            if (slot.len == 0) break;
+
+            // there is data, copy to block buffer
+            compr_copy (slot.buf, slot.len, slot.dty < 0);
+        }
+    }
+}
+
+/**
+ * @brief Compress a piece of a run, starting the run if not already.
+ *        Arena records are released a chunk at a time, file read buffers are released here.
+ */
+void FTBWriter::compr_piece (ComprSlot const &slot)
+{
+    uint32_T bs, len;
+    uint64_T cpustart;
+    uint8_T const *in;
+
+    bs = (1 << l2bs) - hashsize ();
+
+    if (!zisopen) {
+        comprrun = compr_storerun (slot.buf, slot.len) ? storecodec : comprcodec;
+        compr_begin ();
+    }
+    if (comprdict != NULL) comprdict->append (slot.buf, slot.len);
+
+    cpustart = opt_adaptive ? getcputime () : 0;
+    in  = (uint8_T const *) slot.buf;
+    len = slot.len;
+    while (len > 0) {
+        CHECKROOM;
+        comprrun->encode (&in, &len, &zstrm.next_out, &zstrm.avail_out, false);
+        CHECKFULL;
+    }
+    if (opt_adaptive) compr_adcount (slot.len, cpustart);
+
+    if (slot.dty == 2) frbufqueue.enqueue (slot.buf);
+}
+
+/**
+ * @brief Start a run with comprrun.
+ */
+void FTBWriter::compr_begin ()
+{
+    comprrun->encbegin ();
+    zisopen = true;
+
+    /*
+     * With -chaindict, prime the run with the end of the previous runs
+     * unless recovery might start reading at a header since then.
+     */
+    if (comprdict != NULL) {
+        if (comprhdrfirst || (comprrun != comprcodec)) comprdict->reset ();
+        else if (comprdict->len > 0) comprrun->encdict (comprdict->data (), comprdict->len);
+        comprhdrfirst = false;
+    }
+}
+
+/**
+ * @brief Compress a run that is all in one piece, in one call if the codec can.
+ */
+void FTBWriter::compr_whole (ComprSlot const &slot)
+{
+    uint32_T outlen;
+    uint64_T cpustart;
+
+    comprrun = compr_storerun (slot.buf, slot.len) ? storecodec : comprcodec;
+    cpustart = opt_adaptive ? getcputime () : 0;
+    outlen   = wholesize;
+    if (!comprrun->encwhole ((uint8_T const *) slot.buf, slot.len, wholebuf, &outlen)) {
+        compr_begin ();
+        compr_piece (slot);
+        return;
+    }
+    if (opt_adaptive) compr_adcount (slot.len, cpustart);
+
+    compr_copy (wholebuf, outlen, false);
+
+    if (slot.dty == 2) frbufqueue.enqueue (slot.buf);
+}
+
+/**
+ * @brief Count bytes and cpu time for the -adaptive stats.
+ */
+void FTBWriter::compr_adcount (uint32_T len, uint64_T cpustart)
+{
+    if (comprrun == storecodec) {
+        adbypassbytes += len;
+        adbypassns    += getcputime () - cpustart;
+    } else {
+        adcomprbytes  += len;
+        adcomprns     += getcputime () - cpustart;
+    }
+}
+
+/**
+ * @brief Decide if -adaptive should store a compressed run without compressing it,
+ *        ie, the data is probably already compressed or encrypted.
+ * @param buf = first data of the run, usually the first read from the file
+ * @param len = length of data at buf
+ * @returns true: store the run
+ *         false: compress the run
+ */
+bool FTBWriter::compr_storerun (void const *buf, uint32_T len)
+{
+    double bits;
+    uint32_T counts[256], i;
+    uint8_T const *p;
+
+    if (!opt_adaptive || (len < AD_MINSAMPLE)) return false;
+    if (len > AD_MAXSAMPLE) len = AD_MAXSAMPLE;
+
+    /*
+     * Estimate entropy from byte frequencies.  Text and most binaries come out
+     * well under 7 bits per byte, compressed and encrypted data very near 8.
+     */
+    memset (counts, 0, sizeof counts);
+    p = (uint8_T const *) buf;
+    for (i = 0; i < len; i ++) {
+        counts[p[i]] ++;
+    }
+    bits = 0;
+    for (i = 0; i < 256; i ++) {
+        if (counts[i] != 0) bits += counts[i] * log2 (counts[i]);
+    }
+    bits = log2 (len) - bits / len;
+
+    return bits > AD_MAXBITS;
+}
+
+/**
+ * @brief Hand data from the main thread to opt_cthreads worker threads for compression.
+ *
+ *        Each file's data is cut into slices of up to CT_SLICESIZE bytes.  Each slice is
+ *        compressed by a worker as raw deflate data, ending with a sync flush so it ends
+ *        on a byte boundary, except the file's last slice which ends the deflate data.
+ *        The first slice gets the zlib header and we append the adler32 trailer after the
+ *        last slice, so the concatenated slices form the exact same zlib format stream that
+ *        compr_serial() writes, which FTBReader::read_raw() inflates as usual.
+ *        Other codecs have no such trick, so each of their slices is a whole frame.
+ *
+ *        Units (compressed slices and uncompressed headers and data) are linked in saveset
+ *        order from ctoldest to ctnewest and are copied to blocks in that order as their
+ *        compression completes.
+ */
+void FTBWriter::compr_parallel ()
+{
+    ArenaChunk *chunk;
+    ComprSlot slot;
+    ComprUnit *cunit, *unit;
+    int rc;
+    pthread_t *cthandls;
+    uint32_T i, len;
+
+    /*
+     * Set up pool of compression units, allowing four per worker to be in progress
+     * plus some uncompressed headers, etc, waiting behind them.
+     */
+    ctnunits  = opt_cthreads * 4 + RQ_DEFDEPTH;
+    ctoutsize = comprcodec->encbound (CT_SLICESIZE);
+    if (ctoutsize < compressBound (CT_SLICESIZE)) ctoutsize = compressBound (CT_SLICESIZE);
+    ctoutsize += 16;
+    ctunits   = (ComprUnit *) calloc (ctnunits, sizeof *ctunits);
+    if (ctunits == NULL) NOMEM ();
+    for (i = 0; i < ctnunits; i ++) {
+        compr_putunit (&ctunits[i]);
+    }
+    cworkqueue.setdepth (ctnunits);
+
+    /*
+     * Start the compression worker threads.
+     */
+    cthandls = (pthread_t *) alloca (opt_cthreads * sizeof *cthandls);
+    for (i = 0; i < (uint32_T) opt_cthreads; i ++) {
+        rc = pthread_create (&cthandls[i], NULL, cwork_thread_wrapper, this);
+        if (rc != 0) SYSERR (pthread_create, rc);
     }
 
-    block = NULL;
-    bs    = (1 << l2bs) - hashsize ();
-
+    cunit = NULL;
     while (true) {
 
         /*
          * Get data of arbitrary length from main thread to process.
          */
         slot = comprqueue.dequeue ();
-        buf  = slot.buf;
-        len  = slot.len;
-        dty  = slot.dty;
 
         /*
-         * Maybe compress it to fixed-size blocks.
+         * Arena chunk can be released once the newest uncompressed unit has been
+         * copied out.  Its data to be compressed has already been copied to slices.
          */
-        if (dty > 0) {
-            if (!zisopen) {
-                void    *no = zstrm.next_out;
-                uint32_T ao = zstrm.avail_out;
-                memset (&zstrm, 0, sizeof zstrm);
-                rc = deflateInit (&zstrm, Z_DEFAULT_COMPRESSION);
-                if (rc != Z_OK) INTERR (deflateInit, rc);
-                zstrm.next_out  = (Bytef *) no;
-                zstrm.avail_out = ao;
-                zisopen = true;
+        if (slot.dty == 3) {
+            chunk = (ArenaChunk *) slot.buf;
+            if (ctnewraw == NULL) arena_done (chunk);
+            else {
+                chunk->next = ctnewraw->chunks;
+                ctnewraw->chunks = chunk;
             }
-            zstrm.next_in  = (Bytef *) buf;
-            zstrm.avail_in = len;
-            while (zstrm.avail_in > 0) {
-                CHECKROOM;
-                rc = deflate (&zstrm, Z_NO_FLUSH);
-                if (rc != Z_OK) INTERR (deflate, rc);
-                CHECKFULL;
+        }
+
+        /*
+         * Data to be compressed gets copied to slices for the workers.
+         * Give each slice to the workers as soon as it fills.
+         */
+        else if (slot.dty > 0) {
+            for (i = 0; i < slot.len; i += len) {
+                if (cunit == NULL) {
+                    if (!ctrunopen) ctrunstored = compr_storerun (slot.buf, slot.len);
+                    cunit = compr_getunit (true);
+                    cunit->first  = !ctrunopen;
+                    cunit->stored = ctrunstored;
+                    ctrunopen     = true;
+                }
+                len = CT_SLICESIZE - cunit->inlen;
+                if (len > slot.len - i) len = slot.len - i;
+                memcpy (cunit->inbuf + cunit->inlen, (uint8_T *) slot.buf + i, len);
+                cunit->inlen += len;
+                if (cunit->inlen == CT_SLICESIZE) {
+                    cworkqueue.enqueue (cunit);
+                    cunit = NULL;
+                }
             }
+            if (slot.dty == 2) frbufqueue.enqueue (slot.buf);
         }
 
         /*
-         * Otherwise just copy as is to fixed-size blocks.
+         * Uncompressed data ends the compressed stream, so give the final slice to the
+         * workers, possibly empty, to end the deflate data.  Then queue the uncompressed
+         * data behind it.
          */
         else {
-            if (zisopen) {
-                do {
-                    CHECKROOM;
-                    rc = deflate (&zstrm, Z_FINISH);
-                    CHECKFULL;
-                } while (rc == Z_OK);
-                if (rc != Z_STREAM_END) INTERR (deflate, rc);
-                rc = deflateEnd (&zstrm);
-                if (rc != Z_OK) INTERR (deflateEnd, rc);
-                zisopen = false;
+            if (ctrunopen) {
+                if ((cunit == NULL) && (opt_codec == CODEC_ZLIB) && !ctrunstored) cunit = compr_getunit (true);
+                if (cunit != NULL) {
+                    cunit->last = true;
+                    cworkqueue.enqueue (cunit);
+                    cunit = NULL;
+                }
+                ctrunopen = false;
             }
 
             // special case of null buffer means we are done!
-            if (len == 0) break;
+            if (slot.len == 0) break;
 
-            // there is data, copy to block buffer
-            zstrm.next_in  = (Bytef *) buf;
-            zstrm.avail_in = len;
-            do {
-                // maybe we need a new output block
-                CHECKROOM;
-
-                // see if it is a file header
-                if (dty < 0) {
-
-                    // if first header in the block, save its offset for recoveries
-                    if (block->hdroffs == 0) {
-                        block->hdroffs = (ulong_T)zstrm.next_out - (ulong_T)block;
-                    }
+            unit = compr_getunit (false);
+            unit->slot = slot;
+            unit->done = true;
+            ctnewraw   = unit;
+        }
 
-                    // if writing history, queue to history writing thread
-                    if ((histdbname != NULL) && (((Header *)buf)->nameln > 0)) {
-                        hs.fname = strdup (((Header *)buf)->name);
-                        hs.seqno = block->seqno;
-                        if (hs.fname == NULL) NOMEM ();
-                        histqueue.enqueue (hs);
-                    }
-                }
+        /*
+         * Copy out whatever is ready without waiting.
+         */
+        while (compr_emitoldest (false)) { }
+    }
+
+    /*
+     * Copy out everything remaining in order.
+     */
+    while (compr_emitoldest (true)) { }
+
+    /*
+     * Tell the workers to exit.
+     */
+    for (i = 0; i < (uint32_T) opt_cthreads; i ++) {
+        cworkqueue.enqueue (NULL);
+    }
+    for (i = 0; i < (uint32_T) opt_cthreads; i ++) {
+        rc = pthread_join (cthandls[i], NULL);
+        if (rc != 0) SYSERR (pthread_join, rc);
+    }
+}
+
+/**
+ * @brief Get a free compression unit and link it on the end of the in-order list,
+ *        waiting for the oldest to complete if none are free.
+ * @param compress = true: unit will be compressed so make sure it has buffers
+ *                  false: unit will hold uncompressed data
+ */
+FTBWriter::ComprUnit *FTBWriter::compr_getunit (bool compress)
+{
+    ComprUnit *unit;
+
+    while ((unit = ctfree) == NULL) {
+        if (!compr_emitoldest (true)) abort ();
+    }
+    ctfree = unit->next;
+
+    if (compress && (unit->inbuf == NULL)) {
+        unit->inbuf  = (uint8_T *) malloc (CT_SLICESIZE);
+        unit->outbuf = (uint8_T *) malloc (ctoutsize);
+        if ((unit->inbuf == NULL) || (unit->outbuf == NULL)) NOMEM ();
+    }
+
+    unit->next     = NULL;
+    unit->chunks   = NULL;
+    unit->slot.buf = NULL;
+    unit->done     = false;
+    unit->first    = false;
+    unit->last     = false;
+    unit->stored   = false;
+    unit->whole    = false;
+    unit->inlen    = 0;
+    unit->outlen   = 0;
+
+    if (ctnewest == NULL) ctoldest = unit;
+                     else ctnewest->next = unit;
+    ctnewest = unit;
+    return unit;
+}
 
-                // we only care about setting block->hdroffs for the first byte of the header
-                dty = 0;
+void FTBWriter::compr_putunit (ComprUnit *unit)
+{
+    unit->next = ctfree;
+    ctfree = unit;
+}
 
-                // see how much we can copy out and copy it out
-                len = zstrm.avail_out;
-                if (len > zstrm.avail_in) len = zstrm.avail_in;
-                memcpy (zstrm.next_out, zstrm.next_in, len);
+/**
+ * @brief Copy the oldest unit out to blocks if it is complete.
+ * @param wait = true: wait for oldest unit to complete
+ *              false: return if oldest unit not complete
+ * @returns true: oldest unit copied out and freed
+ *         false: no units or oldest one not complete
+ */
+bool FTBWriter::compr_emitoldest (bool wait)
+{
+    ArenaChunk *chunk;
+    ComprUnit *unit;
+    uint8_T trailer[4];
 
-                // update counters to account for the copy
-                zstrm.next_out  += len;
-                zstrm.avail_out -= len;
-                zstrm.next_in   += len;
-                zstrm.avail_in  -= len;
+    unit = ctoldest;
+    if (unit == NULL) return false;
 
-                // if output block full, queue it for writing
-                CHECKFULL;
-            } while (zstrm.avail_in > 0);
+    pthread_mutex_lock (&ctmutex);
+    while (!unit->done) {
+        if (!wait) {
+            pthread_mutex_unlock (&ctmutex);
+            return false;
         }
+        pthread_cond_wait (&ctcond, &ctmutex);
+    }
+    pthread_mutex_unlock (&ctmutex);
+
+    if ((ctoldest = unit->next) == NULL) ctnewest = NULL;
+
+    if (unit->slot.buf != NULL) {
+
+        /*
+         * Uncompressed header or data, copy as is.
+         */
+        compr_copy (unit->slot.buf, unit->slot.len, unit->slot.dty < 0);
+        if (ctnewraw == unit) ctnewraw = NULL;
+    } else {
+
+        /*
+         * Compressed slice, copy out.  Each slice of the other codecs and each stored slice is a whole frame.
+         */
+        compr_copy (unit->outbuf, unit->outlen, false);
 
         /*
-         * Either way, all done with input buffer.
+         * zlib slices are raw deflate, so accumulate adler32 for the whole stream
+         * and if end of the stream, write zlib trailer = big-endian adler32 of all the data.
          */
-        if (dty == 2) frbufqueue.enqueue (buf);
-                               else free (buf);
+        if ((opt_codec == CODEC_ZLIB) && !unit->stored && !unit->whole) {
+            if (unit->first) ctrunadler = adler32 (0, NULL, 0);
+            ctrunadler = adler32_combine (ctrunadler, unit->adler, unit->inlen);
+            if (unit->last) {
+                trailer[0] = ctrunadler >> 24;
+                trailer[1] = ctrunadler >> 16;
+                trailer[2] = ctrunadler >>  8;
+                trailer[3] = ctrunadler;
+                compr_copy (trailer, sizeof trailer, false);
+            }
+        }
     }
 
     /*
-     * Pad and queue final data block.
+     * Release any arena chunks that were waiting for this unit.
      */
-    if (zstrm.avail_out != 0) {
-        memset (zstrm.next_out, 0xFF, zstrm.avail_out);
-        writequeue.enqueue (block);
+    while ((chunk = unit->chunks) != NULL) {
+        unit->chunks = chunk->next;
+        arena_done (chunk);
     }
 
+    compr_putunit (unit);
+    return true;
+}
+
+/**
+ * @brief Copy uncompressed data to fixed-size blocks.
+ * @param buf = address of data to copy
+ * @param len = length of data to copy (gt 0)
+ * @param hdr = true iff it is a file header; else it is data
+ */
+void FTBWriter::compr_copy (void const *buf, uint32_T len, bool hdr)
+{
+    HistSlot hs;
+    uint32_T bs;
+
+    bs = (1 << l2bs) - hashsize ();
+
+    zstrm.next_in  = (Bytef *) buf;
+    zstrm.avail_in = len;
+    do {
+        // maybe we need a new output block
+        CHECKROOM;
+
+        // see if it is a file header
+        if (hdr) {
+
+            // if first header in the block, save its offset for recoveries
+            if (comprblock->hdroffs == 0) {
+                comprblock->hdroffs = (ulong_T)zstrm.next_out - (ulong_T)comprblock;
+                comprhdrfirst = true;
+            }
+
+            // if writing history, queue to history writing thread
+            if ((histdbname != NULL) && (((Header *)buf)->nameln > 0)) {
+                hs.fname = ((Header *)buf)->name;
+                hs.chunk = NULL;
+                hs.seqno = comprblock->seqno;
+                histqueue.enqueue (hs);
+            }
+
+            // if writing catalog, say where this header is
+            if (catfile != NULL) {
+                catalog_file ((Header const *) buf, comprblock->seqno, (ulong_T)zstrm.next_out - (ulong_T)comprblock);
+            }
+        }
+
+        // we only care about setting block->hdroffs for the first byte of the header
+        hdr = false;
+
+        // see how much we can copy out and copy it out
+        len = zstrm.avail_out;
+        if (len > zstrm.avail_in) len = zstrm.avail_in;
+        memcpy (zstrm.next_out, zstrm.next_in, len);
+
+        // update counters to account for the copy
+        zstrm.next_out  += len;
+        zstrm.avail_out -= len;
+        zstrm.next_in   += len;
+        zstrm.avail_in  -= len;
+
+        // if output block full, queue it for writing
+        CHECKFULL;
+    } while (zstrm.avail_in > 0);
+}
+
+/**
+ * @brief Compress slices queued by compr_parallel().
+ */
+void *FTBWriter::cwork_thread_wrapper (void *ftbw)
+{
+    return ((FTBWriter *) ftbw)->cwork_thread ();
+}
+void *FTBWriter::cwork_thread ()
+{
+    Codec *codec, *fast, *frame, *store;
+    ComprUnit *unit;
+    int level, rc;
+    uint32_T hl, inlen, outlen;
+    uint64_T cpustart;
+    uint8_T const *in;
+    uint8_T *out;
+    uint8_T zlibhdr[2];
+    z_stream zs;
+
     /*
-     * Tell history thread to close database and exit.
+     * Other codecs and -adaptive stored runs compress each slice to a whole frame.
      */
-    if (histdbname != NULL) {
-        hs.fname = NULL;
-        hs.seqno = 0;
-        histqueue.enqueue (hs);
+    codec = NULL;
+    if (opt_codec != CODEC_ZLIB) {
+        codec = Codec::create (opt_codec, opt_codeclevel);
+        if (codec == NULL) abort ();
+    }
+    store = NULL;
+    if (opt_adaptive) {
+        store = Codec::create (CODEC_ZLIB, 0);
+        if (store == NULL) abort ();
+    }
+
+    // what deflateInit (..., level) puts on the front
+    level = (opt_codeclevel == CODEC_DEFLEVEL) ? Z_DEFAULT_COMPRESSION : opt_codeclevel;
+    zlibhdr[0] = 0x78;
+    zlibhdr[1] = (level < 0) ? 0x9C : (level < 2) ? 0x01 : (level < 6) ? 0x5E : (level == 6) ? 0x9C : 0xDA;
+
+    fast = NULL;
+    memset (&zs, 0, sizeof zs);
+    if (codec == NULL) {
+        fast = Codec::create (CODEC_ZLIB, opt_codeclevel);
+        if (fast == NULL) abort ();
+        rc = deflateInit2 (&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        if (rc != Z_OK) INTERR (deflateInit2, rc);
+    }
+
+    while ((unit = cworkqueue.dequeue ()) != NULL) {
+        cpustart = opt_adaptive ? getcputime () : 0;
+
+        frame = unit->stored ? store : codec;
+        if (frame != NULL) {
+            in     = unit->inbuf;
+            inlen  = unit->inlen;
+            out    = unit->outbuf;
+            outlen = ctoutsize;
+            frame->encbegin ();
+            if (!frame->encode (&in, &inlen, &out, &outlen, true)) abort ();
+            unit->outlen = ctoutsize - outlen;
+        } else if (unit->first && unit->last && fast->encwhole (unit->inbuf, unit->inlen, unit->outbuf, &(outlen = ctoutsize))) {
+
+            // whole run in this slice, codec made a complete zlib stream in one call
+            unit->outlen = outlen;
+            unit->whole  = true;
+        } else {
+            rc = deflateReset (&zs);
+            if (rc != Z_OK) INTERR (deflateReset, rc);
+
+            hl = 0;
+            if (unit->first) {
+                memcpy (unit->outbuf, zlibhdr, hl = sizeof zlibhdr);
+            }
+
+            zs.next_in   = unit->inbuf;
+            zs.avail_in  = unit->inlen;
+            zs.next_out  = unit->outbuf + hl;
+            zs.avail_out = ctoutsize - hl;
+            rc = deflate (&zs, unit->last ? Z_FINISH : Z_SYNC_FLUSH);
+            if (rc != (unit->last ? Z_STREAM_END : Z_OK)) INTERR (deflate, rc);
+            if ((zs.avail_in != 0) || (zs.avail_out == 0)) abort ();
+
+            unit->outlen = (ulong_T)zs.next_out - (ulong_T)unit->outbuf;
+            unit->adler  = adler32 (adler32 (0, NULL, 0), unit->inbuf, unit->inlen);
+        }
+
+        if (opt_adaptive) {
+            cpustart = getcputime () - cpustart;
+            if (unit->stored) {
+                __atomic_add_fetch (&adbypassbytes, unit->inlen, __ATOMIC_RELAXED);
+                __atomic_add_fetch (&adbypassns, cpustart, __ATOMIC_RELAXED);
+            } else {
+                __atomic_add_fetch (&adcomprbytes, unit->inlen, __ATOMIC_RELAXED);
+                __atomic_add_fetch (&adcomprns, cpustart, __ATOMIC_RELAXED);
+            }
+        }
+
+        pthread_mutex_lock (&ctmutex);
+        unit->done = true;
+        pthread_cond_broadcast (&ctcond);
+        pthread_mutex_unlock (&ctmutex);
     }
 
-    /*
-     * Tell writer thread to write final blocks out.
-     */
-    writequeue.enqueue (NULL);
+    if (codec == NULL) deflateEnd (&zs);
+    delete codec;
+    delete fast;
+    delete store;
 
-    printthreadcputime ("compress");
+    printthreadcputime ("cworker");
 
     return NULL;
 }
-
+
 void *FTBWriter::hist_thread_wrapper (void *ftbw)
 {
     return ((FTBWriter *) ftbw)->hist_thread ();
@@ -1369,6 +3021,14 @@ void *FTBWriter::hist_thread ()
         wht_runtime += getruntime ();
         hs = histqueue.dequeue ();
         wht_runtime -= getruntime ();
+
+        /*
+         * Names in arena chunk all processed, give chunk back to main thread.
+         */
+        if (hs.chunk != NULL) {
+            arena_free (hs.chunk);
+            continue;
+        }
         if (hs.fname == NULL) break;
 
         /*
@@ -1401,10 +3061,6 @@ void *FTBWriter::hist_thread ()
             }
         }
 
-        /*
-         * Entry all processed.
-         */
-        free (hs.fname);
     }
 
     /*
@@ -1433,6 +3089,8 @@ void *FTBWriter::write_thread_wrapper (void *ftbw)
 void *FTBWriter::write_thread ()
 {
     Block *block;
+    int rc;
+    pthread_t *hthandls;
     uint32_T i;
     uint64_T wst_runtime;
 
@@ -1461,14 +3119,43 @@ void *FTBWriter::write_thread ()
         }
     }
 
+    /*
+     * Maybe start hashing threads.  Blocks are handed to them in seqno order
+     * after being XOR'd and written to the saveset in that same order.
+     */
+    hthandls = NULL;
+    if (opt_hthreads > 0) {
+        htnjobs   = frblkcount + xorgc;
+        if (htnjobs > RQ_MAXDEPTH) htnjobs = RQ_MAXDEPTH;  // hash_block() waits for a free job anyway
+        htjobs    = (HashJob *) malloc (htnjobs * sizeof *htjobs);
+        if (htjobs == NULL) NOMEM ();
+        hworkqueue.setdepth (htnjobs);
+        hthandls  = (pthread_t *) alloca (opt_hthreads * sizeof *hthandls);
+        for (i = 0; i < (uint32_T) opt_hthreads; i ++) {
+            rc = pthread_create (&hthandls[i], NULL, hwork_thread_wrapper, this);
+            if (rc != 0) SYSERR (pthread_create, rc);
+        }
+    }
+
     /*
      * Process datablocks.
+     * If hashing threads or saveset writes in flight, don't wait for another block
+     * while any are being hashed or written so we don't hold onto all the blocks
+     * the compression thread needs.
      */
     wst_runtime += getruntime ();
-    while ((block = writequeue.dequeue ()) != NULL) {
+    while (true) {
+        if (!writequeue.trydequeue (&block)) {
+            if (hash_emitoldest (true)) continue;
+            if (ssblock_drain ()) continue;
+            block = writequeue.dequeue ();
+        }
+        if (block == NULL) break;
         wst_runtime -= getruntime ();
         xor_data_block (block);
-        frblkqueue.enqueue (block);
+        if (opt_hthreads > 0) {
+            while (hash_emitoldest (false)) { }
+        }
         wst_runtime += getruntime ();
     }
     wst_runtime -= getruntime ();
@@ -1478,6 +3165,28 @@ void *FTBWriter::write_thread ()
      */
     if (xorgc > 0) {
         hash_xor_blocks ();
+    }
+
+    /*
+     * Write everything the hashing threads have left then tell them to exit.
+     */
+    if (opt_hthreads > 0) {
+        while (hash_emitoldest (true)) { }
+        for (i = 0; i < (uint32_T) opt_hthreads; i ++) {
+            hworkqueue.enqueue (NULL);
+        }
+        for (i = 0; i < (uint32_T) opt_hthreads; i ++) {
+            rc = pthread_join (hthandls[i], NULL);
+            if (rc != 0) SYSERR (pthread_join, rc);
+        }
+    }
+
+    /*
+     * Wait for the saveset writes in flight to complete.
+     */
+    while (ssblock_drain ()) { }
+
+    if (xorgc > 0) {
         for (i = 0; i < xorgc; i ++) {
             free (xorblocks[i]);
         }
@@ -1581,8 +3290,11 @@ void FTBWriter::hash_xor_blocks ()
         if (block->xorbc != 0) {
             memcpy (block->magic, BLOCK_MAGIC, 8);
             block->xorno = lastxorno + i + 1;
+
+            // block is busy until written so start a new one
+            xorblocks[i] = (nxorfree > 0) ? xorfree[--nxorfree] : malloc_block ();
+            xorblocks[i]->xorbc = 0;
             hash_block (block);
-            block->xorbc = 0;
         }
     }
     lastxorno += xorgc;
@@ -1590,8 +3302,97 @@ void FTBWriter::hash_xor_blocks ()
 
 /**
  * @brief Hash, maybe encrypt, then write to saveset.
+ *        If hashing threads, queue to them and they get written in order by hash_emitoldest().
  */
 void FTBWriter::hash_block (Block *block)
+{
+    HashJob *job;
+
+    if (opt_hthreads == 0) {
+        crypt_block (block, hasher, encipher);
+        write_ssblock (block);
+        return;
+    }
+
+    while (htused == htnjobs) {
+        hash_emitoldest (true);
+    }
+    job = &htjobs[(htoldest+htused)%htnjobs];
+    htused ++;
+    job->block = block;
+    job->done  = false;
+    hworkqueue.enqueue (job);
+}
+
+/**
+ * @brief Write the oldest block queued to the hashing threads if it is complete.
+ * @param wait = true: wait for oldest block to complete
+ *              false: return if oldest block not complete
+ * @returns true: oldest block written and freed
+ *         false: no blocks or oldest one not complete
+ */
+bool FTBWriter::hash_emitoldest (bool wait)
+{
+    HashJob *job;
+
+    if (htused == 0) return false;
+    job = &htjobs[htoldest];
+
+    pthread_mutex_lock (&htmutex);
+    while (!job->done) {
+        if (!wait) {
+            pthread_mutex_unlock (&htmutex);
+            return false;
+        }
+        pthread_cond_wait (&htcond, &htmutex);
+    }
+    pthread_mutex_unlock (&htmutex);
+
+    htoldest = (htoldest + 1) % htnjobs;
+    htused --;
+
+    write_ssblock (job->block);
+    return true;
+}
+
+/**
+ * @brief Hash blocks queued by hash_block().
+ *        Each thread has its own hasher and cipher contexts.
+ */
+void *FTBWriter::hwork_thread_wrapper (void *ftbw)
+{
+    return ((FTBWriter *) ftbw)->hwork_thread ();
+}
+void *FTBWriter::hwork_thread ()
+{
+    CryptoPP::BlockCipher *blkcipher;
+    CryptoPP::HashTransformation *blkhasher;
+    HashJob *job;
+
+    blkhasher = newhasher ();
+    blkcipher = newcipher (true);
+
+    while ((job = hworkqueue.dequeue ()) != NULL) {
+        crypt_block (job->block, blkhasher, blkcipher);
+
+        pthread_mutex_lock (&htmutex);
+        job->done = true;
+        pthread_cond_broadcast (&htcond);
+        pthread_mutex_unlock (&htmutex);
+    }
+
+    delete blkhasher;
+    if (blkcipher != NULL) delete blkcipher;
+
+    printthreadcputime ("hworker");
+
+    return NULL;
+}
+
+/**
+ * @brief Hash then maybe encrypt block in place.
+ */
+void FTBWriter::crypt_block (Block *block, CryptoPP::HashTransformation *blkhasher, CryptoPP::BlockCipher *blkcipher)
 {
     uint32_T bs, cbs, i;
     uint64_T *array, temp[2];
@@ -1600,15 +3401,15 @@ void FTBWriter::hash_block (Block *block)
      * Hash the header and the data.
      */
     bs = (1U << l2bs) - hashsize ();
-    hasher->Update ((uint8_T *)block, bs);
-    hasher->Final  ((uint8_T *)block + bs);
+    blkhasher->Update ((uint8_T *)block, bs);
+    blkhasher->Final  ((uint8_T *)block + bs);
 
-    if (encipher != NULL) {
+    if (blkcipher != NULL) {
 
         /*
          * Fill in the nonce with a random number to salt the encryption.
          */
-        cbs = encipher->BlockSize ();
+        cbs = blkcipher->BlockSize ();
         bs  = (1U << l2bs) - cbs;
         if (fread ((uint8_T *) block + bs, cbs, 1, noncefile) != 1) {
             fprintf (stderr, "read(/dev/urandom) error: %s\n", mystrerr (errno));
@@ -1626,41 +3427,41 @@ void FTBWriter::hash_block (Block *block)
         switch (cbs) {
             case  8: {
                 do {
-                    encipher->ProcessAndXorBlock ((CryptoPP::byte *) &array[i], (CryptoPP::byte *) &array[i-1], (CryptoPP::byte *) temp);
-                    encipher->ProcessAndXorBlock ((CryptoPP::byte *) temp, NULL, (CryptoPP::byte *) &array[--i]);
+                    blkcipher->ProcessAndXorBlock ((CryptoPP::byte *) &array[i], (CryptoPP::byte *) &array[i-1], (CryptoPP::byte *) temp);
+                    blkcipher->ProcessAndXorBlock ((CryptoPP::byte *) temp, NULL, (CryptoPP::byte *) &array[--i]);
                 } while (i > offsetof (Block, crip) / 8);
                 break;
             }
             case 16: {
                 do {
-                    encipher->ProcessAndXorBlock ((CryptoPP::byte *) &array[i], (CryptoPP::byte *) &array[i-2], (CryptoPP::byte *) temp);
+                    blkcipher->ProcessAndXorBlock ((CryptoPP::byte *) &array[i], (CryptoPP::byte *) &array[i-2], (CryptoPP::byte *) temp);
                     i -= 2;
-                    encipher->ProcessAndXorBlock ((CryptoPP::byte *) temp, NULL, (CryptoPP::byte *) &array[i]);
+                    blkcipher->ProcessAndXorBlock ((CryptoPP::byte *) temp, NULL, (CryptoPP::byte *) &array[i]);
                 } while (i > offsetof (Block, crip) / 8);
                 break;
             }
             default: abort ();
         }
     }
-
-    /*
-     * Write the possibly encrypted block to the saveset.
-     */
-    write_ssblock (block);
 }
 
 /**
- * @brief Write block to saveset file.
+ * @brief Write block to saveset file, then free it.
+ *        With -owrites, consecutive blocks are gathered into one write and
+ *        freed when it completes.
  */
 void FTBWriter::write_ssblock (Block *block)
 {
+    OutWrite *ow;
     uint32_T bs;
 
     if ((opt_segsize > 0) && (byteswrittentoseg >= opt_segsize)) {
+        while (ssblock_drain ()) { }
         if (close (ssfd) < 0) {
             fprintf (stderr, "ftbackup: close(%s) saveset error: %s\n", sssegname, mystrerr (errno));
             exit (EX_SSIO);
         }
+        if (manfile != NULL) manifest_segment ();
         sprintf (sssegname, "%s%.*u", ssbasename, SEGNODECDIGS, ++ thissegno);
         ssfd = open (sssegname, O_WRONLY | O_CREAT | O_TRUNC | ooptions, 0666);
         if (ssfd < 0) {
@@ -1668,89 +3469,166 @@ void FTBWriter::write_ssblock (Block *block)
             exit (EX_SSIO);
         }
         byteswrittentoseg = 0;
+        sspos = 0;
     }
 
     bs = 1U << l2bs;
-    if (!writeall (ssfd, (uint8_T const *) block, bs)) {
-        fprintf (stderr, "ftbackup: write() saveset error: %s\n", mystrerr (errno));
-        exit (EX_SSIO);
+
+    /*
+     * Keep track of what goes in the segment file for the -manifest.
+     * The seqno and xorno are outside the encrypted part of the block.
+     */
+    if (manfile != NULL) {
+        if (block->xorno == 0) {
+            if (manseg.firstseqno == 0) manseg.firstseqno = block->seqno;
+            manseg.lastseqno = block->seqno;
+        } else {
+            if (manseg.firstxorno == 0) manseg.firstxorno = block->xorno;
+            manseg.lastxorno = block->xorno;
+        }
+        manseg.crc = crc32 (manseg.crc, (Bytef const *) block, bs);
+    }
+
+    if (owrites == NULL) {
+        if (!writeall (ssfd, (uint8_T const *) block, bs)) {
+            fprintf (stderr, "ftbackup: write() saveset error: %s\n", mystrerr (errno));
+            exit (EX_SSIO);
+        }
+        free_block (block);
+    } else {
+
+        /*
+         * Add block to the write being gathered, waiting for a free one if necessary.
+         */
+        if (owused == opt_owrites) ssblock_reap (true);
+        ow = &owrites[(owoldest+owused)%opt_owrites];
+        if (ow->nblocks == 0) ow->pos = sspos;
+        ow->blocks[ow->nblocks] = block;
+        ow->iov[ow->nblocks].iov_base = block;
+        ow->iov[ow->nblocks].iov_len  = bs;
+        sspos += bs;
+
+        /*
+         * Start writing it once it is as big as it gets.
+         */
+        if (++ ow->nblocks == owmaxblocks) ssblock_submit ();
     }
     byteswrittentoseg += bs;
 }
-
+
 /**
- * @brief Slotted queue implementation.
+ * @brief Start writing the blocks gathered by write_ssblock(), if any.
  */
-
-template <class T>
-SlotQueue<T>::SlotQueue ()
-{
-    memset (slots, 0, sizeof slots);
-    pthread_cond_init  (&cond,  NULL);
-    pthread_mutex_init (&mutex, NULL);
-    next = 0;
-    used = 0;
-}
-
-template <class T>
-void SlotQueue<T>::enqueue (T slot)
+void FTBWriter::ssblock_submit ()
 {
+    int rc;
+    OutWrite *ow;
     uint32_T i;
 
-    pthread_mutex_lock (&mutex);
-    while (used == SQ_NSLOTS) {
-        pthread_cond_wait (&cond, &mutex);
+    i  = (owoldest + owused) % opt_owrites;
+    ow = &owrites[i];
+    if ((owused < opt_owrites) && (ow->nblocks > 0)) {
+        ow->done = false;
+        if (!owring.prepwritev (ssfd, ow->iov, ow->nblocks, ow->pos, i)) abort ();
+        rc = owring.submit (0);
+        if (rc < 0) SYSERR (io_uring_enter, - rc);
+        owused ++;
     }
-    i = (next + used) % SQ_NSLOTS;
-    slots[i] = slot;
-    if (++ used == 1) {
-        pthread_cond_signal (&cond);
+}
+
+/**
+ * @brief Start writing the blocks being gathered, else wait for the oldest write to complete.
+ * @returns true: something was started or completed
+ *         false: nothing being gathered or written
+ */
+bool FTBWriter::ssblock_drain ()
+{
+    if (owrites == NULL) return false;
+    if ((owused < opt_owrites) && (owrites[(owoldest+owused)%opt_owrites].nblocks > 0)) {
+        ssblock_submit ();
+        return true;
     }
-    pthread_mutex_unlock (&mutex);
+    if (owused == 0) return false;
+    ssblock_reap (true);
+    return true;
 }
 
-template <class T>
-bool SlotQueue<T>::trydequeue (T *slot)
+/**
+ * @brief Free the blocks of completed saveset writes, oldest first.
+ *        Any error is reported for the first block not written.
+ * @param wait = true: wait for the oldest write to complete
+ */
+void FTBWriter::ssblock_reap (bool wait)
 {
-    bool suc;
-    uint32_T i;
+    int rc, res;
+    OutWrite *ow;
+    uint32_T bs, i;
+    uint64_T data;
+
+    bs = 1U << l2bs;
 
-    pthread_mutex_lock (&mutex);
-    suc = (used != 0);
-    if (suc) {
-        i = next;
-        *slot = slots[i];
-        next = (i + 1) % SQ_NSLOTS;
-        if (-- used == SQ_NSLOTS - 1) {
-            pthread_cond_signal (&cond);
+    while (true) {
+        while (owring.getcqe (&data, &res)) {
+            owrites[data].res  = res;
+            owrites[data].done = true;
         }
+        ow = &owrites[owoldest];
+        if ((owused == 0) || ow->done || !wait) break;
+        rc = owring.submit (1);
+        if (rc < 0) SYSERR (io_uring_enter, - rc);
     }
-    pthread_mutex_unlock (&mutex);
 
-    return suc;
-}
+    while ((owused > 0) && (ow = &owrites[owoldest])->done) {
 
-template <class T>
-T SlotQueue<T>::dequeue ()
-{
-    T slot;
-    uint32_T i;
+        /*
+         * Error means the first block not completely written failed.
+         * Finish a short write the same way writeall() would.
+         */
+        res = ow->res;
+        if (res < 0) {
+            fprintf (stderr, "ftbackup: write() saveset error: %s\n", mystrerr (- res));
+            exit (EX_SSIO);
+        }
+        for (i = 0; i < ow->nblocks; i ++) {
+            if ((uint32_T) res < bs) {
+                do {
+                    rc = pwrite (ssfd, (uint8_T *) ow->blocks[i] + res, bs - res, ow->pos + (uint64_T) i * bs + res);
+                    if (rc <= 0) {
+                        if (rc == 0) errno = MYENDOFILE;
+                        fprintf (stderr, "ftbackup: write() saveset error: %s\n", mystrerr (errno));
+                        exit (EX_SSIO);
+                    }
+                    res += rc;
+                } while ((uint32_T) res < bs);
+            }
+            res -= bs;
+            free_block (ow->blocks[i]);
+        }
 
-    pthread_mutex_lock (&mutex);
-    while (used == 0) {
-        pthread_cond_wait (&cond, &mutex);
+        ow->nblocks = 0;
+        owoldest = (owoldest + 1) % opt_owrites;
+        owused --;
     }
-    i = next;
-    slot = slots[i];
-    next = (i + 1) % SQ_NSLOTS;
-    if (-- used == SQ_NSLOTS - 1) {
-        pthread_cond_signal (&cond);
-    }
-    pthread_mutex_unlock (&mutex);
+}
 
-    return slot;
+/**
+ * @brief Block has been written to saveset, recycle it.
+ *        XOR blocks are kept for hash_xor_blocks() to reuse.
+ */
+void FTBWriter::free_block (Block *block)
+{
+    if (block->xorno == 0) {
+        frblkqueue.enqueue (block);
+    } else {
+        if (nxorfree == xorfreesize) {
+            xorfreesize += xorgc + 8;
+            xorfree = (Block **) realloc (xorfree, xorfreesize * sizeof *xorfree);
+            if (xorfree == NULL) NOMEM ();
+        }
+        xorfree[nxorfree++] = block;
+    }
 }
-
+
 static bool writeall (int fd, uint8_T const *buf, int len)
 {
     int rc;
@@ -1777,6 +3655,16 @@ static uint64_T getruntime ()
     return ((uint64_T) tp.tv_sec * 1000000000ULL) + tp.tv_nsec;
 }
 
+static uint64_T getcputime ()
+{
+    int rc;
+    struct timespec tp;
+
+    rc = clock_gettime (CLOCK_THREAD_CPUTIME_ID, &tp);
+    if (rc < 0) SYSERRNO (clock_gettime);
+    return ((uint64_T) tp.tv_sec * 1000000000ULL) + tp.tv_nsec;
+}
+
 static void printthreadcputime (char const *name)
 {
     int rc;
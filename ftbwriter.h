@@ -19,24 +19,17 @@
 
 #include "ftbackup.h"
 
-#define SQ_NSLOTS 4
+#define CT_SLICESIZE (FILEIOSIZE * 8)   // max uncompressed bytes per -cthreads compression unit
+#define AR_CHUNKSIZE (FILEIOSIZE * 4)   // bytes per arena chunk for headers and small records
+#define AR_NCHUNKS 4                    // number of arena chunks in circulation
+#define LA_PERTHREAD 4                  // files per -lthreads thread looked up ahead of the writer
+#define LA_MAXOPEN 256                  // max files held open by -lthreads threads
+#define AD_MINSAMPLE 4096               // -adaptive compresses runs starting with fewer bytes than this
+#define AD_MAXSAMPLE 65536              // -adaptive looks at no more than this many bytes of a run
+#define AD_MAXBITS 7.9                  // -adaptive stores runs with more bits of entropy per byte than this
+#define OW_COALESCE (1024 * 1024)       // max bytes of consecutive blocks per -owrites write
 
-struct SkipName;
-
-template <class T>
-struct SlotQueue {
-    SlotQueue ();
-    void enqueue (T slot);
-    bool trydequeue (T *slot);
-    T dequeue ();
-
-private:
-    T slots[SQ_NSLOTS];
-    pthread_cond_t  cond;
-    pthread_mutex_t mutex;
-    uint32_T next;
-    uint32_T used;
-};
+struct SkipActive;
 
 struct SinceReader {
     uint64_T ctime;
@@ -62,14 +55,30 @@ private:
 };
 
 struct FTBWriter : FTBackup {
+    bool opt_adaptive;
+    bool opt_chaindict;
     bool opt_verbose;
     char const *histdbname;
     char const *histssname;
+    char const *opt_catalog;
+    char const *opt_manifest;
     char const *opt_record;
     char const *opt_since;
     int ioptions;
     int ooptions;
+    int opt_codec;
+    int opt_codeclevel;
+    int opt_cthreads;
+    int opt_hthreads;
+    int opt_lthreads;
     int opt_verbsec;
+    uint32_T opt_comprdepth;
+    uint32_T opt_frblkdepth;
+    uint32_T opt_frbufdepth;
+    uint32_T opt_histdepth;
+    uint32_T opt_iouring;
+    uint32_T opt_owrites;
+    uint32_T opt_writedepth;
     uint64_T opt_segsize;
 
     IFSAccess *tfs;     // target filesystem, ie, filesystem being backed up
@@ -82,64 +91,237 @@ private:
     struct ComprSlot {
         void    *buf;   // address of data to write
         uint32_T len;   // length of data to write
-        int      dty;   // -1: file header to be left uncompressed, the free ()
-                        //  0: data to be left uncompressed, then free ()
-                        //  1: data to be compressed, then free ()
-                        //  2: data to be compressed, then frqueue.enqueue ()
+        int      dty;   // -1: file header to be left uncompressed, in arena chunk
+                        //  0: data to be left uncompressed, in arena chunk
+                        //  1: data to be compressed, in arena chunk
+                        //  2: data to be compressed, then frbufqueue.enqueue ()
+                        //  3: buf is an ArenaChunk all of whose records have been queued
+    };
+
+    struct ArenaChunk {
+        ArenaChunk *next;   // next chunk waiting for the same unit to be emitted
+        uint32_T    size;   // number of bytes in data[] (gt AR_CHUNKSIZE: one-off for a big header)
+        uint64_T    data[0];
+    };
+
+    struct HdrBuf {
+        Header  *hdr;       // write_file() header buffer for one level of directory recursion
+        uint32_T size;      // number of bytes malloc()d for hdr
+    };
+
+    struct ComprUnit {
+        ComprUnit *next;    // next unit in saveset order (or next free unit)
+        ArenaChunk *chunks; // arena chunks to release after this unit is emitted
+        ComprSlot slot;     // uncompressed data (slot.dty <= 0), else unused
+        bool      done;     // worker has finished compressing inbuf to outbuf
+        bool      first;    // first slice of a compressed stream, outbuf begins with zlib header
+        bool      last;     // last slice of a compressed stream, outbuf ends the deflate data (zlib only)
+        bool      stored;   // -adaptive found run incompressible, outbuf is a whole stored zlib stream
+        bool      whole;    // worker compressed the whole run in one call, outbuf is a whole zlib stream
+        uint32_T  inlen;    // number of bytes in inbuf
+        uint32_T  outlen;   // number of bytes in outbuf
+        uint32_T  adler;    // adler32 of inbuf
+        uint8_T  *inbuf;    // CT_SLICESIZE bytes of uncompressed data
+        uint8_T  *outbuf;   // compressed data
+    };
+
+    struct LookAhead {
+        LookAhead  *next;           // next free node
+        char       *path;           // path of file to look up
+        char       *xattrs;         // attribute names, then each value preceded by its 4-byte length
+        char const *errfunc;        // call that failed: "lstat", "llistxattr", "lgetxattr", else NULL
+        bool        chkdev;         // pdev is valid
+        bool        done;           // lookup has completed
+        bool        early;          // being looked up by a lookahead thread, so open and scan too
+        dev_t       pdev;           // parent directory's device, mountpoints don't get scanned
+        int         err;            // errno from errfunc
+        int         fd;             // regular file opened by lookahead thread, else -1
+        int         openerr;        // errno of lookahead thread's failed open, else 0
+        int         nents;          // number of entries in names, else -1 if not scanned
+        int         scanerr;        // errno of lookahead thread's failed scan, else 0
+        struct dirent **names;      // directory entries sorted by myalphasort
+        struct stat statbuf;        // file's attributes
+        uint32_T    errxattr;       // offset in xattrs of attribute name for lgetxattr error
+        uint32_T    pathsize;       // bytes allocated for path
+        uint32_T    xattrsize;      // bytes allocated for xattrs
+        uint32_T    xattrsused;     // bytes of xattrs filled in
+        uint32_T    xattrslistlen;  // bytes of attribute names at beginning of xattrs
+        uint32_T    xattrsvalslen;  // bytes needed for values in header, including packed lengths
+    };
+
+    struct IoRead {
+        void    *buf;       // file read buffer from frbufqueue
+        uint32_T len;       // number of bytes wanted
+        int      res;       // number of bytes read, else -errno
+        bool     done;      // read has completed
+    };
+
+    struct OutWrite {
+        Block  **blocks;    // consecutive saveset blocks, freed when write completes
+        struct iovec *iov;  // where each block is in memory
+        uint32_T nblocks;   // number of blocks in blocks[] and iov[]
+        uint64_T pos;       // saveset file position of first block
+        int      res;       // number of bytes written, else -errno
+        bool     done;      // write has completed
+    };
+
+    struct HashJob {
+        Block *block;       // block to be hashed and encrypted
+        bool   done;        // worker has finished hashing and encrypting block
+    };
+
+    struct InodeEnt {
+        uint64_T ino;       // inode number of a multiply-linked file already in saveset
+        uint64_T mtimns;    // its modification time, in case inode was freed and reused
+        uint32_T devidx;    // index in inodesdevs[] of its device
+        uint32_T fileno;    // its header's file number, 0 if slot is empty
     };
 
     struct HistSlot {
-        char *fname;
+        char const *fname;  // name in header in arena chunk
+        ArenaChunk *chunk;  // arena chunk to release after previous names processed
         uint32_T seqno;
     };
 
+    ArenaChunk *archunk;
+    Block *comprblock;
+    bool comprhdrfirst;
+    Codec *comprcodec;
+    CodecDict *comprdict;
+    Codec *comprrun;
+    Codec *storecodec;
     Block **xorblocks;
+    Block **xorfree;
+    bool ctrunopen;
+    bool ctrunstored;
     bool zisopen;
     char const *ssbasename;
+    char *dirbuf;
+    char *linkbuf;
     char *sssegname;
-    dev_t inodesdevno;
+    ComprUnit *ctfree;
+    ComprUnit *ctoldest;
+    ComprUnit *ctnewest;
+    ComprUnit *ctnewraw;
+    ComprUnit *ctunits;
+    HashJob *htjobs;
+    HdrBuf *hdrbufs;
+    IoRead *ioreads;
+    ManifestSeg manseg;         // segment file being written, for -manifest
+    IoRing iouring;
+    IoRing owring;
+    OutWrite *owrites;
+    LookAhead *lafree;
+    dev_t *inodesdevs;
+    FILE *catfile;
+    FILE *manfile;
     FILE *noncefile;
-    ino_t *inodeslist;
+    InodeEnt *inodestable;
     int recofd;
     int ssfd;
+    pthread_cond_t ctcond;
+    pthread_cond_t htcond;
+    pthread_cond_t lacond;
+    pthread_mutex_t ctmutex;
+    pthread_mutex_t htmutex;
+    pthread_mutex_t lamutex;
     SinceReader sincrdr;
-    SkipName *skipnames;
+    SkipActive *skipactive;
     time_t lastverbsec;
-    uint32_T inodessize;
+    uint32_T arused;
+    uint32_T dirbufsize;
+    uint32_T hdrbufdepth;
+    uint32_T hdrbufsused;
+    uint32_T inodesmask;
+    uint32_T inodesndevs;
+    uint32_T laopenfds;
+    uint32_T lawindow;
     uint32_T inodesused;
     uint32_T lastfileno;
     uint32_T lastseqno;
     uint32_T lastxorno;
+    uint32_T linkbufsize;
+    uint32_T owmaxblocks;
+    uint32_T owoldest;
+    uint32_T owused;
+    uint32_T xorfreesize;
+    uint32_T ctnunits;
+    uint32_T ctoutsize;
+    uint32_T ctrunadler;
+    uint32_T frblkcount;
+    uint32_T frbufcount;
+    uint32_T htnjobs;
+    uint32_T nxorfree;
+    uint32_T htoldest;
+    uint32_T htused;
     uint32_T reconamelen;
     uint32_T thissegno;
+    uint32_T wholesize;
+    uint64_T adbypassbytes;
+    uint64_T adbypassns;
+    uint64_T adcomprbytes;
+    uint64_T adcomprns;
     uint64_T byteswrittentoseg;
-    uint64_T *inodesmtim;
     uint64_T rft_runtime;
+    uint64_T sspos;
+    uint8_T *wholebuf;
     z_stream zreco;
     z_stream zstrm;
 
-    SlotQueue<void *>    frbufqueue;  // free buffers for reading files
-    SlotQueue<ComprSlot> comprqueue;  // variable length data to be compressed and blocked
-    SlotQueue<Block *>   frblkqueue;  // free blocks for writing to saveset
-    SlotQueue<HistSlot>  histqueue;   // filenames to be written to history
-    SlotQueue<Block *>   writequeue;  // blocks to be written to saveset
+    RingQueue<void *>    frbufqueue;  // free buffers for reading files
+    RingQueue<ArenaChunk *> frchkqueue; // free arena chunks for headers and small records
+    RingQueue<ComprSlot> comprqueue;  // variable length data to be compressed and blocked
+    RingQueue<ComprUnit *> cworkqueue; // -cthreads units to be compressed by worker threads
+    RingQueue<Block *>   frblkqueue;  // free blocks for writing to saveset
+    RingQueue<HashJob *> hworkqueue;  // -hthreads blocks to be hashed and encrypted by worker threads
+    RingQueue<LookAhead *> lworkqueue; // -lthreads files to be looked up by worker threads
+    RingQueue<HistSlot>  histqueue;   // filenames to be written to history
+    RingQueue<Block *>   writequeue;  // blocks to be written to saveset
 
     uint8_T recozbuf[4096];
 
-    bool write_file (char const *path, struct stat const *dirstat);
-    bool write_regular (Header *hdr, struct stat const *dirstat);
-    bool write_directory (Header *hdr, struct stat const *statbuf);
+    bool write_file (LookAhead *la, struct stat const *dirstat);
+    bool write_regular (Header *hdr, LookAhead *la);
+    bool read_iouring (Header const *hdr, int fd, uint64_T *ofs_r);
+    void wait_iouring (IoRead *rd);
+    bool write_directory (Header *hdr, LookAhead *la);
     bool write_mountpoint (Header *hdr);
     bool write_symlink (Header *hdr);
     bool write_special (Header *hdr, dev_t strdev);
     void write_header (Header *hdr);
+    LookAhead *lookahead_get (char const *path, struct stat const *dirstat);
+    void lookahead_put (LookAhead *la);
+    void lookahead_fill (LookAhead *la);
+    static void *lwork_thread_wrapper (void *ftbw);
+    void *lwork_thread ();
     bool skipbysince (Header const *hdr);
+    InodeEnt *inodes_lookup (struct stat const *statbuf);
+    void inodes_save (struct stat const *statbuf, Header const *hdr);
     void maybe_record_file (uint64_T ctime, char const *name);
     void write_reco_data (void const *buf, uint32_T len);
-    void write_raw (void const *buf, uint32_T len, bool hdr);
+    void catalog_file (Header const *hdr, uint32_T seqno, uint32_T hdroffs);
+    void manifest_segment ();
+    void write_raw (void const *buf, uint32_T len, int dty);
+    void *arena_alloc (uint32_T len);
+    void arena_release ();
+    void arena_done (ArenaChunk *chunk);
+    void arena_free (ArenaChunk *chunk);
     void write_queue (void *buf, uint32_T len, int dty);
     static void *compr_thread_wrapper (void *ftbw);
     void *compr_thread ();
+    void compr_serial ();
+    void compr_piece (ComprSlot const &slot);
+    void compr_begin ();
+    void compr_whole (ComprSlot const &slot);
+    void compr_adcount (uint32_T len, uint64_T cpustart);
+    void compr_parallel ();
+    bool compr_storerun (void const *buf, uint32_T len);
+    ComprUnit *compr_getunit (bool compress);
+    void compr_putunit (ComprUnit *unit);
+    bool compr_emitoldest (bool wait);
+    void compr_copy (void const *buf, uint32_T len, bool hdr);
+    static void *cwork_thread_wrapper (void *ftbw);
+    void *cwork_thread ();
     static void *hist_thread_wrapper (void *ftbw);
     void *hist_thread ();
     static void *write_thread_wrapper (void *ftbw);
@@ -148,7 +330,14 @@ private:
     void xor_data_block (Block *block);
     void hash_xor_blocks ();
     void hash_block (Block *block);
+    void crypt_block (Block *block, CryptoPP::HashTransformation *hasher, CryptoPP::BlockCipher *encipher);
+    bool hash_emitoldest (bool wait);
+    static void *hwork_thread_wrapper (void *ftbw);
+    void *hwork_thread ();
     void write_ssblock (Block *block);
+    void ssblock_submit ();
+    bool ssblock_drain ();
+    void ssblock_reap (bool wait);
     void free_block (Block *block);
 };
 